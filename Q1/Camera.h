@@ -132,6 +132,11 @@ public:
         return this->zoom;
     }
     
+    glm::vec3 GetPosition( )
+    {
+        return this->position;
+    }
+    
 private:
     // Camera Attributes
     glm::vec3 position;
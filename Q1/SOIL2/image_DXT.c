@@ -8,11 +8,35 @@
 */
 
 #include "image_DXT.h"
+#include "image_arena.h"
+#include "image_helper.h"
+#include "image_parallel.h"
+#include "pkm_helper.h"
+#include "wfETC.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+/*	the ETC encoder scores all eight intensity tables at once with SSE2,
+	define ETC_ENCODE_NO_SIMD to use the plain C loops instead	*/
+#if !defined( ETC_ENCODE_NO_SIMD ) && ( defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && ( _M_IX86_FP >= 2 ) ) )
+	#define ETC_ENCODE_SSE2
+	#include <emmintrin.h>
+#endif
+
+/*	what convert_image_to_ETC produces	*/
+#define ETC_FORMAT_ETC1			0
+#define ETC_FORMAT_ETC2_RGB8	1
+#define ETC_FORMAT_ETC2_RGBA8	2
+
+/*	KTX glInternalFormat / glBaseInternalFormat values	*/
+#define KTX_ETC1_RGB8_OES					0x8D64
+#define KTX_COMPRESSED_RGB8_ETC2			0x9274
+#define KTX_COMPRESSED_RGBA8_ETC2_EAC		0x9278
+#define KTX_RGB								0x1907
+#define KTX_RGBA							0x1908
+
 /*	set this =1 if you want to use the covarince matrix method...
 	which is better than my method of using standard deviations
 	overall, except on the infintesimal chance that the power
@@ -37,6 +61,37 @@ void compress_DDS_color_block(
 void compress_DDS_alpha_block(
 				const unsigned char *const uncompressed,
 				unsigned char compressed[8] );
+/*
+	Takes a 4x4 block of RGBA pixels and compresses the color
+	into 8 bytes of ETC1, returning the squared error.
+*/
+int compress_ETC1_block(
+				const unsigned char *const uncompressed,
+				int quality,
+				unsigned char compressed[8] );
+/*
+	Same for ETC2 RGB8, which adds the T, H and planar modes.
+*/
+int compress_ETC2_color_block(
+				const unsigned char *const uncompressed,
+				int quality,
+				unsigned char compressed[8] );
+/*
+	Takes a 4x4 block of RGBA pixels and compresses the alpha
+	into the 8 byte EAC block of ETC2 RGBA8.
+*/
+void compress_EAC_alpha_block(
+				const unsigned char *const uncompressed,
+				int quality,
+				unsigned char compressed[8] );
+/*
+	Converts a whole image, block rows are spread over threads.
+*/
+static unsigned char* convert_image_to_ETC(
+				const unsigned char *const uncompressed,
+				int width, int height, int channels,
+				int format, int quality,
+				int *out_size );
 
 /********* Actual Exposed Functions *********/
 int
@@ -94,7 +149,7 @@ int
 	fwrite( DDS_data, 1, DDS_size, fout );
 	fclose( fout );
 	/*	done	*/
-	free( DDS_data );
+	SOIL_arena_free( DDS_data );
 	return 1;
 }
 
@@ -125,7 +180,7 @@ unsigned char* convert_image_to_DXT1(
 	/*	get the RAM for the compressed image
 		(8 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
-	compressed = (unsigned char*)malloc( *out_size );
+	compressed = (unsigned char*)SOIL_arena_malloc( *out_size );
 	/*	go through each block	*/
 	for( j = 0; j < height; j += 4 )
 	{
@@ -208,7 +263,7 @@ unsigned char* convert_image_to_DXT5(
 	/*	get the RAM for the compressed image
 		(16 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
-	compressed = (unsigned char*)malloc( *out_size );
+	compressed = (unsigned char*)SOIL_arena_malloc( *out_size );
 	/*	go through each block	*/
 	for( j = 0; j < height; j += 4 )
 	{
@@ -274,6 +329,194 @@ unsigned char* convert_image_to_DXT5(
 	return compressed;
 }
 
+unsigned char* convert_image_to_ETC1(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int quality,
+		int *out_size )
+{
+	return convert_image_to_ETC( uncompressed, width, height, channels,
+			ETC_FORMAT_ETC1, quality, out_size );
+}
+
+unsigned char* convert_image_to_ETC2(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int quality,
+		int *out_size )
+{
+	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
+	return convert_image_to_ETC( uncompressed, width, height, channels,
+			(channels & 1) ? ETC_FORMAT_ETC2_RGB8 : ETC_FORMAT_ETC2_RGBA8, quality, out_size );
+}
+
+int
+	save_image_as_PKM
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int etc2, int quality
+	)
+{
+	/*	variables	*/
+	FILE *fout;
+	unsigned char *ETC_data;
+	unsigned char header[PKM_HEADER_SIZE];
+	int ETC_size, format;
+	/*	error check	*/
+	if( (NULL == filename) ||
+		(width < 1) || (height < 1) || (width > 0xffff) || (height > 0xffff) ||
+		(channels < 1) || (channels > 4) ||
+		(data == NULL ) )
+	{
+		return 0;
+	}
+	/*	Convert the image	*/
+	if( etc2 )
+	{
+		ETC_data = convert_image_to_ETC2( data, width, height, channels, quality, &ETC_size );
+		format = (channels & 1) ? PKM_FORMAT_ETC2_RGB : PKM_FORMAT_ETC2_RGBA;
+	} else
+	{
+		ETC_data = convert_image_to_ETC1( data, width, height, channels, quality, &ETC_size );
+		format = PKM_FORMAT_ETC1_RGB;
+	}
+	if( NULL == ETC_data )
+	{
+		return 0;
+	}
+	/*	the header is big endian, the padded size is in whole blocks	*/
+	memcpy( header, etc2 ? "PKM 20" : "PKM 10", 6 );
+	header[6] = (unsigned char)(format >> 8);
+	header[7] = (unsigned char)format;
+	header[8] = (unsigned char)(((width + 3) & ~3) >> 8);
+	header[9] = (unsigned char)((width + 3) & ~3);
+	header[10] = (unsigned char)(((height + 3) & ~3) >> 8);
+	header[11] = (unsigned char)((height + 3) & ~3);
+	header[12] = (unsigned char)(width >> 8);
+	header[13] = (unsigned char)width;
+	header[14] = (unsigned char)(height >> 8);
+	header[15] = (unsigned char)height;
+	/*	write it out	*/
+	fout = fopen( filename, "wb" );
+	if( NULL == fout )
+	{
+		SOIL_arena_free( ETC_data );
+		return 0;
+	}
+	fwrite( header, 1, PKM_HEADER_SIZE, fout );
+	fwrite( ETC_data, 1, ETC_size, fout );
+	fclose( fout );
+	/*	done	*/
+	SOIL_arena_free( ETC_data );
+	return 1;
+}
+
+int
+	save_image_as_KTX
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int etc2, int quality, int mipmaps
+	)
+{
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	/*	variables	*/
+	FILE *fout;
+	unsigned int header[13];
+	const unsigned char *level_img = data;
+	unsigned char *resampled = NULL;
+	int levels = 1, level, w = width, h = height, ok = 1;
+	/*	error check	*/
+	if( (NULL == filename) ||
+		(width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(data == NULL ) )
+	{
+		return 0;
+	}
+	if( mipmaps )
+	{
+		while( (w > 1) || (h > 1) )
+		{
+			w = (w >> 1) ? (w >> 1) : 1;
+			h = (h >> 1) ? (h >> 1) : 1;
+			++levels;
+		}
+	}
+	fout = fopen( filename, "wb" );
+	if( NULL == fout )
+	{
+		return 0;
+	}
+	/*	KTX 1.1, written in native byte order as the endianness field says	*/
+	memset( header, 0, sizeof( header ) );
+	header[0] = 0x04030201;
+	header[1] = 0;				/*	glType, 0 for compressed	*/
+	header[2] = 1;				/*	glTypeSize	*/
+	header[3] = 0;				/*	glFormat, 0 for compressed	*/
+	header[4] = !etc2 ? KTX_ETC1_RGB8_OES :
+			((channels & 1) ? KTX_COMPRESSED_RGB8_ETC2 : KTX_COMPRESSED_RGBA8_ETC2_EAC);
+	header[5] = (!etc2 || (channels & 1)) ? KTX_RGB : KTX_RGBA;
+	header[6] = width;
+	header[7] = height;
+	header[8] = 0;				/*	pixelDepth	*/
+	header[9] = 0;				/*	numberOfArrayElements	*/
+	header[10] = 1;				/*	numberOfFaces	*/
+	header[11] = levels;
+	header[12] = 0;				/*	bytesOfKeyValueData	*/
+	fwrite( identifier, 1, sizeof( identifier ), fout );
+	fwrite( header, sizeof( header[0] ), 13, fout );
+	/*	each level is a box filtered copy of the previous one	*/
+	w = width;
+	h = height;
+	for( level = 0; (level < levels) && ok; ++level )
+	{
+		int ETC_size;
+		unsigned int image_size;
+		unsigned char *ETC_data = etc2 ?
+				convert_image_to_ETC2( level_img, w, h, channels, quality, &ETC_size ) :
+				convert_image_to_ETC1( level_img, w, h, channels, quality, &ETC_size );
+		if( NULL == ETC_data )
+		{
+			ok = 0;
+			break;
+		}
+		/*	ETC blocks are 8 or 16 bytes, so no mip padding is needed	*/
+		image_size = ETC_size;
+		fwrite( &image_size, sizeof( image_size ), 1, fout );
+		fwrite( ETC_data, 1, ETC_size, fout );
+		SOIL_arena_free( ETC_data );
+		if( level + 1 < levels )
+		{
+			int nw = (w >> 1) ? (w >> 1) : 1, nh = (h >> 1) ? (h >> 1) : 1;
+			unsigned char *next = (unsigned char*)SOIL_arena_malloc( nw * nh * channels );
+			if( NULL == next )
+			{
+				ok = 0;
+				break;
+			}
+			mipmap_image( level_img, w, h, channels, next,
+					(w > 1) ? 2 : 1, (h > 1) ? 2 : 1 );
+			if( NULL != resampled )
+			{
+				SOIL_arena_free( resampled );
+			}
+			level_img = resampled = next;
+			w = nw;
+			h = nh;
+		}
+	}
+	fclose( fout );
+	if( NULL != resampled )
+	{
+		SOIL_arena_free( resampled );
+	}
+	return ok;
+}
+
 /********* Helper Functions *********/
 int convert_bit_range( int c, int from_bits, int to_bits )
 {
@@ -630,3 +873,919 @@ void
 	}
 	/*	done compressing to DXT1	*/
 }
+
+/********* ETC1 / ETC2 Helper Functions *********/
+
+/*	the intensity modifiers, in the order the 2 bit pixel index picks them	*/
+static const int ETC_modifiers[8][4] =
+{
+	{  2,   8,  -2,   -8 },
+	{  5,  17,  -5,  -17 },
+	{  9,  29,  -9,  -29 },
+	{ 13,  42, -13,  -42 },
+	{ 18,  60, -18,  -60 },
+	{ 24,  80, -24,  -80 },
+	{ 33, 106, -33, -106 },
+	{ 47, 183, -47, -183 }
+};
+
+/*	the same, one vector per pixel index with a lane per table	*/
+static const short ETC_modifier_lanes[4][8] =
+{
+	{  2,  5,  9,  13,  18,  24,  33,   47 },
+	{  8, 17, 29,  42,  60,  80, 106,  183 },
+	{ -2, -5, -9, -13, -18, -24, -33,  -47 },
+	{ -8,-17,-29, -42, -60, -80,-106, -183 }
+};
+
+static const int ETC2_distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static const int EAC_modifiers[16][8] =
+{
+	{ -3, -6,  -9, -15, 2, 5, 8, 14 },
+	{ -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5,  -8, -13, 1, 4, 7, 12 },
+	{ -2, -4,  -6, -13, 1, 3, 5, 12 },
+	{ -3, -6,  -8, -12, 2, 5, 7, 11 },
+	{ -3, -7,  -9, -11, 2, 6, 8, 10 },
+	{ -4, -7,  -8, -11, 3, 6, 7, 10 },
+	{ -3, -5,  -8, -11, 2, 4, 7, 10 },
+	{ -2, -6,  -8, -10, 1, 5, 7,  9 },
+	{ -2, -5,  -8, -10, 1, 4, 7,  9 },
+	{ -2, -4,  -8, -10, 1, 3, 7,  9 },
+	{ -2, -5,  -7, -10, 1, 4, 6,  9 },
+	{ -3, -4,  -7, -10, 2, 3, 6,  9 },
+	{ -1, -2,  -3, -10, 0, 1, 2,  9 },
+	{ -4, -6,  -8,  -9, 3, 5, 7,  8 },
+	{ -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+/*	the signed 3 bit delta of differential mode	*/
+static const int ETC_deltas[8] = { 0, 1, 2, 3, -4, -3, -2, -1 };
+
+static int ETC_clamp( int x )
+{
+	return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+static int ETC_expand( int q, int bits )
+{
+	switch( bits )
+	{
+	case 4:	return (q << 4) | q;
+	case 5:	return (q << 3) | (q >> 2);
+	case 6:	return (q << 2) | (q >> 4);
+	default:	return (q << 1) | (q >> 6);
+	}
+}
+
+static int ETC_quantize( float c, int bits )
+{
+	int q = (int)(c * ((1 << bits) - 1) / 255.0f + 0.5f);
+	return q < 0 ? 0 : (q > (1 << bits) - 1 ? (1 << bits) - 1 : q);
+}
+
+static int ETC_color_error( const unsigned char *const pixel, int r, int g, int b )
+{
+	return (pixel[0] - r) * (pixel[0] - r) + (pixel[1] - g) * (pixel[1] - g) + (pixel[2] - b) * (pixel[2] - b);
+}
+
+/*	squared RGB error between two 4x4 RGBA blocks	*/
+static int ETC_block_error( const unsigned char *const block, const unsigned char *const decoded )
+{
+	int i, error = 0;
+	for( i = 0; i < 16*4; i += 4 )
+	{
+		error += ETC_color_error( block + i, decoded[i+0], decoded[i+1], decoded[i+2] );
+	}
+	return error;
+}
+
+/*	a differential mode byte holding this sum would overflow 5 bits	*/
+static int ETC2_overflows( int byte )
+{
+	int c = (byte >> 3) + ETC_deltas[byte & 7];
+	return (c < 0) || (c > 31);
+}
+
+#ifdef ETC_ENCODE_SSE2
+static __m128i ETC_min_epi32( __m128i a, __m128i b )
+{
+	__m128i a_less = _mm_cmplt_epi32( a, b );
+	return _mm_or_si128( _mm_and_si128( a_less, a ), _mm_andnot_si128( a_less, b ) );
+}
+#endif
+
+/*
+	Total error of 8 sub-block pixels around one base color, for every
+	intensity table at once. Each pixel takes its best modifier, the
+	best table's index goes to *table.
+*/
+static int ETC_sub_block_error(
+		const unsigned char *const pixels[8],
+		const int base[3],
+		int *table )
+{
+	int errors[8];
+	int i, best;
+#ifdef ETC_ENCODE_SSE2
+	/*	one 16 bit lane per table; the squares are summed in 32 bits by pmaddwd	*/
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16( 255 );
+	__m128i candidates[4][3];
+	__m128i total_lo = zero, total_hi = zero;
+	int m, c;
+	for( m = 0; m < 4; ++m )
+	{
+		const __m128i modifier = _mm_loadu_si128( (const __m128i*)ETC_modifier_lanes[m] );
+		for( c = 0; c < 3; ++c )
+		{
+			candidates[m][c] = _mm_min_epi16( _mm_max_epi16( _mm_add_epi16( _mm_set1_epi16( (short)base[c] ), modifier ), zero ), full );
+		}
+	}
+	for( i = 0; i < 8; ++i )
+	{
+		const __m128i r = _mm_set1_epi16( pixels[i][0] );
+		const __m128i g = _mm_set1_epi16( pixels[i][1] );
+		const __m128i b = _mm_set1_epi16( pixels[i][2] );
+		__m128i best_lo = _mm_set1_epi32( 0x7fffffff ), best_hi = best_lo;
+		for( m = 0; m < 4; ++m )
+		{
+			const __m128i dr = _mm_sub_epi16( r, candidates[m][0] );
+			const __m128i dg = _mm_sub_epi16( g, candidates[m][1] );
+			const __m128i db = _mm_sub_epi16( b, candidates[m][2] );
+			const __m128i rg_lo = _mm_unpacklo_epi16( dr, dg ), rg_hi = _mm_unpackhi_epi16( dr, dg );
+			const __m128i b_lo = _mm_unpacklo_epi16( db, zero ), b_hi = _mm_unpackhi_epi16( db, zero );
+			best_lo = ETC_min_epi32( best_lo, _mm_add_epi32( _mm_madd_epi16( rg_lo, rg_lo ), _mm_madd_epi16( b_lo, b_lo ) ) );
+			best_hi = ETC_min_epi32( best_hi, _mm_add_epi32( _mm_madd_epi16( rg_hi, rg_hi ), _mm_madd_epi16( b_hi, b_hi ) ) );
+		}
+		total_lo = _mm_add_epi32( total_lo, best_lo );
+		total_hi = _mm_add_epi32( total_hi, best_hi );
+	}
+	_mm_storeu_si128( (__m128i*)(errors + 0), total_lo );
+	_mm_storeu_si128( (__m128i*)(errors + 4), total_hi );
+#else
+	int t, m;
+	for( t = 0; t < 8; ++t )
+	{
+		errors[t] = 0;
+		for( i = 0; i < 8; ++i )
+		{
+			int best_error = 0x7fffffff;
+			for( m = 0; m < 4; ++m )
+			{
+				int e = ETC_color_error( pixels[i],
+						ETC_clamp( base[0] + ETC_modifiers[t][m] ),
+						ETC_clamp( base[1] + ETC_modifiers[t][m] ),
+						ETC_clamp( base[2] + ETC_modifiers[t][m] ) );
+				best_error = e < best_error ? e : best_error;
+			}
+			errors[t] += best_error;
+		}
+	}
+#endif
+	best = 0;
+	for( i = 1; i < 8; ++i )
+	{
+		if( errors[i] < errors[best] )
+		{
+			best = i;
+		}
+	}
+	*table = best;
+	return errors[best];
+}
+
+/*
+	Finds the base color (quantized to 'bits' per channel) of a sub-block.
+	Fast mode takes the rounded average, high quality then walks the
+	neighbouring colors one channel step at a time while the error drops.
+*/
+static int ETC_fit_base_color(
+		const unsigned char *const pixels[8],
+		int bits, int quality,
+		int q[3], int *table )
+{
+	int base[3], c, i, error, improved, passes;
+	float average[3] = { 0.0f, 0.0f, 0.0f };
+	for( i = 0; i < 8; ++i )
+	{
+		for( c = 0; c < 3; ++c )
+		{
+			average[c] += pixels[i][c] * 0.125f;
+		}
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		q[c] = ETC_quantize( average[c], bits );
+		base[c] = ETC_expand( q[c], bits );
+	}
+	error = ETC_sub_block_error( pixels, base, table );
+	for( passes = 0, improved = (quality == ETC_QUALITY_HIGH); improved && (passes < 8); ++passes )
+	{
+		improved = 0;
+		for( i = 0; i < 6; ++i )
+		{
+			int trial[3], trial_base[3], trial_table, trial_error;
+			c = i >> 1;
+			trial[0] = q[0];
+			trial[1] = q[1];
+			trial[2] = q[2];
+			trial[c] += (i & 1) ? 1 : -1;
+			if( (trial[c] < 0) || (trial[c] >= (1 << bits)) )
+			{
+				continue;
+			}
+			trial_base[0] = ETC_expand( trial[0], bits );
+			trial_base[1] = ETC_expand( trial[1], bits );
+			trial_base[2] = ETC_expand( trial[2], bits );
+			trial_error = ETC_sub_block_error( pixels, trial_base, &trial_table );
+			if( trial_error < error )
+			{
+				error = trial_error;
+				*table = trial_table;
+				q[0] = trial[0];
+				q[1] = trial[1];
+				q[2] = trial[2];
+				improved = 1;
+			}
+		}
+	}
+	return error;
+}
+
+/*	picks each pixel's modifier and fills in the index planes of an ETC1 style block	*/
+static void ETC1_pack_indices(
+		const unsigned char *const block,
+		int flip,
+		const int base[2][3], const int table[2],
+		unsigned char compressed[8] )
+{
+	unsigned int msb = 0, lsb = 0;
+	int x, y, m;
+	for( y = 0; y < 4; ++y )
+	{
+		for( x = 0; x < 4; ++x )
+		{
+			const unsigned char *const pixel = block + (y*4 + x)*4;
+			const int s = ((flip ? y : x) >> 1);
+			int best_m = 0, best_error = 0x7fffffff;
+			for( m = 0; m < 4; ++m )
+			{
+				const int modifier = ETC_modifiers[table[s]][m];
+				int e = ETC_color_error( pixel,
+						ETC_clamp( base[s][0] + modifier ),
+						ETC_clamp( base[s][1] + modifier ),
+						ETC_clamp( base[s][2] + modifier ) );
+				if( e < best_error )
+				{
+					best_error = e;
+					best_m = m;
+				}
+			}
+			msb |= (unsigned int)(best_m >> 1) << (x*4 + y);
+			lsb |= (unsigned int)(best_m & 1) << (x*4 + y);
+		}
+	}
+	compressed[4] = (unsigned char)(msb >> 8);
+	compressed[5] = (unsigned char)msb;
+	compressed[6] = (unsigned char)(lsb >> 8);
+	compressed[7] = (unsigned char)lsb;
+}
+
+/*	the best individual or differential encoding, returns its error	*/
+int
+	compress_ETC1_block
+	(
+		const unsigned char *const uncompressed,
+		int quality,
+		unsigned char compressed[8]
+	)
+{
+	int best_error = 0x7fffffff;
+	int flip, s, c;
+	for( flip = 0; flip < 2; ++flip )
+	{
+		const unsigned char *pixels[2][8];
+		int count[2] = { 0, 0 };
+		int q4[2][3], q5[2][3], table4[2], table5[2];
+		int error4, error5 = 0x7fffffff;
+		int x, y;
+		for( y = 0; y < 4; ++y )
+		{
+			for( x = 0; x < 4; ++x )
+			{
+				s = (flip ? y : x) >> 1;
+				pixels[s][count[s]++] = uncompressed + (y*4 + x)*4;
+			}
+		}
+		/*	individual mode, two 444 colors	*/
+		error4 = ETC_fit_base_color( pixels[0], 4, quality, q4[0], &table4[0] ) +
+				ETC_fit_base_color( pixels[1], 4, quality, q4[1], &table4[1] );
+		/*	differential mode, 555 plus a 333 delta	*/
+		{
+			int e0 = ETC_fit_base_color( pixels[0], 5, quality, q5[0], &table5[0] );
+			int e1 = ETC_fit_base_color( pixels[1], 5, quality, q5[1], &table5[1] );
+			int in_range = 1;
+			for( c = 0; c < 3; ++c )
+			{
+				int delta = q5[1][c] - q5[0][c];
+				in_range &= (delta >= -4) && (delta <= 3);
+			}
+			if( !in_range && (quality == ETC_QUALITY_HIGH) )
+			{
+				/*	the refined colors drifted apart, pull the second one into reach	*/
+				int base[3];
+				for( c = 0; c < 3; ++c )
+				{
+					int delta = q5[1][c] - q5[0][c];
+					q5[1][c] = q5[0][c] + (delta < -4 ? -4 : (delta > 3 ? 3 : delta));
+					base[c] = ETC_expand( q5[1][c], 5 );
+				}
+				e1 = ETC_sub_block_error( pixels[1], base, &table5[1] );
+				in_range = 1;
+			}
+			if( in_range )
+			{
+				error5 = e0 + e1;
+			}
+		}
+		if( (error4 < best_error) || (error5 < best_error) )
+		{
+			int base[2][3];
+			const int differential = error5 < error4;
+			const int *table = differential ? table5 : table4;
+			for( s = 0; s < 2; ++s )
+			{
+				for( c = 0; c < 3; ++c )
+				{
+					base[s][c] = differential ? ETC_expand( q5[s][c], 5 ) : ETC_expand( q4[s][c], 4 );
+				}
+			}
+			for( c = 0; c < 3; ++c )
+			{
+				compressed[c] = (unsigned char)(differential ?
+						((q5[0][c] << 3) | ((q5[1][c] - q5[0][c]) & 7)) :
+						((q4[0][c] << 4) | q4[1][c]));
+			}
+			compressed[3] = (unsigned char)((table[0] << 5) | (table[1] << 2) | (differential << 1) | flip);
+			ETC1_pack_indices( uncompressed, flip, (const int (*)[3])base, table, compressed );
+			best_error = differential ? error5 : error4;
+		}
+	}
+	return best_error;
+}
+
+/*
+	T, H and planar blocks are told apart from differential ones by an
+	overflowing channel sum; the bits the mode doesn't use are searched for
+	a combination that triggers its overflow and none of the earlier ones.
+*/
+static int ETC2_select_mode(
+		unsigned char compressed[8],
+		const int *free_bits, int free_count,
+		int overflow_channel )
+{
+	int combination, i;
+	for( combination = 0; combination < (1 << free_count); ++combination )
+	{
+		for( i = 0; i < free_count; ++i )
+		{
+			const int byte = free_bits[i] >> 3, bit = free_bits[i] & 7;
+			compressed[byte] = (unsigned char)((compressed[byte] & ~(1 << bit)) | (((combination >> i) & 1) << bit));
+		}
+		for( i = 0; i < overflow_channel; ++i )
+		{
+			if( ETC2_overflows( compressed[i] ) )
+			{
+				break;
+			}
+		}
+		if( (i == overflow_channel) && ETC2_overflows( compressed[overflow_channel] ) )
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*	least squares plane through each channel, then the best rounding of its corners	*/
+static int ETC2_compress_planar(
+		const unsigned char *const uncompressed,
+		unsigned char compressed[8] )
+{
+	static const int bits[3] = { 6, 7, 6 };
+	static const int free_bits[6] = { 7, 15, 23, 22, 21, 18 };
+	int q[3][3];	/*	[origin, horizontal, vertical][r, g, b]	*/
+	int c, x, y;
+	for( c = 0; c < 3; ++c )
+	{
+		float sum = 0.0f, sum_x = 0.0f, sum_y = 0.0f;
+		float dx, dy, o;
+		int corner[3], best_error = 0x7fffffff, trial;
+		for( y = 0; y < 4; ++y )
+		{
+			for( x = 0; x < 4; ++x )
+			{
+				const float p = uncompressed[(y*4 + x)*4 + c];
+				sum += p;
+				sum_x += (x - 1.5f) * p;
+				sum_y += (y - 1.5f) * p;
+			}
+		}
+		dx = sum_x / 20.0f;
+		dy = sum_y / 20.0f;
+		o = sum / 16.0f - 1.5f * dx - 1.5f * dy;
+		corner[0] = ETC_quantize( o, bits[c] );
+		corner[1] = ETC_quantize( o + 4.0f * dx, bits[c] );
+		corner[2] = ETC_quantize( o + 4.0f * dy, bits[c] );
+		/*	channels are independent, so all 27 roundings are cheap to try	*/
+		for( trial = 0; trial < 27; ++trial )
+		{
+			int t[3], e[3], error = 0, i;
+			t[0] = corner[0] + (trial % 3) - 1;
+			t[1] = corner[1] + (trial / 3 % 3) - 1;
+			t[2] = corner[2] + (trial / 9) - 1;
+			for( i = 0; i < 3; ++i )
+			{
+				if( (t[i] < 0) || (t[i] >= (1 << bits[c])) )
+				{
+					break;
+				}
+				e[i] = ETC_expand( t[i], bits[c] );
+			}
+			if( i < 3 )
+			{
+				continue;
+			}
+			for( y = 0; y < 4; ++y )
+			{
+				for( x = 0; x < 4; ++x )
+				{
+					const int d = uncompressed[(y*4 + x)*4 + c] -
+							ETC_clamp( (x*(e[1] - e[0]) + y*(e[2] - e[0]) + 4*e[0] + 2) >> 2 );
+					error += d * d;
+				}
+			}
+			if( error < best_error )
+			{
+				best_error = error;
+				q[0][c] = t[0];
+				q[1][c] = t[1];
+				q[2][c] = t[2];
+			}
+		}
+	}
+	compressed[0] = (unsigned char)((q[0][0] << 1) | (q[0][1] >> 6));
+	compressed[1] = (unsigned char)(((q[0][1] & 0x3f) << 1) | (q[0][2] >> 5));
+	compressed[2] = (unsigned char)((q[0][2] & 0x18) | ((q[0][2] >> 1) & 3));
+	compressed[3] = (unsigned char)(((q[0][2] & 1) << 7) | ((q[1][0] >> 1) << 2) | 2 | (q[1][0] & 1));
+	compressed[4] = (unsigned char)((q[1][1] << 1) | (q[1][2] >> 5));
+	compressed[5] = (unsigned char)(((q[1][2] & 0x1f) << 3) | (q[2][0] >> 3));
+	compressed[6] = (unsigned char)(((q[2][0] & 7) << 5) | (q[2][1] >> 2));
+	compressed[7] = (unsigned char)(((q[2][1] & 3) << 6) | q[2][2]);
+	return ETC2_select_mode( compressed, free_bits, 6, 2 );
+}
+
+/*
+	T and H modes paint the block with two clusters of colors: one color
+	and a line of three (T), or two lines of two (H). The clusters come
+	from a few 2-means iterations.
+*/
+static int ETC2_compress_T_H(
+		const unsigned char *const uncompressed,
+		int h_mode,
+		unsigned char compressed[8] )
+{
+	static const int t_free_bits[4] = { 7, 6, 5, 2 };
+	static const int h_free_bits[5] = { 7, 15, 14, 13, 10 };
+	float center[2][3];
+	int group[16], q[2][3], e[2][3];
+	int i, c, k, iteration, lo = 0, hi = 0;
+	int best_error = 0x7fffffff, best_distance = 0, best_swap = 0;
+	/*	seed with the darkest and brightest pixels	*/
+	for( i = 1; i < 16; ++i )
+	{
+		const unsigned char *p = uncompressed + i*4;
+		const int luma = p[0] + 2*p[1] + p[2];
+		if( luma < uncompressed[lo*4] + 2*uncompressed[lo*4+1] + uncompressed[lo*4+2] )
+		{
+			lo = i;
+		}
+		if( luma > uncompressed[hi*4] + 2*uncompressed[hi*4+1] + uncompressed[hi*4+2] )
+		{
+			hi = i;
+		}
+	}
+	if( lo == hi )
+	{
+		return 0;
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		center[0][c] = uncompressed[lo*4 + c];
+		center[1][c] = uncompressed[hi*4 + c];
+	}
+	for( iteration = 0; iteration < 4; ++iteration )
+	{
+		float sum[2][3] = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+		int count[2] = { 0, 0 };
+		for( i = 0; i < 16; ++i )
+		{
+			float d[2];
+			for( k = 0; k < 2; ++k )
+			{
+				d[k] = 0.0f;
+				for( c = 0; c < 3; ++c )
+				{
+					d[k] += (uncompressed[i*4 + c] - center[k][c]) * (uncompressed[i*4 + c] - center[k][c]);
+				}
+			}
+			group[i] = d[1] < d[0];
+			++count[group[i]];
+			for( c = 0; c < 3; ++c )
+			{
+				sum[group[i]][c] += uncompressed[i*4 + c];
+			}
+		}
+		if( (count[0] == 0) || (count[1] == 0) )
+		{
+			return 0;
+		}
+		for( k = 0; k < 2; ++k )
+		{
+			for( c = 0; c < 3; ++c )
+			{
+				center[k][c] = sum[k][c] / count[k];
+			}
+		}
+	}
+	for( k = 0; k < 2; ++k )
+	{
+		for( c = 0; c < 3; ++c )
+		{
+			q[k][c] = ETC_quantize( center[k][c], 4 );
+		}
+	}
+	/*	T mode: try either cluster as the lone color	*/
+	for( k = 0; k < (h_mode ? 1 : 2); ++k )
+	{
+		int d;
+		for( c = 0; c < 3; ++c )
+		{
+			e[0][c] = ETC_expand( q[k][c], 4 );
+			e[1][c] = ETC_expand( q[1 - k][c], 4 );
+		}
+		for( d = 0; d < 8; ++d )
+		{
+			const int distance = ETC2_distances[d];
+			int paint[4][3], error = 0, m;
+			if( h_mode )
+			{
+				/*	the order of the two colors holds the distance's low bit	*/
+				const int first_is_larger = ((q[0][0] << 8) | (q[0][1] << 4) | q[0][2]) >= ((q[1][0] << 8) | (q[1][1] << 4) | q[1][2]);
+				if( (first_is_larger != (d & 1)) && (0 == memcmp( q[0], q[1], sizeof( q[0] ) )) )
+				{
+					continue;
+				}
+				for( c = 0; c < 3; ++c )
+				{
+					paint[0][c] = ETC_clamp( e[0][c] + distance );
+					paint[1][c] = ETC_clamp( e[0][c] - distance );
+					paint[2][c] = ETC_clamp( e[1][c] + distance );
+					paint[3][c] = ETC_clamp( e[1][c] - distance );
+				}
+			} else
+			{
+				for( c = 0; c < 3; ++c )
+				{
+					paint[0][c] = e[0][c];
+					paint[1][c] = ETC_clamp( e[1][c] + distance );
+					paint[2][c] = e[1][c];
+					paint[3][c] = ETC_clamp( e[1][c] - distance );
+				}
+			}
+			for( i = 0; i < 16; ++i )
+			{
+				int best = 0x7fffffff;
+				for( m = 0; m < 4; ++m )
+				{
+					int pe = ETC_color_error( uncompressed + i*4, paint[m][0], paint[m][1], paint[m][2] );
+					best = pe < best ? pe : best;
+				}
+				error += best;
+			}
+			if( error < best_error )
+			{
+				best_error = error;
+				best_distance = d;
+				best_swap = k;
+			}
+		}
+	}
+	if( best_error == 0x7fffffff )
+	{
+		return 0;
+	}
+	/*	H mode: swap the colors if their order disagrees with the distance	*/
+	if( h_mode )
+	{
+		const int first_is_larger = ((q[0][0] << 8) | (q[0][1] << 4) | q[0][2]) >= ((q[1][0] << 8) | (q[1][1] << 4) | q[1][2]);
+		best_swap = first_is_larger != (best_distance & 1);
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		const int first = q[best_swap][c], second = q[1 - best_swap][c];
+		q[0][c] = first;
+		q[1][c] = second;
+		e[0][c] = ETC_expand( first, 4 );
+		e[1][c] = ETC_expand( second, 4 );
+	}
+	if( h_mode )
+	{
+		compressed[0] = (unsigned char)((q[0][0] << 3) | (q[0][1] >> 1));
+		compressed[1] = (unsigned char)(((q[0][1] & 1) << 4) | (q[0][2] & 8) | ((q[0][2] >> 1) & 3));
+		compressed[2] = (unsigned char)(((q[0][2] & 1) << 7) | (q[1][0] << 3) | (q[1][1] >> 1));
+		compressed[3] = (unsigned char)(((q[1][1] & 1) << 7) | (q[1][2] << 3) | (best_distance & 4) | 2 | ((best_distance >> 1) & 1));
+	} else
+	{
+		compressed[0] = (unsigned char)(((q[0][0] >> 2) << 3) | (q[0][0] & 3));
+		compressed[1] = (unsigned char)((q[0][1] << 4) | q[0][2]);
+		compressed[2] = (unsigned char)((q[1][0] << 4) | q[1][1]);
+		compressed[3] = (unsigned char)((q[1][2] << 4) | ((best_distance >> 1) << 2) | 2 | (best_distance & 1));
+	}
+	/*	the pixel indices for the chosen paint colors	*/
+	{
+		const int distance = ETC2_distances[best_distance];
+		unsigned int msb = 0, lsb = 0;
+		int paint[4][3], m, x, y;
+		for( c = 0; c < 3; ++c )
+		{
+			if( h_mode )
+			{
+				paint[0][c] = ETC_clamp( e[0][c] + distance );
+				paint[1][c] = ETC_clamp( e[0][c] - distance );
+				paint[2][c] = ETC_clamp( e[1][c] + distance );
+				paint[3][c] = ETC_clamp( e[1][c] - distance );
+			} else
+			{
+				paint[0][c] = e[0][c];
+				paint[1][c] = ETC_clamp( e[1][c] + distance );
+				paint[2][c] = e[1][c];
+				paint[3][c] = ETC_clamp( e[1][c] - distance );
+			}
+		}
+		for( y = 0; y < 4; ++y )
+		{
+			for( x = 0; x < 4; ++x )
+			{
+				int best_m = 0, best = 0x7fffffff;
+				for( m = 0; m < 4; ++m )
+				{
+					int pe = ETC_color_error( uncompressed + (y*4 + x)*4, paint[m][0], paint[m][1], paint[m][2] );
+					if( pe < best )
+					{
+						best = pe;
+						best_m = m;
+					}
+				}
+				msb |= (unsigned int)(best_m >> 1) << (x*4 + y);
+				lsb |= (unsigned int)(best_m & 1) << (x*4 + y);
+			}
+		}
+		compressed[4] = (unsigned char)(msb >> 8);
+		compressed[5] = (unsigned char)msb;
+		compressed[6] = (unsigned char)(lsb >> 8);
+		compressed[7] = (unsigned char)lsb;
+	}
+	return h_mode ?
+			ETC2_select_mode( compressed, h_free_bits, 5, 1 ) :
+			ETC2_select_mode( compressed, t_free_bits, 4, 0 );
+}
+
+/*
+	ETC2 RGB: the ETC1 encoding, or the planar mode for smooth gradients;
+	high quality also tries the T and H modes for two-color blocks. Each
+	candidate is decoded to measure its real error.
+*/
+int
+	compress_ETC2_color_block
+	(
+		const unsigned char *const uncompressed,
+		int quality,
+		unsigned char compressed[8]
+	)
+{
+	unsigned char candidate[8], decoded[16*4];
+	int best_error = compress_ETC1_block( uncompressed, quality, compressed );
+	int mode;
+	for( mode = 0; (mode < 3) && (best_error > 0); ++mode )
+	{
+		int valid;
+		if( mode == 0 )
+		{
+			valid = ETC2_compress_planar( uncompressed, candidate );
+		} else
+		{
+			if( quality != ETC_QUALITY_HIGH )
+			{
+				break;
+			}
+			valid = ETC2_compress_T_H( uncompressed, mode == 2, candidate );
+		}
+		if( valid )
+		{
+			int error;
+			wfETC2_DecodeBlock( candidate, decoded, 4, WF_ETC2_RGB8 );
+			error = ETC_block_error( uncompressed, decoded );
+			if( error < best_error )
+			{
+				best_error = error;
+				memcpy( compressed, candidate, 8 );
+			}
+		}
+	}
+	return best_error;
+}
+
+/*	EAC alpha: every table, with the multiplier and base that span the block's alpha range	*/
+void
+	compress_EAC_alpha_block
+	(
+		const unsigned char *const uncompressed,
+		int quality,
+		unsigned char compressed[8]
+	)
+{
+	int lo = 255, hi = 0, i, t;
+	int best_error = 0x7fffffff, best_table = 13, best_multiplier = 1, best_base;
+	unsigned long long indices = 0;
+	for( i = 0; i < 16; ++i )
+	{
+		lo = uncompressed[i*4 + 3] < lo ? uncompressed[i*4 + 3] : lo;
+		hi = uncompressed[i*4 + 3] > hi ? uncompressed[i*4 + 3] : hi;
+	}
+	/*	flat alpha: table 13 has a zero modifier	*/
+	best_base = lo;
+	if( lo != hi )
+	{
+		for( t = 0; t < 16; ++t )
+		{
+			const int *modifiers = EAC_modifiers[t];
+			const int span = modifiers[7] - modifiers[3];
+			const int estimate = (hi - lo + span/2) / span;
+			int multiplier, shift;
+			for( multiplier = estimate - (quality == ETC_QUALITY_HIGH); multiplier <= estimate + 1; ++multiplier )
+			{
+				int centered;
+				if( (multiplier < 1) || (multiplier > 15) )
+				{
+					continue;
+				}
+				centered = (lo + hi - (modifiers[3] + modifiers[7]) * multiplier) / 2;
+				for( shift = (quality == ETC_QUALITY_HIGH) ? -2 : 0; shift <= ((quality == ETC_QUALITY_HIGH) ? 2 : 0); ++shift )
+				{
+					const int base = ETC_clamp( centered + shift );
+					int values[8], error = 0, m;
+					for( m = 0; m < 8; ++m )
+					{
+						values[m] = ETC_clamp( base + modifiers[m] * multiplier );
+					}
+					for( i = 0; (i < 16) && (error < best_error); ++i )
+					{
+						int best = 0x7fffffff;
+						for( m = 0; m < 8; ++m )
+						{
+							const int d = (uncompressed[i*4 + 3] - values[m]) * (uncompressed[i*4 + 3] - values[m]);
+							best = d < best ? d : best;
+						}
+						error += best;
+					}
+					if( error < best_error )
+					{
+						best_error = error;
+						best_table = t;
+						best_multiplier = multiplier;
+						best_base = base;
+					}
+				}
+			}
+		}
+	}
+	/*	indices are stored column by column, 3 bits each	*/
+	for( i = 0; i < 16; ++i )
+	{
+		const int alpha = uncompressed[((i & 3)*4 + (i >> 2))*4 + 3];
+		int m, best_m = 0, best = 0x7fffffff;
+		for( m = 0; m < 8; ++m )
+		{
+			const int d = alpha - ETC_clamp( best_base + EAC_modifiers[best_table][m] * best_multiplier );
+			if( d * d < best )
+			{
+				best = d * d;
+				best_m = m;
+			}
+		}
+		indices |= (unsigned long long)best_m << (45 - 3*i);
+	}
+	compressed[0] = (unsigned char)best_base;
+	compressed[1] = (unsigned char)((best_multiplier << 4) | best_table);
+	for( i = 0; i < 6; ++i )
+	{
+		compressed[2 + i] = (unsigned char)(indices >> (40 - 8*i));
+	}
+}
+
+/*	the block rows one encoding thread works on	*/
+typedef struct
+{
+	const unsigned char *uncompressed;
+	int width, height, channels;
+	int format;
+	int quality;
+	unsigned char *compressed;
+} ETC_encode_job;
+
+static void ETC_encode_rows( void *context, int begin, int end )
+{
+	const ETC_encode_job *job = (const ETC_encode_job*)context;
+	const int block_size = (job->format == ETC_FORMAT_ETC2_RGBA8) ? 16 : 8;
+	const int width_blocks = (job->width + 3) >> 2;
+	unsigned char block[16*4];
+	int bx, by, x, y;
+	for( by = begin; by < end; ++by )
+	{
+		unsigned char *out = job->compressed + (size_t)by * width_blocks * block_size;
+		for( bx = 0; bx < width_blocks; ++bx, out += block_size )
+		{
+			/*	gather the block as RGBA, repeating the last row and column past the edges	*/
+			for( y = 0; y < 4; ++y )
+			{
+				const int sy = (by*4 + y < job->height) ? by*4 + y : job->height - 1;
+				for( x = 0; x < 4; ++x )
+				{
+					const int sx = (bx*4 + x < job->width) ? bx*4 + x : job->width - 1;
+					const unsigned char *p = job->uncompressed + ((size_t)sy * job->width + sx) * job->channels;
+					unsigned char *b = block + (y*4 + x)*4;
+					if( job->channels < 3 )
+					{
+						b[0] = b[1] = b[2] = p[0];
+					} else
+					{
+						b[0] = p[0];
+						b[1] = p[1];
+						b[2] = p[2];
+					}
+					b[3] = (job->channels & 1) ? 255 : p[job->channels - 1];
+				}
+			}
+			switch( job->format )
+			{
+			case ETC_FORMAT_ETC1:
+				compress_ETC1_block( block, job->quality, out );
+				break;
+			case ETC_FORMAT_ETC2_RGB8:
+				compress_ETC2_color_block( block, job->quality, out );
+				break;
+			default:
+				compress_EAC_alpha_block( block, job->quality, out );
+				compress_ETC2_color_block( block, job->quality, out + 8 );
+				break;
+			}
+		}
+	}
+}
+
+static unsigned char* convert_image_to_ETC(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int format, int quality,
+		int *out_size )
+{
+	ETC_encode_job job;
+	const int block_rows = (height + 3) >> 2;
+	/*	error check	*/
+	*out_size = 0;
+	if( (width < 1) || (height < 1) ||
+		(NULL == uncompressed) ||
+		(channels < 1) || (channels > 4) )
+	{
+		return NULL;
+	}
+	*out_size = ((width+3) >> 2) * block_rows * ((format == ETC_FORMAT_ETC2_RGBA8) ? 16 : 8);
+	job.uncompressed = uncompressed;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.format = format;
+	job.quality = quality;
+	job.compressed = (unsigned char*)SOIL_arena_malloc( *out_size );
+	if( NULL == job.compressed )
+	{
+		*out_size = 0;
+		return NULL;
+	}
+	/*	a block row is a lot of work, hand them out one at a time	*/
+	SOIL_parallel_for( block_rows, 1, ETC_encode_rows, &job );
+	return job.compressed;
+}
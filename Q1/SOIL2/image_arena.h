@@ -0,0 +1,104 @@
+/*
+	Per-thread arena allocator for image decoding
+
+	Every load runs inside a SOIL_arena_begin / SOIL_arena_end scope. The
+	decoder's small and medium allocations (zlib buffers, Huffman tables,
+	JPEG component planes, resampling temporaries) are bumped out of a
+	thread-local block that is reset at the end of the scope, so decoding
+	many textures on several threads neither fragments the heap nor
+	contends on the global allocator. Pointers that are not owned by the
+	arena fall through to malloc / realloc / free, so the functions below
+	are safe to use on any block.
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_ARENA
+#define HEADER_IMAGE_ARENA
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	Opens an allocation scope on the calling thread. Scopes nest; only the
+	outermost one resets the arena.
+	\param expected_size estimate of the scope's arena usage (from stbi_info),
+	the arena is grown to it up front so buffers don't have to be moved later
+	\param heap_threshold allocations of at least this many bytes go straight
+	to the heap (typically the final image, which outlives the scope),
+	0 keeps everything in the arena
+**/
+void
+	SOIL_arena_begin
+	(
+		size_t expected_size,
+		size_t heap_threshold
+	);
+
+/**
+	Closes the scope opened by SOIL_arena_begin. When the outermost scope
+	closes every arena block handed out inside it becomes invalid.
+**/
+void
+	SOIL_arena_end
+	(
+		void
+	);
+
+void*
+	SOIL_arena_malloc
+	(
+		size_t size
+	);
+
+/**
+	Grows or shrinks a block. The most recent arena allocation is resized in
+	place, which is what makes stbi__zexpand cheap.
+**/
+void*
+	SOIL_arena_realloc
+	(
+		void *ptr,
+		size_t new_size
+	);
+
+/**
+	Frees a block. Arena blocks are only reclaimed if they are the most
+	recent allocation, the rest goes away when the scope ends.
+**/
+void
+	SOIL_arena_free
+	(
+		void *ptr
+	);
+
+/**
+	Makes sure a block survives the end of the scope: arena blocks are
+	copied to the heap, heap blocks are returned unchanged.
+	\return NULL if failed, otherwise a block to be released with free()
+**/
+void*
+	SOIL_arena_detach
+	(
+		void *ptr,
+		size_t size
+	);
+
+/**
+	Releases the calling thread's arena memory, call it before a decoding
+	worker thread exits.
+**/
+void
+	SOIL_arena_release
+	(
+		void
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_ARENA	*/
@@ -2,8 +2,9 @@
 #define PKM_HELPER_H
 
 typedef struct {
-	char aName[6];
-	unsigned short iBlank;
+	char aName[6];				/* "PKM 10" or "PKM 20", not NUL terminated */
+	unsigned char iFormatMSB;
+	unsigned char iFormatLSB;
 	unsigned char iPaddedWidthMSB;
 	unsigned char iPaddedWidthLSB;
 	unsigned char iPaddedHeightMSB;
@@ -16,4 +17,11 @@ typedef struct {
 
 #define PKM_HEADER_SIZE 16
 
+/*	format field, "PKM 10" files only hold ETC1	*/
+#define PKM_FORMAT_ETC1_RGB			0
+#define PKM_FORMAT_ETC2_RGB			1
+#define PKM_FORMAT_ETC2_RGBA_OLD	2
+#define PKM_FORMAT_ETC2_RGBA		3
+#define PKM_FORMAT_ETC2_RGBA1		4
+
 #endif
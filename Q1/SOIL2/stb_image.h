@@ -233,6 +233,11 @@ RECENT REVISION HISTORY:
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
+// Defining STBI_FAST_PNG swaps in a faster PNG path: inflate with a 64-bit
+// bit-buffer, a two-literals-per-lookup Huffman table and 8-byte match
+// copies, plus SSE2 scanline unfiltering for 8-bit RGB/RGBA images with the
+// RGB->RGBA expansion fused in. The output is identical to the default path.
+//
 // ===========================================================================
 //
 // HDR image support   (disable by defining STBI_NO_HDR)
@@ -611,6 +616,14 @@ typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
 #endif
 
+#ifdef STBI_FAST_PNG
+#ifdef _MSC_VER
+typedef unsigned __int64 stbi__uint64;
+#else
+typedef uint64_t stbi__uint64;
+#endif
+#endif
+
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 
@@ -3967,6 +3980,11 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 // fast-way is faster to check than jpeg huffman, but slow way is slower
 #define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
+#ifdef STBI_FAST_PNG
+// multi-symbol literal/length table, one lookup yields up to two literals
+#define STBI__ZFAST2_BITS 11
+#define STBI__ZFAST2_MASK ((1 << STBI__ZFAST2_BITS) - 1)
+#endif
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
@@ -4062,6 +4080,9 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+#ifdef STBI_FAST_PNG
+   stbi__uint32 z_litfast[1 << STBI__ZFAST2_BITS];
+#endif
 } stbi__zbuf;
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -4154,9 +4175,183 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+#ifdef STBI_FAST_PNG
+// STBI_FAST_PNG inflate: a 64-bit bit-buffer refilled 8 bytes at a time, a
+// literal/length table that resolves up to two literals per lookup, and
+// match copies done 8 bytes at a time. It runs while there is enough input
+// and output margin for the widest symbol, then hands the (resynchronized)
+// state back to stbi__parse_huffman_block for the tail of the block.
+
+#define STBI__ZFAST_IN_MARGIN   8
+#define STBI__ZFAST_OUT_MARGIN  (258 + 8)
+
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+#if defined(STBI__X64_TARGET) || defined(STBI__X86_TARGET) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+   stbi__uint64 v;
+   memcpy(&v, p, 8);
+   return v;
+#else
+   return  (stbi__uint64) p[0]        | ((stbi__uint64) p[1] <<  8) |
+          ((stbi__uint64) p[2] << 16) | ((stbi__uint64) p[3] << 24) |
+          ((stbi__uint64) p[4] << 32) | ((stbi__uint64) p[5] << 40) |
+          ((stbi__uint64) p[6] << 48) | ((stbi__uint64) p[7] << 56);
+#endif
+}
+
+// decode one symbol from the low bits of 'bits' (LSB first) without a stream;
+// returns the symbol and its code length in *len, or -1 for an invalid code
+static int stbi__zhuffman_peek(const stbi__zhuffman *z, stbi__uint32 bits, int *len)
+{
+   int b,s,k;
+   b = z->fast[bits & STBI__ZFAST_MASK];
+   if (b) {
+      *len = b >> 9;
+      return b & 511;
+   }
+   k = stbi__bit_reverse(bits & 0xffff, 16);
+   for (s=STBI__ZFAST_BITS+1; s < 16; ++s)
+      if (k < z->maxcode[s])
+         break;
+   if (s == 16) return -1;
+   b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
+   if (b < 0 || b >= 288 || z->size[b] != s) return -1;
+   *len = s;
+   return z->value[b];
+}
+
+// entry layout: bits 0-3 total code length, bits 4-5 symbol count (0 = use
+// stbi__zhuffman_peek), bits 8-16 first symbol, bits 20-27 second literal
+static void stbi__zbuild_litfast(stbi__zbuf *a)
+{
+   int i;
+   for (i=0; i < (1 << STBI__ZFAST2_BITS); ++i) {
+      int len1, len2, sym2;
+      int sym1 = stbi__zhuffman_peek(&a->z_length, (stbi__uint32) i, &len1);
+      stbi__uint32 e = 0;
+      if (sym1 >= 0 && len1 <= STBI__ZFAST2_BITS) {
+         e = (stbi__uint32) len1 | (1 << 4) | ((stbi__uint32) sym1 << 8);
+         if (sym1 < 256 && len1 < STBI__ZFAST2_BITS) {
+            // fits a second literal in the remaining lookup bits?
+            sym2 = stbi__zhuffman_peek(&a->z_length, (stbi__uint32) (i >> len1), &len2);
+            if (sym2 >= 0 && sym2 < 256 && len1 + len2 <= STBI__ZFAST2_BITS)
+               e = (stbi__uint32) (len1 + len2) | (2 << 4) | ((stbi__uint32) sym1 << 8) | ((stbi__uint32) sym2 << 20);
+         }
+      }
+      a->z_litfast[i] = e;
+   }
+}
+
+// returns 1 at the end of the block, 0 on error, 2 if it ran out of margin
+static int stbi__parse_huffman_block_fast(stbi__zbuf *a)
+{
+   stbi__uint64 bits = a->code_buffer;
+   int nbits = a->num_bits;
+   stbi_uc *in = a->zbuffer;
+   char *zout = a->zout;
+   int result = 2;
+
+   // the slow path pads with zeros past the end of the input, never hand
+   // those bits back as if they had been read from the buffer
+   if (a->zbuffer_end - in < STBI__ZFAST_IN_MARGIN)
+      return 2;
+
+   for(;;) {
+      stbi__uint32 e;
+      int z, len, dist, n;
+      if (a->zbuffer_end - in < STBI__ZFAST_IN_MARGIN || a->zout_end - zout < STBI__ZFAST_OUT_MARGIN)
+         break;
+      // branchless refill to at least 56 bits: the longest length/distance
+      // pair with its extra bits is 48 bits
+      bits |= stbi__zload64(in) << nbits;
+      in += (63 - nbits) >> 3;
+      nbits |= 56;
+
+      e = a->z_litfast[bits & STBI__ZFAST2_MASK];
+      if (e & (3 << 4)) {
+         n = e & 15;
+         bits >>= n;
+         nbits -= n;
+         z = (e >> 8) & 511;
+         if ((e >> 4 & 3) == 2) {
+            zout[0] = (char) z;
+            zout[1] = (char) (e >> 20);
+            zout += 2;
+            continue;
+         }
+      } else {
+         z = stbi__zhuffman_peek(&a->z_length, (stbi__uint32) bits, &n);
+         if (z < 0) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+         bits >>= n;
+         nbits -= n;
+      }
+      if (z < 256) {
+         *zout++ = (char) z;
+         continue;
+      }
+      if (z == 256) {
+         result = 1;
+         break;
+      }
+      z -= 257;
+      if (z >= 29) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      len = stbi__zlength_base[z];
+      n = stbi__zlength_extra[z];
+      if (n) {
+         len += (int) (bits & ((1u << n) - 1));
+         bits >>= n;
+         nbits -= n;
+      }
+      z = stbi__zhuffman_peek(&a->z_distance, (stbi__uint32) bits, &n);
+      if (z < 0 || z >= 30) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      bits >>= n;
+      nbits -= n;
+      dist = stbi__zdist_base[z];
+      n = stbi__zdist_extra[z];
+      if (n) {
+         dist += (int) (bits & ((1u << n) - 1));
+         bits >>= n;
+         nbits -= n;
+      }
+      if (zout - a->zout_start < dist) { result = stbi__err("bad dist","Corrupt PNG"); break; }
+      {
+         const char *p = zout - dist;
+         char *end = zout + len;
+         if (dist >= 8) {
+            // may write up to 7 bytes past the match, the output margin covers it
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+         } else if (dist == 1) {
+            memset(zout, *p, len);
+         } else {
+            do *zout++ = *p++; while (zout < end);
+         }
+         zout = end;
+      }
+   }
+
+   // hand back whole unread bytes so the 32-bit slow path can take over
+   in -= nbits >> 3;
+   nbits &= 7;
+   a->zbuffer = in;
+   a->num_bits = nbits;
+   a->code_buffer = (stbi__uint32) (bits & ((1u << nbits) - 1));
+   a->zout = zout;
+   return result;
+}
+#endif // STBI_FAST_PNG
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
+#ifdef STBI_FAST_PNG
+   int r = stbi__parse_huffman_block_fast(a);
+   if (r != 2) return r;
+   zout = a->zout;
+#endif
    for(;;) {
       int z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
@@ -4338,6 +4533,9 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
+         #ifdef STBI_FAST_PNG
+         stbi__zbuild_litfast(a);
+         #endif
          if (!stbi__parse_huffman_block(a)) return 0;
       }
    } while (!final);
@@ -4505,6 +4703,124 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#if defined(STBI_FAST_PNG) && defined(STBI_SSE2) && (defined(STBI__X64_TARGET) || defined(__SSE2__))
+#define STBI__PNG_SSE2
+// SSE2 unfiltering of one 8-bit RGB/RGBA scanline. Sub/Avg/Paeth depend on
+// the pixel to the left, so those go one pixel per step with all channels
+// in one register; None/Up go 16 bytes at a time. RGB rows decoded into
+// RGBA output get their alpha in the same pass. prior is NULL on the first
+// row, which turns every filter into its *_first variant.
+stbi_inline static __m128i stbi__png_load_px(const stbi_uc *p, int n)
+{
+   stbi__uint32 v = 0;
+   memcpy(&v, p, n);
+   return _mm_cvtsi32_si128((int) v);
+}
+
+stbi_inline static void stbi__png_store_px(stbi_uc *p, __m128i v, int n)
+{
+   stbi__uint32 v32 = (stbi__uint32) _mm_cvtsi128_si32(v);
+   memcpy(p, &v32, n);
+}
+
+stbi_inline static __m128i stbi__png_load4(const stbi_uc *p)
+{
+   stbi__uint32 v;
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128((int) v);
+}
+
+stbi_inline static void stbi__png_store4(stbi_uc *p, __m128i v)
+{
+   stbi__uint32 v32 = (stbi__uint32) _mm_cvtsi128_si32(v);
+   memcpy(p, &v32, 4);
+}
+
+stbi_inline static __m128i stbi__png_avg(__m128i a, __m128i b)
+{
+   // floor((a+b)/2); pavgb rounds up
+   return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+stbi_inline static __m128i stbi__png_paeth(__m128i a, __m128i b, __m128i c)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i a16 = _mm_unpacklo_epi8(a, zero);
+   __m128i b16 = _mm_unpacklo_epi8(b, zero);
+   __m128i c16 = _mm_unpacklo_epi8(c, zero);
+   __m128i pa = _mm_sub_epi16(b16, c16);
+   __m128i pb = _mm_sub_epi16(a16, c16);
+   __m128i pc = _mm_add_epi16(pa, pb);
+   __m128i not_a, use_c, bc;
+   pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+   pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+   pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+   not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+   use_c = _mm_cmpgt_epi16(pb, pc);
+   bc = _mm_or_si128(_mm_and_si128(use_c, c16), _mm_andnot_si128(use_c, b16));
+   return _mm_packus_epi16(_mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a16)), zero);
+}
+
+// every pixel but the last moves with 4-byte loads/stores: for 3-channel
+// rows the 4th lane carries a neighbour's byte, which never mixes into the
+// other lanes and is overwritten by the next pixel (or by the alpha)
+#define STBI__PNG_PIXELS(use_prior, predict)                                  \
+   for (i=0; i < x; ++i, raw += img_n, cur += out_n) {                         \
+      __m128i r, d;                                                            \
+      int last = (i + 1 == x);                                                 \
+      r = last ? stbi__png_load_px(raw, img_n) : stbi__png_load4(raw);         \
+      if (use_prior) {                                                         \
+         b = last ? stbi__png_load_px(prior, img_n) : stbi__png_load4(prior);  \
+         prior += out_n;                                                       \
+      }                                                                        \
+      d = _mm_or_si128(_mm_add_epi8(r, predict), alpha);                       \
+      if (last) stbi__png_store_px(cur, d, out_n); else stbi__png_store4(cur, d); \
+      c = b;                                                                   \
+      a = d;                                                                   \
+   }
+
+static void stbi__png_unfilter_row_sse2(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int filter, stbi__uint32 x, int img_n, int out_n)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i alpha = _mm_cvtsi32_si128(img_n != out_n ? (int) 0xff000000u : 0);
+   __m128i a = zero, b = zero, c = zero;   // left, up, up-left
+   stbi__uint32 i, k, n;
+
+   if (prior == NULL) {
+      // first row: up is none, paeth(a,0,0) is a
+      if (filter == STBI__F_up)    filter = STBI__F_none;
+      if (filter == STBI__F_paeth) filter = STBI__F_sub;
+   }
+
+   if (img_n == out_n && (filter == STBI__F_none || filter == STBI__F_up)) {
+      n = x * img_n;
+      if (filter == STBI__F_none) {
+         memcpy(cur, raw, n);
+         return;
+      }
+      for (k=0; k + 16 <= n; k += 16)
+         _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw+k)),
+                                                            _mm_loadu_si128((const __m128i *) (prior+k))));
+      for (; k < n; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      return;
+   }
+
+   switch (filter) {
+      case STBI__F_none:  STBI__PNG_PIXELS(0, zero) break;
+      case STBI__F_sub:   STBI__PNG_PIXELS(0, a) break;
+      case STBI__F_up:    STBI__PNG_PIXELS(1, b) break;
+      case STBI__F_avg:
+         if (prior) { STBI__PNG_PIXELS(1, stbi__png_avg(a, b)) }
+         else       { STBI__PNG_PIXELS(0, stbi__png_avg(a, zero)) }
+         break;
+      case STBI__F_paeth: STBI__PNG_PIXELS(1, stbi__png_paeth(a, b, c)) break;
+   }
+   STBI_NOTUSED(c);
+}
+#undef STBI__PNG_PIXELS
+#endif
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4540,6 +4856,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       if (filter > 4)
          return stbi__err("invalid filter","Corrupt PNG");
 
+      #ifdef STBI__PNG_SSE2
+      if (depth == 8 && img_n >= 3) {
+         stbi__png_unfilter_row_sse2(cur, j ? cur - stride : NULL, raw, filter, x, img_n, out_n);
+         raw += x*img_n;
+         continue;
+      }
+      #endif
+
       if (depth < 8) {
          STBI_ASSERT(img_width_bytes <= x);
          cur += x*out_n - img_width_bytes; // store output to the rightmost img_len bytes, so we can decode in place
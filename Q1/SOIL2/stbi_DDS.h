@@ -28,6 +28,46 @@ extern int      stbi__dds_info_from_path   (char const *filename,     int *x, in
 extern int      stbi__dds_info_from_file   (FILE *f,                  int *x, int *y, int *comp, int *iscompressed);
 #endif
 
+/*	block formats of the DXT decoders, BC4 decodes to red and BC5 to red/green, the way OpenGL samples them */
+enum
+{
+	STBI_DXT1 = 1,
+	STBI_DXT3 = 3,
+	STBI_DXT5 = 5,
+	STBI_BC4,
+	STBI_BC5
+};
+
+/*	bytes per 4x4 block, 0 for an unknown format */
+extern int      stbi_DXT_block_size        (int format);
+
+/*	decodes a row of num_blocks blocks to 4 rows of RGBA pixels, stride bytes apart */
+extern void     stbi_decode_DXT_blocks     (int format, unsigned char const *compressed, int num_blocks, unsigned char *uncompressed, int stride);
+
+/*	decodes a whole image to RGBA, block rows in parallel. The data is padded to whole blocks. */
+extern void     stbi_decode_DXT_image      (int format, unsigned char const *compressed, int width, int height, unsigned char *uncompressed);
+
+/*	samples DXT/BC data in place on the CPU, decoding the blocks it touches */
+typedef struct
+{
+	unsigned char const *compressed;
+	int format;
+	int width;
+	int height;
+	int block_pitch;
+	int block_size;
+	int cached[4];					/* block held in each slot, -1 for none */
+	unsigned char texels[4][16*4];	/* a 2x2 neighbourhood of blocks never shares a slot */
+} stbi_dxt_sampler;
+
+extern void     stbi_dxt_sampler_init      (stbi_dxt_sampler *sampler, int format, unsigned char const *compressed, int width, int height);
+
+/*	the texel at x, y, wrapping round the edges */
+extern void     stbi_dxt_sampler_fetch     (stbi_dxt_sampler *sampler, int x, int y, unsigned char rgba[4]);
+
+/*	bilinear sample at texture coordinates u, v with GL_REPEAT wrapping, in 0..1 */
+extern void     stbi_dxt_sampler_sample    (stbi_dxt_sampler *sampler, float u, float v, float rgba[4]);
+
 /*
 //
 ////   end header file   /////////////////////////////////////////////////////*/
@@ -0,0 +1,1016 @@
+#ifndef TextureManager_h
+#define TextureManager_h
+
+#include <map>
+#include <cmath>
+#include <deque>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <iostream>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/stb_image.h"
+#include "SOIL2/image_arena.h"
+#include "SOIL2/image_cache.h"
+#include "SOIL2/image_helper.h"
+#include "SOIL2/image_DXT.h"
+
+// Load options; they are part of the key textures are shared by
+enum TextureFlags
+{
+    TEXTURE_SRGB = 1,           // color data, sampled as sRGB
+    TEXTURE_COMPRESS = 2,       // stored as BC1 (opaque) or BC3 when the driver has S3TC
+    TEXTURE_NO_MIPMAPS = 4,
+    TEXTURE_CLAMP = 8,          // GL_CLAMP_TO_EDGE instead of GL_REPEAT
+    TEXTURE_PINNED = 16,        // never shrunk by the budget, for textures whose GL name must not change
+    TEXTURE_STREAM = 32         // shows up at once, mip levels stream in from the texture cache coarsest first
+};
+
+// A streamed texture gets every level up to this size as soon as its cache entry is mapped
+const GLsizei TEXTURE_STREAM_TAIL_SIZE = 64;
+
+// Mip data EndFrame( ) uploads for streamed textures, at least one level goes up per frame
+const size_t TEXTURE_STREAM_BYTES_PER_FRAME = 4 << 20;
+
+// How much of a level's LOD bias is taken off per frame once it has landed, so new detail fades in
+const GLfloat TEXTURE_STREAM_FADE_PER_FRAME = 0.25f;
+
+// Owns the 2D textures of a program. A file loaded twice with the same flags is shared, handles are
+// reference counted and every texture's size is tracked. Storage is immutable RGBA8, SRGB8_ALPHA8 or
+// BC1/BC3, so rows are always 4-byte aligned. When a budget is set and the resident bytes exceed it, the
+// least recently used textures lose their top mip level until everything fits again; this reallocates
+// the texture, so the GL name behind a handle can change (units bound through Bind( ) are rebound).
+//
+// TEXTURE_STREAM textures are allocated from the file's header and start out as one gray texel in their
+// last level. A worker thread maps the file's entry in the SOIL texture cache (building it on the first
+// run), the small levels are uploaded as soon as it is there and EndFrame( ) then uploads finer levels
+// for the textures whose projected size on screen is furthest from their resident detail.
+// GL_TEXTURE_BASE_LEVEL keeps sampling to the levels that hold data, GL_TEXTURE_MIN_LOD blends a new
+// level in over a few frames.
+class TextureManager
+{
+public:
+    // 0 is no texture
+    typedef GLuint Handle;
+
+    // A budget of 0 means no limit
+    TextureManager( size_t budgetBytes = 0 )
+    {
+        this->budget = budgetBytes;
+        this->resident = 0;
+        this->frame = 0;
+        this->nextLoad = 0;
+        this->stopping = false;
+    }
+
+    ~TextureManager( )
+    {
+        this->Clear( );
+    }
+
+    // Returns the texture for path, loading it on first use; every Load needs a matching Release
+    Handle Load( const std::string &path, unsigned int flags = 0 )
+    {
+        std::string key = Key( path, flags );
+        std::map<std::string, Handle>::iterator found = this->byKey.find( key );
+
+        if ( found != this->byKey.end( ) )
+        {
+            this->Acquire( found->second );
+            return found->second;
+        }
+
+        Entry entry;
+        entry.key = key;
+        entry.flags = flags;
+        entry.references = 1;
+        entry.lastUsed = this->frame;
+        entry.load = ++this->nextLoad;
+
+        if ( !( ( flags & TEXTURE_STREAM ) ? this->createStreamed( entry, path ) : this->createLoaded( entry, path ) ) )
+        {
+            std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+            return 0;
+        }
+
+        entry.bytes = StorageBytes( entry.internalFormat, entry.width, entry.height, entry.levels );
+        this->resident += entry.bytes;
+
+        Handle handle = this->store( entry );
+        this->byKey[key] = handle;
+
+        if ( entry.flags & TEXTURE_STREAM )
+        {
+            this->requestStream( handle, path );
+        }
+        this->enforceBudget( );
+        this->restoreUnits( );
+
+        return handle;
+    }
+
+    void Acquire( Handle handle )
+    {
+        if ( this->isLive( handle ) )
+        {
+            this->entries[handle - 1].references++;
+        }
+    }
+
+    // Deletes the texture once the last reference is gone
+    void Release( Handle handle )
+    {
+        if ( !this->isLive( handle ) || --this->entries[handle - 1].references > 0 )
+        {
+            return;
+        }
+
+        Entry &entry = this->entries[handle - 1];
+
+        this->unbind( handle );
+        this->endStream( entry );
+        glDeleteTextures( 1, &entry.texture );
+        this->resident -= entry.bytes;
+        this->byKey.erase( entry.key );
+
+        entry = Entry( );
+        this->freeSlots.push_back( handle );
+    }
+
+    // Current GL name of the texture, valid until the next Load, SetBudget or EndFrame
+    GLuint Texture( Handle handle ) const
+    {
+        return this->isLive( handle ) ? this->entries[handle - 1].texture : 0;
+    }
+
+    // Binds the texture to a unit and marks it as used this frame; the unit follows the texture if it is reallocated
+    void Bind( Handle handle, GLuint unit )
+    {
+        if ( unit >= this->boundUnits.size( ) )
+        {
+            this->boundUnits.resize( unit + 1, 0 );
+        }
+        this->boundUnits[unit] = handle;
+
+        this->Touch( handle );
+        glActiveTexture( GL_TEXTURE0 + unit );
+        glBindTexture( GL_TEXTURE_2D, this->Texture( handle ) );
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    // Marks a texture as used this frame without binding it
+    void Touch( Handle handle )
+    {
+        if ( this->isLive( handle ) )
+        {
+            this->entries[handle - 1].lastUsed = this->frame;
+        }
+    }
+
+    // Sets how many pixels the texture covers on screen, which caps the detail streamed in for it;
+    // textures never given a size stream in completely
+    void SetScreenSize( Handle handle, GLfloat pixels )
+    {
+        if ( this->isLive( handle ) )
+        {
+            this->entries[handle - 1].screenSize = pixels;
+        }
+    }
+
+    // Pixels an object of the given world size spans at a distance, under a perspective projection
+    static GLfloat ProjectedSize( GLfloat worldSize, GLfloat distance, GLfloat fovY, GLsizei viewportHeight )
+    {
+        GLfloat extent = 2.0f * ( distance > 0.001f ? distance : 0.001f ) * std::tan( fovY * 0.5f );
+
+        return worldSize / std::fabs( extent ) * viewportHeight;
+    }
+
+    // Advances the clock the least recently used textures are picked by and streams in mip levels
+    void EndFrame( )
+    {
+        this->frame++;
+        this->receiveStreams( );
+        this->streamLevels( );
+        this->enforceBudget( );
+        this->restoreUnits( );
+    }
+
+    void SetBudget( size_t budgetBytes )
+    {
+        this->budget = budgetBytes;
+        this->enforceBudget( );
+        this->restoreUnits( );
+    }
+
+    size_t GetBudget( ) const
+    {
+        return this->budget;
+    }
+
+    // Bytes of texture storage held by all live textures
+    size_t GetResidentBytes( ) const
+    {
+        return this->resident;
+    }
+
+    size_t GetBytes( Handle handle ) const
+    {
+        return this->isLive( handle ) ? this->entries[handle - 1].bytes : 0;
+    }
+
+    // Mip levels given up to the budget
+    GLint GetDroppedLevels( Handle handle ) const
+    {
+        return this->isLive( handle ) ? this->entries[handle - 1].droppedLevels : 0;
+    }
+
+    // Finest level holding data, above 0 while a streamed texture is still coming in
+    GLint GetBaseLevel( Handle handle ) const
+    {
+        return this->isLive( handle ) ? this->entries[handle - 1].baseLevel : 0;
+    }
+
+    // Deletes every texture; call it while the GL context is still current
+    void Clear( )
+    {
+        this->stopStreaming( );
+
+        for ( size_t i = 0; i < this->entries.size( ); i++ )
+        {
+            this->endStream( this->entries[i] );
+            if ( 0 != this->entries[i].texture )
+            {
+                glDeleteTextures( 1, &this->entries[i].texture );
+            }
+        }
+
+        this->entries.clear( );
+        this->freeSlots.clear( );
+        this->byKey.clear( );
+        this->boundUnits.clear( );
+        this->resident = 0;
+    }
+
+    static GLint LevelCount( GLsizei width, GLsizei height )
+    {
+        GLint levels = 1;
+
+        for ( GLsizei size = width > height ? width : height; size > 1; size >>= 1 )
+        {
+            levels++;
+        }
+
+        return levels;
+    }
+
+    // Size of a full texture; BCn levels are whole 4x4 blocks
+    static size_t StorageBytes( GLenum internalFormat, GLsizei width, GLsizei height, GLint levels )
+    {
+        size_t bytes = 0;
+
+        for ( GLint level = 0; level < levels; level++ )
+        {
+            bytes += LevelBytes( internalFormat, width, height, level );
+        }
+
+        return bytes;
+    }
+
+    static size_t LevelBytes( GLenum internalFormat, GLsizei width, GLsizei height, GLint level )
+    {
+        size_t levelWidth = ( width >> level ) > 0 ? ( width >> level ) : 1;
+        size_t levelHeight = ( height >> level ) > 0 ? ( height >> level ) : 1;
+        size_t blockBytes = BlockBytes( internalFormat );
+
+        if ( 0 == blockBytes )
+        {
+            return levelWidth * levelHeight * 4;
+        }
+
+        return ( ( levelWidth + 3 ) / 4 ) * ( ( levelHeight + 3 ) / 4 ) * blockBytes;
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        unsigned int flags;
+        GLuint texture;
+        GLenum internalFormat;
+        GLsizei width, height;      // of the current top level
+        GLint levels;
+        GLint droppedLevels;
+        int references;
+        size_t bytes;
+        unsigned long long lastUsed;
+
+        // Streaming: levels below baseLevel are still to come from the mapped cache entry in source
+        unsigned int load;
+        GLint baseLevel;
+        GLfloat minLod;
+        GLfloat screenSize;
+        const unsigned char *source;
+        int sourceLength;
+
+        Entry( ) : flags( 0 ), texture( 0 ), internalFormat( 0 ), width( 0 ), height( 0 ), levels( 0 ),
+                   droppedLevels( 0 ), references( 0 ), bytes( 0 ), lastUsed( 0 ), load( 0 ), baseLevel( 0 ),
+                   minLod( 0.0f ), screenSize( 0.0f ), source( NULL ), sourceLength( 0 ) { }
+    };
+
+    // A cache entry for the streaming thread to map, and what it found
+    struct StreamJob
+    {
+        Handle handle;
+        unsigned int load;
+        std::string path;
+        int channels;
+        unsigned int soilFlags;
+        const unsigned char *source;
+        int sourceLength;
+    };
+
+    // Slot i holds handle i + 1, released slots are reused
+    std::vector<Entry> entries;
+    std::vector<Handle> freeSlots;
+    std::map<std::string, Handle> byKey;
+
+    // Handle last bound to each unit through Bind( )
+    std::vector<Handle> boundUnits;
+
+    size_t budget;
+    size_t resident;
+    unsigned long long frame;
+    unsigned int nextLoad;
+
+    // Shared with the streaming thread, which only starts once something is streamed
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<StreamJob> wanted;
+    std::deque<StreamJob> completed;
+    bool stopping;
+
+    static std::string Key( const std::string &path, unsigned int flags )
+    {
+        // Streaming doesn't change what ends up in the texture
+        return path + '\n' + std::to_string( flags & ~( TEXTURE_PINNED | TEXTURE_STREAM ) );
+    }
+
+    // Bytes per 4x4 block, 0 for uncompressed formats
+    static size_t BlockBytes( GLenum internalFormat )
+    {
+        switch ( internalFormat )
+        {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+                return 8;
+
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+                return 16;
+        }
+
+        return 0;
+    }
+
+    static void chooseFormat( Entry &entry, bool hasAlpha )
+    {
+        bool srgb = 0 != ( entry.flags & TEXTURE_SRGB );
+
+        if ( ( entry.flags & TEXTURE_COMPRESS ) && GLEW_EXT_texture_compression_s3tc )
+        {
+            if ( hasAlpha )
+            {
+                entry.internalFormat = srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            }
+            else
+            {
+                entry.internalFormat = srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            }
+        }
+        else
+        {
+            entry.internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+        }
+    }
+
+    bool isLive( Handle handle ) const
+    {
+        return handle > 0 && handle <= this->entries.size( ) && this->entries[handle - 1].references > 0;
+    }
+
+    Handle store( const Entry &entry )
+    {
+        if ( !this->freeSlots.empty( ) )
+        {
+            Handle handle = this->freeSlots.back( );
+            this->freeSlots.pop_back( );
+            this->entries[handle - 1] = entry;
+            return handle;
+        }
+
+        this->entries.push_back( entry );
+        return ( Handle )this->entries.size( );
+    }
+
+    // Decodes the whole file and fills every level
+    bool createLoaded( Entry &entry, const std::string &path )
+    {
+        int width, height, channels;
+        unsigned char *image = SOIL_load_image( path.c_str( ), &width, &height, &channels, SOIL_LOAD_RGBA );
+
+        if ( NULL == image )
+        {
+            return false;
+        }
+
+        entry.width = width;
+        entry.height = height;
+        entry.levels = ( entry.flags & TEXTURE_NO_MIPMAPS ) ? 1 : LevelCount( width, height );
+        chooseFormat( entry, 2 == channels || 4 == channels );
+
+        this->allocate( entry );
+        this->upload( entry, image );
+        SOIL_free_image_data( image );
+
+        return true;
+    }
+
+    // Allocates from the file header alone, the last level holds a gray texel until the data arrives
+    bool createStreamed( Entry &entry, const std::string &path )
+    {
+        int width, height, channels;
+
+        // Without mip levels there is nothing to show early, and files stb_image can't read the header of go in one piece
+        if ( ( entry.flags & TEXTURE_NO_MIPMAPS ) || !stbi_info( path.c_str( ), &width, &height, &channels ) )
+        {
+            entry.flags &= ~TEXTURE_STREAM;
+            return this->createLoaded( entry, path );
+        }
+
+        entry.width = width;
+        entry.height = height;
+        entry.levels = LevelCount( width, height );
+        entry.baseLevel = entry.levels - 1;
+        chooseFormat( entry, 2 == channels || 4 == channels );
+        this->allocate( entry );
+
+        unsigned char gray[4 * 4 * 4];
+        memset( gray, 128, sizeof( gray ) );
+
+        if ( 0 == BlockBytes( entry.internalFormat ) )
+        {
+            glTexSubImage2D( GL_TEXTURE_2D, entry.baseLevel, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, gray );
+            return true;
+        }
+
+        int size = 0;
+        unsigned char *block = ( 16 == BlockBytes( entry.internalFormat ) ) ?
+            convert_image_to_DXT5( gray, 4, 4, 4, &size ) : convert_image_to_DXT1( gray, 4, 4, 4, &size );
+
+        if ( NULL != block )
+        {
+            glCompressedTexSubImage2D( GL_TEXTURE_2D, entry.baseLevel, 0, 0, 1, 1, entry.internalFormat, size, block );
+            SOIL_free_image_data( block );
+        }
+
+        return true;
+    }
+
+    // Creates entry.texture with storage for entry.levels levels and leaves it bound to the active unit
+    void allocate( Entry &entry )
+    {
+        GLint wrap = ( entry.flags & TEXTURE_CLAMP ) ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+
+        glGenTextures( 1, &entry.texture );
+        glBindTexture( GL_TEXTURE_2D, entry.texture );
+
+        if ( GLEW_ARB_texture_storage )
+        {
+            glTexStorage2D( GL_TEXTURE_2D, entry.levels, entry.internalFormat, entry.width, entry.height );
+        }
+        else
+        {
+            // Same layout as immutable storage, the level range is pinned so the texture is always complete
+            for ( GLint level = 0; level < entry.levels; level++ )
+            {
+                GLsizei levelWidth = ( entry.width >> level ) > 0 ? ( entry.width >> level ) : 1;
+                GLsizei levelHeight = ( entry.height >> level ) > 0 ? ( entry.height >> level ) : 1;
+
+                if ( 0 != BlockBytes( entry.internalFormat ) )
+                {
+                    glCompressedTexImage2D( GL_TEXTURE_2D, level, entry.internalFormat, levelWidth, levelHeight, 0,
+                                           ( GLsizei )LevelBytes( entry.internalFormat, entry.width, entry.height, level ), NULL );
+                }
+                else
+                {
+                    glTexImage2D( GL_TEXTURE_2D, level, entry.internalFormat, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+                }
+            }
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.levels - 1 );
+        }
+
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, entry.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap );
+
+        if ( entry.baseLevel > 0 || entry.minLod > 0.0f )
+        {
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.baseLevel );
+            glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod );
+        }
+    }
+
+    // Fills every level of the bound texture from an RGBA image
+    void upload( const Entry &entry, const unsigned char *image )
+    {
+        if ( 0 == BlockBytes( entry.internalFormat ) )
+        {
+            glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, entry.width, entry.height, GL_RGBA, GL_UNSIGNED_BYTE, image );
+            if ( entry.levels > 1 )
+            {
+                glGenerateMipmap( GL_TEXTURE_2D );
+            }
+            return;
+        }
+
+        // BCn levels are compressed on the CPU, each from a box filtered copy of the one above
+        std::vector<unsigned char> level( image, image + ( size_t )entry.width * entry.height * 4 ), next;
+        GLsizei levelWidth = entry.width, levelHeight = entry.height;
+
+        for ( GLint i = 0; i < entry.levels; i++ )
+        {
+            int size = 0;
+            unsigned char *blocks = ( 16 == BlockBytes( entry.internalFormat ) ) ?
+                convert_image_to_DXT5( &level[0], levelWidth, levelHeight, 4, &size ) :
+                convert_image_to_DXT1( &level[0], levelWidth, levelHeight, 4, &size );
+
+            if ( NULL != blocks )
+            {
+                glCompressedTexSubImage2D( GL_TEXTURE_2D, i, 0, 0, levelWidth, levelHeight, entry.internalFormat, size, blocks );
+                SOIL_free_image_data( blocks );
+            }
+
+            if ( i + 1 < entry.levels )
+            {
+                GLsizei nextWidth = levelWidth > 1 ? levelWidth >> 1 : 1;
+                GLsizei nextHeight = levelHeight > 1 ? levelHeight >> 1 : 1;
+
+                next.resize( ( size_t )nextWidth * nextHeight * 4 );
+                mipmap_image( &level[0], levelWidth, levelHeight, 4, &next[0], levelWidth > 1 ? 2 : 1, levelHeight > 1 ? 2 : 1 );
+                level.swap( next );
+                levelWidth = nextWidth;
+                levelHeight = nextHeight;
+            }
+        }
+    }
+
+    // Shrinks the least recently used textures, biggest first among equals, until the budget holds
+    void enforceBudget( )
+    {
+        while ( this->budget > 0 && this->resident > this->budget )
+        {
+            Entry *victim = NULL;
+
+            for ( size_t i = 0; i < this->entries.size( ); i++ )
+            {
+                Entry &entry = this->entries[i];
+
+                if ( entry.references <= 0 || entry.levels <= 1 || ( entry.flags & TEXTURE_PINNED ) )
+                {
+                    continue;
+                }
+                if ( NULL == victim || entry.lastUsed < victim->lastUsed ||
+                     ( entry.lastUsed == victim->lastUsed && entry.bytes > victim->bytes ) )
+                {
+                    victim = &entry;
+                }
+            }
+
+            if ( NULL == victim )
+            {
+                return;
+            }
+
+            this->dropTopLevel( *victim );
+        }
+    }
+
+    // Moves levels 1..n-1 into a new texture one level shorter and deletes the old one; levels a streamed
+    // texture doesn't have yet are skipped, they come from the cache entry later
+    void dropTopLevel( Entry &entry )
+    {
+        Entry smaller = entry;
+        GLuint old = entry.texture;
+        bool compressed = 0 != BlockBytes( entry.internalFormat );
+
+        smaller.width = entry.width > 1 ? entry.width >> 1 : 1;
+        smaller.height = entry.height > 1 ? entry.height >> 1 : 1;
+        smaller.levels = entry.levels - 1;
+        smaller.droppedLevels = entry.droppedLevels + 1;
+        smaller.baseLevel = entry.baseLevel > 0 ? entry.baseLevel - 1 : 0;
+        this->allocate( smaller );
+
+        for ( GLint level = smaller.baseLevel; level < smaller.levels; level++ )
+        {
+            GLsizei levelWidth = ( smaller.width >> level ) > 0 ? ( smaller.width >> level ) : 1;
+            GLsizei levelHeight = ( smaller.height >> level ) > 0 ? ( smaller.height >> level ) : 1;
+
+            if ( GLEW_ARB_copy_image )
+            {
+                glCopyImageSubData( old, GL_TEXTURE_2D, level + 1, 0, 0, 0,
+                                    smaller.texture, GL_TEXTURE_2D, level, 0, 0, 0, levelWidth, levelHeight, 1 );
+                continue;
+            }
+
+            // Without copy_image the level goes through client memory
+            std::vector<unsigned char> pixels( LevelBytes( entry.internalFormat, entry.width, entry.height, level + 1 ) );
+
+            glBindTexture( GL_TEXTURE_2D, old );
+            if ( compressed )
+            {
+                glGetCompressedTexImage( GL_TEXTURE_2D, level + 1, &pixels[0] );
+            }
+            else
+            {
+                glGetTexImage( GL_TEXTURE_2D, level + 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0] );
+            }
+
+            glBindTexture( GL_TEXTURE_2D, smaller.texture );
+            if ( compressed )
+            {
+                glCompressedTexSubImage2D( GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, smaller.internalFormat,
+                                          ( GLsizei )pixels.size( ), &pixels[0] );
+            }
+            else
+            {
+                glTexSubImage2D( GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0] );
+            }
+        }
+
+        glDeleteTextures( 1, &old );
+
+        smaller.bytes = StorageBytes( smaller.internalFormat, smaller.width, smaller.height, smaller.levels );
+        this->resident -= entry.bytes - smaller.bytes;
+        entry = smaller;
+    }
+
+    // Uploads and reallocations bind textures as they go, this puts back what Bind( ) set up
+    void restoreUnits( )
+    {
+        for ( size_t unit = 0; unit < this->boundUnits.size( ); unit++ )
+        {
+            Handle handle = this->boundUnits[unit];
+
+            if ( this->isLive( handle ) )
+            {
+                glActiveTexture( GL_TEXTURE0 + ( GLenum )unit );
+                glBindTexture( GL_TEXTURE_2D, this->entries[handle - 1].texture );
+            }
+        }
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    void unbind( Handle handle )
+    {
+        for ( size_t unit = 0; unit < this->boundUnits.size( ); unit++ )
+        {
+            if ( this->boundUnits[unit] == handle )
+            {
+                this->boundUnits[unit] = 0;
+            }
+        }
+    }
+
+    // Finest level worth having at the texture's size on screen
+    static GLint wantedLevel( const Entry &entry )
+    {
+        GLsizei size = entry.width > entry.height ? entry.width : entry.height;
+        GLint level = 0;
+
+        if ( entry.screenSize <= 0.0f )
+        {
+            return 0;
+        }
+
+        while ( level + 1 < entry.levels && ( GLfloat )( size >> ( level + 1 ) ) >= entry.screenSize )
+        {
+            level++;
+        }
+
+        return level;
+    }
+
+    void setLodClamp( const Entry &entry )
+    {
+        glBindTexture( GL_TEXTURE_2D, entry.texture );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.baseLevel );
+        glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod );
+    }
+
+    // Whether a cache entry holds the levels the texture was allocated for
+    static bool matchesSource( const Entry &entry, const unsigned char *source, int sourceLength )
+    {
+        if ( NULL == source || sourceLength < ( int )sizeof( SOIL_cache_header ) )
+        {
+            return false;
+        }
+
+        const SOIL_cache_header *header = ( const SOIL_cache_header * )source;
+        GLsizei width = ( GLsizei )header->width >> entry.droppedLevels;
+        GLsizei height = ( GLsizei )header->height >> entry.droppedLevels;
+        bool compressed = 0 != BlockBytes( entry.internalFormat );
+
+        return ( GLint )header->num_levels == entry.levels + entry.droppedLevels &&
+               ( width > 0 ? width : 1 ) == entry.width && ( height > 0 ? height : 1 ) == entry.height &&
+               ( compressed ? 0 == header->pixel_format && header->internal_format == entry.internalFormat :
+                              GL_RGBA == header->pixel_format && 4 == header->channels );
+    }
+
+    // Copies one level out of the mapped cache entry
+    void uploadLevel( const Entry &entry, GLint level )
+    {
+        const SOIL_cache_header *header = ( const SOIL_cache_header * )entry.source;
+        const SOIL_cache_level *source = ( const SOIL_cache_level * )( entry.source + sizeof( SOIL_cache_header ) ) + level + entry.droppedLevels;
+
+        glBindTexture( GL_TEXTURE_2D, entry.texture );
+        if ( 0 == header->pixel_format )
+        {
+            glCompressedTexSubImage2D( GL_TEXTURE_2D, level, 0, 0, source->width, source->height, entry.internalFormat,
+                                      source->size, entry.source + source->offset );
+        }
+        else
+        {
+            glTexSubImage2D( GL_TEXTURE_2D, level, 0, 0, source->width, source->height, GL_RGBA, GL_UNSIGNED_BYTE,
+                             entry.source + source->offset );
+        }
+    }
+
+    void requestStream( Handle handle, const std::string &path )
+    {
+        const Entry &entry = this->entries[handle - 1];
+        bool compressed = 0 != BlockBytes( entry.internalFormat );
+        StreamJob job;
+
+        // Compressed entries keep the file's channels so SOIL picks BC1 or BC3 the way chooseFormat( ) did
+        job.handle = handle;
+        job.load = entry.load;
+        job.path = path;
+        job.channels = compressed ? SOIL_LOAD_AUTO : SOIL_LOAD_RGBA;
+        job.soilFlags = SOIL_FLAG_MIPMAPS;
+        if ( compressed )
+        {
+            job.soilFlags |= SOIL_FLAG_COMPRESS_TO_DXT | ( ( entry.flags & TEXTURE_SRGB ) ? SOIL_FLAG_SRGB_COLOR_SPACE : 0 );
+        }
+        job.source = NULL;
+        job.sourceLength = 0;
+
+        if ( !this->worker.joinable( ) )
+        {
+            this->stopping = false;
+            this->worker = std::thread( &TextureManager::streamTextures, this );
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+            this->wanted.push_back( job );
+        }
+        this->wakeup.notify_one( );
+    }
+
+    void streamTextures( )
+    {
+        std::unique_lock<std::mutex> lock( this->mutex );
+
+        while ( true )
+        {
+            while ( !this->stopping && this->wanted.empty( ) )
+            {
+                this->wakeup.wait( lock );
+            }
+
+            if ( this->stopping )
+            {
+                break;
+            }
+
+            StreamJob job = this->wanted.front( );
+            this->wanted.pop_front( );
+
+            lock.unlock( );
+            job.source = SOIL_load_cache_entry( job.path.c_str( ), job.channels, job.soilFlags, &job.sourceLength );
+            lock.lock( );
+
+            this->completed.push_back( job );
+        }
+
+        lock.unlock( );
+        SOIL_arena_release( );
+    }
+
+    void stopStreaming( )
+    {
+        if ( this->worker.joinable( ) )
+        {
+            {
+                std::lock_guard<std::mutex> lock( this->mutex );
+                this->stopping = true;
+            }
+            this->wakeup.notify_one( );
+            this->worker.join( );
+        }
+
+        for ( size_t i = 0; i < this->completed.size( ); i++ )
+        {
+            if ( NULL != this->completed[i].source )
+            {
+                SOIL_cache_release( this->completed[i].source, this->completed[i].sourceLength );
+            }
+        }
+        this->completed.clear( );
+        this->wanted.clear( );
+    }
+
+    void endStream( Entry &entry )
+    {
+        if ( NULL != entry.source )
+        {
+            SOIL_cache_release( entry.source, entry.sourceLength );
+            entry.source = NULL;
+            entry.sourceLength = 0;
+        }
+    }
+
+    // Takes the cache entries the streaming thread has mapped and uploads their small levels right away
+    void receiveStreams( )
+    {
+        std::deque<StreamJob> arrived;
+
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+            arrived.swap( this->completed );
+        }
+
+        for ( size_t i = 0; i < arrived.size( ); i++ )
+        {
+            const StreamJob &job = arrived[i];
+
+            // Released, or released and loaded again, while the thread was on it
+            if ( !this->isLive( job.handle ) || this->entries[job.handle - 1].load != job.load )
+            {
+                if ( NULL != job.source )
+                {
+                    SOIL_cache_release( job.source, job.sourceLength );
+                }
+                continue;
+            }
+
+            Entry &entry = this->entries[job.handle - 1];
+
+            if ( !matchesSource( entry, job.source, job.sourceLength ) )
+            {
+                if ( NULL != job.source )
+                {
+                    SOIL_cache_release( job.source, job.sourceLength );
+                }
+                this->loadInPlace( entry, job.path );
+                continue;
+            }
+
+            entry.source = job.source;
+            entry.sourceLength = job.sourceLength;
+
+            for ( GLint level = entry.levels - 1; level >= entry.baseLevel; level-- )
+            {
+                this->uploadLevel( entry, level );
+            }
+            while ( entry.baseLevel > 0 && ( entry.width >> ( entry.baseLevel - 1 ) ) <= TEXTURE_STREAM_TAIL_SIZE &&
+                    ( entry.height >> ( entry.baseLevel - 1 ) ) <= TEXTURE_STREAM_TAIL_SIZE )
+            {
+                this->uploadLevel( entry, --entry.baseLevel );
+            }
+            this->setLodClamp( entry );
+
+            if ( 0 == entry.baseLevel )
+            {
+                this->endStream( entry );
+            }
+        }
+    }
+
+    // Without a cache entry (say the cache directory is read-only) the file is decoded here in one go
+    void loadInPlace( Entry &entry, const std::string &path )
+    {
+        int width, height, channels;
+        unsigned char *image = SOIL_load_image( path.c_str( ), &width, &height, &channels, SOIL_LOAD_RGBA );
+
+        if ( NULL == image )
+        {
+            std::cout << "ERROR::TEXTURE::STREAM_FAILED " << path << std::endl;
+            return;
+        }
+
+        std::vector<unsigned char> level( image, image + ( size_t )width * height * 4 ), next;
+        SOIL_free_image_data( image );
+
+        // Levels given up to the budget while the thread was busy are filtered away first
+        for ( GLint i = 0; i < entry.droppedLevels; i++ )
+        {
+            GLsizei nextWidth = width > 1 ? width >> 1 : 1;
+            GLsizei nextHeight = height > 1 ? height >> 1 : 1;
+
+            next.resize( ( size_t )nextWidth * nextHeight * 4 );
+            mipmap_image( &level[0], width, height, 4, &next[0], width > 1 ? 2 : 1, height > 1 ? 2 : 1 );
+            level.swap( next );
+            width = nextWidth;
+            height = nextHeight;
+        }
+
+        if ( width != entry.width || height != entry.height )
+        {
+            std::cout << "ERROR::TEXTURE::STREAM_FAILED " << path << std::endl;
+            return;
+        }
+
+        glBindTexture( GL_TEXTURE_2D, entry.texture );
+        this->upload( entry, &level[0] );
+
+        entry.baseLevel = 0;
+        entry.minLod = 0.0f;
+        this->setLodClamp( entry );
+    }
+
+    // Brings the textures furthest below the detail their screen size asks for one level closer,
+    // coarsest first, until the frame's upload allowance is spent
+    void streamLevels( )
+    {
+        size_t allowance = TEXTURE_STREAM_BYTES_PER_FRAME;
+        bool uploaded = false;
+
+        for ( size_t i = 0; i < this->entries.size( ); i++ )
+        {
+            Entry &entry = this->entries[i];
+
+            if ( entry.references > 0 && entry.minLod > 0.0f )
+            {
+                entry.minLod = entry.minLod > TEXTURE_STREAM_FADE_PER_FRAME ? entry.minLod - TEXTURE_STREAM_FADE_PER_FRAME : 0.0f;
+                this->setLodClamp( entry );
+            }
+        }
+
+        while ( true )
+        {
+            Entry *next = NULL;
+            GLint nextMissing = 0;
+
+            for ( size_t i = 0; i < this->entries.size( ); i++ )
+            {
+                Entry &entry = this->entries[i];
+                GLint missing = entry.baseLevel - wantedLevel( entry );
+
+                if ( entry.references <= 0 || NULL == entry.source || missing <= 0 )
+                {
+                    continue;
+                }
+                if ( missing > nextMissing || ( missing == nextMissing && entry.screenSize > next->screenSize ) )
+                {
+                    next = &entry;
+                    nextMissing = missing;
+                }
+            }
+
+            if ( NULL == next )
+            {
+                return;
+            }
+
+            size_t bytes = LevelBytes( next->internalFormat, next->width, next->height, next->baseLevel - 1 );
+            if ( uploaded && bytes > allowance )
+            {
+                return;
+            }
+
+            // The new level fades in from the one above it
+            this->uploadLevel( *next, --next->baseLevel );
+            next->minLod = 1.0f;
+            this->setLodClamp( *next );
+
+            allowance -= bytes < allowance ? bytes : allowance;
+            uploaded = true;
+
+            if ( 0 == next->baseLevel )
+            {
+                this->endStream( *next );
+            }
+        }
+    }
+};
+
+#endif
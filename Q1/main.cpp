@@ -1,4 +1,5 @@
 #include <string>
+#include <cstring>
 
 // GLEW
 #define GLEW_STATIC
@@ -18,9 +19,13 @@
 
 // Other Libs
 #include "SOIL2/SOIL2.h"
+#include "TextureManager.h"
+#include "SoftwareRenderer.h"
 
 // Properties
 const GLuint WIDTH = 800, HEIGHT = 600;
+// Texture memory the TextureManager may keep resident before it starts dropping mip levels
+const size_t TEXTURE_BUDGET = 256 << 20;
 int SCREEN_WIDTH, SCREEN_HEIGHT;
 
 // Function prototypes
@@ -28,6 +33,7 @@ void KeyCallback( GLFWwindow *window, int key, int scancode, int action, int mod
 void ScrollCallback( GLFWwindow *window, double xOffset, double yOffset );
 void MouseCallback( GLFWwindow *window, double xPos, double yPos );
 void DoMovement( );
+int RenderSoftware( const std::string &image, const GLfloat *vertices, GLsizei vertexCount );
 
 // Camera
 Camera  camera(glm::vec3( 0.0f, 0.0f, 3.0f ) );
@@ -40,8 +46,60 @@ GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
 
 // The MAIN function, from here we start our application and run our Game loop
-int main( )
+int main( int argc, char **argv )
 {
+    // Set up our vertex data (and buffer(s)) and attribute pointers
+    GLfloat vertices[] =
+    {
+        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+        0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
+        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+        
+        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+        0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+        0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+        -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
+        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+        
+        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+        
+        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+        0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+        0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+        0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+        
+        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+        0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
+        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+        
+        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+        -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
+        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
+    };
+    
+    // --software <image> renders a frame on the CPU into the image, no window or GPU needed
+    if ( 3 == argc && 0 == strcmp( argv[1], "--software" ) )
+    {
+        return RenderSoftware( argv[2], vertices, sizeof( vertices ) / sizeof( GLfloat ) / 5 );
+    }
+    
     // Init GLFW
     glfwInit( );
     glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
@@ -94,52 +152,6 @@ int main( )
     // Setup and compile our shaders
     Shader ourShader( "resources/shaders/core.vs", "resources/shaders/frag.vs" );
     
-    // Set up our vertex data (and buffer(s)) and attribute pointers
-    GLfloat vertices[] =
-    {
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-        0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-        
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-    };
-    
     
     GLuint VBO, VAO;
     glGenVertexArrays( 1, &VAO );
@@ -160,23 +172,15 @@ int main( )
     glBindVertexArray( 0 ); // Unbind VAO
     
     // Load and create a texture
-    GLuint texture;
+    TextureManager textures( TEXTURE_BUDGET );
     // --== TEXTURE == --
-    glGenTextures( 1, &texture );
-    glBindTexture( GL_TEXTURE_2D, texture ); // All upcoming GL_TEXTURE_2D operations now have effect on our texture object
-    // Set our texture parameters
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    // Set texture filtering
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-    // Load, create texture and generate mipmaps
-    int width, height;
-    unsigned char *image = SOIL_load_image( "resources/images/image2.jpg", &width, &height, 0, SOIL_LOAD_RGB );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
-    SOIL_free_image_data( image );
-    glBindTexture( GL_TEXTURE_2D, 0 ); // Unbind texture when done, so we won't accidentily mess up our texture.
+    // Create the texture and stream its mipmaps in from the texture cache, coarsest first, so the first frame doesn't wait
+    TextureManager::Handle texture = textures.Load( "resources/images/image2.jpg", TEXTURE_STREAM );
+    
+    // The only 2D texture stays on unit 0 for the whole run, so the loop doesn't rebind it
+    textures.Bind( texture, 0 );
+    ourShader.Use( );
+    glUniform1i( glGetUniformLocation( ourShader.Program, "ourTexture1" ), 0 );
     
     // Game loop
     while( !glfwWindowShouldClose( window ) )
@@ -197,11 +201,6 @@ int main( )
         // Draw our first triangle
         ourShader.Use( );
         
-        // Bind Textures using texture units
-        glActiveTexture( GL_TEXTURE0 );
-        glBindTexture( GL_TEXTURE_2D, texture );
-        glUniform1i( glGetUniformLocation( ourShader.Program, "ourTexture1" ), 0 );
-        
         glm::mat4 projection(1);
         projection = glm::perspective(camera.GetZoom( ), (GLfloat)SCREEN_WIDTH/(GLfloat)SCREEN_HEIGHT, 0.1f, 1000.0f);
         
@@ -221,8 +220,12 @@ int main( )
         glBindVertexArray( VAO );
         
         
+        // The box's size on screen decides how much of its texture is worth streaming in
+        glm::vec3 boxPosition( 0.5f, 0.6f, 0.7f );
+        textures.SetScreenSize( texture, TextureManager::ProjectedSize( 1.0f, glm::length( boxPosition - camera.GetPosition( ) ), camera.GetZoom( ), SCREEN_HEIGHT ) );
+        
         glm::mat4 model(1);
-        model = glm::translate( model, glm::vec3(0.5f, 0.6f, 0.7f) );
+        model = glm::translate( model, boxPosition );
         GLfloat angle = 0.0f;
         model = glm::rotate(model, angle, glm::vec3( 1.0f, 0.3f, 0.5f ) );
         glUniformMatrix4fv( modelLoc, 1, GL_FALSE, glm::value_ptr( model ) );
@@ -234,11 +237,13 @@ int main( )
         
         // Swap the buffers
         glfwSwapBuffers( window );
+        textures.EndFrame( );
     }
     
     // Properly de-allocate all resources once they've outlived their purpose
     glDeleteVertexArrays( 1, &VAO );
     glDeleteBuffers( 1, &VBO );
+    textures.Clear( );
     glfwTerminate( );
     
     return EXIT_SUCCESS;
@@ -313,3 +318,24 @@ void ScrollCallback( GLFWwindow *window, double xOffset, double yOffset )
 {
     camera.ProcessMouseScroll( yOffset );
 }
+
+// The box of the first frame drawn on the CPU by SoftwareRenderer.h from the default camera and written to image
+int RenderSoftware( const std::string &image, const GLfloat *vertices, GLsizei vertexCount )
+{
+    SoftwareRenderer renderer( WIDTH, HEIGHT );
+    renderer.SetBlend( true );
+    
+    SoftwareTexture texture;
+    texture.Load( "resources/images/image2.jpg" );
+    
+    SoftwareTexturedProgram box;
+    box.projection = glm::perspective( camera.GetZoom( ), ( GLfloat )WIDTH / ( GLfloat )HEIGHT, 0.1f, 1000.0f );
+    box.view = camera.GetViewMatrix( );
+    box.model = glm::translate( glm::mat4( 1 ), glm::vec3( 0.5f, 0.6f, 0.7f ) );
+    box.texture = &texture;
+    
+    renderer.ClearBuffers( glm::vec4( 0.5f, 0.6f, 0.7f, 1.0f ) );
+    renderer.Draw( box, vertices, 5, vertexCount );
+    
+    return renderer.Save( image ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
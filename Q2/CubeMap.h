@@ -1,33 +1,334 @@
-#include "SOIL2/stb_image.h"
+#ifndef CubeMap_h
+#define CubeMap_h
 
-unsigned int loadCubemap(std::vector<std::string> faces)
+#include <string>
+#include <vector>
+#include <cstring>
+#include <utility>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/image_arena.h"
+#include "SOIL2/image_helper.h"
+#include "SOIL2/image_parallel.h"
+#include "SOIL2/image_DXT.h"
+
+enum CubemapFlags
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-    
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
+    CUBEMAP_MIPMAPS = 1,
+    CUBEMAP_COMPRESS = 2        // BC1 when the driver has S3TC, an eighth of RGBA8
+};
+
+// One face on its way to the GPU: the decoded image, then its levels as uploaded
+struct CubemapFace
+{
+    std::string path;           // empty for faces cut out of a single image
+    std::vector<unsigned char> pixels;
+    int size;
+    std::vector< std::vector<unsigned char> > levels;
+};
+
+struct CubemapLoad
+{
+    CubemapFace faces[6];
+    bool mipmaps;
+    bool compress;
+};
+
+// Decodes the faces with a path, then builds and compresses the levels of every face
+static void buildCubemapFaces( void *context, int begin, int end )
+{
+    CubemapLoad *load = ( CubemapLoad * )context;
+
+    for ( int i = begin; i < end; i++ )
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        CubemapFace &face = load->faces[i];
+
+        if ( !face.path.empty( ) )
+        {
+            int width, height, channels;
+            unsigned char *data = SOIL_load_image( face.path.c_str( ), &width, &height, &channels, SOIL_LOAD_RGBA );
+
+            if ( NULL != data && width == height )
+            {
+                face.pixels.assign( data, data + ( size_t )width * height * 4 );
+                face.size = width;
+            }
+            SOIL_free_image_data( data );
+        }
+
+        if ( face.pixels.empty( ) )
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-                         );
-            stbi_image_free(data);
+            continue;
+        }
+
+        std::vector<unsigned char> level, next;
+        int size = face.size;
+
+        level.swap( face.pixels );
+        while ( true )
+        {
+            bool last = !load->mipmaps || 1 == size;
+
+            if ( load->compress )
+            {
+                int bytes = 0;
+                unsigned char *blocks = convert_image_to_DXT1( &level[0], size, size, 4, &bytes );
+
+                face.levels.push_back( std::vector<unsigned char>( blocks, blocks + ( NULL != blocks ? bytes : 0 ) ) );
+                SOIL_free_image_data( blocks );
+            }
+            else
+            {
+                face.levels.push_back( last ? std::move( level ) : level );
+            }
+
+            if ( last )
+            {
+                break;
+            }
+
+            next.resize( ( size_t )( size / 2 ) * ( size / 2 ) * 4 );
+            mipmap_image( &level[0], size, size, 4, &next[0], 2, 2 );
+            level.swap( next );
+            size /= 2;
+        }
+    }
+
+    // The decode may have run on a worker thread that is about to exit
+    SOIL_arena_release( );
+}
+
+// Uploads whatever buildCubemapFaces made of the faces into immutable storage; faces that failed to load are black
+static unsigned int uploadCubemap( CubemapLoad &load )
+{
+    int size = 0;
+    for ( int i = 0; i < 6; i++ )
+    {
+        if ( !load.faces[i].levels.empty( ) && ( 0 == size || load.faces[i].size == size ) )
+        {
+            size = load.faces[i].size;
         }
         else
         {
-            std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            if ( !load.faces[i].path.empty( ) )
+            {
+                std::cout << "Cubemap tex failed to load at path: " << load.faces[i].path << std::endl;
+            }
+            load.faces[i].levels.clear( );
+        }
+    }
+
+    if ( 0 == size )
+    {
+        return 0;
+    }
+
+    GLenum format = load.compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8;
+    GLint levels = 1;
+    while ( load.mipmaps && ( size >> levels ) > 0 )
+    {
+        levels++;
+    }
+
+    unsigned int textureID;
+    glGenTextures( 1, &textureID );
+    glBindTexture( GL_TEXTURE_CUBE_MAP, textureID );
+
+    if ( GLEW_ARB_texture_storage )
+    {
+        glTexStorage2D( GL_TEXTURE_CUBE_MAP, levels, format, size, size );
+    }
+    else
+    {
+        for ( int i = 0; i < 6; i++ )
+        {
+            for ( GLint level = 0; level < levels; level++ )
+            {
+                GLsizei levelSize = size >> level;
+
+                if ( load.compress )
+                {
+                    glCompressedTexImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, format, levelSize, levelSize, 0,
+                                            ( ( levelSize + 3 ) / 4 ) * ( ( levelSize + 3 ) / 4 ) * 8, NULL );
+                }
+                else
+                {
+                    glTexImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, format, levelSize, levelSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+                }
+            }
+        }
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+    }
+
+    for ( int i = 0; i < 6; i++ )
+    {
+        for ( GLint level = 0; level < levels; level++ )
+        {
+            GLsizei levelSize = size >> level;
+            const std::vector<unsigned char> *texels = load.faces[i].levels.empty( ) ? NULL : &load.faces[i].levels[level];
+            std::vector<unsigned char> black;
+
+            if ( NULL == texels || texels->empty( ) )
+            {
+                black.assign( load.compress ? ( ( levelSize + 3 ) / 4 ) * ( ( levelSize + 3 ) / 4 ) * 8 : ( size_t )levelSize * levelSize * 4, 0 );
+                texels = &black;
+            }
+
+            if ( load.compress )
+            {
+                glCompressedTexSubImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, levelSize, levelSize, format, ( GLsizei )texels->size( ), &( *texels )[0] );
+            }
+            else
+            {
+                glTexSubImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, levelSize, levelSize, GL_RGBA, GL_UNSIGNED_BYTE, &( *texels )[0] );
+            }
         }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    
+
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+
+    // Filter across face edges instead of clamping at them
+    glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS );
+
     return textureID;
 }
+
+static void startCubemapLoad( CubemapLoad &load, unsigned int flags )
+{
+    load.mipmaps = 0 != ( flags & CUBEMAP_MIPMAPS );
+    load.compress = ( flags & CUBEMAP_COMPRESS ) && GLEW_EXT_texture_compression_s3tc;
+    for ( int i = 0; i < 6; i++ )
+    {
+        load.faces[i].size = 0;
+    }
+}
+
+// Six face files in +X, -X, +Y, -Y, +Z, -Z order, decoded in parallel (one thread per face, up to the core count)
+unsigned int loadCubemap( const std::vector<std::string> &faces, unsigned int flags = 0 )
+{
+    CubemapLoad load;
+    startCubemapLoad( load, flags );
+
+    for ( size_t i = 0; i < faces.size( ) && i < 6; i++ )
+    {
+        load.faces[i].path = faces[i];
+    }
+
+    SOIL_parallel_for( 6, 1, buildCubemapFaces, &load );
+
+    return uploadCubemap( load );
+}
+
+// All six faces in one file: a DDS cubemap (uploaded as stored), a 6:1 or 1:6 strip in
+// SOIL_DDS_CUBEMAP_FACE_ORDER (+X, -X, +Y, -Y, +Z, -Z), or a 4:3 horizontal or 3:4 vertical cross
+// (the vertical cross has -Z upside down below -Y)
+unsigned int loadCubemap( const std::string &path, unsigned int flags = 0 )
+{
+    std::string extension = path.size( ) > 4 ? path.substr( path.size( ) - 4 ) : "";
+
+    if ( ".dds" == extension || ".DDS" == extension )
+    {
+        unsigned int textureID = SOIL_load_OGL_single_cubemap( path.c_str( ), SOIL_DDS_CUBEMAP_FACE_ORDER, SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID,
+                                                               SOIL_FLAG_DDS_LOAD_DIRECT | ( ( flags & CUBEMAP_MIPMAPS ) ? SOIL_FLAG_MIPMAPS : 0 ) );
+
+        if ( 0 == textureID )
+        {
+            std::cout << "Cubemap tex failed to load at path: " << path << std::endl;
+            return 0;
+        }
+
+        glBindTexture( GL_TEXTURE_CUBE_MAP, textureID );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+        glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS );
+
+        return textureID;
+    }
+
+    int width, height, channels;
+    unsigned char *data = SOIL_load_image( path.c_str( ), &width, &height, &channels, SOIL_LOAD_RGBA );
+
+    // Face origins in face-sized cells, in +X, -X, +Y, -Y, +Z, -Z order
+    static const int strip[6][2] = { { 0, 0 }, { 1, 0 }, { 2, 0 }, { 3, 0 }, { 4, 0 }, { 5, 0 } };
+    static const int horizontalCross[6][2] = { { 2, 1 }, { 0, 1 }, { 1, 0 }, { 1, 2 }, { 1, 1 }, { 3, 1 } };
+    static const int verticalCross[6][2] = { { 2, 1 }, { 0, 1 }, { 1, 0 }, { 1, 2 }, { 1, 1 }, { 1, 3 } };
+    const int ( *cells )[2] = NULL;
+    int size = 0;
+    bool transposed = false;
+
+    if ( NULL != data )
+    {
+        if ( width == 6 * height )
+        {
+            cells = strip;
+            size = height;
+        }
+        else if ( height == 6 * width )
+        {
+            cells = strip;
+            size = width;
+            transposed = true;
+        }
+        else if ( 3 * width == 4 * height )
+        {
+            cells = horizontalCross;
+            size = width / 4;
+        }
+        else if ( 4 * width == 3 * height )
+        {
+            cells = verticalCross;
+            size = width / 3;
+        }
+    }
+
+    if ( NULL == cells || 0 == size )
+    {
+        std::cout << "Cubemap tex failed to load at path: " << path << std::endl;
+        SOIL_free_image_data( data );
+        return 0;
+    }
+
+    CubemapLoad load;
+    startCubemapLoad( load, flags );
+
+    for ( int i = 0; i < 6; i++ )
+    {
+        int x = ( transposed ? cells[i][1] : cells[i][0] ) * size;
+        int y = ( transposed ? cells[i][0] : cells[i][1] ) * size;
+        bool rotated = verticalCross == cells && 5 == i;
+        CubemapFace &face = load.faces[i];
+
+        face.size = size;
+        face.pixels.resize( ( size_t )size * size * 4 );
+        for ( int row = 0; row < size; row++ )
+        {
+            const unsigned char *source = data + ( ( size_t )( y + row ) * width + x ) * 4;
+
+            if ( !rotated )
+            {
+                memcpy( &face.pixels[( size_t )row * size * 4], source, ( size_t )size * 4 );
+                continue;
+            }
+
+            for ( int column = 0; column < size; column++ )
+            {
+                memcpy( &face.pixels[( ( size_t )( size - 1 - row ) * size + ( size - 1 - column ) ) * 4], source + column * 4, 4 );
+            }
+        }
+    }
+    SOIL_free_image_data( data );
+
+    SOIL_parallel_for( 6, 1, buildCubemapFaces, &load );
+
+    return uploadCubemap( load );
+}
+
+#endif
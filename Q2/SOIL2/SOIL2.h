@@ -122,6 +122,8 @@ enum
 	(BMP supports uncompressed RGB)
 	(DDS supports DXT1 and DXT5)
 	(PNG supports RGB / RGBA)
+	(PKM supports ETC1, and ETC2 RGBA8 for images with alpha)
+	(KTX supports ETC2 RGB8 / RGBA8, with a full mipmap chain)
 **/
 enum
 {
@@ -129,7 +131,9 @@ enum
 	SOIL_SAVE_TYPE_BMP = 1,
 	SOIL_SAVE_TYPE_PNG = 2,
 	SOIL_SAVE_TYPE_DDS = 3,
-	SOIL_SAVE_TYPE_JPG = 4
+	SOIL_SAVE_TYPE_JPG = 4,
+	SOIL_SAVE_TYPE_PKM = 5,
+	SOIL_SAVE_TYPE_KTX = 6
 };
 
 /**
@@ -171,6 +175,72 @@ unsigned int
 		unsigned int flags
 	);
 
+/**
+	Loads an image from disk into an OpenGL texture, going through the
+	persistent texture cache. The decoded (and, if requested, MIP mapped and
+	DXT compressed) result is stored on disk keyed by a hash of the file
+	contents and the load options, so later runs upload it straight from
+	the cache without decoding. Takes the same parameters as SOIL_load_OGL_texture;
+	SOIL_FLAG_POWER_OF_TWO, SOIL_FLAG_TEXTURE_RECTANGLE and the *_LOAD_DIRECT
+	flags bypass the cache.
+	\return 0-failed, otherwise returns the OpenGL texture handle
+**/
+unsigned int
+	SOIL_load_OGL_texture_cached
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags
+	);
+
+/**
+	Returns the texture cache entry of an image file, the same entry
+	SOIL_load_OGL_texture_cached uploads: a SOIL_cache_header, the level
+	table and the level data (see image_cache.h). A missing entry is built
+	and stored first. Makes no OpenGL calls, so it can run on a loader
+	thread; SOIL_FLAG_COMPRESS_TO_DXT and SOIL_FLAG_SRGB_COLOR_SPACE are
+	taken as given, the caller checks that the driver supports them.
+	\return NULL if the image couldn't be decoded or the cache couldn't be
+	written, otherwise the entry (release with SOIL_cache_release)
+**/
+const unsigned char*
+	SOIL_load_cache_entry
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int flags,
+		int *entry_length
+	);
+
+/**
+	Sets the directory used by SOIL_load_OGL_texture_cached (default ".soil_cache").
+**/
+void
+	SOIL_cache_set_directory
+	(
+		const char *path
+	);
+
+/**
+	Sets the size the cache directory is trimmed to, least recently used
+	entries first (default 256 MB).
+**/
+void
+	SOIL_cache_set_size_limit
+	(
+		unsigned long long bytes
+	);
+
+/**
+	Prints the cache hit / miss counters; also runs at exit once the cache is used.
+**/
+void
+	SOIL_cache_print_stats
+	(
+		void
+	);
+
 /**
 	Loads 6 images from disk into an OpenGL cubemap texture.
 	\param x_pos_file the name of the file to upload as the +x cube face
@@ -403,9 +473,34 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	Maps a whole file read-only into memory (mmap / MapViewOfFile), hinting
+	the kernel that it will be read sequentially. Platforms without file
+	mapping fall back to reading the file into a malloc'd buffer.
+	The result must be released with SOIL_unmap_file.
+	\return NULL if failed, otherwise a pointer to the file contents
+**/
+const unsigned char*
+	SOIL_map_file
+	(
+		const char *filename,
+		int *length
+	);
+
+/**
+	Releases a file mapping returned by SOIL_map_file.
+**/
+void
+	SOIL_unmap_file
+	(
+		const unsigned char *data,
+		int length
+	);
+
 /**
 	Saves an image from an array of unsigned chars (RGBA) to disk
-	\param quality parameter only used for SOIL_SAVE_TYPE_JPG files, values accepted between 0 and 100.
+	\param quality parameter used for SOIL_SAVE_TYPE_JPG files, values accepted between 0 and 100.
+	For SOIL_SAVE_TYPE_PKM and SOIL_SAVE_TYPE_KTX values below 50 select the fast ETC encoder, other types ignore it.
 	\return 0 if failed, otherwise returns 1
 **/
 int
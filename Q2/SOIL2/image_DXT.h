@@ -10,6 +10,10 @@
 #ifndef HEADER_IMAGE_DXT
 #define HEADER_IMAGE_DXT
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
 	Converts an image from an array of unsigned chars (RGB or RGBA) to
 	DXT1 or DXT5, then saves the converted image to disk.
@@ -45,6 +49,64 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**	ETC encoder effort: the rounded block averages only, or a search
+	around them plus (ETC2) the T and H modes	**/
+#define ETC_QUALITY_FAST	0
+#define ETC_QUALITY_HIGH	1
+
+/**
+	take an image and convert it to ETC1 (no alpha)
+**/
+unsigned char*
+convert_image_to_ETC1
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int quality,
+    int *out_size
+);
+
+/**
+	take an image and convert it to ETC2, RGB8 for 1 or 3 channels
+	and RGBA8 (EAC alpha) for 2 or 4 channels
+**/
+unsigned char*
+convert_image_to_ETC2
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int quality,
+    int *out_size
+);
+
+/**
+	Converts an image to ETC1 ("PKM 10") or ETC2 ("PKM 20"),
+	then saves it to disk as a PKM file.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_image_as_PKM
+(
+    const char *filename,
+    int width, int height, int channels,
+    const unsigned char *const data,
+    int etc2, int quality
+);
+
+/**
+	Converts an image to ETC1 or ETC2, optionally with a full
+	box filtered mipmap chain, then saves it to disk as a KTX file.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_image_as_KTX
+(
+    const char *filename,
+    int width, int height, int channels,
+    const unsigned char *const data,
+    int etc2, int quality, int mipmaps
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
@@ -121,4 +183,8 @@ DDS_header ;
 #define DDSCAPS2_CUBEMAP_NEGATIVEZ	0x00008000
 #define DDSCAPS2_VOLUME	0x00200000
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* HEADER_IMAGE_DXT	*/
@@ -0,0 +1,430 @@
+/*
+	Persistent cache of decoded, GPU-ready texture data
+
+	public domain
+*/
+
+#include "SOIL2.h"
+#include "image_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( __WIN32__ ) || defined( _WIN32 ) || defined( WIN32 )
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <direct.h>
+	#define SOIL_CACHE_MKDIR( path ) _mkdir( path )
+	static SRWLOCK cache_lock = SRWLOCK_INIT;
+	#define SOIL_CACHE_LOCK() AcquireSRWLockExclusive( &cache_lock )
+	#define SOIL_CACHE_UNLOCK() ReleaseSRWLockExclusive( &cache_lock )
+#else
+	#include <pthread.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <dirent.h>
+	#include <unistd.h>
+	#include <utime.h>
+	#define SOIL_CACHE_MKDIR( path ) mkdir( path, 0755 )
+	#define SOIL_CACHE_HAS_DIRENT
+	static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+	#define SOIL_CACHE_LOCK() pthread_mutex_lock( &cache_lock )
+	#define SOIL_CACHE_UNLOCK() pthread_mutex_unlock( &cache_lock )
+#endif
+
+#define SOIL_CACHE_SUFFIX ".soilcache"
+
+/*	loads run on worker threads as well as the render thread, so the
+	settings and counters below are only touched under cache_lock	*/
+static char cache_directory[512] = ".soil_cache";
+static unsigned long long cache_size_limit = 256ull * 1024ull * 1024ull;
+static int cache_directory_ready = 0;
+static int cache_stats_registered = 0;
+static unsigned int cache_hits = 0;
+static unsigned int cache_misses = 0;
+static unsigned long long cache_bytes_saved = 0;
+
+void
+	SOIL_cache_set_directory
+	(
+		const char *path
+	)
+{
+	if( NULL != path )
+	{
+		SOIL_CACHE_LOCK();
+		strncpy( cache_directory, path, sizeof( cache_directory ) - 1 );
+		cache_directory[sizeof( cache_directory ) - 1] = '\0';
+		cache_directory_ready = 0;
+		SOIL_CACHE_UNLOCK();
+	}
+}
+
+void
+	SOIL_cache_set_size_limit
+	(
+		unsigned long long bytes
+	)
+{
+	SOIL_CACHE_LOCK();
+	cache_size_limit = bytes;
+	SOIL_CACHE_UNLOCK();
+}
+
+void
+	SOIL_cache_print_stats
+	(
+		void
+	)
+{
+	unsigned int hits, misses;
+	unsigned long long bytes_saved;
+	SOIL_CACHE_LOCK();
+	hits = cache_hits;
+	misses = cache_misses;
+	bytes_saved = cache_bytes_saved;
+	SOIL_CACHE_UNLOCK();
+	printf( "SOIL texture cache: %u hits, %u misses, %llu bytes saved\n",
+			hits, misses, bytes_saved );
+}
+
+/*	called with cache_lock held	*/
+static void
+	register_stats
+	(
+		void
+	)
+{
+	if( !cache_stats_registered )
+	{
+		cache_stats_registered = 1;
+		atexit( SOIL_cache_print_stats );
+	}
+}
+
+void
+	SOIL_cache_count_hit
+	(
+		unsigned int bytes_saved
+	)
+{
+	SOIL_CACHE_LOCK();
+	register_stats();
+	++cache_hits;
+	cache_bytes_saved += bytes_saved;
+	SOIL_CACHE_UNLOCK();
+}
+
+void
+	SOIL_cache_count_miss
+	(
+		void
+	)
+{
+	SOIL_CACHE_LOCK();
+	register_stats();
+	++cache_misses;
+	SOIL_CACHE_UNLOCK();
+}
+
+/*	64 bit multiply-xorshift hash, four independent lanes so the
+	multiplies overlap instead of forming one long dependency chain	*/
+SOIL_cache_key
+	SOIL_cache_make_key
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned int options
+	)
+{
+	const unsigned long long prime = 0x9E3779B97F4A7C15ull;
+	unsigned long long lane[4];
+	unsigned long long h;
+	int i = 0, j;
+	lane[0] = 0x243F6A8885A308D3ull ^ (unsigned long long)buffer_length;
+	lane[1] = 0x13198A2E03707344ull;
+	lane[2] = 0xA4093822299F31D0ull;
+	lane[3] = 0x082EFA98EC4E6C89ull ^ options;
+	for( ; i + 32 <= buffer_length; i += 32 )
+	{
+		for( j = 0; j < 4; ++j )
+		{
+			unsigned long long w;
+			memcpy( &w, buffer + i + j*8, 8 );
+			lane[j] = ( lane[j] ^ w ) * prime;
+			lane[j] ^= lane[j] >> 29;
+		}
+	}
+	h = lane[0] ^ ( lane[1] * 3 ) ^ ( lane[2] * 5 ) ^ ( lane[3] * 7 );
+	for( ; i < buffer_length; ++i )
+	{
+		h = ( h ^ buffer[i] ) * 0x100000001B3ull;
+	}
+	h ^= options;
+	h *= prime;
+	h ^= h >> 32;
+	return h;
+}
+
+static void
+	entry_path
+	(
+		char *path,
+		size_t path_size,
+		SOIL_cache_key key
+	)
+{
+	SOIL_CACHE_LOCK();
+	snprintf( path, path_size, "%s/%016llx" SOIL_CACHE_SUFFIX, cache_directory, key );
+	SOIL_CACHE_UNLOCK();
+}
+
+/*	GL enums of the formats entries are stored in, image_cache.c does not include GL	*/
+#define SOIL_CACHE_LUMINANCE			0x1909
+#define SOIL_CACHE_LUMINANCE_ALPHA		0x190A
+#define SOIL_CACHE_RGB					0x1907
+#define SOIL_CACHE_RGBA					0x1908
+#define SOIL_CACHE_RGB_S3TC_DXT1		0x83F0
+#define SOIL_CACHE_RGBA_S3TC_DXT1		0x83F1
+#define SOIL_CACHE_RGBA_S3TC_DXT3		0x83F2
+#define SOIL_CACHE_RGBA_S3TC_DXT5		0x83F3
+#define SOIL_CACHE_SRGB_S3TC_DXT1		0x8C4C
+#define SOIL_CACHE_SRGB_ALPHA_S3TC_DXT1	0x8C4D
+#define SOIL_CACHE_SRGB_ALPHA_S3TC_DXT3	0x8C4E
+#define SOIL_CACHE_SRGB_ALPHA_S3TC_DXT5	0x8C4F
+
+/*	bytes the upload reads for a w x h level of the entry's format, 0 for a
+	format no entry is written in	*/
+static unsigned long long
+	level_bytes
+	(
+		const SOIL_cache_header *header,
+		unsigned int w,
+		unsigned int h
+	)
+{
+	unsigned long long blocks = (unsigned long long)((w + 3) / 4) * ((h + 3) / 4);
+	unsigned int pixel_channels;
+	if( 0 == header->pixel_format )
+	{
+		switch( header->internal_format )
+		{
+		case SOIL_CACHE_RGB_S3TC_DXT1:
+		case SOIL_CACHE_RGBA_S3TC_DXT1:
+		case SOIL_CACHE_SRGB_S3TC_DXT1:
+		case SOIL_CACHE_SRGB_ALPHA_S3TC_DXT1:
+			return blocks * 8;
+		case SOIL_CACHE_RGBA_S3TC_DXT3:
+		case SOIL_CACHE_RGBA_S3TC_DXT5:
+		case SOIL_CACHE_SRGB_ALPHA_S3TC_DXT3:
+		case SOIL_CACHE_SRGB_ALPHA_S3TC_DXT5:
+			return blocks * 16;
+		default:
+			return 0;
+		}
+	}
+	switch( header->pixel_format )
+	{
+	case SOIL_CACHE_LUMINANCE:			pixel_channels = 1; break;
+	case SOIL_CACHE_LUMINANCE_ALPHA:	pixel_channels = 2; break;
+	case SOIL_CACHE_RGB:				pixel_channels = 3; break;
+	case SOIL_CACHE_RGBA:				pixel_channels = 4; break;
+	default:							return 0;
+	}
+	/*	uploads are unpacked with the channels the format says, tightly packed	*/
+	if( pixel_channels != header->channels )
+	{
+		return 0;
+	}
+	return (unsigned long long)w * h * pixel_channels;
+}
+
+int
+	SOIL_cache_validate
+	(
+		const unsigned char *const entry,
+		int entry_length,
+		SOIL_cache_key key
+	)
+{
+	const SOIL_cache_header *header = (const SOIL_cache_header*)entry;
+	const SOIL_cache_level *levels;
+	unsigned int i;
+	if( (NULL == entry) || (entry_length < (int)sizeof( SOIL_cache_header )) )
+	{
+		return 0;
+	}
+	if( (0 != memcmp( header->magic, SOIL_CACHE_MAGIC, 8 )) ||
+		(header->key != key) ||
+		(header->num_levels < 1) || (header->num_levels > SOIL_CACHE_MAX_LEVELS) ||
+		(sizeof( SOIL_cache_header ) + header->num_levels * sizeof( SOIL_cache_level ) > (unsigned int)entry_length) )
+	{
+		return 0;
+	}
+	levels = (const SOIL_cache_level*)(entry + sizeof( SOIL_cache_header ));
+	for( i = 0; i < header->num_levels; ++i )
+	{
+		/*	the upload reads what the level's size and format call for,
+			so the stored size has to be exactly that and inside the file.
+			Levels never grow past the header's size or the level before
+			(cube entries repeat each size for the six faces)	*/
+		if( (levels[i].width < 1) || (levels[i].height < 1) ||
+			(levels[i].width > header->width) || (levels[i].height > header->height) ||
+			((i > 0) && ((levels[i].width > levels[i - 1].width) || (levels[i].height > levels[i - 1].height))) ||
+			(levels[i].size != level_bytes( header, levels[i].width, levels[i].height )) ||
+			(levels[i].offset > (unsigned int)entry_length) ||
+			(levels[i].size > (unsigned int)entry_length - levels[i].offset) )
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+const unsigned char*
+	SOIL_cache_lookup
+	(
+		SOIL_cache_key key,
+		int *entry_length
+	)
+{
+	char path[600];
+	const unsigned char *entry;
+	entry_path( path, sizeof( path ), key );
+	entry = SOIL_map_file( path, entry_length );
+	if( NULL == entry )
+	{
+		return NULL;
+	}
+	if( !SOIL_cache_validate( entry, *entry_length, key ) )
+	{
+		/*	truncated or stale, get rid of it	*/
+		SOIL_unmap_file( entry, *entry_length );
+		remove( path );
+		return NULL;
+	}
+#if defined( SOIL_CACHE_HAS_DIRENT )
+	/*	the modification time doubles as the LRU timestamp	*/
+	utime( path, NULL );
+#endif
+	return entry;
+}
+
+void
+	SOIL_cache_release
+	(
+		const unsigned char *entry,
+		int entry_length
+	)
+{
+	SOIL_unmap_file( entry, entry_length );
+}
+
+static void
+	evict_entries
+	(
+		void
+	)
+{
+#if defined( SOIL_CACHE_HAS_DIRENT )
+	char directory[sizeof( cache_directory )];
+	unsigned long long size_limit;
+	SOIL_CACHE_LOCK();
+	strcpy( directory, cache_directory );
+	size_limit = cache_size_limit;
+	SOIL_CACHE_UNLOCK();
+	/*	drop the oldest entries until the directory fits the limit	*/
+	for( ;; )
+	{
+		DIR *dir = opendir( directory );
+		struct dirent *dirent_entry;
+		unsigned long long total = 0;
+		time_t oldest_time = 0;
+		char oldest[600] = "";
+		if( NULL == dir )
+		{
+			return;
+		}
+		while( NULL != (dirent_entry = readdir( dir )) )
+		{
+			char path[600];
+			struct stat st;
+			size_t name_length = strlen( dirent_entry->d_name );
+			size_t suffix_length = strlen( SOIL_CACHE_SUFFIX );
+			if( (name_length <= suffix_length) ||
+				(0 != strcmp( dirent_entry->d_name + name_length - suffix_length, SOIL_CACHE_SUFFIX )) )
+			{
+				continue;
+			}
+			snprintf( path, sizeof( path ), "%s/%s", directory, dirent_entry->d_name );
+			if( 0 != stat( path, &st ) )
+			{
+				continue;
+			}
+			total += (unsigned long long)st.st_size;
+			if( ('\0' == oldest[0]) || (st.st_mtime < oldest_time) )
+			{
+				oldest_time = st.st_mtime;
+				strcpy( oldest, path );
+			}
+		}
+		closedir( dir );
+		if( (total <= size_limit) || ('\0' == oldest[0]) )
+		{
+			return;
+		}
+		remove( oldest );
+	}
+#endif
+}
+
+int
+	SOIL_cache_store
+	(
+		SOIL_cache_key key,
+		const unsigned char *const entry,
+		int entry_length
+	)
+{
+	char path[600], temp_path[640];
+	FILE *f;
+	size_t written;
+	int fits;
+	SOIL_CACHE_LOCK();
+	fits = ((unsigned long long)entry_length <= cache_size_limit);
+	if( fits && !cache_directory_ready )
+	{
+		SOIL_CACHE_MKDIR( cache_directory );
+		cache_directory_ready = 1;
+	}
+	SOIL_CACHE_UNLOCK();
+	if( !fits )
+	{
+		return 0;
+	}
+	entry_path( path, sizeof( path ), key );
+	/*	write to a private name and rename, so a concurrent reader never
+		maps a half written entry	*/
+	snprintf( temp_path, sizeof( temp_path ), "%s.%p.tmp", path, (const void*)entry );
+	f = fopen( temp_path, "wb" );
+	if( NULL == f )
+	{
+		return 0;
+	}
+	written = fwrite( entry, 1, entry_length, f );
+	if( (0 != fclose( f )) || (written != (size_t)entry_length) )
+	{
+		remove( temp_path );
+		return 0;
+	}
+#if !defined( SOIL_CACHE_HAS_DIRENT )
+	remove( path );
+#endif
+	if( 0 != rename( temp_path, path ) )
+	{
+		remove( temp_path );
+		return 0;
+	}
+	evict_entries();
+	return 1;
+}
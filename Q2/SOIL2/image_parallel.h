@@ -0,0 +1,49 @@
+/*
+	Parallel-for for the block decoders
+
+	Splits a range of block rows into contiguous chunks and decodes them
+	on short lived worker threads (pthreads or Win32 threads), the calling
+	thread taking the first chunk. Small images stay on the calling thread,
+	thread start-up would cost more than the decode.
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_PARALLEL
+#define HEADER_IMAGE_PARALLEL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**	Processes rows [begin, end) **/
+typedef void (*SOIL_parallel_task)( void *context, int begin, int end );
+
+/**
+	Runs task over [0, count), using at most one thread per core.
+	\param min_per_thread smallest chunk worth a thread of its own
+**/
+void
+	SOIL_parallel_for
+	(
+		int count,
+		int min_per_thread,
+		SOIL_parallel_task task,
+		void *context
+	);
+
+/**
+	Sets how many threads SOIL_parallel_for may use. 0 (the default) means
+	one per core, 1 keeps every decode on the calling thread.
+**/
+void
+	SOIL_parallel_set_threads
+	(
+		int threads
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_PARALLEL	*/
@@ -3,6 +3,7 @@
 ///	(use SOIL for that ;-)
 
 #include "image_DXT.h"
+#include "image_parallel.h"
 
 static int stbi__dds_test(stbi__context *s)
 {
@@ -78,8 +79,13 @@ int      stbi__dds_test_callbacks      (stbi_io_callbacks const *clbk, void *use
 //	helper functions
 int stbi_convert_bit_range( int c, int from_bits, int to_bits )
 {
-	int b = (1 << (from_bits - 1)) + c * ((1 << to_bits) - 1);
-	return (b + (b >> from_bits)) >> from_bits;
+	//	repeat the high bits in the low ones, the way GPUs expand them
+	int b = c << (to_bits - from_bits);
+	for( ; from_bits < to_bits; from_bits *= 2 )
+	{
+		b |= b >> from_bits;
+	}
+	return b;
 }
 void stbi_rgb_888_from_565( unsigned int c, int *r, int *g, int *b )
 {
@@ -240,6 +246,434 @@ void stbi_decode_DXT_color_block(
 	//	done
 }
 
+/*
+	Batch decoders
+
+	stbi_decode_DXT_blocks decodes a row of blocks straight into an image.
+	With SSE2 the palette of each colour block is interpolated in 16 bit
+	lanes, and its pixels are picked out of the palette with compares, a
+	row of 4 pixels per register. Alpha, BC4 and BC5 values are looked up
+	per pixel and merged in. Both paths match the single block decoders.
+*/
+
+#if defined(STBI_SSE2) && (defined(STBI__X64_TARGET) || defined(__SSE2__))
+#define STBI_DDS_SSE2
+#endif
+
+int stbi_DXT_block_size( int format )
+{
+	switch( format )
+	{
+	case STBI_DXT1:
+	case STBI_BC4:
+		return 8;
+	case STBI_DXT3:
+	case STBI_DXT5:
+	case STBI_BC5:
+		return 16;
+	}
+	return 0;
+}
+
+//	the 16 values of a DXT5 alpha or BC4 block
+static void stbi__decode_DXT_channel(
+			unsigned char const *compressed,
+			unsigned char values[16] )
+{
+	unsigned char palette[8];
+	unsigned int bits;
+	int i;
+	palette[0] = compressed[0];
+	palette[1] = compressed[1];
+	if( palette[0] > palette[1] )
+	{
+		//	6 step intermediate
+		palette[2] = (6*palette[0] + 1*palette[1]) / 7;
+		palette[3] = (5*palette[0] + 2*palette[1]) / 7;
+		palette[4] = (4*palette[0] + 3*palette[1]) / 7;
+		palette[5] = (3*palette[0] + 4*palette[1]) / 7;
+		palette[6] = (2*palette[0] + 5*palette[1]) / 7;
+		palette[7] = (1*palette[0] + 6*palette[1]) / 7;
+	} else
+	{
+		//	4 step intermediate, plus full and none
+		palette[2] = (4*palette[0] + 1*palette[1]) / 5;
+		palette[3] = (3*palette[0] + 2*palette[1]) / 5;
+		palette[4] = (2*palette[0] + 3*palette[1]) / 5;
+		palette[5] = (1*palette[0] + 4*palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	//	3 bit indices, 8 pixels to each 24 bits
+	bits = compressed[2] | (compressed[3] << 8) | (compressed[4] << 16);
+	for( i = 0; i < 8; ++i, bits >>= 3 )
+	{
+		values[i] = palette[bits & 7];
+	}
+	bits = compressed[5] | (compressed[6] << 8) | (compressed[7] << 16);
+	for( i = 8; i < 16; ++i, bits >>= 3 )
+	{
+		values[i] = palette[bits & 7];
+	}
+}
+
+#ifdef STBI_DDS_SSE2
+//	the 4 rows of a colour block; alpha is 255 for DXT1, 0 for DXT3/5 so the alpha block can be or'ed in
+static void stbi__decode_DXT_color_sse2(
+			unsigned char const *compressed,
+			int dxt1,
+			__m128i rows[4] )
+{
+	int c0 = compressed[0] | (compressed[1] << 8);
+	int c1 = compressed[2] | (compressed[3] << 8);
+	__m128i ends, swapped, mid, palette, bits, low, high, bit0, bit1;
+	__m128i color01, color23;
+	int r;
+	/*	c0 and c1 as 16 bit RGBA, each channel's bits masked in place and then
+		shifted up to 8 bits, with its high bits repeated below	*/
+	ends = _mm_shufflelo_epi16( _mm_cvtsi32_si128( (int)((unsigned int)c0 | ((unsigned int)c1 << 16)) ), _MM_SHUFFLE( 1, 1, 0, 0 ) );
+	ends = _mm_unpacklo_epi16( ends, ends );
+	ends = _mm_and_si128( ends, _mm_set_epi16( 0, 0x001F, 0x07E0, (short)0xF800, 0, 0x001F, 0x07E0, (short)0xF800 ) );
+	ends = _mm_or_si128(
+			_mm_or_si128( _mm_mulhi_epu16( ends, _mm_set_epi16( 0, 0, 1 << 13, 1 << 8, 0, 0, 1 << 13, 1 << 8 ) ),
+						  _mm_mullo_epi16( ends, _mm_set_epi16( 0, 8, 0, 0, 0, 8, 0, 0 ) ) ),
+			_mm_mulhi_epu16( ends, _mm_set_epi16( 0, 1 << 14, 1 << 7, 1 << 3, 0, 1 << 14, 1 << 7, 1 << 3 ) ) );
+	if( dxt1 )
+	{
+		ends = _mm_or_si128( ends, _mm_set_epi16( 255, 0, 0, 0, 255, 0, 0, 0 ) );
+	}
+	swapped = _mm_shuffle_epi32( ends, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+	if( dxt1 && (c0 <= c1) )
+	{
+		//	1 interpolated color, then transparent black
+		mid = _mm_move_epi64( _mm_srli_epi16( _mm_add_epi16( ends, swapped ), 1 ) );
+	} else
+	{
+		//	(2*c0 + c1) / 3 and (c0 + 2*c1) / 3, 0xAAAB / 2^17 divides by 3 exactly below 2^16
+		mid = _mm_add_epi16( _mm_add_epi16( ends, ends ), swapped );
+		mid = _mm_srli_epi16( _mm_mulhi_epu16( mid, _mm_set1_epi16( (short)0xAAAB ) ), 1 );
+	}
+	palette = _mm_packus_epi16( ends, mid );
+	/*	pixel i of a row uses bits 2i and 2i+1 of the row's index byte. The
+		low bit picks between c0/c1 and c2/c3, the high bit between those	*/
+	low = _mm_set_epi32( 1 << 6, 1 << 4, 1 << 2, 1 );
+	high = _mm_add_epi32( low, low );
+	color01 = _mm_xor_si128( _mm_shuffle_epi32( palette, 0x00 ), _mm_shuffle_epi32( palette, 0x55 ) );
+	color23 = _mm_xor_si128( _mm_shuffle_epi32( palette, 0xAA ), _mm_shuffle_epi32( palette, 0xFF ) );
+	for( r = 0; r < 4; ++r )
+	{
+		__m128i pick01, pick23;
+		bits = _mm_set1_epi32( compressed[4 + r] );
+		bit0 = _mm_cmpeq_epi32( _mm_and_si128( bits, low ), low );
+		bit1 = _mm_cmpeq_epi32( _mm_and_si128( bits, high ), high );
+		pick01 = _mm_xor_si128( _mm_shuffle_epi32( palette, 0x00 ), _mm_and_si128( bit0, color01 ) );
+		pick23 = _mm_xor_si128( _mm_shuffle_epi32( palette, 0xAA ), _mm_and_si128( bit0, color23 ) );
+		rows[r] = _mm_xor_si128( pick01, _mm_and_si128( bit1, _mm_xor_si128( pick01, pick23 ) ) );
+	}
+}
+
+//	ors 16 bytes into the alpha of 4 rows
+static void stbi__merge_DXT_alpha_sse2(
+			__m128i alpha,
+			__m128i rows[4] )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8( zero, alpha );
+	__m128i hi = _mm_unpackhi_epi8( zero, alpha );
+	rows[0] = _mm_or_si128( rows[0], _mm_unpacklo_epi16( zero, lo ) );
+	rows[1] = _mm_or_si128( rows[1], _mm_unpackhi_epi16( zero, lo ) );
+	rows[2] = _mm_or_si128( rows[2], _mm_unpacklo_epi16( zero, hi ) );
+	rows[3] = _mm_or_si128( rows[3], _mm_unpackhi_epi16( zero, hi ) );
+}
+
+static void stbi__decode_DXT_block_sse2(
+			int format,
+			unsigned char const *compressed,
+			__m128i rows[4] )
+{
+	unsigned char values[2][16];
+	__m128i zero = _mm_setzero_si128();
+	__m128i alpha, red, green, rg;
+	switch( format )
+	{
+	case STBI_DXT1:
+		stbi__decode_DXT_color_sse2( compressed, 1, rows );
+		break;
+	case STBI_DXT3:
+		//	4 bit alpha, low nibble first, times 17
+		stbi__decode_DXT_color_sse2( compressed + 8, 0, rows );
+		alpha = _mm_loadl_epi64( (__m128i const*)compressed );
+		alpha = _mm_unpacklo_epi8(
+				_mm_and_si128( alpha, _mm_set1_epi8( 15 ) ),
+				_mm_and_si128( _mm_srli_epi16( alpha, 4 ), _mm_set1_epi8( 15 ) ) );
+		alpha = _mm_or_si128( alpha, _mm_slli_epi16( alpha, 4 ) );
+		stbi__merge_DXT_alpha_sse2( alpha, rows );
+		break;
+	case STBI_DXT5:
+		stbi__decode_DXT_color_sse2( compressed + 8, 0, rows );
+		stbi__decode_DXT_channel( compressed, values[0] );
+		stbi__merge_DXT_alpha_sse2( _mm_loadu_si128( (__m128i const*)values[0] ), rows );
+		break;
+	case STBI_BC4:
+	case STBI_BC5:
+		stbi__decode_DXT_channel( compressed, values[0] );
+		red = _mm_loadu_si128( (__m128i const*)values[0] );
+		green = zero;
+		if( format == STBI_BC5 )
+		{
+			stbi__decode_DXT_channel( compressed + 8, values[1] );
+			green = _mm_loadu_si128( (__m128i const*)values[1] );
+		}
+		rows[0] = rows[1] = rows[2] = rows[3] = _mm_set1_epi32( (int)0xFF000000 );
+		rg = _mm_unpacklo_epi8( red, green );
+		rows[0] = _mm_or_si128( rows[0], _mm_unpacklo_epi16( rg, zero ) );
+		rows[1] = _mm_or_si128( rows[1], _mm_unpackhi_epi16( rg, zero ) );
+		rg = _mm_unpackhi_epi8( red, green );
+		rows[2] = _mm_or_si128( rows[2], _mm_unpacklo_epi16( rg, zero ) );
+		rows[3] = _mm_or_si128( rows[3], _mm_unpackhi_epi16( rg, zero ) );
+		break;
+	default:
+		rows[0] = rows[1] = rows[2] = rows[3] = zero;
+		break;
+	}
+}
+#else
+static void stbi__decode_DXT_block(
+			int format,
+			unsigned char const *compressed,
+			unsigned char uncompressed[16*4] )
+{
+	unsigned char values[2][16];
+	int i;
+	switch( format )
+	{
+	case STBI_DXT1:
+		stbi_decode_DXT1_block( uncompressed, (unsigned char*)compressed );
+		break;
+	case STBI_DXT3:
+		stbi_decode_DXT23_alpha_block( uncompressed, (unsigned char*)compressed );
+		stbi_decode_DXT_color_block( uncompressed, (unsigned char*)compressed + 8 );
+		break;
+	case STBI_DXT5:
+		stbi_decode_DXT45_alpha_block( uncompressed, (unsigned char*)compressed );
+		stbi_decode_DXT_color_block( uncompressed, (unsigned char*)compressed + 8 );
+		break;
+	case STBI_BC4:
+	case STBI_BC5:
+		stbi__decode_DXT_channel( compressed, values[0] );
+		memset( values[1], 0, 16 );
+		if( format == STBI_BC5 )
+		{
+			stbi__decode_DXT_channel( compressed + 8, values[1] );
+		}
+		for( i = 0; i < 16; ++i )
+		{
+			uncompressed[i*4+0] = values[0][i];
+			uncompressed[i*4+1] = values[1][i];
+			uncompressed[i*4+2] = 0;
+			uncompressed[i*4+3] = 255;
+		}
+		break;
+	default:
+		memset( uncompressed, 0, 16*4 );
+		break;
+	}
+}
+#endif
+
+void stbi_decode_DXT_blocks(
+			int format,
+			unsigned char const *compressed,
+			int num_blocks,
+			unsigned char *uncompressed,
+			int stride )
+{
+	int block_size = stbi_DXT_block_size( format );
+	int i, r;
+#ifdef STBI_DDS_SSE2
+	__m128i rows[4];
+	for( i = 0; i < num_blocks; ++i )
+	{
+		stbi__decode_DXT_block_sse2( format, compressed + i*block_size, rows );
+		for( r = 0; r < 4; ++r )
+		{
+			_mm_storeu_si128( (__m128i*)(uncompressed + r*stride + i*16), rows[r] );
+		}
+	}
+#else
+	unsigned char block[16*4];
+	for( i = 0; i < num_blocks; ++i )
+	{
+		stbi__decode_DXT_block( format, compressed + i*block_size, block );
+		for( r = 0; r < 4; ++r )
+		{
+			memcpy( uncompressed + r*stride + i*16, block + r*16, 16 );
+		}
+	}
+#endif
+}
+
+typedef struct
+{
+	int format;
+	unsigned char const *compressed;
+	int width;
+	int height;
+	unsigned char *uncompressed;
+} stbi__dxt_image_job;
+
+static void stbi__decode_DXT_rows( void *context, int begin, int end )
+{
+	stbi__dxt_image_job *job = (stbi__dxt_image_job*)context;
+	int block_size = stbi_DXT_block_size( job->format );
+	int block_pitch = (job->width + 3) >> 2;
+	int stride = job->width * 4;
+	unsigned char block[16*4];
+	int bx, by, r, rows, cols;
+	for( by = begin; by < end; ++by )
+	{
+		unsigned char const *src = job->compressed + by * block_pitch * block_size;
+		unsigned char *dst = job->uncompressed + by * 4 * stride;
+		rows = job->height - by * 4;
+		if( rows > 4 )
+		{
+			rows = 4;
+		}
+		bx = 0;
+		if( rows == 4 )
+		{
+			bx = job->width >> 2;
+			stbi_decode_DXT_blocks( job->format, src, bx, dst, stride );
+		}
+		//	blocks hanging over the right or bottom edge go through a temporary block
+		for( ; bx < block_pitch; ++bx )
+		{
+			cols = job->width - bx * 4;
+			if( cols > 4 )
+			{
+				cols = 4;
+			}
+			stbi_decode_DXT_blocks( job->format, src + bx * block_size, 1, block, 16 );
+			for( r = 0; r < rows; ++r )
+			{
+				memcpy( dst + r * stride + bx * 16, block + r * 16, cols * 4 );
+			}
+		}
+	}
+}
+
+void stbi_decode_DXT_image(
+			int format,
+			unsigned char const *compressed,
+			int width,
+			int height,
+			unsigned char *uncompressed )
+{
+	stbi__dxt_image_job job;
+	job.format = format;
+	job.compressed = compressed;
+	job.width = width;
+	job.height = height;
+	job.uncompressed = uncompressed;
+	SOIL_parallel_for( (height + 3) >> 2, 16, stbi__decode_DXT_rows, &job );
+}
+
+/*
+	CPU sampler
+
+	Reads texels straight out of the compressed data, for rendering
+	without a GPU. The blocks of a bilinear footprint are decoded with the
+	decoders above and kept, so neighbouring samples rarely decode again.
+*/
+
+void stbi_dxt_sampler_init(
+			stbi_dxt_sampler *sampler,
+			int format,
+			unsigned char const *compressed,
+			int width,
+			int height )
+{
+	int i;
+	sampler->compressed = compressed;
+	sampler->format = format;
+	sampler->width = width;
+	sampler->height = height;
+	sampler->block_pitch = (width + 3) >> 2;
+	sampler->block_size = stbi_DXT_block_size( format );
+	for( i = 0; i < 4; ++i )
+	{
+		sampler->cached[i] = -1;
+	}
+}
+
+void stbi_dxt_sampler_fetch(
+			stbi_dxt_sampler *sampler,
+			int x,
+			int y,
+			unsigned char rgba[4] )
+{
+	unsigned char const *texel;
+	int bx, by, slot, block;
+	x %= sampler->width;
+	y %= sampler->height;
+	if( x < 0 )
+	{
+		x += sampler->width;
+	}
+	if( y < 0 )
+	{
+		y += sampler->height;
+	}
+	bx = x >> 2;
+	by = y >> 2;
+	slot = (bx & 1) | ((by & 1) << 1);
+	block = by * sampler->block_pitch + bx;
+	if( sampler->cached[slot] != block )
+	{
+		stbi_decode_DXT_blocks( sampler->format, sampler->compressed + block * sampler->block_size,
+				1, sampler->texels[slot], 16 );
+		sampler->cached[slot] = block;
+	}
+	texel = &sampler->texels[slot][((y & 3) * 4 + (x & 3)) * 4];
+	rgba[0] = texel[0];
+	rgba[1] = texel[1];
+	rgba[2] = texel[2];
+	rgba[3] = texel[3];
+}
+
+static int stbi__dxt_floor( float f )
+{
+	int i = (int)f;
+	return i - (f < (float)i);
+}
+
+void stbi_dxt_sampler_sample(
+			stbi_dxt_sampler *sampler,
+			float u,
+			float v,
+			float rgba[4] )
+{
+	unsigned char texels[4][4];
+	//	texel centres sit on half texels, as in OpenGL
+	float fx = u * sampler->width - 0.5f;
+	float fy = v * sampler->height - 0.5f;
+	int x = stbi__dxt_floor( fx );
+	int y = stbi__dxt_floor( fy );
+	float wx = fx - x;
+	float wy = fy - y;
+	int k;
+	stbi_dxt_sampler_fetch( sampler, x, y, texels[0] );
+	stbi_dxt_sampler_fetch( sampler, x + 1, y, texels[1] );
+	stbi_dxt_sampler_fetch( sampler, x, y + 1, texels[2] );
+	stbi_dxt_sampler_fetch( sampler, x + 1, y + 1, texels[3] );
+	for( k = 0; k < 4; ++k )
+	{
+		float top = texels[0][k] + (texels[1][k] - texels[0][k]) * wx;
+		float bottom = texels[2][k] + (texels[3][k] - texels[2][k]) * wx;
+		rgba[k] = (top + (bottom - top) * wy) * (1.0f / 255.0f);
+	}
+}
+
 static int stbi__dds_info( stbi__context *s, int *x, int *y, int *comp, int *iscompressed ) {
 	int flags,is_compressed,has_alpha;
 	DDS_header header={0};
@@ -340,9 +774,8 @@ static void * stbi__dds_load(stbi__context *s, int *x, int *y, int *comp, int re
 {
 	//	all variables go up front
 	stbi_uc *dds_data = NULL;
-	stbi_uc block[16*4];
-	stbi_uc compressed[8];
-	int flags, DXT_family;
+	stbi_uc *dxt_data = NULL;
+	int flags, DXT_family, format, block_size;
 	int has_alpha, has_mipmap;
 	int is_compressed, cubemap_faces;
 	int block_pitch, num_blocks;
@@ -390,78 +823,56 @@ static void * stbi__dds_load(stbi__context *s, int *x, int *y, int *comp, int re
 	{
 		/*	compressed	*/
 		//	note: header.sPixelFormat.dwFourCC is something like (('D'<<0)|('X'<<8)|('T'<<16)|('1'<<24))
-		DXT_family = 1 + (header.sPixelFormat.dwFourCC >> 24) - '1';
-		if( (DXT_family < 1) || (DXT_family > 5) ) return NULL;
+		if( (header.sPixelFormat.dwFourCC & 0xFFFFFF) == (('D'<<0)|('X'<<8)|('T'<<16)) )
+		{
+			DXT_family = 1 + (header.sPixelFormat.dwFourCC >> 24) - '1';
+			if( (DXT_family < 1) || (DXT_family > 5) ) return NULL;
+			format = (DXT_family == 1) ? STBI_DXT1 : (DXT_family < 4) ? STBI_DXT3 : STBI_DXT5;
+		} else if( (header.sPixelFormat.dwFourCC == (('A'<<0)|('T'<<8)|('I'<<16)|('1'<<24))) ||
+				   (header.sPixelFormat.dwFourCC == (('B'<<0)|('C'<<8)|('4'<<16)|('U'<<24))) )
+		{
+			format = STBI_BC4;
+		} else if( (header.sPixelFormat.dwFourCC == (('A'<<0)|('T'<<8)|('I'<<16)|('2'<<24))) ||
+				   (header.sPixelFormat.dwFourCC == (('B'<<0)|('C'<<8)|('5'<<16)|('U'<<24))) )
+		{
+			format = STBI_BC5;
+		} else
+		{
+			return NULL;
+		}
+		block_size = stbi_DXT_block_size( format );
 		/*	check the expected size...oops, nevermind...
 			those non-compliant writers leave
 			dwPitchOrLinearSize == 0	*/
 		//	passed all the tests, get the RAM for decoding
 		sz = (s->img_x)*(s->img_y)*4*cubemap_faces;
-		dds_data = (unsigned char*)malloc( sz );
+		dds_data = (unsigned char*)STBI_MALLOC( sz );
+		dxt_data = (unsigned char*)STBI_MALLOC( num_blocks*block_size );
+		if( (NULL == dds_data) || (NULL == dxt_data) )
+		{
+			STBI_FREE( dds_data );
+			STBI_FREE( dxt_data );
+			return stbi__errpuc("outofmem", "Out of memory");
+		}
 		/*	do this once for each face	*/
 		for( cf = 0; cf < cubemap_faces; ++ cf )
 		{
-			//	now read and decode all the blocks
-			for( i = 0; i < num_blocks; ++i )
+			//	read all the blocks of the face, then decode them a block row at a time
+			if( !stbi__getn( s, dxt_data, num_blocks*block_size ) )
 			{
-				//	where are we?
-				int bx, by, bw=4, bh=4;
-				int ref_x = 4 * (i % block_pitch);
-				int ref_y = 4 * (i / block_pitch);
-				//	get the next block's worth of compressed data, and decompress it
-				if( DXT_family == 1 )
-				{
-					//	DXT1
-					stbi__getn( s, compressed, 8 );
-					stbi_decode_DXT1_block( block, compressed );
-				} else if( DXT_family < 4 )
-				{
-					//	DXT2/3
-					stbi__getn( s, compressed, 8 );
-					stbi_decode_DXT23_alpha_block ( block, compressed );
-					stbi__getn( s, compressed, 8 );
-					stbi_decode_DXT_color_block ( block, compressed );
-				} else
-				{
-					//	DXT4/5
-					stbi__getn( s, compressed, 8 );
-					stbi_decode_DXT45_alpha_block ( block, compressed );
-					stbi__getn( s, compressed, 8 );
-					stbi_decode_DXT_color_block ( block, compressed );
-				}
-				//	is this a partial block?
-				if( ref_x + 4 > (int)s->img_x )
-				{
-					bw = s->img_x - ref_x;
-				}
-				if( ref_y + 4 > (int)s->img_y )
-				{
-					bh = s->img_y - ref_y;
-				}
-				//	now drop our decompressed data into the buffer
-				for( by = 0; by < bh; ++by )
-				{
-					int idx = 4*((ref_y+by+cf*s->img_x)*s->img_x + ref_x);
-					for( bx = 0; bx < bw*4; ++bx )
-					{
-
-						dds_data[idx+bx] = block[by*16+bx];
-					}
-				}
+				STBI_FREE( dds_data );
+				STBI_FREE( dxt_data );
+				return stbi__errpuc("bad file", "DDS data truncated");
 			}
+			stbi_decode_DXT_image( format, dxt_data, s->img_x, s->img_y, &dds_data[cf*s->img_x*s->img_y*4] );
 			/*	done reading and decoding the main image...
 				stbi__skip MIPmaps if present	*/
 			if( has_mipmap )
 			{
-				int block_size = 16;
-				if( DXT_family == 1 )
-				{
-					block_size = 8;
-				}
 				for( i = 1; i < (int)header.dwMipMapCount; ++i )
 				{
-					int mx = s->img_x >> (i + 2);
-					int my = s->img_y >> (i + 2);
+					int mx = s->img_x >> i;
+					int my = s->img_y >> i;
 					if( mx < 1 )
 					{
 						mx = 1;
@@ -470,10 +881,11 @@ static void * stbi__dds_load(stbi__context *s, int *x, int *y, int *comp, int re
 					{
 						my = 1;
 					}
-					stbi__skip( s, mx*my*block_size );
+					stbi__skip( s, ((mx+3)>>2)*((my+3)>>2)*block_size );
 				}
 			}
 		}/* per cubemap face */
+		STBI_FREE( dxt_data );
 	} else
 	{
 		/*	uncompressed	*/
@@ -485,7 +897,7 @@ static void * stbi__dds_load(stbi__context *s, int *x, int *y, int *comp, int re
 		}
 		*comp = s->img_n;
 		sz = s->img_x*s->img_y*s->img_n*cubemap_faces;
-		dds_data = (unsigned char*)malloc( sz );
+		dds_data = (unsigned char*)STBI_MALLOC( sz );
 		/*	do this once for each face	*/
 		for( cf = 0; cf < cubemap_faces; ++ cf )
 		{
@@ -1,4 +1,5 @@
 #include "pvr_helper.h"
+#include "image_parallel.h"
 
 static int stbi__pvr_test(stbi__context *s)
 {
@@ -875,6 +876,282 @@ static void Decompress(AMTC_BLOCK_STRUCT *pCompressedData,
 
 }
 
+/***********************************************************/
+/*
+// Tiled decompression
+//
+// All the pixels of a quad - the XBlockSize x 4 pixels centred on the
+// corner shared by a 2x2 neighbourhood of blocks - are interpolated from
+// the same four blocks, so each quad unpacks its blocks once and then
+// writes its pixels a row at a time. A row of quads writes whole output
+// rows that no other row of quads touches, so rows of quads are decoded in
+// parallel. The output is identical to Decompress.
+*/
+/***********************************************************/
+
+#if defined(STBI_SSE2) && (defined(STBI__X64_TARGET) || defined(__SSE2__))
+#define PVRT_SSE2
+#endif
+
+typedef struct
+{
+	const AMTC_BLOCK_STRUCT *pCompressedData;
+	int Do2bitMode;
+	int XDim;
+	int YDim;
+	unsigned char *pResultImage;
+} PVRT_DECOMPRESS_JOB;
+
+#ifdef PVRT_SSE2
+/*
+// Writes one row of a quad. The A and B signals are linear in the pixel's
+// position along the row, base + u * step, with 2 pixels of RGBA per
+// register. The shifts that differ between RGB and A are done as a
+// multiply followed by a common shift.
+*/
+static void DecompressQuadRow(const int Base[2][4],
+							  const int Step[2][4],
+							  const int Mod[BLK_X_MAX],
+							  const int DoPT[BLK_X_MAX],
+							  const int Do2bitMode,
+							  const int XBlockSize,
+							  unsigned char *pPixels)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Lop = Do2bitMode ? _mm_set_epi16(4, 2, 2, 2, 4, 2, 2, 2) : _mm_set_epi16(2, 1, 1, 1, 2, 1, 1, 1);
+	const __m128i Expand = _mm_set_epi16(2, 1, 1, 1, 2, 1, 1, 1);
+	__m128i Sig[2], SigStep[2], Colour[2], Packed[2];
+	__m128i ModV, Keep, Result;
+	int i, k;
+
+	for(i = 0; i < 2; i++)
+	{
+		__m128i B = _mm_set_epi16((short)Base[i][3], (short)Base[i][2], (short)Base[i][1], (short)Base[i][0],
+								  (short)Base[i][3], (short)Base[i][2], (short)Base[i][1], (short)Base[i][0]);
+		__m128i S = _mm_set_epi16((short)Step[i][3], (short)Step[i][2], (short)Step[i][1], (short)Step[i][0],
+								  (short)Step[i][3], (short)Step[i][2], (short)Step[i][1], (short)Step[i][0]);
+
+		// pixels u and u+1 start at base + (0, step)
+		Sig[i] = _mm_add_epi16(B, _mm_unpackhi_epi64(Zero, S));
+		SigStep[i] = _mm_add_epi16(S, S);
+	}
+
+	for(k = 0; k < XBlockSize; k += 2)
+	{
+		for(i = 0; i < 2; i++)
+		{
+			// lop off the bits below 8 bit precision, then 5554 => 8888
+			Colour[i] = _mm_srai_epi16(_mm_mullo_epi16(Sig[i], Lop), Do2bitMode ? 3 : 1);
+			Colour[i] = _mm_add_epi16(Colour[i], _mm_srli_epi16(_mm_mullo_epi16(Colour[i], Expand), 5));
+
+			Sig[i] = _mm_add_epi16(Sig[i], SigStep[i]);
+		}
+
+		ModV = _mm_set_epi16((short)Mod[k+1], (short)Mod[k+1], (short)Mod[k+1], (short)Mod[k+1],
+							 (short)Mod[k], (short)Mod[k], (short)Mod[k], (short)Mod[k]);
+		Keep = _mm_set_epi16(DoPT[k+1] ? 0 : -1, -1, -1, -1, DoPT[k] ? 0 : -1, -1, -1, -1);
+
+		// A * 8 + Mod * (B - A), with the alpha of punch-through pixels cleared
+		Result = _mm_add_epi16(_mm_slli_epi16(Colour[0], 3), _mm_mullo_epi16(ModV, _mm_sub_epi16(Colour[1], Colour[0])));
+		Result = _mm_srai_epi16(Result, 3);
+		Result = _mm_and_si128(Result, Keep);
+
+		Packed[(k >> 1) & 1] = Result;
+		if((k & 2) != 0)
+		{
+			_mm_storeu_si128((__m128i*)(pPixels + (k - 2) * 4), _mm_packus_epi16(Packed[0], Packed[1]));
+		}
+	}
+}
+#else
+static void DecompressQuadRow(const int Base[2][4],
+							  const int Step[2][4],
+							  const int Mod[BLK_X_MAX],
+							  const int DoPT[BLK_X_MAX],
+							  const int Do2bitMode,
+							  const int XBlockSize,
+							  unsigned char *pPixels)
+{
+	int Sig[2][4];
+	int Result;
+	int u, i, k;
+
+	for(u = 0; u < XBlockSize; u++)
+	{
+		for(i = 0; i < 2; i++)
+		{
+			for(k = 0; k < 4; k++)
+			{
+				Sig[i][k] = Base[i][k] + u * Step[i][k];
+			}
+
+			// lop off the bits below 8 bit precision, then 5554 => 8888
+			for(k = 0; k < 3; k++)
+			{
+				Sig[i][k] >>= Do2bitMode ? 2 : 1;
+				Sig[i][k] += Sig[i][k] >> 5;
+			}
+
+			Sig[i][3] >>= Do2bitMode ? 1 : 0;
+			Sig[i][3] += Sig[i][3] >> 4;
+		}
+
+		for(k = 0; k < 4; k++)
+		{
+			Result = (Sig[0][k] * 8 + Mod[u] * (Sig[1][k] - Sig[0][k])) >> 3;
+			pPixels[u * 4 + k] = (unsigned char)Result;
+		}
+
+		if(DoPT[u])
+		{
+			pPixels[u * 4 + 3] = 0;
+		}
+	}
+}
+#endif
+
+static void DecompressQuadRows(void *context, int begin, int end)
+{
+	const PVRT_DECOMPRESS_JOB *job = (const PVRT_DECOMPRESS_JOB*)context;
+	const int Do2bitMode = job->Do2bitMode;
+	const int XBlockSize = Do2bitMode ? BLK_X_2BPP : BLK_X_4BPP;
+	const int BlkXDim = job->XDim / XBlockSize;
+	const int BlkYDim = job->YDim / BLK_Y_SIZE;
+	const int RowBytes = job->XDim * 4;
+
+	int BlkX, BlkY;
+	int BlkXp1, BlkYp1;
+	int StartX, StartY;
+	int i, j, k, u, v;
+	int x, y;
+
+	int ModulationVals[8][16];
+	int ModulationModes[8][16];
+
+	int Colours5554[2][2][2][4];
+	int Base[2][4], BaseStep[2][4];
+	int Step[2][4], StepStep[2][4];
+	int Mod[BLK_X_MAX], DoPT[BLK_X_MAX];
+
+	const AMTC_BLOCK_STRUCT *pBlocks[2][2];
+
+	unsigned char Row[BLK_X_MAX * 4];
+	unsigned char *pRow;
+
+	for(BlkY = begin; BlkY < end; BlkY++)
+	{
+		BlkYp1 = WRAP_COORD(BlkY+1, BlkYDim);
+
+		for(BlkX = 0; BlkX < BlkXDim; BlkX++)
+		{
+			BlkXp1 = WRAP_COORD(BlkX+1, BlkXDim);
+
+			pBlocks[0][0] = job->pCompressedData + TwiddleUV(BlkYDim, BlkXDim, BlkY, BlkX);
+			pBlocks[0][1] = job->pCompressedData + TwiddleUV(BlkYDim, BlkXDim, BlkY, BlkXp1);
+			pBlocks[1][0] = job->pCompressedData + TwiddleUV(BlkYDim, BlkXDim, BlkYp1, BlkX);
+			pBlocks[1][1] = job->pCompressedData + TwiddleUV(BlkYDim, BlkXDim, BlkYp1, BlkXp1);
+
+			StartY = 0;
+			for(i = 0; i < 2; i++)
+			{
+				StartX = 0;
+				for(j = 0; j < 2; j++)
+				{
+					Unpack5554Colour(pBlocks[i][j], Colours5554[i][j]);
+
+					UnpackModulations(pBlocks[i][j],
+						Do2bitMode,
+						ModulationVals,
+						ModulationModes,
+						StartX, StartY);
+
+					StartX += XBlockSize;
+				}
+
+				StartY += BLK_Y_SIZE;
+			}
+
+			/*
+			// InterpolateColours expanded for the quad: at (u, v)
+			//   (P * uscale + u * (Q - P)) * 4 + v * ((R - P) * uscale + u * (S - R - Q + P))
+			// so each row is Base + u * Step, and each row steps Base and Step
+			*/
+			for(i = 0; i < 2; i++)
+			{
+				for(k = 0; k < 4; k++)
+				{
+					const int P = Colours5554[0][0][i][k];
+					const int Q = Colours5554[0][1][i][k];
+					const int R = Colours5554[1][0][i][k];
+					const int S = Colours5554[1][1][i][k];
+
+					Base[i][k] = P * XBlockSize * 4;
+					BaseStep[i][k] = (R - P) * XBlockSize;
+					Step[i][k] = (Q - P) * 4;
+					StepStep[i][k] = S - R - Q + P;
+				}
+			}
+
+			// the quad starts half a block in, and its right half wraps round on the last column
+			x = BlkX * XBlockSize + XBlockSize/2;
+
+			for(v = 0; v < BLK_Y_SIZE; v++)
+			{
+				y = WRAP_COORD(BlkY * BLK_Y_SIZE + BLK_Y_SIZE/2 + v, job->YDim);
+				pRow = job->pResultImage + y * RowBytes;
+
+				for(u = 0; u < XBlockSize; u++)
+				{
+					GetModulationValue(x + u, y, Do2bitMode, (const int (*)[16])ModulationVals, (const int (*)[16])ModulationModes,
+						&Mod[u], &DoPT[u]);
+				}
+
+				DecompressQuadRow((const int (*)[4])Base, (const int (*)[4])Step, Mod, DoPT, Do2bitMode, XBlockSize, Row);
+
+				memcpy(pRow + x * 4, Row, XBlockSize * 2);
+				memcpy(pRow + WRAP_COORD(x + XBlockSize/2, job->XDim) * 4, Row + XBlockSize * 2, XBlockSize * 2);
+
+				for(i = 0; i < 2; i++)
+				{
+					for(k = 0; k < 4; k++)
+					{
+						Base[i][k] += BaseStep[i][k];
+						Step[i][k] += StepStep[i][k];
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+// Decompresses with DecompressQuadRows where it can. Images under two
+// blocks across or down, or not a power of two, go through Decompress.
+*/
+static void DecompressTiled(AMTC_BLOCK_STRUCT *pCompressedData,
+							const int Do2bitMode,
+							const int XDim,
+							const int YDim,
+							unsigned char* pResultImage)
+{
+	const int XBlockSize = Do2bitMode ? BLK_X_2BPP : BLK_X_4BPP;
+	PVRT_DECOMPRESS_JOB job;
+
+	if(!POWER_OF_2(XDim) || !POWER_OF_2(YDim) || XDim < 2 * XBlockSize || YDim < 2 * BLK_Y_SIZE)
+	{
+		Decompress(pCompressedData, Do2bitMode, XDim, YDim, 1, pResultImage);
+		return;
+	}
+
+	job.pCompressedData = pCompressedData;
+	job.Do2bitMode = Do2bitMode;
+	job.XDim = XDim;
+	job.YDim = YDim;
+	job.pResultImage = pResultImage;
+
+	SOIL_parallel_for(YDim / BLK_Y_SIZE, 16, DecompressQuadRows, &job);
+}
+
 static void * stbi__pvr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
 	stbi_uc *pvr_data = NULL;
@@ -942,15 +1219,32 @@ static void * stbi__pvr_load(stbi__context *s, int *x, int *y, int *comp, int re
 	// Load only the first mip map level
 	levelSize = (s->img_x * s->img_y * header.dwBitCount + 7) / 8;
 
+	// the decoder reads at least 2x2 blocks, which is what the file stores for small levels
+	if ( iscompressed ) {
+		unsigned int blocks = PVRT_MAX( 2, s->img_x / ( bitmode ? BLK_X_2BPP : BLK_X_4BPP ) ) * PVRT_MAX( 2, s->img_y / BLK_Y_SIZE );
+		levelSize = PVRT_MAX( levelSize, blocks * sizeof(AMTC_BLOCK_STRUCT) );
+	}
+
 	// get the raw data
-	pvr_data = (stbi_uc *)malloc( levelSize );
-	stbi__getn( s, pvr_data, levelSize );
+	pvr_data = (stbi_uc *)STBI_MALLOC( levelSize );
+	if ( NULL == pvr_data ) {
+		return stbi__errpuc("outofmem", "Out of memory");
+	}
+
+	if ( !stbi__getn( s, pvr_data, levelSize ) ) {
+		STBI_FREE( pvr_data );
+		return stbi__errpuc("bad file", "PVR file too short");
+	}
 
 	// if compressed decompress as RGBA
 	if ( iscompressed ) {
-		pvr_res_data = (stbi_uc *)malloc( s->img_x * s->img_y * 4 );
-		Decompress( (AMTC_BLOCK_STRUCT*)pvr_data, bitmode, s->img_x, s->img_y, 1, (unsigned char*)pvr_res_data );
-		free( pvr_data );
+		pvr_res_data = (stbi_uc *)STBI_MALLOC( s->img_x * s->img_y * 4 );
+		if ( NULL == pvr_res_data ) {
+			STBI_FREE( pvr_data );
+			return stbi__errpuc("outofmem", "Out of memory");
+		}
+		DecompressTiled( (AMTC_BLOCK_STRUCT*)pvr_data, bitmode, s->img_x, s->img_y, (unsigned char*)pvr_res_data );
+		STBI_FREE( pvr_data );
 	} else {
 		// otherwise use the raw data
 		pvr_res_data = pvr_data;
@@ -1,18 +1,11 @@
-
 #include "wfETC.h"
+#include "image_parallel.h"
+#include <string.h>
 
 // specification: http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
-
-#ifdef WF_LITTLE_ENDIAN
-	#define WF_ETC1_COLOR_OFFSET( offset ) ( (64-(offset)) - (4-((offset)%8))*2 )
-	#define WF_ETC1_PIXEL_OFFSET( offset ) ( (32-(offset)) - (4-((offset)%8))*2 )
-#else
-	#define WF_ETC1_COLOR_OFFSET( offset ) (offset-32)
-	#define WF_ETC1_PIXEL_OFFSET( offset ) offset
-#endif
+// ETC2 / EAC: OpenGL ES 3.0 specification, appendix C
 
 #define WF_INLINE
-#define WF_ASSUME( expr )
 
 #ifndef WF_EXPECT
 	#if defined __GNUC__ && __GNUC__
@@ -22,8 +15,22 @@
 	#endif
 #endif
 
+#if !defined( WF_ETC_NO_SIMD ) && ( defined( __x86_64__ ) || defined( _M_X64 ) || defined( __i386__ ) || defined( _M_IX86 ) )
+	#define WF_ETC_SSSE3
+	#include <tmmintrin.h>
+	#if defined __GNUC__ || defined __clang__
+		#define WF_ETC_TARGET_SSSE3 __attribute__(( target( "ssse3" ) ))
+	#else
+		#include <intrin.h>
+		#define WF_ETC_TARGET_SSSE3
+	#endif
+#endif
+
+// block rows a decode thread should get at least, below that threads cost more than they save
+#define WF_ETC_ROWS_PER_THREAD 16
+
 // this table is rearranged from the specification so we do not have to add any logic to index into it
-const int32_t wfETC_IntensityTables[8][4] = 
+const int16_t wfETC_IntensityTables[8][4] =
 {
 	{  2,   8,  -2, -8   },
 	{  5,  17,  -5, -17  },
@@ -35,6 +42,49 @@ const int32_t wfETC_IntensityTables[8][4] =
 	{ 47, 183, -47, -183 }
 };
 
+// T and H mode distances
+const int32_t wfETC2_DistanceTable[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+// EAC alpha modifiers, indexed by the 3 bit pixel index
+const int32_t wfETC2_AlphaModifierTables[16][8] =
+{
+	{ -3, -6,  -9, -15, 2, 5, 8, 14 },
+	{ -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5,  -8, -13, 1, 4, 7, 12 },
+	{ -2, -4,  -6, -13, 1, 3, 5, 12 },
+	{ -3, -6,  -8, -12, 2, 5, 7, 11 },
+	{ -3, -7,  -9, -11, 2, 6, 8, 10 },
+	{ -4, -7,  -8, -11, 3, 6, 7, 10 },
+	{ -3, -5,  -8, -11, 2, 4, 7, 10 },
+	{ -2, -6,  -8, -10, 1, 5, 7,  9 },
+	{ -2, -5,  -8, -10, 1, 4, 7,  9 },
+	{ -2, -4,  -8, -10, 1, 3, 7,  9 },
+	{ -2, -5,  -7, -10, 1, 4, 6,  9 },
+	{ -3, -4,  -7, -10, 2, 3, 6,  9 },
+	{ -1, -2,  -3, -10, 0, 1, 2,  9 },
+	{ -4, -6,  -8,  -9, 3, 5, 7,  8 },
+	{ -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+const int32_t wfETC1_Color3IdxLUT[] = { 0, 1, 2, 3, -4, -3, -2, -1 };
+
+// Every mode but planar boils down to at most eight colors per block, picked per pixel by
+// sub-block*4 + 2 bit index, each color being a base color plus a modifier. Blocks are parsed
+// into this palette, then the scalar or SSSE3 writer clamps it and expands it to pixels.
+typedef struct _wfETC_Palette
+{
+	int16_t base[3][8];				// [r,g,b][sub-block*4 + pixel index]
+	int16_t modifier[8];
+	uint32_t transparent;			// punch-through: entries decoding to transparent black, one bit each
+	uint32_t pixels;				// msb of every pixel index in bits 31..16, lsb in 15..0, bit x*4+y
+	int32_t flip;					// sub-blocks are 4x2 instead of 2x4
+	int32_t planar;
+	int32_t planarColors[3][3];		// [origin, horizontal, vertical][r,g,b]
+	int32_t hasAlpha;				// EAC: alpha[] is indexed by alphaIndices
+	uint8_t alpha[8];
+	uint8_t alphaIndices[16];		// raster order
+} wfETC_Palette;
+
 WF_INLINE
 int32_t wfETC_ClampColor( const int32_t x )
 {
@@ -43,186 +93,538 @@ int32_t wfETC_ClampColor( const int32_t x )
 	return x;
 }
 
-#define WF_ETC1_BUILD_COLOR( dst, blockIdx, colorIdx, intensityTable, baseColor ) \
-	dst[ blockIdx ][ colorIdx ] = WF_ETC_RGBA( \
-		wfETC_ClampColor( intensityTable[ blockIdx ][ colorIdx ] + baseColor[ blockIdx ][ 0 ] ), \
-		wfETC_ClampColor( intensityTable[ blockIdx ][ colorIdx ] + baseColor[ blockIdx ][ 1 ] ), \
-		wfETC_ClampColor( intensityTable[ blockIdx ][ colorIdx ] + baseColor[ blockIdx ][ 2 ] ), \
-		255 \
-	);
+WF_INLINE
+uint32_t wfETC_ReadBigEndian32( const uint8_t* src )
+{
+	return ( (uint32_t)src[0] << 24 ) | ( (uint32_t)src[1] << 16 ) | ( (uint32_t)src[2] << 8 ) | (uint32_t)src[3];
+}
 
-typedef struct _wfETC1_Block
+WF_INLINE
+int32_t wfETC_Extend4( const int32_t x )
 {
-	int32_t baseColorsAndFlags;
-	int32_t pixels;
-} wfETC1_Block;
+	return x | (x<<4);
+}
 
-#define WF_ETC1_CHECK_DIFF_BIT( block ) ( block->baseColorsAndFlags & (1<<WF_ETC1_COLOR_OFFSET(33)) )
-#define WF_ETC1_CHECK_FLIP_BIT( block ) ( block->baseColorsAndFlags & (1<<WF_ETC1_COLOR_OFFSET(32)) )
+// 5 bit base plus signed 3 bit delta, kept unclamped like the reference decoder so
+// out of range ETC1 deltas decode the same as they always did
+WF_INLINE
+int32_t wfETC_Extend5( const int32_t x )
+{
+	return (x<<3) | ((x>>2) & 0x7);
+}
 
 WF_INLINE
-int32_t wfETC1_ReadColor4( const wfETC1_Block* block, const uint32_t offset )
+int32_t wfETC_Extend6( const int32_t x )
 {
-	const uint32_t bitOffset = WF_ETC1_COLOR_OFFSET(offset);
-	const int32_t color = ( block->baseColorsAndFlags >> bitOffset ) & 0xf;
-	return color | (color<<4);
+	return (x<<2) | (x>>4);
 }
 
-const int32_t wfETC1_Color3IdxLUT[] = { 0, 1, 2, 3, -4, -3, -2, -1 };
+WF_INLINE
+int32_t wfETC_Extend7( const int32_t x )
+{
+	return (x<<1) | (x>>6);
+}
 
 WF_INLINE
-void wfETC1_ReadColor53( const wfETC1_Block* block, const uint32_t offset3, int32_t* WF_RESTRICT dst5, int32_t* WF_RESTRICT dst3 )
+void wfETC_SetBase( wfETC_Palette* WF_RESTRICT palette, const int32_t entry, const int32_t count, const int32_t r, const int32_t g, const int32_t b )
 {
-	// read the 5 bit color and expand to 8 bit
+	int32_t i;
+	if( WF_EXPECT( count == 4, 1 ) )
 	{
-		const uint32_t bitOffset = WF_ETC1_COLOR_OFFSET((offset3+3));
-		const int32_t color = ( block->baseColorsAndFlags >> (bitOffset-3) ) & 0xf8;
-		*dst5 = color | (color>>5);
+		// a whole sub-block, four lanes per store
+		const uint64_t lanes = 0x0001000100010001ull;
+		const uint64_t rrrr = (uint64_t)(uint16_t)r * lanes, gggg = (uint64_t)(uint16_t)g * lanes, bbbb = (uint64_t)(uint16_t)b * lanes;
+		memcpy( &palette->base[0][entry], &rrrr, sizeof( rrrr ) );
+		memcpy( &palette->base[1][entry], &gggg, sizeof( gggg ) );
+		memcpy( &palette->base[2][entry], &bbbb, sizeof( bbbb ) );
+		return;
 	}
-
-	// read the 3 bit color and expand to 8 bit
+	for( i = entry; i < entry + count; ++i )
 	{
-		const uint32_t bitOffset = WF_ETC1_COLOR_OFFSET(offset3);
-		const int32_t offset = wfETC1_Color3IdxLUT[ ( block->baseColorsAndFlags >> bitOffset ) & 0x7 ];
-		int32_t color = (*dst5>>3) + offset;
-		color <<= 3;
-		color |= (color>>5) & 0x7;
-		*dst3 = color;
+		palette->base[0][i] = (int16_t)r;
+		palette->base[1][i] = (int16_t)g;
+		palette->base[2][i] = (int16_t)b;
 	}
 }
 
 WF_INLINE
-int32_t wfETC1_ReadPixel( const wfETC1_Block* block, const uint32_t offset )
+void wfETC_SetModifiers( wfETC_Palette* WF_RESTRICT palette, const uint8_t* src )
 {
-	return
-		(  (block->pixels>>WF_ETC1_PIXEL_OFFSET(offset)) & 0x1  )
-		|
-		(  ( (block->pixels>>WF_ETC1_PIXEL_OFFSET(16+offset)) & 0x1 ) << 1 )
-	;
+	memcpy( palette->modifier,     wfETC_IntensityTables[ src[3] >> 5 ],           sizeof( wfETC_IntensityTables[0] ) );
+	memcpy( palette->modifier + 4, wfETC_IntensityTables[ ( src[3] >> 2 ) & 0x7 ], sizeof( wfETC_IntensityTables[0] ) );
 }
 
-void wfETC1_DecodeBlock( const void* WF_RESTRICT src, void* WF_RESTRICT pDst, const uint32_t dstStride )
+void wfETC1_ParseBlock( const uint8_t* WF_RESTRICT src, wfETC_Palette* WF_RESTRICT palette )
 {
-	const wfETC1_Block* WF_RESTRICT block = ( wfETC1_Block* )src;
-	int32_t* WF_RESTRICT dst = (int32_t*)pDst;
-
+	// individual and differential blocks are mixed about evenly in real data, so both
+	// decodings are computed and selected rather than branched on
+	const int32_t differential = src[3] & 0x2;
 	int32_t baseColors[2][3]; // [sub-block][r,g,b]
-	int32_t colors[2][4]; // [sub-block][colorIdx]
+	int32_t c;
+
+	palette->pixels = wfETC_ReadBigEndian32( src + 4 );
+	palette->flip = src[3] & 0x1;
+	palette->planar = 0;
+	palette->transparent = 0;
+	palette->hasAlpha = 0;
+
+	for( c = 0; c < 3; ++c )
+	{
+		const int32_t color5 = src[c] >> 3;
+		baseColors[0][c] = differential ? wfETC_Extend5( color5 ) : wfETC_Extend4( src[c] >> 4 );
+		baseColors[1][c] = differential ? wfETC_Extend5( color5 + wfETC1_Color3IdxLUT[ src[c] & 0x7 ] ) : wfETC_Extend4( src[c] & 0xf );
+	}
+
+	wfETC_SetBase( palette, 0, 4, baseColors[0][0], baseColors[0][1], baseColors[0][2] );
+	wfETC_SetBase( palette, 4, 4, baseColors[1][0], baseColors[1][1], baseColors[1][2] );
+	wfETC_SetModifiers( palette, src );
+}
+
+// T and H modes paint four colors, the same for both halves of the palette
+void wfETC2_SetPaintModifiers( wfETC_Palette* WF_RESTRICT palette, const int16_t m0, const int16_t m1, const int16_t m2, const int16_t m3 )
+{
+	palette->modifier[0] = palette->modifier[4] = m0;
+	palette->modifier[1] = palette->modifier[5] = m1;
+	palette->modifier[2] = palette->modifier[6] = m2;
+	palette->modifier[3] = palette->modifier[7] = m3;
+}
+
+void wfETC2_ParseBlock( const uint8_t* WF_RESTRICT src, wfETC_Palette* WF_RESTRICT palette, const int32_t punchThrough )
+{
+	// with punch-through alpha there is no individual mode, the diff bit says whether the block is opaque
+	const int32_t nonOpaque = punchThrough && ( src[3] & 0x2 ) == 0;
+	int32_t r, g, b;
+
+	if( !punchThrough && ( src[3] & 0x2 ) == 0 )
+	{
+		wfETC1_ParseBlock( src, palette );
+		return;
+	}
+
+	palette->pixels = wfETC_ReadBigEndian32( src + 4 );
+	palette->flip = src[3] & 0x1;
+	palette->planar = 0;
+	palette->hasAlpha = 0;
+	// index 2 of either sub-block
+	palette->transparent = nonOpaque ? 0x44 : 0;
+
+	// the second base color overflowing in the differential encoding selects the extra modes
+	r = ( src[0] >> 3 ) + wfETC1_Color3IdxLUT[ src[0] & 0x7 ];
+	g = ( src[1] >> 3 ) + wfETC1_Color3IdxLUT[ src[1] & 0x7 ];
+	b = ( src[2] >> 3 ) + wfETC1_Color3IdxLUT[ src[2] & 0x7 ];
+
+	// T mode: C1, C2 + d, C2, C2 - d
+	if( WF_EXPECT( r < 0 || r > 31, 0 ) )
+	{
+		const int16_t distance = (int16_t)wfETC2_DistanceTable[ ( ( src[3] >> 1 ) & 0x6 ) | ( src[3] & 0x1 ) ];
+		const int32_t r1 = wfETC_Extend4( ( ( src[0] >> 1 ) & 0xc ) | ( src[0] & 0x3 ) );
+		const int32_t g1 = wfETC_Extend4( src[1] >> 4 );
+		const int32_t b1 = wfETC_Extend4( src[1] & 0xf );
+		const int32_t r2 = wfETC_Extend4( src[2] >> 4 );
+		const int32_t g2 = wfETC_Extend4( src[2] & 0xf );
+		const int32_t b2 = wfETC_Extend4( src[3] >> 4 );
+		wfETC_SetBase( palette, 0, 1, r1, g1, b1 );
+		wfETC_SetBase( palette, 1, 3, r2, g2, b2 );
+		wfETC_SetBase( palette, 4, 1, r1, g1, b1 );
+		wfETC_SetBase( palette, 5, 3, r2, g2, b2 );
+		wfETC2_SetPaintModifiers( palette, 0, distance, 0, (int16_t)-distance );
+		return;
+	}
+
+	// H mode: C1 + d, C1 - d, C2 + d, C2 - d
+	if( WF_EXPECT( g < 0 || g > 31, 0 ) )
+	{
+		const int32_t r1 = wfETC_Extend4( ( src[0] >> 3 ) & 0xf );
+		const int32_t g1 = wfETC_Extend4( ( ( src[0] & 0x7 ) << 1 ) | ( ( src[1] >> 4 ) & 0x1 ) );
+		const int32_t b1 = wfETC_Extend4( ( src[1] & 0x8 ) | ( ( src[1] & 0x3 ) << 1 ) | ( src[2] >> 7 ) );
+		const int32_t r2 = wfETC_Extend4( ( src[2] >> 3 ) & 0xf );
+		const int32_t g2 = wfETC_Extend4( ( ( src[2] & 0x7 ) << 1 ) | ( src[3] >> 7 ) );
+		const int32_t b2 = wfETC_Extend4( ( src[3] >> 3 ) & 0xf );
+		// the lowest distance bit is implied by the order of the two colors
+		const int16_t distance = (int16_t)wfETC2_DistanceTable[ ( src[3] & 0x4 ) | ( ( src[3] & 0x1 ) << 1 ) |
+			( ( ( r1 << 16 ) | ( g1 << 8 ) | b1 ) >= ( ( r2 << 16 ) | ( g2 << 8 ) | b2 ) ) ];
+		wfETC_SetBase( palette, 0, 2, r1, g1, b1 );
+		wfETC_SetBase( palette, 2, 2, r2, g2, b2 );
+		wfETC_SetBase( palette, 4, 2, r1, g1, b1 );
+		wfETC_SetBase( palette, 6, 2, r2, g2, b2 );
+		wfETC2_SetPaintModifiers( palette, distance, (int16_t)-distance, distance, (int16_t)-distance );
+		return;
+	}
 
-	// individual mode
-	if( WF_ETC1_CHECK_DIFF_BIT( block ) == 0 )
+	// planar mode, always opaque
+	if( WF_EXPECT( b < 0 || b > 31, 0 ) )
 	{
-		baseColors[0][0] = wfETC1_ReadColor4( block, 60 );
-		baseColors[0][1] = wfETC1_ReadColor4( block, 52 );
-		baseColors[0][2] = wfETC1_ReadColor4( block, 44 );
-		baseColors[1][0] = wfETC1_ReadColor4( block, 56 );
-		baseColors[1][1] = wfETC1_ReadColor4( block, 48 );
-		baseColors[1][2] = wfETC1_ReadColor4( block, 40 );
+		palette->planar = 1;
+		palette->planarColors[0][0] = wfETC_Extend6( ( src[0] >> 1 ) & 0x3f );
+		palette->planarColors[0][1] = wfETC_Extend7( ( ( src[0] & 0x1 ) << 6 ) | ( ( src[1] >> 1 ) & 0x3f ) );
+		palette->planarColors[0][2] = wfETC_Extend6( ( ( src[1] & 0x1 ) << 5 ) | ( src[2] & 0x18 ) | ( ( src[2] & 0x3 ) << 1 ) | ( src[3] >> 7 ) );
+		palette->planarColors[1][0] = wfETC_Extend6( ( ( src[3] >> 1 ) & 0x3e ) | ( src[3] & 0x1 ) );
+		palette->planarColors[1][1] = wfETC_Extend7( ( src[4] >> 1 ) & 0x7f );
+		palette->planarColors[1][2] = wfETC_Extend6( ( ( src[4] & 0x1 ) << 5 ) | ( src[5] >> 3 ) );
+		palette->planarColors[2][0] = wfETC_Extend6( ( ( src[5] & 0x7 ) << 3 ) | ( src[6] >> 5 ) );
+		palette->planarColors[2][1] = wfETC_Extend7( ( ( src[6] & 0x1f ) << 2 ) | ( src[7] >> 6 ) );
+		palette->planarColors[2][2] = wfETC_Extend6( src[7] & 0x3f );
+		palette->transparent = 0;
+		return;
 	}
+
 	// differential mode
-	else
+	wfETC_SetBase( palette, 0, 4, wfETC_Extend5( src[0] >> 3 ), wfETC_Extend5( src[1] >> 3 ), wfETC_Extend5( src[2] >> 3 ) );
+	wfETC_SetBase( palette, 4, 4, wfETC_Extend5( r ), wfETC_Extend5( g ), wfETC_Extend5( b ) );
+	wfETC_SetModifiers( palette, src );
+	if( nonOpaque )
+	{
+		// the small positive modifier goes away in non-opaque blocks
+		palette->modifier[0] = palette->modifier[4] = 0;
+	}
+}
+
+// EAC alpha block: base, multiplier and table, then 16 three bit indices
+void wfETC2_ParseAlpha( const uint8_t* WF_RESTRICT src, wfETC_Palette* WF_RESTRICT palette )
+{
+	const int32_t base = src[0];
+	const int32_t multiplier = src[1] >> 4;
+	const int32_t* modifiers = wfETC2_AlphaModifierTables[ src[1] & 0xf ];
+	const uint64_t indices = ( (uint64_t)src[2] << 40 ) | ( (uint64_t)src[3] << 32 ) | ( (uint64_t)wfETC_ReadBigEndian32( src + 4 ) );
+	int32_t i;
+
+	for( i = 0; i < 8; ++i )
+	{
+		palette->alpha[i] = (uint8_t)wfETC_ClampColor( base + modifiers[i] * multiplier );
+	}
+	// indices are stored column by column
+	for( i = 0; i < 16; ++i )
+	{
+		palette->alphaIndices[ ( i & 3 ) * 4 + ( i >> 2 ) ] = (uint8_t)( ( indices >> ( 45 - 3*i ) ) & 0x7 );
+	}
+	palette->hasAlpha = 1;
+}
+
+void wfETC_ParseBlock( const uint8_t* WF_RESTRICT src, wfETC_Palette* WF_RESTRICT palette, const wfETC_Format format )
+{
+	switch( format )
+	{
+	case WF_ETC2_RGB8:
+		wfETC2_ParseBlock( src, palette, 0 );
+		break;
+	case WF_ETC2_RGB8A1:
+		wfETC2_ParseBlock( src, palette, 1 );
+		break;
+	case WF_ETC2_RGBA8:
+		wfETC2_ParseBlock( src + 8, palette, 0 );
+		wfETC2_ParseAlpha( src, palette );
+		break;
+	default:
+		wfETC1_ParseBlock( src, palette );
+		break;
+	}
+}
+
+// dstStride in bytes
+void wfETC_WritePlanar( const wfETC_Palette* WF_RESTRICT palette, uint8_t* WF_RESTRICT dst, const uint32_t dstStride )
+{
+	const int32_t (*colors)[3] = palette->planarColors;
+	int32_t x, y, c;
+	for( y = 0; y < 4; ++y )
+	{
+		uint8_t* row = dst + y*dstStride;
+		for( x = 0; x < 4; ++x )
+		{
+			for( c = 0; c < 3; ++c )
+			{
+				row[x*4+c] = (uint8_t)wfETC_ClampColor( ( x*( colors[1][c] - colors[0][c] ) + y*( colors[2][c] - colors[0][c] ) + 4*colors[0][c] + 2 ) >> 2 );
+			}
+			row[x*4+3] = palette->hasAlpha ? palette->alpha[ palette->alphaIndices[y*4+x] ] : 255;
+		}
+	}
+}
+
+void wfETC_WritePalette( const wfETC_Palette* WF_RESTRICT palette, uint8_t* WF_RESTRICT dst, const uint32_t dstStride )
+{
+	const uint32_t pixels = palette->pixels;
+	uint8_t colors[8][4];
+	uint32_t x, y, c;
+
+	for( x = 0; x < 8; ++x )
 	{
-		wfETC1_ReadColor53( block, 56, &baseColors[0][0], &baseColors[1][0] );
-		wfETC1_ReadColor53( block, 48, &baseColors[0][1], &baseColors[1][1] );
-		wfETC1_ReadColor53( block, 40, &baseColors[0][2], &baseColors[1][2] );
+		const int32_t transparent = ( palette->transparent >> x ) & 0x1;
+		for( c = 0; c < 3; ++c )
+		{
+			colors[x][c] = transparent ? 0 : (uint8_t)wfETC_ClampColor( palette->base[c][x] + palette->modifier[x] );
+		}
+		colors[x][3] = transparent ? 0 : 255;
 	}
 
-	// build color tables
+	for( y = 0; y < 4; ++y )
 	{
-		const int32_t* intensityTable[2] = // [sub-block]
+		uint8_t* row = dst + y*dstStride;
+		for( x = 0; x < 4; ++x )
 		{
-			wfETC_IntensityTables[ ( block->baseColorsAndFlags >> WF_ETC1_COLOR_OFFSET(37) ) & 0x7 ],
-			wfETC_IntensityTables[ ( block->baseColorsAndFlags >> WF_ETC1_COLOR_OFFSET(34) ) & 0x7 ]
-		};
-		WF_ETC1_BUILD_COLOR( colors, 0, 0, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 0, 1, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 0, 2, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 0, 3, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 1, 0, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 1, 1, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 1, 2, intensityTable, baseColors );
-		WF_ETC1_BUILD_COLOR( colors, 1, 3, intensityTable, baseColors );
-	}
-
-	// vertical split
-	if( WF_ETC1_CHECK_FLIP_BIT( block ) == 0 )
-	{
-		// row 0
-		dst[0] = colors[0][ wfETC1_ReadPixel( block, 0  ) ];
-		dst[1] = colors[0][ wfETC1_ReadPixel( block, 4  ) ];
-		dst[2] = colors[1][ wfETC1_ReadPixel( block, 8  ) ];
-		dst[3] = colors[1][ wfETC1_ReadPixel( block, 12 ) ];
-		dst += dstStride;
-
-		// row 1
-		dst[0] = colors[0][ wfETC1_ReadPixel( block, 1  ) ];
-		dst[1] = colors[0][ wfETC1_ReadPixel( block, 5  ) ];
-		dst[2] = colors[1][ wfETC1_ReadPixel( block, 9  ) ];
-		dst[3] = colors[1][ wfETC1_ReadPixel( block, 13 ) ];
-		dst += dstStride;
-
-		// row 2
-		dst[0] = colors[0][ wfETC1_ReadPixel( block, 2  ) ];
-		dst[1] = colors[0][ wfETC1_ReadPixel( block, 6  ) ];
-		dst[2] = colors[1][ wfETC1_ReadPixel( block, 10 ) ];
-		dst[3] = colors[1][ wfETC1_ReadPixel( block, 14 ) ];
-		dst += dstStride;
-
-		// row 3
-		dst[0] = colors[0][ wfETC1_ReadPixel( block, 3  ) ];
-		dst[1] = colors[0][ wfETC1_ReadPixel( block, 7  ) ];
-		dst[2] = colors[1][ wfETC1_ReadPixel( block, 11 ) ];
-		dst[3] = colors[1][ wfETC1_ReadPixel( block, 15 ) ];
-		//dst += dstStride;
-	}
-	// horizontal split
+			const uint32_t bit = x*4 + y;
+			const uint32_t idx = ( ( pixels >> ( 15 + bit ) ) & 0x2 ) | ( ( pixels >> bit ) & 0x1 );
+			const uint32_t entry = ( ( palette->flip ? y : x ) & 0x2 ) * 2 + idx;
+			row[x*4+0] = colors[entry][0];
+			row[x*4+1] = colors[entry][1];
+			row[x*4+2] = colors[entry][2];
+			row[x*4+3] = palette->hasAlpha ? palette->alpha[ palette->alphaIndices[y*4+x] ] : colors[entry][3];
+		}
+	}
+}
+
+#ifdef WF_ETC_SSSE3
+// All 16 pixels at once: each pixel's palette entry is built in a byte lane (lane = y*4+x),
+// then one pshufb per channel looks it up. redGreen holds the eight clamped red values followed
+// by the eight green ones, blueAlpha the same for blue and alpha.
+static WF_INLINE WF_ETC_TARGET_SSSE3
+void wfETC_ExpandSSSE3( const __m128i redGreen, const __m128i blueAlpha, const wfETC_Palette* WF_RESTRICT palette, const uint32_t pixels, const int32_t flip, uint8_t* WF_RESTRICT dst, const uint32_t dstStride )
+{
+	// pixel x,y has its index bits at bit x*4+y of each 16 bit plane: byte x/2, bit (x&1)*4+y
+	const __m128i planeByte = _mm_setr_epi8( 0,0,1,1, 0,0,1,1, 0,0,1,1, 0,0,1,1 );
+	const __m128i bitMask = _mm_setr_epi8( 1,16,1,16, 2,32,2,32, 4,64,4,64, 8,-128,8,-128 );
+	const __m128i subBlockColumns = _mm_setr_epi8( 0,0,4,4, 0,0,4,4, 0,0,4,4, 0,0,4,4 );
+	const __m128i subBlockRows = _mm_setr_epi8( 0,0,0,0, 0,0,0,0, 4,4,4,4, 4,4,4,4 );
+	const __m128i eight = _mm_set1_epi8( 8 );
+
+	const __m128i planes = _mm_cvtsi32_si128( (int)pixels );
+	const __m128i lsb = _mm_shuffle_epi8( planes, planeByte );
+	const __m128i msb = _mm_shuffle_epi8( planes, _mm_add_epi8( planeByte, _mm_set1_epi8( 2 ) ) );
+	const __m128i lsbSet = _mm_cmpeq_epi8( _mm_and_si128( lsb, bitMask ), bitMask );
+	const __m128i msbSet = _mm_cmpeq_epi8( _mm_and_si128( msb, bitMask ), bitMask );
+	const __m128i entry = _mm_or_si128(
+		_mm_or_si128( _mm_and_si128( msbSet, _mm_set1_epi8( 2 ) ), _mm_and_si128( lsbSet, _mm_set1_epi8( 1 ) ) ),
+		flip ? subBlockRows : subBlockColumns );
+	const __m128i alphaEntry = palette->hasAlpha ? _mm_loadu_si128( (const __m128i*)palette->alphaIndices ) : entry;
+
+	const __m128i r = _mm_shuffle_epi8( redGreen, entry );
+	const __m128i g = _mm_shuffle_epi8( redGreen, _mm_add_epi8( entry, eight ) );
+	const __m128i b = _mm_shuffle_epi8( blueAlpha, entry );
+	const __m128i a = _mm_shuffle_epi8( blueAlpha, _mm_add_epi8( alphaEntry, eight ) );
+
+	const __m128i rgLo = _mm_unpacklo_epi8( r, g );
+	const __m128i rgHi = _mm_unpackhi_epi8( r, g );
+	const __m128i baLo = _mm_unpacklo_epi8( b, a );
+	const __m128i baHi = _mm_unpackhi_epi8( b, a );
+
+	_mm_storeu_si128( (__m128i*)( dst               ), _mm_unpacklo_epi16( rgLo, baLo ) );
+	_mm_storeu_si128( (__m128i*)( dst + dstStride   ), _mm_unpackhi_epi16( rgLo, baLo ) );
+	_mm_storeu_si128( (__m128i*)( dst + dstStride*2 ), _mm_unpacklo_epi16( rgHi, baHi ) );
+	_mm_storeu_si128( (__m128i*)( dst + dstStride*3 ), _mm_unpackhi_epi16( rgHi, baHi ) );
+}
+
+static WF_INLINE WF_ETC_TARGET_SSSE3
+__m128i wfETC_AlphaSSSE3( const wfETC_Palette* WF_RESTRICT palette )
+{
+	return palette->hasAlpha ? _mm_loadl_epi64( (const __m128i*)palette->alpha ) : _mm_set1_epi8( -1 );
+}
+
+// T, H and punch-through blocks, from the parsed palette; the colors are clamped with saturating packs
+WF_ETC_TARGET_SSSE3
+void wfETC_WritePaletteSSSE3( const wfETC_Palette* WF_RESTRICT palette, uint8_t* WF_RESTRICT dst, const uint32_t dstStride )
+{
+	const __m128i entryBits = _mm_setr_epi8( 1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128 );
+	const __m128i modifier = _mm_loadu_si128( (const __m128i*)palette->modifier );
+	const __m128i red = _mm_add_epi16( _mm_loadu_si128( (const __m128i*)palette->base[0] ), modifier );
+	const __m128i green = _mm_add_epi16( _mm_loadu_si128( (const __m128i*)palette->base[1] ), modifier );
+	const __m128i blue = _mm_add_epi16( _mm_loadu_si128( (const __m128i*)palette->base[2] ), modifier );
+	const __m128i transparent = _mm_cmpeq_epi8( _mm_and_si128( _mm_set1_epi8( (char)palette->transparent ), entryBits ), entryBits );
+	const __m128i redGreen = _mm_andnot_si128( transparent, _mm_packus_epi16( red, green ) );
+	const __m128i blueAlpha = _mm_andnot_si128( transparent, _mm_unpacklo_epi64( _mm_packus_epi16( blue, blue ), wfETC_AlphaSSSE3( palette ) ) );
+	wfETC_ExpandSSSE3( redGreen, blueAlpha, palette, palette->pixels, palette->flip, dst, dstStride );
+}
+
+// Individual and differential blocks straight from the source bytes, both base color encodings
+// are computed in 16 bit lanes and the block's mode picks one. Going through wfETC_Palette
+// would stall on the store-to-load forwarding of its freshly written rows.
+WF_ETC_TARGET_SSSE3
+void wfETC1_DecodeBlockSSSE3( const uint8_t* WF_RESTRICT src, const wfETC_Palette* WF_RESTRICT alpha, uint8_t* WF_RESTRICT dst, const uint32_t dstStride )
+{
+	const __m128i seven = _mm_set1_epi16( 7 );
+	const __m128i colors = _mm_unpacklo_epi8( _mm_cvtsi32_si128( src[0] | ( src[1] << 8 ) | ( src[2] << 16 ) ), _mm_setzero_si128() );
+	__m128i base0, base1, bases;
+
+	if( src[3] & 0x2 )
+	{
+		const __m128i color5 = _mm_srli_epi16( colors, 3 );
+		const __m128i delta3 = _mm_sub_epi16( _mm_xor_si128( _mm_and_si128( colors, seven ), _mm_set1_epi16( 4 ) ), _mm_set1_epi16( 4 ) );
+		const __m128i color53 = _mm_add_epi16( color5, delta3 );
+		base0 = _mm_or_si128( _mm_slli_epi16( color5, 3 ), _mm_and_si128( _mm_srai_epi16( color5, 2 ), seven ) );
+		base1 = _mm_or_si128( _mm_slli_epi16( color53, 3 ), _mm_and_si128( _mm_srai_epi16( color53, 2 ), seven ) );
+	}
 	else
 	{
-		// row 0
-		dst[0] = colors[0][ wfETC1_ReadPixel( block, 0  ) ];
-		dst[1] = colors[0][ wfETC1_ReadPixel( block, 4  ) ];
-		dst[2] = colors[0][ wfETC1_ReadPixel( block, 8  ) ];
-		dst[3] = colors[0][ wfETC1_ReadPixel( block, 12 ) ];
-		dst += dstStride;
+		const __m128i high = _mm_srli_epi16( colors, 4 );
+		const __m128i low = _mm_and_si128( colors, _mm_set1_epi16( 0xf ) );
+		base0 = _mm_or_si128( high, _mm_slli_epi16( high, 4 ) );
+		base1 = _mm_or_si128( low, _mm_slli_epi16( low, 4 ) );
+	}
+	bases = _mm_unpacklo_epi64( base0, base1 );
+
+	{
+		const __m128i modifier = _mm_unpacklo_epi64(
+			_mm_loadl_epi64( (const __m128i*)wfETC_IntensityTables[ src[3] >> 5 ] ),
+			_mm_loadl_epi64( (const __m128i*)wfETC_IntensityTables[ ( src[3] >> 2 ) & 0x7 ] ) );
+		// broadcast each sub-block's base color to its four palette entries
+		const __m128i red = _mm_add_epi16( _mm_shuffle_epi8( bases, _mm_setr_epi8( 0,1,0,1,0,1,0,1, 8,9,8,9,8,9,8,9 ) ), modifier );
+		const __m128i green = _mm_add_epi16( _mm_shuffle_epi8( bases, _mm_setr_epi8( 2,3,2,3,2,3,2,3, 10,11,10,11,10,11,10,11 ) ), modifier );
+		const __m128i blue = _mm_add_epi16( _mm_shuffle_epi8( bases, _mm_setr_epi8( 4,5,4,5,4,5,4,5, 12,13,12,13,12,13,12,13 ) ), modifier );
+		const __m128i redGreen = _mm_packus_epi16( red, green );
+		const __m128i blueAlpha = _mm_unpacklo_epi64( _mm_packus_epi16( blue, blue ), wfETC_AlphaSSSE3( alpha ) );
+		wfETC_ExpandSSSE3( redGreen, blueAlpha, alpha, wfETC_ReadBigEndian32( src + 4 ), src[3] & 0x1, dst, dstStride );
+	}
+}
+
+int wfETC_HasSSSE3( void )
+{
+	static int hasSSSE3 = -1;
+	if( hasSSSE3 < 0 )
+	{
+#if defined __GNUC__ || defined __clang__
+		__builtin_cpu_init();
+		hasSSSE3 = __builtin_cpu_supports( "ssse3" ) ? 1 : 0;
+#else
+		int info[4];
+		__cpuid( info, 1 );
+		hasSSSE3 = ( info[2] & ( 1<<9 ) ) ? 1 : 0;
+#endif
+	}
+	return hasSSSE3;
+}
+#endif
+
+void wfETC_WriteBlock( const wfETC_Palette* WF_RESTRICT palette, uint8_t* WF_RESTRICT dst, const uint32_t dstStride, const int32_t simd )
+{
+	if( WF_EXPECT( palette->planar, 0 ) )
+	{
+		wfETC_WritePlanar( palette, dst, dstStride );
+		return;
+	}
+#ifdef WF_ETC_SSSE3
+	if( simd )
+	{
+		wfETC_WritePaletteSSSE3( palette, dst, dstStride );
+		return;
+	}
+#endif
+	(void)simd;
+	wfETC_WritePalette( palette, dst, dstStride );
+}
+
+void wfETC1_DecodeBlock( const void* WF_RESTRICT src, void* WF_RESTRICT pDst, const uint32_t dstStride )
+{
+	wfETC_Palette palette;
+	wfETC1_ParseBlock( (const uint8_t*)src, &palette );
+	wfETC_WritePalette( &palette, (uint8_t*)pDst, dstStride*4 );
+}
+
+void wfETC2_DecodeBlock( const void* WF_RESTRICT src, void* WF_RESTRICT pDst, const uint32_t dstStride, const wfETC_Format format )
+{
+	wfETC_Palette palette;
+	wfETC_ParseBlock( (const uint8_t*)src, &palette, format );
+	wfETC_WriteBlock( &palette, (uint8_t*)pDst, dstStride*4, 0 );
+}
 
-		// row 1
-		dst[0] = colors[0][ wfETC1_ReadPixel( block, 1  ) ];
-		dst[1] = colors[0][ wfETC1_ReadPixel( block, 5  ) ];
-		dst[2] = colors[0][ wfETC1_ReadPixel( block, 9  ) ];
-		dst[3] = colors[0][ wfETC1_ReadPixel( block, 13 ) ];
-		dst += dstStride;
+uint32_t wfETC_ImageSize( const uint32_t width, const uint32_t height, const wfETC_Format format )
+{
+	return ( (width+3)/4 ) * ( (height+3)/4 ) * ( format == WF_ETC2_RGBA8 ? 16 : 8 );
+}
 
-		// row 2
-		dst[0] = colors[1][ wfETC1_ReadPixel( block, 2  ) ];
-		dst[1] = colors[1][ wfETC1_ReadPixel( block, 6  ) ];
-		dst[2] = colors[1][ wfETC1_ReadPixel( block, 10 ) ];
-		dst[3] = colors[1][ wfETC1_ReadPixel( block, 14 ) ];
-		dst += dstStride;
+typedef struct _wfETC_DecodeJob
+{
+	const uint8_t* src;
+	uint8_t* dst;
+	uint32_t width;
+	uint32_t height;
+	wfETC_Format format;
+	int32_t simd;
+} wfETC_DecodeJob;
 
-		// row 3
-		dst[0] = colors[1][ wfETC1_ReadPixel( block, 3  ) ];
-		dst[1] = colors[1][ wfETC1_ReadPixel( block, 7  ) ];
-		dst[2] = colors[1][ wfETC1_ReadPixel( block, 11 ) ];
-		dst[3] = colors[1][ wfETC1_ReadPixel( block, 15 ) ];
-		//dst += dstStride;
+// true for blocks that decode exactly like ETC1: no T, H or planar mode and no punch-through alpha
+WF_INLINE
+int32_t wfETC_IsETC1Block( const uint8_t* WF_RESTRICT src, const wfETC_Format format )
+{
+	if( format == WF_ETC1_RGB8 || ( format != WF_ETC2_RGB8A1 && ( src[3] & 0x2 ) == 0 ) )
+	{
+		return 1;
 	}
+	if( ( src[3] & 0x2 ) == 0 )
+	{
+		return 0;
+	}
+	return (uint32_t)( ( src[0] >> 3 ) + wfETC1_Color3IdxLUT[ src[0] & 0x7 ] ) < 32 &&
+		(uint32_t)( ( src[1] >> 3 ) + wfETC1_Color3IdxLUT[ src[1] & 0x7 ] ) < 32 &&
+		(uint32_t)( ( src[2] >> 3 ) + wfETC1_Color3IdxLUT[ src[2] & 0x7 ] ) < 32;
 }
 
-void wfETC1_DecodeImage( const void* WF_RESTRICT pSrc, void* WF_RESTRICT pDst, const uint32_t width, const uint32_t height )
+void wfETC_DecodeRows( void* context, int begin, int end )
 {
-	const uint8_t* WF_RESTRICT src = (uint8_t*)pSrc;
-	uint8_t* WF_RESTRICT dst = (uint8_t*)pDst;
-	const uint32_t widthBlocks  = width/4;
-	const uint32_t heightBlocks = height/4;
-	uint32_t x, y;
-	for( y = 0; y != heightBlocks; ++y )
+	const wfETC_DecodeJob* job = (const wfETC_DecodeJob*)context;
+	const uint32_t blockSize = job->format == WF_ETC2_RGBA8 ? 16 : 8;
+	const uint32_t colorOffset = job->format == WF_ETC2_RGBA8 ? 8 : 0;
+	const uint32_t widthBlocks = ( job->width + 3 ) / 4;
+	const uint32_t stride = job->width * 4;
+	uint8_t edge[4*4*4];
+	uint32_t x, y, row;
+
+	for( y = (uint32_t)begin; y < (uint32_t)end; ++y )
 	{
-		for( x = 0; x != widthBlocks; ++x )
+		const uint8_t* src = job->src + (size_t)y * widthBlocks * blockSize;
+		uint8_t* dst = job->dst + (size_t)y * 4 * stride;
+		const uint32_t rows = job->height - y*4 < 4 ? job->height - y*4 : 4;
+
+		for( x = 0; x < widthBlocks; ++x, src += blockSize, dst += 16 )
 		{
-			wfETC1_DecodeBlock( src, dst, width );
-			src += 8;
-			dst += 16;
+			// blocks hanging over the right or bottom edge are decoded aside and clipped
+			const int32_t inside = rows == 4 && x*4 + 4 <= job->width;
+			uint8_t* target = WF_EXPECT( inside, 1 ) ? dst : edge;
+			const uint32_t targetStride = WF_EXPECT( inside, 1 ) ? stride : 16;
+			wfETC_Palette palette;
+
+#ifdef WF_ETC_SSSE3
+			if( job->simd && wfETC_IsETC1Block( src + colorOffset, job->format ) )
+			{
+				palette.hasAlpha = 0;
+				if( job->format == WF_ETC2_RGBA8 )
+				{
+					wfETC2_ParseAlpha( src, &palette );
+				}
+				wfETC1_DecodeBlockSSSE3( src + colorOffset, &palette, target, targetStride );
+			}
+			else
+#endif
+			{
+				wfETC_ParseBlock( src, &palette, job->format );
+				wfETC_WriteBlock( &palette, target, targetStride, job->simd );
+			}
+
+			if( WF_EXPECT( !inside, 0 ) )
+			{
+				const uint32_t columns = job->width - x*4 < 4 ? job->width - x*4 : 4;
+				for( row = 0; row < rows; ++row )
+				{
+					memcpy( dst + row*stride, edge + row*16, columns*4 );
+				}
+			}
 		}
-		dst += width*4*3;
 	}
 }
+
+void wfETC_DecodeImage( const void* WF_RESTRICT pSrc, void* WF_RESTRICT pDst, const uint32_t width, const uint32_t height, const wfETC_Format format )
+{
+	wfETC_DecodeJob job;
+	job.src = (const uint8_t*)pSrc;
+	job.dst = (uint8_t*)pDst;
+	job.width = width;
+	job.height = height;
+	job.format = format;
+#ifdef WF_ETC_SSSE3
+	job.simd = wfETC_HasSSSE3();
+#else
+	job.simd = 0;
+#endif
+	SOIL_parallel_for( (int)( ( height + 3 ) / 4 ), WF_ETC_ROWS_PER_THREAD, wfETC_DecodeRows, &job );
+}
+
+void wfETC1_DecodeImage( const void* WF_RESTRICT pSrc, void* WF_RESTRICT pDst, const uint32_t width, const uint32_t height )
+{
+	wfETC_DecodeImage( pSrc, pDst, width, height, WF_ETC1_RGB8 );
+}
@@ -1,4 +1,5 @@
 #include <string>
+#include <cstring>
 
 // GLEW
 #define GLEW_STATIC
@@ -18,12 +19,16 @@
 
 // Other Libs
 #include "SOIL2/SOIL2.h"
+#include "TextureManager.h"
+#include "SoftwareRenderer.h"
 
 //CubeMap
 #include "CubeMap.h"
 
 // Properties
 const GLuint WIDTH = 800, HEIGHT = 600;
+// Texture memory the TextureManager may keep resident before it starts dropping mip levels
+const size_t TEXTURE_BUDGET = 256 << 20;
 int SCREEN_WIDTH, SCREEN_HEIGHT;
 
 // Function prototypes
@@ -31,6 +36,8 @@ void KeyCallback( GLFWwindow *window, int key, int scancode, int action, int mod
 void ScrollCallback( GLFWwindow *window, double xOffset, double yOffset );
 void MouseCallback( GLFWwindow *window, double xPos, double yPos );
 void DoMovement( );
+int RenderSoftware( const std::string &image, const GLfloat *vertices, GLsizei vertexCount, const GLfloat *skyboxVertices,
+                    const std::vector<std::string> &faces );
 
 // Camera
 Camera  camera(glm::vec3( 0.0f, 0.0f, 3.0f ) );
@@ -44,60 +51,8 @@ GLfloat lastFrame = 0.0f;
 
 
 // The MAIN function, from here we start our application and run our Game loop
-int main( )
+int main( int argc, char **argv )
 {
-    // Init GLFW
-    glfwInit( );
-    glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
-    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 3 );
-    glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
-    glfwWindowHint( GLFW_RESIZABLE, GL_FALSE );
-    glfwWindowHint( GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE );
-    
-    GLFWwindow* window = glfwCreateWindow( WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr ); // Windowed
-    
-    if ( nullptr == window )
-    {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate( );
-        
-        return EXIT_FAILURE;
-    }
-    
-    glfwMakeContextCurrent( window );
-    
-    glfwGetFramebufferSize( window, &SCREEN_WIDTH, &SCREEN_HEIGHT );
-    
-    // Set the required callback functions
-    glfwSetKeyCallback( window, KeyCallback );
-    glfwSetCursorPosCallback( window, MouseCallback );
-    glfwSetScrollCallback( window, ScrollCallback );
-    
-    // Options, removes the mouse cursor for a more immersive experience
-    glfwSetInputMode( window, GLFW_CURSOR, GLFW_CURSOR_DISABLED );
-    
-    // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
-    glewExperimental = GL_TRUE;
-    // Initialize GLEW to setup the OpenGL Function pointers
-    if ( GLEW_OK != glewInit( ) )
-    {
-        std::cout << "Failed to initialize GLEW" << std::endl;
-        return EXIT_FAILURE;
-    }
-    
-    // Define the viewport dimensions
-    glViewport( 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT );
-    
-    // Setup some OpenGL options
-    glEnable( GL_DEPTH_TEST );
-    
-    // enable alpha support
-    glEnable( GL_BLEND );
-    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-    
-    // Setup and compile our shaders
-    Shader ourShader( "resources/shaders/core.vs", "resources/shaders/frag.vs" );
-    
     // Set up our vertex data (and buffer(s)) and attribute pointers
     GLfloat vertices[] =
     {
@@ -144,47 +99,6 @@ int main( )
         -0.05f,  0.05f, -0.05f,  0.0f, 1.0f
     };
     
-
-
-    
-    
-    GLuint VBO, VAO;
-    glGenVertexArrays( 1, &VAO );
-    glGenBuffers( 1, &VBO );
-    // Bind our Vertex Array Object first, then bind and set our buffers and pointers.
-    glBindVertexArray( VAO );
-    
-    glBindBuffer( GL_ARRAY_BUFFER, VBO );
-    glBufferData( GL_ARRAY_BUFFER, sizeof( vertices ), vertices, GL_STATIC_DRAW );
-    
-    // Position attribute
-    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), ( GLvoid * )0 );
-    glEnableVertexAttribArray( 0 );
-    // TexCoord attribute
-    glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), ( GLvoid * )( 3 * sizeof( GLfloat ) ) );
-    glEnableVertexAttribArray( 2 );
-    
-    glBindVertexArray( 0 ); // Unbind VAO
-    
-    // Load and create a texture
-    GLuint texture;
-    // --== TEXTURE == --
-    glGenTextures( 1, &texture );
-    glBindTexture( GL_TEXTURE_2D, texture ); // All upcoming GL_TEXTURE_2D operations now have effect on our texture object
-    // Set our texture parameters
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    // Set texture filtering
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-    // Load, create texture and generate mipmaps
-    int width, height;
-    unsigned char *image = SOIL_load_image( "resources/images/image2.jpg", &width, &height, 0, SOIL_LOAD_RGB );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
-    SOIL_free_image_data( image );
-    glBindTexture( GL_TEXTURE_2D, 0 ); // Unbind texture when done, so we won't accidentily mess up our texture.
-    
     //Cubemap
     std::vector<std::string> faces =
     {
@@ -196,8 +110,6 @@ int main( )
         "resources/images/back.jpg"
     };
     
-    unsigned int cubemapTexture = loadCubemap(faces);
-    
     float skyboxVertices[] = {
         // positions
         -1.0f,  1.0f, -1.0f,
@@ -242,8 +154,106 @@ int main( )
         -1.0f, -1.0f,  1.0f,
         1.0f, -1.0f,  1.0f
     };
-   
+    
+    // --software <image> renders a frame on the CPU into the image, no window or GPU needed
+    if ( 3 == argc && 0 == strcmp( argv[1], "--software" ) )
+    {
+        return RenderSoftware( argv[2], vertices, sizeof( vertices ) / sizeof( GLfloat ) / 5, skyboxVertices, faces );
+    }
+    
+    // Init GLFW
+    glfwInit( );
+    glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
+    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 3 );
+    glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
+    glfwWindowHint( GLFW_RESIZABLE, GL_FALSE );
+    glfwWindowHint( GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE );
+    
+    GLFWwindow* window = glfwCreateWindow( WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr ); // Windowed
+    
+    if ( nullptr == window )
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate( );
+        
+        return EXIT_FAILURE;
+    }
+    
+    glfwMakeContextCurrent( window );
+    
+    glfwGetFramebufferSize( window, &SCREEN_WIDTH, &SCREEN_HEIGHT );
+    
+    // Set the required callback functions
+    glfwSetKeyCallback( window, KeyCallback );
+    glfwSetCursorPosCallback( window, MouseCallback );
+    glfwSetScrollCallback( window, ScrollCallback );
+    
+    // Options, removes the mouse cursor for a more immersive experience
+    glfwSetInputMode( window, GLFW_CURSOR, GLFW_CURSOR_DISABLED );
+    
+    // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
+    glewExperimental = GL_TRUE;
+    // Initialize GLEW to setup the OpenGL Function pointers
+    if ( GLEW_OK != glewInit( ) )
+    {
+        std::cout << "Failed to initialize GLEW" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    // Define the viewport dimensions
+    glViewport( 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT );
+    
+    // Setup some OpenGL options
+    glEnable( GL_DEPTH_TEST );
+    
+    // enable alpha support
+    glEnable( GL_BLEND );
+    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+    
+    // Setup and compile our shaders
+    Shader ourShader( "resources/shaders/core.vs", "resources/shaders/frag.vs" );
+    
+    GLuint VBO, VAO;
+    glGenVertexArrays( 1, &VAO );
+    glGenBuffers( 1, &VBO );
+    // Bind our Vertex Array Object first, then bind and set our buffers and pointers.
+    glBindVertexArray( VAO );
+    
+    glBindBuffer( GL_ARRAY_BUFFER, VBO );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( vertices ), vertices, GL_STATIC_DRAW );
+    
+    // Position attribute
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), ( GLvoid * )0 );
+    glEnableVertexAttribArray( 0 );
+    // TexCoord attribute
+    glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), ( GLvoid * )( 3 * sizeof( GLfloat ) ) );
+    glEnableVertexAttribArray( 2 );
+    
+    glBindVertexArray( 0 ); // Unbind VAO
+    
+    // Load and create a texture
+    TextureManager textures( TEXTURE_BUDGET );
+    // --== TEXTURE == --
+    // Create the texture and stream its mipmaps in from the texture cache, coarsest first, so the first frame doesn't wait
+    TextureManager::Handle texture = textures.Load( "resources/images/image2.jpg", TEXTURE_STREAM );
+    
+    // The only 2D texture stays on unit 0 for the whole run, so the loop doesn't rebind it
+    textures.Bind( texture, 0 );
+    ourShader.Use( );
+    glUniform1i( glGetUniformLocation( ourShader.Program, "ourTexture1" ), 0 );
+    
+    
+    // Faces decode in parallel and are stored as BC1, an eighth of the uncompressed size
+    unsigned int cubemapTexture = loadCubemap( faces, CUBEMAP_COMPRESS );
+    
+    // The skybox lives on unit 1 next to the box texture, also bound once
+    glActiveTexture( GL_TEXTURE1 );
+    glBindTexture( GL_TEXTURE_CUBE_MAP, cubemapTexture );
+    glActiveTexture( GL_TEXTURE0 );
+    
     Shader skyboxShader( "resources/shaders/skycore.vs", "resources/shaders/skyfrag.vs" );
+    skyboxShader.Use( );
+    glUniform1i( glGetUniformLocation( skyboxShader.Program, "skybox" ), 1 );
     
     GLuint VBOcm, VAOcm;
     glGenVertexArrays( 1, &VAOcm );
@@ -295,7 +305,6 @@ int main( )
         
         // skybox cube
         glBindVertexArray( VAOcm );
-        glBindTexture( GL_TEXTURE_CUBE_MAP, cubemapTexture );
         glDrawArrays( GL_TRIANGLES, 0, 36 );
         glBindVertexArray( 0 );
         glDepthMask( GL_TRUE ); // Set depth function back to default
@@ -303,11 +312,6 @@ int main( )
         // Draw our first triangle
         ourShader.Use( );
         
-        // Bind Textures using texture units
-        glActiveTexture( GL_TEXTURE0 );
-        glBindTexture( GL_TEXTURE_2D, texture );
-        glUniform1i( glGetUniformLocation( ourShader.Program, "texture1" ), 0 );
-        
         // Get the uniform locations
         GLint modelLoc = glGetUniformLocation( ourShader.Program, "model" );
         GLint viewLoc = glGetUniformLocation( ourShader.Program, "view" );
@@ -320,7 +324,10 @@ int main( )
         glBindVertexArray( VAO );
         
         // Calculate the model matrix for each object and pass it to shader before drawing
-        model = glm::translate( model, glm::vec3(-0.1f, 0.1f, -0.7f) );
+        glm::vec3 boxPosition( -0.1f, 0.1f, -0.7f );
+        model = glm::translate( model, boxPosition );
+        // The view has no translation, so the box stays at the same distance and the texture's detail follows it
+        textures.SetScreenSize( texture, TextureManager::ProjectedSize( 1.0f, glm::length( boxPosition ), camera.GetZoom( ), SCREEN_HEIGHT ) );
         glUniformMatrix4fv( modelLoc, 1, GL_FALSE, glm::value_ptr( model ) );
         glDrawArrays( GL_TRIANGLES, 0, 36 );
         glBindVertexArray( 0 );
@@ -332,6 +339,7 @@ int main( )
         
         // Swap the buffers
         glfwSwapBuffers( window );
+        textures.EndFrame( );
     }
     
     // Properly de-allocate all resources once they've outlived their purpose
@@ -339,6 +347,8 @@ int main( )
     glDeleteBuffers( 1, &VBO );
     glDeleteVertexArrays( 1, &VAOcm );
     glDeleteBuffers( 1, &VBOcm );
+    glDeleteTextures( 1, &cubemapTexture );
+    textures.Clear( );
     glfwTerminate( );
     
     return EXIT_SUCCESS;
@@ -414,3 +424,39 @@ void ScrollCallback( GLFWwindow *window, double xOffset, double yOffset )
     camera.ProcessMouseScroll( yOffset );
 }
 
+
+// The sky and box of the first frame drawn on the CPU by SoftwareRenderer.h from the default camera and written to image
+int RenderSoftware( const std::string &image, const GLfloat *vertices, GLsizei vertexCount, const GLfloat *skyboxVertices,
+                    const std::vector<std::string> &faces )
+{
+    SoftwareRenderer renderer( WIDTH, HEIGHT );
+    renderer.SetBlend( true );
+    
+    SoftwareTexture texture;
+    texture.Load( "resources/images/image2.jpg" );
+    SoftwareCubeMap sky;
+    sky.Load( faces );
+    
+    glm::mat4 projection = glm::perspective( camera.GetZoom( ), ( float )WIDTH / ( float )HEIGHT, 0.1f, 1000.0f );
+    glm::mat4 view = glm::mat4( glm::mat3( camera.GetViewMatrix( ) ) );
+    
+    renderer.ClearBuffers( glm::vec4( 0.05f, 0.05f, 0.05f, 1.0f ) );
+    
+    // Skybox without depth writes
+    SoftwareSkyboxProgram skybox;
+    skybox.view = view;
+    skybox.projection = projection;
+    skybox.skybox = &sky;
+    renderer.SetDepthMask( false );
+    renderer.Draw( skybox, skyboxVertices, 3, 36 );
+    renderer.SetDepthMask( true );
+    
+    SoftwareTexturedProgram box;
+    box.projection = projection;
+    box.view = view;
+    box.model = glm::translate( glm::mat4( 1 ), glm::vec3( -0.1f, 0.1f, -0.7f ) );
+    box.texture = &texture;
+    renderer.Draw( box, vertices, 5, vertexCount );
+    
+    return renderer.Save( image ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,438 @@
+#ifndef ClusteredLights_h
+#define ClusteredLights_h
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define CLUSTER_SSE2
+#endif
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "SOIL2/image_parallel.h"
+#include "Shader.h"
+
+// Froxel grid: screen tiles by exponential depth slices between the near and far plane.
+// The tile count per row is a multiple of 4 so the SSE2 tests never straddle rows
+const GLint CLUSTER_TILES_X = 16;
+const GLint CLUSTER_TILES_Y = 9;
+const GLint CLUSTER_SLICES = 24;
+const GLint CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+// Light indices are 16 bit
+const GLuint CLUSTER_MAX_LIGHTS = 65535;
+
+// A light stops where it would add less than this to an 8 bit channel
+const GLfloat CLUSTER_LIGHT_CUTOFF = 1.0f / 128.0f;
+
+struct ClusterLight
+{
+    glm::vec3 position;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    GLfloat constant;
+    GLfloat linear;
+    GLfloat quadratic;
+};
+
+// Clustered forward lighting (Olsson et al. 2012). Every frame the lights are assigned on the CPU to
+// the clusters their range overlaps, each depth slice on its own thread, and the result goes to the
+// GPU as three texture buffers: the lights, an (offset, count) pair per cluster, and the light index
+// lists those point into. frag.vs finds its cluster from gl_FragCoord and depth and only loops over
+// the lights listed there, so the shading cost follows the lights near a pixel, not the light count.
+class ClusteredLights
+{
+public:
+    ClusteredLights( )
+    {
+        this->program = 0;
+        this->screenWidth = 0;
+        this->screenHeight = 0;
+        this->projection = glm::mat4( 0.0f );
+        this->nearPlane = 0.1f;
+        this->farPlane = 100.0f;
+        this->bounds.resize( CLUSTER_SLICES );
+        this->lists.resize( CLUSTER_COUNT );
+        this->grid.resize( CLUSTER_COUNT * 2 );
+
+        glGenBuffers( 3, this->buffers );
+        glGenTextures( 3, this->textures );
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        for ( int i = 0; i < 3; i++ )
+        {
+            glBindBuffer( GL_TEXTURE_BUFFER, this->buffers[i] );
+            glBufferData( GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW );
+            glBindTexture( GL_TEXTURE_BUFFER, this->textures[i] );
+            glTexBuffer( GL_TEXTURE_BUFFER, formats[i], this->buffers[i] );
+        }
+        glBindTexture( GL_TEXTURE_BUFFER, 0 );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+    }
+
+    ~ClusteredLights( )
+    {
+        this->Clear( );
+    }
+
+    // Binds the light buffers to three units from firstUnit on; Update( ) sets the grid uniforms of this shader
+    void Attach( const Shader &shader, GLint firstUnit )
+    {
+        static const char *samplers[3] = { "lights", "lightClusters", "lightIndices" };
+
+        this->program = shader.Program;
+        glUseProgram( shader.Program );
+        for ( int i = 0; i < 3; i++ )
+        {
+            glUniform1i( glGetUniformLocation( shader.Program, samplers[i] ), firstUnit + i );
+            glActiveTexture( GL_TEXTURE0 + firstUnit + i );
+            glBindTexture( GL_TEXTURE_BUFFER, this->textures[i] );
+        }
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    // Assigns the lights to clusters for this view and uploads them, call once per frame before drawing
+    void Update( const std::vector<ClusterLight> &lights, const glm::mat4 &view, const glm::mat4 &projection,
+                 GLint screenWidth, GLint screenHeight )
+    {
+        if ( projection != this->projection || screenWidth != this->screenWidth || screenHeight != this->screenHeight )
+        {
+            this->projection = projection;
+            this->screenWidth = screenWidth;
+            this->screenHeight = screenHeight;
+            this->buildBounds( );
+        }
+
+        size_t count = std::min( lights.size( ), ( size_t )CLUSTER_MAX_LIGHTS );
+        this->prepareLights( lights, count, view );
+
+        SOIL_parallel_for( CLUSTER_SLICES, 1, assignSlices, this );
+
+        // Compact the per-cluster lists into one index buffer
+        this->indices.clear( );
+        for ( GLint cluster = 0; cluster < CLUSTER_COUNT; cluster++ )
+        {
+            this->grid[cluster * 2] = ( GLuint )this->indices.size( );
+            this->grid[cluster * 2 + 1] = ( GLuint )this->lists[cluster].size( );
+            this->indices.insert( this->indices.end( ), this->lists[cluster].begin( ), this->lists[cluster].end( ) );
+        }
+        if ( this->indices.empty( ) )
+        {
+            this->indices.push_back( 0 );
+        }
+
+        upload( this->buffers[0], this->packed.empty( ) ? NULL : &this->packed[0], this->packed.size( ) * sizeof( GLfloat ) );
+        upload( this->buffers[1], &this->grid[0], this->grid.size( ) * sizeof( GLuint ) );
+        upload( this->buffers[2], &this->indices[0], this->indices.size( ) * sizeof( GLushort ) );
+
+        if ( 0 != this->program )
+        {
+            GLfloat depthScale = CLUSTER_SLICES / std::log( this->farPlane / this->nearPlane );
+
+            glUseProgram( this->program );
+            glUniform4f( glGetUniformLocation( this->program, "clusterTiles" ), ( GLfloat )this->tileWidth, ( GLfloat )this->tileHeight,
+                         ( GLfloat )CLUSTER_TILES_X, ( GLfloat )CLUSTER_TILES_Y );
+            glUniform3f( glGetUniformLocation( this->program, "clusterSlices" ), depthScale, -std::log( this->nearPlane ) * depthScale,
+                         ( GLfloat )CLUSTER_SLICES );
+        }
+    }
+
+    // Light indices stored this frame, a light in n clusters counts n times
+    size_t GetAssignments( ) const
+    {
+        return this->indices.size( );
+    }
+
+    void Clear( )
+    {
+        if ( 0 != this->textures[0] )
+        {
+            glDeleteTextures( 3, this->textures );
+            glDeleteBuffers( 3, this->buffers );
+            this->textures[0] = 0;
+        }
+    }
+
+    // Distance at which a light's brightest channel falls to CLUSTER_LIGHT_CUTOFF
+    static GLfloat Range( const ClusterLight &light )
+    {
+        GLfloat brightest = std::max( std::max( light.diffuse.r, light.diffuse.g ), light.diffuse.b );
+        brightest = std::max( brightest, std::max( std::max( light.specular.r, light.specular.g ), light.specular.b ) );
+
+        // Solve quadratic * d^2 + linear * d + constant = brightest / cutoff
+        GLfloat c = light.constant - brightest / CLUSTER_LIGHT_CUTOFF;
+        if ( c >= 0.0f )
+        {
+            return 0.0f;
+        }
+        if ( light.quadratic > 0.0f )
+        {
+            return ( -light.linear + std::sqrt( light.linear * light.linear - 4.0f * light.quadratic * c ) ) / ( 2.0f * light.quadratic );
+        }
+        if ( light.linear > 0.0f )
+        {
+            return -c / light.linear;
+        }
+
+        return 1e30f;
+    }
+
+private:
+    GLuint program;
+    GLuint buffers[3];
+    GLuint textures[3];
+    GLint screenWidth;
+    GLint screenHeight;
+    GLint tileWidth;
+    GLint tileHeight;
+    glm::mat4 projection;
+    GLfloat nearPlane;
+    GLfloat farPlane;
+
+    // View space bounds of the tiles of one slice, one float per tile and side
+    struct SliceBounds
+    {
+        GLfloat minX[CLUSTER_TILES_X * CLUSTER_TILES_Y];
+        GLfloat maxX[CLUSTER_TILES_X * CLUSTER_TILES_Y];
+        GLfloat minY[CLUSTER_TILES_X * CLUSTER_TILES_Y];
+        GLfloat maxY[CLUSTER_TILES_X * CLUSTER_TILES_Y];
+        GLfloat nearDepth;
+        GLfloat farDepth;
+    };
+
+    // A light in view space, with the slices and tiles its bounding box can touch
+    struct ViewLight
+    {
+        GLfloat x, y, depth, radius;
+        GLint firstSlice, lastSlice;
+        GLint firstTileX, lastTileX, firstTileY, lastTileY;
+    };
+
+    std::vector<SliceBounds> bounds;
+    std::vector<ViewLight> viewLights;
+    std::vector< std::vector<GLushort> > lists;
+    std::vector<GLuint> grid;
+    std::vector<GLushort> indices;
+    std::vector<GLfloat> packed;
+
+    static void upload( GLuint buffer, const void *data, size_t bytes )
+    {
+        // Orphan the old store so the driver doesn't wait for last frame's draws
+        glBindBuffer( GL_TEXTURE_BUFFER, buffer );
+        glBufferData( GL_TEXTURE_BUFFER, bytes, NULL, GL_STREAM_DRAW );
+        glBufferData( GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+    }
+
+    GLfloat sliceDepth( GLint slice ) const
+    {
+        return this->nearPlane * std::pow( this->farPlane / this->nearPlane, ( GLfloat )slice / CLUSTER_SLICES );
+    }
+
+    GLint depthSlice( GLfloat depth ) const
+    {
+        if ( depth <= this->nearPlane )
+        {
+            return 0;
+        }
+        GLint slice = ( GLint )( std::log( depth / this->nearPlane ) / std::log( this->farPlane / this->nearPlane ) * CLUSTER_SLICES );
+
+        return std::min( slice, CLUSTER_SLICES - 1 );
+    }
+
+    // Tile corners are rays through the near plane; a cluster's box covers them between its slice's depths
+    void buildBounds( )
+    {
+        this->nearPlane = this->projection[3][2] / ( this->projection[2][2] - 1.0f );
+        this->farPlane = this->projection[3][2] / ( this->projection[2][2] + 1.0f );
+        this->tileWidth = ( this->screenWidth + CLUSTER_TILES_X - 1 ) / CLUSTER_TILES_X;
+        this->tileHeight = ( this->screenHeight + CLUSTER_TILES_Y - 1 ) / CLUSTER_TILES_Y;
+
+        for ( GLint slice = 0; slice < CLUSTER_SLICES; slice++ )
+        {
+            SliceBounds &slab = this->bounds[slice];
+            slab.nearDepth = this->sliceDepth( slice );
+            slab.farDepth = this->sliceDepth( slice + 1 );
+
+            for ( GLint y = 0; y < CLUSTER_TILES_Y; y++ )
+            {
+                for ( GLint x = 0; x < CLUSTER_TILES_X; x++ )
+                {
+                    // Tiles are whole pixels, so the last column and row can reach past the screen edge
+                    GLfloat x0 = 2.0f * x * this->tileWidth / this->screenWidth - 1.0f;
+                    GLfloat x1 = 2.0f * ( x + 1 ) * this->tileWidth / this->screenWidth - 1.0f;
+                    GLfloat y0 = 2.0f * y * this->tileHeight / this->screenHeight - 1.0f;
+                    GLfloat y1 = 2.0f * ( y + 1 ) * this->tileHeight / this->screenHeight - 1.0f;
+                    GLint tile = y * CLUSTER_TILES_X + x;
+
+                    slab.minX[tile] = std::min( x0 * slab.nearDepth, x0 * slab.farDepth ) / this->projection[0][0];
+                    slab.maxX[tile] = std::max( x1 * slab.nearDepth, x1 * slab.farDepth ) / this->projection[0][0];
+                    slab.minY[tile] = std::min( y0 * slab.nearDepth, y0 * slab.farDepth ) / this->projection[1][1];
+                    slab.maxY[tile] = std::max( y1 * slab.nearDepth, y1 * slab.farDepth ) / this->projection[1][1];
+                }
+            }
+        }
+    }
+
+    // Moves the lights to view space, finds the slices and tiles they can touch and packs them for the GPU
+    void prepareLights( const std::vector<ClusterLight> &lights, size_t count, const glm::mat4 &view )
+    {
+        this->viewLights.resize( count );
+        this->packed.resize( count * 12 );
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+            const ClusterLight &light = lights[i];
+            ViewLight &viewLight = this->viewLights[i];
+            glm::vec4 center = view * glm::vec4( light.position, 1.0f );
+            GLfloat radius = std::min( Range( light ), 2.0f * this->farPlane );
+
+            viewLight.x = center.x;
+            viewLight.y = center.y;
+            viewLight.depth = -center.z;
+            viewLight.radius = radius;
+
+            // The constant term is folded into the colours: 1 / ( c + l d + q d^2 ) = ( 1 / c ) / ( 1 + l / c d + q / c d^2 )
+            GLfloat scale = light.constant > 0.0f ? 1.0f / light.constant : 1.0f;
+            GLfloat *out = &this->packed[i * 12];
+            out[0] = light.position.x;
+            out[1] = light.position.y;
+            out[2] = light.position.z;
+            out[3] = radius;
+            out[4] = light.diffuse.r * scale;
+            out[5] = light.diffuse.g * scale;
+            out[6] = light.diffuse.b * scale;
+            out[7] = light.linear * scale;
+            out[8] = light.specular.r * scale;
+            out[9] = light.specular.g * scale;
+            out[10] = light.specular.b * scale;
+            out[11] = light.quadratic * scale;
+
+            if ( 0.0f == radius || viewLight.depth + radius < this->nearPlane || viewLight.depth - radius > this->farPlane )
+            {
+                viewLight.firstSlice = 1;
+                viewLight.lastSlice = 0;
+                continue;
+            }
+            viewLight.firstSlice = this->depthSlice( viewLight.depth - radius );
+            viewLight.lastSlice = this->depthSlice( viewLight.depth + radius );
+
+            // Screen rectangle of the light's bounding box, the whole screen if the box reaches the near plane
+            viewLight.firstTileX = 0;
+            viewLight.lastTileX = CLUSTER_TILES_X - 1;
+            viewLight.firstTileY = 0;
+            viewLight.lastTileY = CLUSTER_TILES_Y - 1;
+            if ( viewLight.depth - radius > this->nearPlane )
+            {
+                GLfloat minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+                for ( int corner = 0; corner < 4; corner++ )
+                {
+                    GLfloat depth = viewLight.depth + ( corner & 1 ? radius : -radius );
+                    GLfloat side = corner & 2 ? radius : -radius;
+                    GLfloat x = ( viewLight.x + side ) * this->projection[0][0] / depth;
+                    GLfloat y = ( viewLight.y + side ) * this->projection[1][1] / depth;
+                    minX = std::min( minX, x );
+                    maxX = std::max( maxX, x );
+                    minY = std::min( minY, y );
+                    maxY = std::max( maxY, y );
+                }
+                viewLight.firstTileX = this->screenTile( minX, this->screenWidth, this->tileWidth, CLUSTER_TILES_X );
+                viewLight.lastTileX = this->screenTile( maxX, this->screenWidth, this->tileWidth, CLUSTER_TILES_X );
+                viewLight.firstTileY = this->screenTile( minY, this->screenHeight, this->tileHeight, CLUSTER_TILES_Y );
+                viewLight.lastTileY = this->screenTile( maxY, this->screenHeight, this->tileHeight, CLUSTER_TILES_Y );
+            }
+        }
+    }
+
+    static GLint screenTile( GLfloat ndc, GLint screenSize, GLint tileSize, GLint tiles )
+    {
+        GLfloat pixel = ( ndc * 0.5f + 0.5f ) * screenSize;
+
+        return std::min( std::max( ( GLint )std::floor( pixel / tileSize ), 0 ), tiles - 1 );
+    }
+
+    // One depth slice per call: every light whose depth range overlaps the slice is tested against
+    // the tiles of its screen rectangle, four at a time with SSE2
+    static void assignSlices( void *context, int begin, int end )
+    {
+        ClusteredLights *clusters = ( ClusteredLights * )context;
+
+        for ( int slice = begin; slice < end; slice++ )
+        {
+            const SliceBounds &slab = clusters->bounds[slice];
+            std::vector<GLushort> *lists = &clusters->lists[slice * CLUSTER_TILES_X * CLUSTER_TILES_Y];
+
+            for ( GLint tile = 0; tile < CLUSTER_TILES_X * CLUSTER_TILES_Y; tile++ )
+            {
+                lists[tile].clear( );
+            }
+
+            for ( size_t i = 0; i < clusters->viewLights.size( ); i++ )
+            {
+                const ViewLight &light = clusters->viewLights[i];
+
+                if ( slice < light.firstSlice || slice > light.lastSlice )
+                {
+                    continue;
+                }
+
+                // Depth is shared by the whole slice
+                GLfloat dz = std::max( std::max( slab.nearDepth - light.depth, light.depth - slab.farDepth ), 0.0f );
+                GLfloat remaining = light.radius * light.radius - dz * dz;
+                if ( remaining < 0.0f )
+                {
+                    continue;
+                }
+
+                for ( GLint y = light.firstTileY; y <= light.lastTileY; y++ )
+                {
+                    GLint row = y * CLUSTER_TILES_X;
+                    GLint x = light.firstTileX;
+#ifdef CLUSTER_SSE2
+                    __m128 centerX = _mm_set1_ps( light.x );
+                    __m128 centerY = _mm_set1_ps( light.y );
+                    __m128 limit = _mm_set1_ps( remaining );
+                    __m128 zero = _mm_setzero_ps( );
+
+                    // Rows are a multiple of 4 tiles, so round down to an aligned group and mask the tiles outside
+                    for ( x &= ~3; x <= light.lastTileX; x += 4 )
+                    {
+                        GLint tile = row + x;
+                        __m128 dx = _mm_max_ps( _mm_max_ps( _mm_sub_ps( _mm_loadu_ps( &slab.minX[tile] ), centerX ),
+                                                            _mm_sub_ps( centerX, _mm_loadu_ps( &slab.maxX[tile] ) ) ), zero );
+                        __m128 dy = _mm_max_ps( _mm_max_ps( _mm_sub_ps( _mm_loadu_ps( &slab.minY[tile] ), centerY ),
+                                                            _mm_sub_ps( centerY, _mm_loadu_ps( &slab.maxY[tile] ) ) ), zero );
+                        int hits = _mm_movemask_ps( _mm_cmple_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), limit ) );
+
+                        for ( int lane = 0; lane < 4 && 0 != hits; lane++, hits >>= 1 )
+                        {
+                            if ( ( hits & 1 ) && x + lane >= light.firstTileX && x + lane <= light.lastTileX )
+                            {
+                                lists[tile + lane].push_back( ( GLushort )i );
+                            }
+                        }
+                    }
+#else
+                    for ( ; x <= light.lastTileX; x++ )
+                    {
+                        GLint tile = row + x;
+                        GLfloat dx = std::max( std::max( slab.minX[tile] - light.x, light.x - slab.maxX[tile] ), 0.0f );
+                        GLfloat dy = std::max( std::max( slab.minY[tile] - light.y, light.y - slab.maxY[tile] ), 0.0f );
+
+                        if ( dx * dx + dy * dy <= remaining )
+                        {
+                            lists[tile].push_back( ( GLushort )i );
+                        }
+                    }
+#endif
+                }
+            }
+        }
+    }
+};
+
+#endif
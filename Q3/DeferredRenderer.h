@@ -0,0 +1,413 @@
+#ifndef DeferredRenderer_h
+#define DeferredRenderer_h
+
+#include <vector>
+#include <cmath>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "ClusteredLights.h"
+
+// Light volumes are spheres of this many slices and stacks, pushed out so the facets enclose the range
+const GLint DEFERRED_SPHERE_SLICES = 16;
+const GLint DEFERRED_SPHERE_STACKS = 8;
+
+// Up to this many point lights get a draw each, clipped to their depth with EXT_depth_bounds_test;
+// past it one instanced draw for all of them costs less than the draw calls
+const GLuint DEFERRED_BOUNDED_LIGHTS = 256;
+
+// Deferred shading: the scene is drawn once into a G-buffer and lit afterwards, so the cost of a light
+// is the pixels its volume covers, not the geometry drawn. The geometry pass is frag.vs built with
+// GBUFFER_PASS, writing
+//   0: RGBA16F  lit colour, cleared to black under the geometry, the lights add up here
+//   1: RGBA8    albedo, specular intensity in alpha
+//   2: RG16F    normal, octahedral encoding
+//   3: R32F     view space depth, positions are rebuilt from it
+// and 1 into the stencil wherever it drew. The lighting pass is deferredcore.vs and deferredfrag.vs:
+// a fullscreen triangle adds the ambient and directional light, then every point light draws the back
+// faces of a sphere around its range, additively. The depth test keeps only the pixels in front of the
+// back faces and the stencil the ones that hold geometry, so the sky is never shaded.
+class DeferredRenderer
+{
+public:
+    // defines are the lines the forward shader was built with.
+    // The light buffer is bound to firstUnit, albedo, normal and depth to the three units after it
+    DeferredRenderer( const std::string &defines, GLint firstUnit )
+        : geometryShader( "resources/shaders/core.vs", "resources/shaders/frag.vs", "#define GBUFFER_PASS\n" + defines ),
+          lightingShader( "resources/shaders/deferredcore.vs", "resources/shaders/deferredfrag.vs", defines )
+    {
+        this->firstUnit = firstUnit;
+        this->width = 0;
+        this->height = 0;
+        this->framebuffer = 0;
+        this->depthStencil = 0;
+        for ( int i = 0; i < 4; i++ )
+        {
+            this->targets[i] = 0;
+        }
+
+        static const char *samplers[3] = { "gAlbedo", "gNormal", "gDepth" };
+        this->lightingShader.Use( );
+        for ( int i = 0; i < 3; i++ )
+        {
+            glUniform1i( glGetUniformLocation( this->lightingShader.Program, samplers[i] ), firstUnit + 1 + i );
+        }
+        glUniform1i( glGetUniformLocation( this->lightingShader.Program, "lights" ), firstUnit );
+
+        // Lights go to a texture buffer like the clustered path's, so single draws can pick theirs by index
+        glGenBuffers( 1, &this->lightBuffer );
+        glBindBuffer( GL_TEXTURE_BUFFER, this->lightBuffer );
+        glBufferData( GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+        glGenTextures( 1, &this->lightTexture );
+        glActiveTexture( GL_TEXTURE0 + firstUnit );
+        glBindTexture( GL_TEXTURE_BUFFER, this->lightTexture );
+        glTexBuffer( GL_TEXTURE_BUFFER, GL_RGBA32F, this->lightBuffer );
+        glActiveTexture( GL_TEXTURE0 );
+
+        this->buildSphere( );
+        glGenVertexArrays( 1, &this->fullscreenVAO );
+    }
+
+    ~DeferredRenderer( )
+    {
+        this->Clear( );
+    }
+
+    // The geometry pass, materials and skybox data get attached to these like to the forward shader
+    Shader &GeometryShader( )
+    {
+        return this->geometryShader;
+    }
+
+    Shader &LightingShader( )
+    {
+        return this->lightingShader;
+    }
+
+    // Starts a frame: binds and clears the G-buffer, leaving only the lit colour as draw buffer so
+    // the skybox can go in first
+    void Begin( GLint screenWidth, GLint screenHeight )
+    {
+        if ( screenWidth != this->width || screenHeight != this->height )
+        {
+            this->createTargets( screenWidth, screenHeight );
+        }
+
+        static const GLfloat background[4] = { 0.1f, 0.1f, 0.1f, 1.0f };
+        static const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        glBindFramebuffer( GL_FRAMEBUFFER, this->framebuffer );
+        glViewport( 0, 0, this->width, this->height );
+        this->drawBuffers( 4 );
+        glClearBufferfv( GL_COLOR, 0, background );
+        for ( int i = 1; i < 4; i++ )
+        {
+            glClearBufferfv( GL_COLOR, i, zero );
+        }
+        glStencilMask( 0xFF );
+        glClear( GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
+        this->drawBuffers( 1 );
+    }
+
+    // Draws after this fill the G-buffer, with the geometry shader
+    void BeginGeometry( )
+    {
+        this->drawBuffers( 4 );
+        glEnable( GL_STENCIL_TEST );
+        glStencilFunc( GL_ALWAYS, 1, 0xFF );
+        glStencilOp( GL_KEEP, GL_KEEP, GL_REPLACE );
+    }
+
+    void EndGeometry( )
+    {
+        glDisable( GL_STENCIL_TEST );
+        this->drawBuffers( 1 );
+    }
+
+    // Lights the G-buffer into the lit colour. Set the lighting shader's viewPos, direction, blinn, db
+    // and material uniforms first; pointLights false skips the volumes (directional light only).
+    // The G-buffer stays bound, so lamps and the like can be drawn depth tested afterwards
+    void Light( const std::vector<ClusterLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, bool pointLights )
+    {
+        GLuint program = this->lightingShader.Program;
+        GLfloat nearPlane = projection[3][2] / ( projection[2][2] - 1.0f );
+        GLfloat farPlane = projection[3][2] / ( projection[2][2] + 1.0f );
+
+        glBindFramebuffer( GL_FRAMEBUFFER, this->framebuffer );
+        glViewport( 0, 0, this->width, this->height );
+        this->drawBuffers( 1 );
+
+        this->lightingShader.Use( );
+        glUniformMatrix4fv( glGetUniformLocation( program, "view" ), 1, GL_FALSE, glm::value_ptr( view ) );
+        glUniformMatrix4fv( glGetUniformLocation( program, "projection" ), 1, GL_FALSE, glm::value_ptr( projection ) );
+        glUniformMatrix4fv( glGetUniformLocation( program, "inverseView" ), 1, GL_FALSE, glm::value_ptr( glm::inverse( view ) ) );
+        glUniform2f( glGetUniformLocation( program, "projectionScale" ), projection[0][0], projection[1][1] );
+
+        // Only pixels with geometry, added on top of what is there, nothing written but colour
+        glEnable( GL_STENCIL_TEST );
+        glStencilFunc( GL_EQUAL, 1, 0xFF );
+        glStencilMask( 0x00 );
+        glEnable( GL_BLEND );
+        glBlendFunc( GL_ONE, GL_ONE );
+        glDepthMask( GL_FALSE );
+
+        // Ambient and directional light cover every pixel
+        glDisable( GL_DEPTH_TEST );
+        glUniform1i( glGetUniformLocation( program, "fullscreen" ), 1 );
+        glBindVertexArray( this->fullscreenVAO );
+        glDrawArrays( GL_TRIANGLES, 0, 3 );
+
+        size_t count = pointLights ? lights.size( ) : 0;
+        if ( count > 0 )
+        {
+            this->packLights( lights, count, farPlane );
+
+            // Back faces only, so a volume the camera is in still draws, and a pixel is lit where its
+            // surface is in front of them. Depth clamp keeps the back faces past the far plane
+            glEnable( GL_DEPTH_TEST );
+            glDepthFunc( GL_GEQUAL );
+            glEnable( GL_CULL_FACE );
+            glCullFace( GL_FRONT );
+            glEnable( GL_DEPTH_CLAMP );
+            glUniform1i( glGetUniformLocation( program, "fullscreen" ), 0 );
+            glBindVertexArray( this->sphereVAO );
+
+            GLint firstLightLoc = glGetUniformLocation( program, "firstLight" );
+            if ( GLEW_EXT_depth_bounds_test && count <= DEFERRED_BOUNDED_LIGHTS )
+            {
+                // The depth test can't drop surfaces in front of a volume, the depth bounds can
+                glEnable( GL_DEPTH_BOUNDS_TEST_EXT );
+                for ( size_t i = 0; i < count; i++ )
+                {
+                    glm::vec4 center = view * glm::vec4( lights[i].position, 1.0f );
+                    GLfloat radius = this->packed[i * 12 + 3];
+                    GLfloat nearest = std::max( -center.z - radius, nearPlane );
+                    GLfloat farthest = std::min( -center.z + radius, farPlane );
+
+                    if ( nearest > farthest )
+                    {
+                        continue;
+                    }
+                    glDepthBoundsEXT( windowDepth( projection, nearest ), windowDepth( projection, farthest ) );
+                    glUniform1i( firstLightLoc, ( GLint )i );
+                    glDrawElementsInstanced( GL_TRIANGLES, this->sphereIndices, GL_UNSIGNED_SHORT, 0, 1 );
+                }
+                glDisable( GL_DEPTH_BOUNDS_TEST_EXT );
+            }
+            else
+            {
+                glUniform1i( firstLightLoc, 0 );
+                glDrawElementsInstanced( GL_TRIANGLES, this->sphereIndices, GL_UNSIGNED_SHORT, 0, ( GLsizei )count );
+            }
+
+            glDisable( GL_DEPTH_CLAMP );
+            glCullFace( GL_BACK );
+            glDisable( GL_CULL_FACE );
+            glDepthFunc( GL_LESS );
+        }
+        glBindVertexArray( 0 );
+
+        glEnable( GL_DEPTH_TEST );
+        glDepthMask( GL_TRUE );
+        glDisable( GL_BLEND );
+        glStencilMask( 0xFF );
+        glDisable( GL_STENCIL_TEST );
+    }
+
+    // Copies the lit colour to the window and goes back to the default framebuffer
+    void Resolve( )
+    {
+        glBindFramebuffer( GL_READ_FRAMEBUFFER, this->framebuffer );
+        glReadBuffer( GL_COLOR_ATTACHMENT0 );
+        glBindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
+        glBlitFramebuffer( 0, 0, this->width, this->height, 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_NEAREST );
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    }
+
+    void Clear( )
+    {
+        if ( 0 != this->lightTexture )
+        {
+            this->deleteTargets( );
+            glDeleteTextures( 1, &this->lightTexture );
+            glDeleteBuffers( 1, &this->lightBuffer );
+            glDeleteBuffers( 2, this->sphereBuffers );
+            glDeleteVertexArrays( 1, &this->sphereVAO );
+            glDeleteVertexArrays( 1, &this->fullscreenVAO );
+            this->lightTexture = 0;
+        }
+    }
+
+private:
+    Shader geometryShader;
+    Shader lightingShader;
+    GLint firstUnit;
+    GLint width, height;
+    GLuint framebuffer;
+    GLuint targets[4];
+    GLuint depthStencil;
+    GLuint lightBuffer, lightTexture;
+    GLuint sphereVAO, sphereBuffers[2];
+    GLsizei sphereIndices;
+    GLuint fullscreenVAO;
+    std::vector<GLfloat> packed;
+
+    static GLfloat windowDepth( const glm::mat4 &projection, GLfloat depth )
+    {
+        GLfloat ndc = ( projection[2][2] * -depth + projection[3][2] ) / depth;
+
+        return std::min( std::max( ndc * 0.5f + 0.5f, 0.0f ), 1.0f );
+    }
+
+    void drawBuffers( GLsizei count )
+    {
+        static const GLenum attachments[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+
+        glDrawBuffers( count, attachments );
+    }
+
+    // Same layout as ClusteredLights: position and range, diffuse and linear, specular and quadratic,
+    // the constant term folded into the rest
+    void packLights( const std::vector<ClusterLight> &lights, size_t count, GLfloat farPlane )
+    {
+        this->packed.resize( count * 12 );
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+            const ClusterLight &light = lights[i];
+            GLfloat scale = light.constant > 0.0f ? 1.0f / light.constant : 1.0f;
+            GLfloat *out = &this->packed[i * 12];
+            out[0] = light.position.x;
+            out[1] = light.position.y;
+            out[2] = light.position.z;
+            out[3] = std::min( ClusteredLights::Range( light ), 2.0f * farPlane );
+            out[4] = light.diffuse.r * scale;
+            out[5] = light.diffuse.g * scale;
+            out[6] = light.diffuse.b * scale;
+            out[7] = light.linear * scale;
+            out[8] = light.specular.r * scale;
+            out[9] = light.specular.g * scale;
+            out[10] = light.specular.b * scale;
+            out[11] = light.quadratic * scale;
+        }
+
+        // Orphan the old store so the driver doesn't wait for last frame's draws
+        glBindBuffer( GL_TEXTURE_BUFFER, this->lightBuffer );
+        glBufferData( GL_TEXTURE_BUFFER, this->packed.size( ) * sizeof( GLfloat ), NULL, GL_STREAM_DRAW );
+        glBufferData( GL_TEXTURE_BUFFER, this->packed.size( ) * sizeof( GLfloat ), &this->packed[0], GL_STREAM_DRAW );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+    }
+
+    // A unit UV sphere scaled up so the flat facets, not just the vertices, reach radius 1
+    void buildSphere( )
+    {
+        const GLfloat pi = 3.14159265f;
+        GLfloat grow = 1.0f / ( std::cos( pi / DEFERRED_SPHERE_SLICES ) * std::cos( pi / ( 2 * DEFERRED_SPHERE_STACKS ) ) );
+        std::vector<GLfloat> vertices;
+        std::vector<GLushort> indices;
+
+        for ( GLint stack = 0; stack <= DEFERRED_SPHERE_STACKS; stack++ )
+        {
+            GLfloat polar = pi * stack / DEFERRED_SPHERE_STACKS;
+            for ( GLint slice = 0; slice <= DEFERRED_SPHERE_SLICES; slice++ )
+            {
+                GLfloat azimuth = 2.0f * pi * slice / DEFERRED_SPHERE_SLICES;
+                vertices.push_back( grow * std::sin( polar ) * std::cos( azimuth ) );
+                vertices.push_back( grow * std::cos( polar ) );
+                vertices.push_back( grow * std::sin( polar ) * std::sin( azimuth ) );
+            }
+        }
+
+        // Counter-clockwise seen from outside
+        for ( GLint stack = 0; stack < DEFERRED_SPHERE_STACKS; stack++ )
+        {
+            for ( GLint slice = 0; slice < DEFERRED_SPHERE_SLICES; slice++ )
+            {
+                GLushort a = ( GLushort )( stack * ( DEFERRED_SPHERE_SLICES + 1 ) + slice );
+                GLushort b = ( GLushort )( a + DEFERRED_SPHERE_SLICES + 1 );
+                GLushort quad[6] = { a, ( GLushort )( a + 1 ), b, b, ( GLushort )( a + 1 ), ( GLushort )( b + 1 ) };
+                indices.insert( indices.end( ), quad, quad + 6 );
+            }
+        }
+        this->sphereIndices = ( GLsizei )indices.size( );
+
+        glGenVertexArrays( 1, &this->sphereVAO );
+        glGenBuffers( 2, this->sphereBuffers );
+        glBindVertexArray( this->sphereVAO );
+        glBindBuffer( GL_ARRAY_BUFFER, this->sphereBuffers[0] );
+        glBufferData( GL_ARRAY_BUFFER, vertices.size( ) * sizeof( GLfloat ), &vertices[0], GL_STATIC_DRAW );
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof( GLfloat ), ( GLvoid * )0 );
+        glEnableVertexAttribArray( 0 );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->sphereBuffers[1] );
+        glBufferData( GL_ELEMENT_ARRAY_BUFFER, indices.size( ) * sizeof( GLushort ), &indices[0], GL_STATIC_DRAW );
+        glBindVertexArray( 0 );
+    }
+
+    void createTargets( GLint screenWidth, GLint screenHeight )
+    {
+        static const GLenum formats[4] = { GL_RGBA16F, GL_RGBA8, GL_RG16F, GL_R32F };
+        static const GLenum layouts[4] = { GL_RGBA, GL_RGBA, GL_RG, GL_RED };
+
+        this->deleteTargets( );
+        this->width = screenWidth;
+        this->height = screenHeight;
+
+        glGenFramebuffers( 1, &this->framebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, this->framebuffer );
+
+        glGenTextures( 4, this->targets );
+        for ( int i = 0; i < 4; i++ )
+        {
+            glActiveTexture( GL_TEXTURE0 + this->firstUnit + i );
+            glBindTexture( GL_TEXTURE_2D, this->targets[i] );
+            glTexImage2D( GL_TEXTURE_2D, 0, formats[i], this->width, this->height, 0, layouts[i], GL_FLOAT, NULL );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+            glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, this->targets[i], 0 );
+        }
+
+        // The lit colour's unit is where the light buffer lives, it is never sampled
+        glActiveTexture( GL_TEXTURE0 + this->firstUnit );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        glBindTexture( GL_TEXTURE_BUFFER, this->lightTexture );
+        glActiveTexture( GL_TEXTURE0 );
+
+        glGenRenderbuffers( 1, &this->depthStencil );
+        glBindRenderbuffer( GL_RENDERBUFFER, this->depthStencil );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, this->width, this->height );
+        glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->depthStencil );
+
+        if ( GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus( GL_FRAMEBUFFER ) )
+        {
+            std::cout << "ERROR::DEFERRED::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    }
+
+    void deleteTargets( )
+    {
+        if ( 0 != this->framebuffer )
+        {
+            glDeleteFramebuffers( 1, &this->framebuffer );
+            glDeleteTextures( 4, this->targets );
+            glDeleteRenderbuffers( 1, &this->depthStencil );
+            this->framebuffer = 0;
+            this->width = 0;
+            this->height = 0;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef DepthPrepass_h
+#define DepthPrepass_h
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+
+enum DepthPrepassMode
+{
+    PREPASS_OFF,
+    PREPASS_ON,
+    PREPASS_AUTO
+};
+
+// Auto mode turns the pre-pass on above the first overdraw and off again below the second
+const GLfloat PREPASS_ENABLE_OVERDRAW = 1.25f;
+const GLfloat PREPASS_DISABLE_OVERDRAW = 1.1f;
+
+// While off in auto mode, one frame in this many still runs the pre-pass to measure the overdraw
+const GLuint PREPASS_PROBE_INTERVAL = 60;
+
+// Query pairs in flight, results are read a few frames late so nothing waits on the GPU
+const GLint PREPASS_QUERIES = 4;
+
+// Optional depth-only pass before the shaded one. The opaque geometry is drawn first with a position
+// only VAO and an empty fragment shader, then the shaded pass runs with GL_EQUAL and depth writes off,
+// so every pixel runs frag.vs once, however much geometry overlaps it. depthcore.vs and core.vs
+// declare gl_Position invariant so both passes produce the same depth.
+// The overdraw is measured with two SAMPLES_PASSED queries: the pre-pass counts the fragments that
+// pass GL_LESS in draw order, which is what the shaded pass would run without it, the shaded pass
+// counts the ones left after it. Auto mode keeps the pre-pass while their ratio makes it pay.
+class DepthPrepass
+{
+public:
+    DepthPrepass( )
+        : shader( "resources/shaders/depthcore.vs", "resources/shaders/depthfrag.vs" )
+    {
+        this->mode = PREPASS_AUTO;
+        this->active = false;
+        this->running = false;
+        this->measuring = false;
+        this->frame = 0;
+        this->overdraw = 0.0f;
+        this->next = 0;
+        glGenQueries( PREPASS_QUERIES * 2, this->queries[0] );
+        for ( int i = 0; i < PREPASS_QUERIES; i++ )
+        {
+            this->pending[i] = false;
+        }
+    }
+
+    ~DepthPrepass( )
+    {
+        this->Clear( );
+    }
+
+    void SetMode( DepthPrepassMode mode )
+    {
+        this->mode = mode;
+        this->active = PREPASS_ON == mode;
+    }
+
+    DepthPrepassMode GetMode( ) const
+    {
+        return this->mode;
+    }
+
+    // Whether the pre-pass runs on frames that aren't probes
+    bool IsActive( ) const
+    {
+        return this->active;
+    }
+
+    // Shaded fragments per visible fragment without the pre-pass, from the latest measurement
+    GLfloat GetOverdraw( ) const
+    {
+        return this->overdraw;
+    }
+
+    // Starts the depth-only pass if this frame has one, draw the opaque geometry with Draw( ) and
+    // call End( ) when it returns true
+    bool Begin( const glm::mat4 &view, const glm::mat4 &projection )
+    {
+        this->frame++;
+        bool probe = PREPASS_AUTO == this->mode && 0 == this->frame % PREPASS_PROBE_INTERVAL;
+        this->running = PREPASS_ON == this->mode || ( PREPASS_AUTO == this->mode && this->active ) || probe;
+
+        // If the GPU is so far behind that the next query pair is still in flight, this frame isn't measured
+        this->measuring = this->running && ( !this->pending[this->next] || this->collect( this->next ) );
+        this->running = this->running && ( this->measuring || !probe || this->active );
+
+        if ( !this->running )
+        {
+            return false;
+        }
+
+        this->shader.Use( );
+        glUniformMatrix4fv( glGetUniformLocation( this->shader.Program, "view" ), 1, GL_FALSE, glm::value_ptr( view ) );
+        glUniformMatrix4fv( glGetUniformLocation( this->shader.Program, "projection" ), 1, GL_FALSE, glm::value_ptr( projection ) );
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        if ( this->measuring )
+        {
+            glBeginQuery( GL_SAMPLES_PASSED, this->queries[this->next][0] );
+        }
+
+        return true;
+    }
+
+    // One draw of the pre-pass, vao only needs positions at location 0
+    void Draw( GLuint vao, const glm::mat4 &model, GLsizei vertices )
+    {
+        glUniformMatrix4fv( glGetUniformLocation( this->shader.Program, "model" ), 1, GL_FALSE, glm::value_ptr( model ) );
+        glBindVertexArray( vao );
+        glDrawArrays( GL_TRIANGLES, 0, vertices );
+        glBindVertexArray( 0 );
+    }
+
+    void End( )
+    {
+        if ( this->measuring )
+        {
+            glEndQuery( GL_SAMPLES_PASSED );
+        }
+        glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+    }
+
+    // Wrap the shaded draws of the same geometry in these two
+    void BeginShading( )
+    {
+        if ( !this->running )
+        {
+            return;
+        }
+
+        glDepthFunc( GL_EQUAL );
+        glDepthMask( GL_FALSE );
+        if ( this->measuring )
+        {
+            glBeginQuery( GL_SAMPLES_PASSED, this->queries[this->next][1] );
+        }
+    }
+
+    void EndShading( )
+    {
+        if ( !this->running )
+        {
+            return;
+        }
+
+        glDepthFunc( GL_LESS );
+        glDepthMask( GL_TRUE );
+        if ( this->measuring )
+        {
+            glEndQuery( GL_SAMPLES_PASSED );
+            this->pending[this->next] = true;
+            this->next = ( this->next + 1 ) % PREPASS_QUERIES;
+        }
+
+        // Results of earlier frames that have come in since
+        for ( int i = 0; i < PREPASS_QUERIES; i++ )
+        {
+            if ( this->pending[i] )
+            {
+                this->collect( i );
+            }
+        }
+    }
+
+    void Clear( )
+    {
+        if ( 0 != this->queries[0][0] )
+        {
+            glDeleteQueries( PREPASS_QUERIES * 2, this->queries[0] );
+            this->queries[0][0] = 0;
+        }
+    }
+
+private:
+    Shader shader;
+    DepthPrepassMode mode;
+    bool active;
+    bool running;
+    bool measuring;
+    GLuint frame;
+    GLfloat overdraw;
+    GLuint queries[PREPASS_QUERIES][2];     // pre-pass and shaded pass samples
+    bool pending[PREPASS_QUERIES];
+    GLint next;
+
+    // Reads a query pair if the GPU is done with it and updates the auto mode decision
+    bool collect( GLint slot )
+    {
+        GLuint available = 0;
+        glGetQueryObjectuiv( this->queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available );
+        if ( !available )
+        {
+            return false;
+        }
+
+        GLuint depthSamples = 0, shadedSamples = 0;
+        glGetQueryObjectuiv( this->queries[slot][0], GL_QUERY_RESULT, &depthSamples );
+        glGetQueryObjectuiv( this->queries[slot][1], GL_QUERY_RESULT, &shadedSamples );
+        this->pending[slot] = false;
+
+        // Nothing on screen, nothing to decide
+        if ( 0 == shadedSamples )
+        {
+            return true;
+        }
+
+        this->overdraw = ( GLfloat )depthSamples / shadedSamples;
+        if ( PREPASS_AUTO == this->mode )
+        {
+            this->active = this->overdraw > ( this->active ? PREPASS_DISABLE_OVERDRAW : PREPASS_ENABLE_OVERDRAW );
+        }
+
+        return true;
+    }
+};
+
+#endif
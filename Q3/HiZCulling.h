@@ -0,0 +1,353 @@
+#ifndef HiZCulling_h
+#define HiZCulling_h
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "MaskedOcclusion.h"
+
+// Invocations per work group of hizcull.comp and per side of hizreduce.comp's
+const GLint HIZ_CULL_GROUP = 64;
+const GLint HIZ_REDUCE_GROUP = 8;
+
+// Visible counts in flight, each read back once its fence has passed so nothing waits on the GPU
+const GLint HIZ_READBACKS = 4;
+
+// What glDrawArraysIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawArraysIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+// Hierarchical-Z occlusion culling on the GPU. Build( ) copies the depth of the bound framebuffer and
+// reduces it in hizreduce.comp into a pyramid of R32F levels, each texel the farthest depth of the 2x2
+// under it. Cull( ) then runs hizcull.comp over the instances: a box is projected with the view the
+// depth was drawn with, and compared with the 2x2 texels of the first level where its rectangle fits
+// in that many. The instances left are packed into GetInstances( ), ready to be per instance vertex
+// attributes, and their count goes through an atomic counter straight into the instanceCount of the
+// GetCommand( ) indirect draw, so the CPU never learns which ones were drawn.
+// The depth can be from an earlier frame, the usual case when occluders and occludees are drawn in the
+// same pass: whatever moved since shows up a frame late. The visible count is read back a few frames late.
+// Needs compute shaders, storage buffers, atomic counters and indirect draws; IsSupported( ) says
+// whether the driver has them.
+class HiZCulling
+{
+public:
+    // unit is the texture unit Build( ) and Cull( ) bind the depth and the pyramid to
+    HiZCulling( GLuint unit )
+    {
+        this->unit = unit;
+        this->width = 0;
+        this->height = 0;
+        this->levels = 0;
+        this->depthTexture = 0;
+        this->pyramid = 0;
+        this->reduceProgram = 0;
+        this->cullProgram = 0;
+        this->viewProjection = glm::mat4( 1.0f );
+        this->capacity = 0;
+        this->visible = 0;
+        this->culled = 0;
+        this->next = 0;
+        for ( int i = 0; i < HIZ_READBACKS; i++ )
+        {
+            this->readbacks[i] = 0;
+            this->fences[i] = 0;
+            this->counts[i] = 0;
+        }
+        for ( int i = 0; i < 4; i++ )
+        {
+            this->buffers[i] = 0;
+        }
+
+        if ( !GLEW_ARB_compute_shader || !GLEW_ARB_shader_image_load_store || !GLEW_ARB_shader_storage_buffer_object ||
+             !GLEW_ARB_shader_atomic_counters || !GLEW_ARB_shading_language_420pack || !GLEW_ARB_draw_indirect ||
+             !GLEW_ARB_texture_storage )
+        {
+            return;
+        }
+
+        Shader reduce( "resources/shaders/hizreduce.comp" );
+        Shader cull( "resources/shaders/hizcull.comp" );
+        this->reduceProgram = reduce.Program;
+        this->cullProgram = cull.Program;
+        if ( !reduce.Valid( ) || !cull.Valid( ) )
+        {
+            this->Clear( );
+            return;
+        }
+
+        // Boxes, instances, visible instances and the draw command
+        glGenBuffers( 4, this->buffers );
+        glGenBuffers( HIZ_READBACKS, this->readbacks );
+        for ( int i = 0; i < HIZ_READBACKS; i++ )
+        {
+            glBindBuffer( GL_COPY_WRITE_BUFFER, this->readbacks[i] );
+            glBufferData( GL_COPY_WRITE_BUFFER, sizeof( GLuint ), NULL, GL_STREAM_READ );
+        }
+        glBindBuffer( GL_COPY_WRITE_BUFFER, this->buffers[3] );
+        glBufferData( GL_COPY_WRITE_BUFFER, sizeof( DrawArraysIndirectCommand ), NULL, GL_DYNAMIC_DRAW );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+    }
+
+    ~HiZCulling( )
+    {
+        this->Clear( );
+    }
+
+    bool IsSupported( ) const
+    {
+        return 0 != this->cullProgram;
+    }
+
+    // Copies the depth of the framebuffer bound for reading, width x height from the origin, and builds the
+    // pyramid from it. viewProjection is the one the depth was drawn with, Cull( ) projects the boxes with it
+    void Build( GLint width, GLint height, const glm::mat4 &viewProjection )
+    {
+        if ( !this->IsSupported( ) )
+        {
+            return;
+        }
+        if ( width != this->width || height != this->height )
+        {
+            this->allocate( width, height );
+        }
+        this->viewProjection = viewProjection;
+
+        glActiveTexture( GL_TEXTURE0 + this->unit );
+        glBindTexture( GL_TEXTURE_2D, this->depthTexture );
+        glCopyTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height );
+
+        glUseProgram( this->reduceProgram );
+        glUniform1i( glGetUniformLocation( this->reduceProgram, "source" ), this->unit );
+        glUniform1i( glGetUniformLocation( this->reduceProgram, "target" ), 0 );
+        GLint sourceWidth = width, sourceHeight = height;
+        for ( GLint level = 0; level < this->levels; level++ )
+        {
+            GLint targetWidth = std::max( sourceWidth / 2, 1 ), targetHeight = std::max( sourceHeight / 2, 1 );
+
+            // Level 0 comes from the depth texture, every level after it from the one before
+            glBindTexture( GL_TEXTURE_2D, 0 == level ? this->depthTexture : this->pyramid );
+            glBindImageTexture( 0, this->pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+            glUniform1i( glGetUniformLocation( this->reduceProgram, "sourceLevel" ), 0 == level ? 0 : level - 1 );
+            glUniform2i( glGetUniformLocation( this->reduceProgram, "sourceSize" ), sourceWidth, sourceHeight );
+            glUniform2i( glGetUniformLocation( this->reduceProgram, "targetSize" ), targetWidth, targetHeight );
+            glDispatchCompute( ( targetWidth + HIZ_REDUCE_GROUP - 1 ) / HIZ_REDUCE_GROUP, ( targetHeight + HIZ_REDUCE_GROUP - 1 ) / HIZ_REDUCE_GROUP, 1 );
+            glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+
+            sourceWidth = targetWidth;
+            sourceHeight = targetHeight;
+        }
+        glBindImageTexture( 0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    // Tests count boxes against the pyramid of the last Build( ), and packs the instances (stride floats each)
+    // of the ones that may be visible into GetInstances( ). The indirect command draws vertices of each
+    void Cull( const OcclusionBox *boxes, const GLfloat *instances, GLint stride, GLsizei count, GLuint vertices )
+    {
+        if ( !this->IsSupported( ) || 0 == this->levels )
+        {
+            return;
+        }
+        this->collect( );
+
+        GLsizeiptr instanceBytes = ( GLsizeiptr )count * stride * sizeof( GLfloat );
+        if ( instanceBytes > this->capacity )
+        {
+            this->capacity = instanceBytes;
+            glBindBuffer( GL_SHADER_STORAGE_BUFFER, this->buffers[2] );
+            glBufferData( GL_SHADER_STORAGE_BUFFER, this->capacity, NULL, GL_DYNAMIC_COPY );
+        }
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, this->buffers[0] );
+        glBufferData( GL_SHADER_STORAGE_BUFFER, count * sizeof( OcclusionBox ), boxes, GL_STREAM_DRAW );
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, this->buffers[1] );
+        glBufferData( GL_SHADER_STORAGE_BUFFER, instanceBytes, instances, GL_STREAM_DRAW );
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+        DrawArraysIndirectCommand command = { vertices, 0, 0, 0 };
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, this->buffers[3] );
+        glBufferSubData( GL_DRAW_INDIRECT_BUFFER, 0, sizeof( command ), &command );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+
+        glUseProgram( this->cullProgram );
+        glActiveTexture( GL_TEXTURE0 + this->unit );
+        glBindTexture( GL_TEXTURE_2D, this->pyramid );
+        glUniform1i( glGetUniformLocation( this->cullProgram, "pyramid" ), this->unit );
+        glUniform1i( glGetUniformLocation( this->cullProgram, "pyramidLevels" ), this->levels );
+        glUniform2i( glGetUniformLocation( this->cullProgram, "depthSize" ), this->width, this->height );
+        glUniformMatrix4fv( glGetUniformLocation( this->cullProgram, "viewProjection" ), 1, GL_FALSE, glm::value_ptr( this->viewProjection ) );
+        glUniform1i( glGetUniformLocation( this->cullProgram, "count" ), count );
+        glUniform1i( glGetUniformLocation( this->cullProgram, "stride" ), stride );
+        for ( GLuint i = 0; i < 3; i++ )
+        {
+            glBindBufferBase( GL_SHADER_STORAGE_BUFFER, i, this->buffers[i] );
+        }
+        glBindBufferRange( GL_ATOMIC_COUNTER_BUFFER, 0, this->buffers[3], offsetof( DrawArraysIndirectCommand, instanceCount ), sizeof( GLuint ) );
+        glDispatchCompute( ( count + HIZ_CULL_GROUP - 1 ) / HIZ_CULL_GROUP, 1, 1 );
+        glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT );
+        glBindBufferBase( GL_ATOMIC_COUNTER_BUFFER, 0, 0 );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        glActiveTexture( GL_TEXTURE0 );
+
+        // The count goes to a readback buffer of its own, to be read once the GPU is past the fence
+        if ( 0 != this->fences[this->next] )
+        {
+            glDeleteSync( this->fences[this->next] );
+        }
+        glBindBuffer( GL_COPY_READ_BUFFER, this->buffers[3] );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, this->readbacks[this->next] );
+        glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offsetof( DrawArraysIndirectCommand, instanceCount ), 0, sizeof( GLuint ) );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+        this->fences[this->next] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        this->counts[this->next] = count;
+        this->next = ( this->next + 1 ) % HIZ_READBACKS;
+    }
+
+    // The visible instances, packed, for glVertexAttribPointer with a divisor
+    GLuint GetInstances( ) const
+    {
+        return this->buffers[2];
+    }
+
+    // A DrawArraysIndirectCommand for GL_DRAW_INDIRECT_BUFFER and glDrawArraysIndirect
+    GLuint GetCommand( ) const
+    {
+        return this->buffers[3];
+    }
+
+    // Instances drawn and left out by the latest Cull( ) whose count has come back
+    GLsizei GetVisible( ) const
+    {
+        return this->visible;
+    }
+
+    GLsizei GetCulled( ) const
+    {
+        return this->culled;
+    }
+
+    void Clear( )
+    {
+        for ( int i = 0; i < HIZ_READBACKS; i++ )
+        {
+            if ( 0 != this->fences[i] )
+            {
+                glDeleteSync( this->fences[i] );
+                this->fences[i] = 0;
+            }
+        }
+        if ( 0 != this->buffers[0] )
+        {
+            glDeleteBuffers( 4, this->buffers );
+            glDeleteBuffers( HIZ_READBACKS, this->readbacks );
+            this->buffers[0] = 0;
+        }
+        this->release( );
+        if ( 0 != this->reduceProgram )
+        {
+            glDeleteProgram( this->reduceProgram );
+            this->reduceProgram = 0;
+        }
+        if ( 0 != this->cullProgram )
+        {
+            glDeleteProgram( this->cullProgram );
+            this->cullProgram = 0;
+        }
+    }
+
+private:
+    GLuint unit;
+    GLint width, height;
+    GLint levels;
+    GLuint depthTexture;
+    GLuint pyramid;
+    GLuint reduceProgram, cullProgram;
+    glm::mat4 viewProjection;
+    GLuint buffers[4];
+    GLsizeiptr capacity;
+    GLuint readbacks[HIZ_READBACKS];
+    GLsync fences[HIZ_READBACKS];
+    GLsizei counts[HIZ_READBACKS];
+    GLsizei visible, culled;
+    GLint next;
+
+    // The depth copy at width x height and the pyramid from half that down to 1x1, levels rounding down as mips do
+    void allocate( GLint width, GLint height )
+    {
+        this->release( );
+        this->width = width;
+        this->height = height;
+
+        glActiveTexture( GL_TEXTURE0 + this->unit );
+        glGenTextures( 1, &this->depthTexture );
+        glBindTexture( GL_TEXTURE_2D, this->depthTexture );
+        glTexStorage2D( GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE );
+
+        GLint pyramidWidth = std::max( width / 2, 1 ), pyramidHeight = std::max( height / 2, 1 );
+        this->levels = 1;
+        for ( GLint side = std::max( pyramidWidth, pyramidHeight ); side > 1; side /= 2 )
+        {
+            this->levels++;
+        }
+        glGenTextures( 1, &this->pyramid );
+        glBindTexture( GL_TEXTURE_2D, this->pyramid );
+        glTexStorage2D( GL_TEXTURE_2D, this->levels, GL_R32F, pyramidWidth, pyramidHeight );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    void release( )
+    {
+        if ( 0 != this->depthTexture )
+        {
+            glDeleteTextures( 1, &this->depthTexture );
+            glDeleteTextures( 1, &this->pyramid );
+            this->depthTexture = 0;
+            this->pyramid = 0;
+        }
+        this->width = 0;
+        this->height = 0;
+        this->levels = 0;
+    }
+
+    // Takes in the counts the GPU is done with, oldest first
+    void collect( )
+    {
+        for ( int i = 0; i < HIZ_READBACKS; i++ )
+        {
+            GLint slot = ( this->next + i ) % HIZ_READBACKS;
+            if ( 0 == this->fences[slot] || GL_TIMEOUT_EXPIRED == glClientWaitSync( this->fences[slot], 0, 0 ) )
+            {
+                continue;
+            }
+
+            GLuint count = 0;
+            glBindBuffer( GL_COPY_READ_BUFFER, this->readbacks[slot] );
+            glGetBufferSubData( GL_COPY_READ_BUFFER, 0, sizeof( GLuint ), &count );
+            glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+            glDeleteSync( this->fences[slot] );
+            this->fences[slot] = 0;
+            this->visible = ( GLsizei )count;
+            this->culled = this->counts[slot] - this->visible;
+        }
+    }
+};
+
+#endif /* HiZCulling_h */
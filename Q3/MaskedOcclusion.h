@@ -0,0 +1,598 @@
+#ifndef MaskedOcclusion_h
+#define MaskedOcclusion_h
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define OCCLUSION_AVX2
+#endif
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "SOIL2/image_parallel.h"
+
+// Resolution of the coarse depth buffer whatever the window's, in tiles of 32x8 pixels. The pixels
+// needn't be square, the buffer only has to cover the same view as the screen
+const GLint OCCLUSION_WIDTH = 320;
+const GLint OCCLUSION_HEIGHT = 192;
+const GLint OCCLUSION_TILE_WIDTH = 32;
+const GLint OCCLUSION_TILE_HEIGHT = 8;
+
+// Boxes tested on a thread of their own once there are this many
+const GLint OCCLUSION_BOXES_PER_THREAD = 16384;
+
+// An axis-aligned box in world space, what the culling tests instead of the object inside it
+struct OcclusionBox
+{
+    glm::vec3 center;
+    glm::vec3 extent;     // half the size along each axis
+};
+
+// Masked software occlusion culling (Hasselgren et al. 2016). The big opaque meshes are rasterized on
+// the CPU into a coarse depth buffer of 32x8 pixel tiles, each tile row on a thread of its own. A tile
+// keeps no depth per pixel but two layers: a far depth that holds for the whole tile, and a nearer one
+// for the pixels set in a 256 bit mask, a row of 32 pixels per 32 bit lane, so a triangle updates a
+// tile with a few AVX2 operations. When the mask fills, the near layer becomes the far one.
+// Boxes are then projected to a screen rectangle and their nearest depth, and are hidden if no pixel
+// under them can be farther. Both ends err towards visible: occluders only cover the pixels they cover
+// entirely and leave out triangles the near or far plane cuts, boxes touch every pixel they overlap.
+// Per frame: Begin( ), AddOccluder( ) for each occluder, Rasterize( ), then Cull( ) as often as needed.
+class MaskedOcclusion
+{
+public:
+    MaskedOcclusion( )
+    {
+        this->tilesX = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+        this->tilesY = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+        this->masks.resize( this->tilesX * this->tilesY * OCCLUSION_TILE_HEIGHT );
+        this->farDepth.resize( this->tilesX * this->tilesY );
+        this->nearDepth.resize( this->tilesX * this->tilesY );
+        this->boxes = NULL;
+        this->Begin( glm::mat4( 1.0f ) );
+    }
+
+    // Empties the depth buffer and the occluders for a view
+    void Begin( const glm::mat4 &viewProjection )
+    {
+        this->viewProjection = viewProjection;
+        this->triangles.clear( );
+        std::fill( this->masks.begin( ), this->masks.end( ), 0u );
+        std::fill( this->farDepth.begin( ), this->farDepth.end( ), 1.0f );
+        std::fill( this->nearDepth.begin( ), this->nearDepth.end( ), 0.0f );
+    }
+
+    // Triangles of count vertices, a position in the first three of each stride floats, placed by model.
+    // Only sets them up, Rasterize( ) draws them all at once
+    void AddOccluder( const GLfloat *vertices, GLint stride, GLsizei count, const glm::mat4 &model )
+    {
+        glm::mat4 transform = this->viewProjection * model;
+        for ( GLsizei v = 0; v + 2 < count; v += 3 )
+        {
+            glm::vec3 screen[3];
+            bool clipped = false;
+            for ( int i = 0; i < 3; i++ )
+            {
+                const GLfloat *position = vertices + ( v + i ) * stride;
+                glm::vec4 clip = transform * glm::vec4( position[0], position[1], position[2], 1.0f );
+                // Past the near or far plane the GPU cuts the triangle open, what is behind shows through
+                if ( clip.w <= 0.0f || clip.z < -clip.w || clip.z > clip.w )
+                {
+                    clipped = true;
+                    break;
+                }
+                screen[i] = glm::vec3( ( clip.x / clip.w * 0.5f + 0.5f ) * OCCLUSION_WIDTH,
+                                       ( clip.y / clip.w * 0.5f + 0.5f ) * OCCLUSION_HEIGHT, clip.z / clip.w * 0.5f + 0.5f );
+            }
+            if ( !clipped )
+            {
+                this->setupTriangle( screen );
+            }
+        }
+    }
+
+    // Draws the occluders into the depth buffer
+    void Rasterize( )
+    {
+        SOIL_parallel_for( this->tilesY, 1, rasterizeRows, this );
+    }
+
+    // Whether any of the box can be seen past the occluders and inside the view
+    bool IsVisible( const OcclusionBox &box ) const
+    {
+        Footprint footprint;
+        this->project( box, footprint );
+        return this->uncovered( footprint );
+    }
+
+    // Fills visible with the indices of the boxes IsVisible( ) lets through, in order, and returns how many there are
+    GLsizei Cull( const OcclusionBox *boxes, GLsizei count, std::vector<GLuint> &visible )
+    {
+        this->boxes = boxes;
+        this->flags.resize( count );
+        SOIL_parallel_for( count, OCCLUSION_BOXES_PER_THREAD, cullBoxes, this );
+        this->boxes = NULL;
+
+        // Without a branch, as likely taken as not
+        visible.resize( count );
+        GLsizei found = 0;
+        for ( GLsizei i = 0; i < count; i++ )
+        {
+            visible[found] = ( GLuint )i;
+            found += this->flags[i];
+        }
+        visible.resize( found );
+        return found;
+    }
+
+    // Copies the per instance attributes (stride floats each) of the visible objects next to each other, ready for
+    // glBufferSubData and an instanced or indirect draw of visible.size( ) instances
+    static void Gather( const GLfloat *instances, GLint stride, const std::vector<GLuint> &visible, std::vector<GLfloat> &gathered )
+    {
+        gathered.resize( visible.size( ) * stride );
+        for ( size_t i = 0; i < visible.size( ); i++ )
+        {
+            std::copy( instances + visible[i] * stride, instances + ( visible[i] + 1 ) * stride, &gathered[i * stride] );
+        }
+    }
+
+    GLsizei GetTriangles( ) const
+    {
+        return ( GLsizei )this->triangles.size( );
+    }
+
+private:
+    // An occluder triangle in buffer pixels: edge functions A x + B y + C, positive inside, and a depth plane
+    struct Triangle
+    {
+        GLfloat a[3], b[3], c[3];
+        GLfloat depth, depthX, depthY;     // depth at the buffer's origin, and its change per pixel
+        GLfloat farthest;                  // the deepest vertex
+        GLint left, right, bottom, top;    // tiles of the bounding box, inclusive
+    };
+
+    GLint tilesX, tilesY;
+    glm::mat4 viewProjection;
+    std::vector<Triangle> triangles;
+    std::vector<GLuint> masks;
+    std::vector<GLfloat> farDepth;
+    std::vector<GLfloat> nearDepth;
+    const OcclusionBox *boxes;
+    std::vector<GLubyte> flags;
+
+    void setupTriangle( const glm::vec3 *screen )
+    {
+        GLfloat area = ( screen[1].x - screen[0].x ) * ( screen[2].y - screen[0].y ) - ( screen[2].x - screen[0].x ) * ( screen[1].y - screen[0].y );
+        if ( 0.0f == area || area != area )
+        {
+            return;
+        }
+
+        // Both windings occlude, the edges are flipped for the clockwise ones
+        Triangle triangle;
+        GLfloat sign = area > 0.0f ? 1.0f : -1.0f;
+        for ( int i = 0; i < 3; i++ )
+        {
+            const glm::vec3 &from = screen[i], &to = screen[( i + 1 ) % 3];
+            triangle.a[i] = -( to.y - from.y ) * sign;
+            triangle.b[i] = ( to.x - from.x ) * sign;
+            triangle.c[i] = -( triangle.a[i] * from.x + triangle.b[i] * from.y );
+        }
+        triangle.depthX = ( ( screen[1].z - screen[0].z ) * ( screen[2].y - screen[0].y ) - ( screen[2].z - screen[0].z ) * ( screen[1].y - screen[0].y ) ) / area;
+        triangle.depthY = ( ( screen[2].z - screen[0].z ) * ( screen[1].x - screen[0].x ) - ( screen[1].z - screen[0].z ) * ( screen[2].x - screen[0].x ) ) / area;
+        triangle.depth = screen[0].z - triangle.depthX * screen[0].x - triangle.depthY * screen[0].y;
+        triangle.farthest = std::max( std::max( screen[0].z, screen[1].z ), screen[2].z );
+
+        GLfloat minX = std::min( std::min( screen[0].x, screen[1].x ), screen[2].x );
+        GLfloat maxX = std::max( std::max( screen[0].x, screen[1].x ), screen[2].x );
+        GLfloat minY = std::min( std::min( screen[0].y, screen[1].y ), screen[2].y );
+        GLfloat maxY = std::max( std::max( screen[0].y, screen[1].y ), screen[2].y );
+        if ( maxX <= 0.0f || maxY <= 0.0f || minX >= OCCLUSION_WIDTH || minY >= OCCLUSION_HEIGHT )
+        {
+            return;
+        }
+        triangle.left = std::max( ( GLint )minX, 0 ) / OCCLUSION_TILE_WIDTH;
+        triangle.right = std::min( ( GLint )maxX, OCCLUSION_WIDTH - 1 ) / OCCLUSION_TILE_WIDTH;
+        triangle.bottom = std::max( ( GLint )minY, 0 ) / OCCLUSION_TILE_HEIGHT;
+        triangle.top = std::min( ( GLint )maxY, OCCLUSION_HEIGHT - 1 ) / OCCLUSION_TILE_HEIGHT;
+        this->triangles.push_back( triangle );
+    }
+
+    // A row of tiles at a time, each triangle in the order it was added
+    static void rasterizeRows( void *context, int begin, int end )
+    {
+        MaskedOcclusion *occlusion = ( MaskedOcclusion * )context;
+        for ( int tileY = begin; tileY < end; tileY++ )
+        {
+            for ( size_t i = 0; i < occlusion->triangles.size( ); i++ )
+            {
+                const Triangle &triangle = occlusion->triangles[i];
+                if ( tileY >= triangle.bottom && tileY <= triangle.top )
+                {
+                    occlusion->rasterizeRow( triangle, tileY );
+                }
+            }
+        }
+    }
+
+    void rasterizeRow( const Triangle &triangle, GLint tileY )
+    {
+        GLint y = tileY * OCCLUSION_TILE_HEIGHT;
+
+        // The pixels [first, last) of each of the 8 rows that lie wholly inside the triangle: every edge
+        // is checked at the corner of the pixel where it is lowest
+#ifdef OCCLUSION_AVX2
+        __m256 row = _mm256_add_ps( _mm256_set1_ps( ( GLfloat )y ), _mm256_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f ) );
+        __m256 first = _mm256_set1_ps( -1.0e30f ), last = _mm256_set1_ps( 1.0e30f );
+        for ( int i = 0; i < 3; i++ )
+        {
+            __m256 corner = triangle.b[i] < 0.0f ? _mm256_add_ps( row, _mm256_set1_ps( 1.0f ) ) : row;
+            __m256 value = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( triangle.b[i] ), corner ), _mm256_set1_ps( triangle.c[i] ) );
+            if ( triangle.a[i] > 0.0f )
+            {
+                __m256 bound = _mm256_div_ps( _mm256_sub_ps( _mm256_setzero_ps( ), value ), _mm256_set1_ps( triangle.a[i] ) );
+                first = _mm256_max_ps( first, _mm256_ceil_ps( bound ) );
+            }
+            else if ( triangle.a[i] < 0.0f )
+            {
+                __m256 bound = _mm256_div_ps( value, _mm256_set1_ps( -triangle.a[i] ) );
+                last = _mm256_min_ps( last, _mm256_floor_ps( bound ) );
+            }
+            else
+            {
+                first = _mm256_blendv_ps( first, _mm256_set1_ps( 1.0e30f ), _mm256_cmp_ps( value, _mm256_setzero_ps( ), _CMP_LT_OQ ) );
+            }
+        }
+#else
+        GLfloat first[8], last[8];
+        for ( int r = 0; r < OCCLUSION_TILE_HEIGHT; r++ )
+        {
+            first[r] = -1.0e30f;
+            last[r] = 1.0e30f;
+            for ( int i = 0; i < 3; i++ )
+            {
+                GLfloat value = triangle.b[i] * ( y + r + ( triangle.b[i] < 0.0f ? 1.0f : 0.0f ) ) + triangle.c[i];
+                if ( triangle.a[i] > 0.0f )
+                {
+                    first[r] = std::max( first[r], std::ceil( -value / triangle.a[i] ) );
+                }
+                else if ( triangle.a[i] < 0.0f )
+                {
+                    last[r] = std::min( last[r], std::floor( value / -triangle.a[i] ) );
+                }
+                else if ( value < 0.0f )
+                {
+                    first[r] = 1.0e30f;
+                }
+            }
+        }
+#endif
+
+        for ( GLint tileX = triangle.left; tileX <= triangle.right; tileX++ )
+        {
+            GLfloat x = ( GLfloat )( tileX * OCCLUSION_TILE_WIDTH );
+
+            // The pixels covered in each row as a run of bits
+#ifdef OCCLUSION_AVX2
+            __m256 offset = _mm256_set1_ps( x ), zero = _mm256_setzero_ps( ), width = _mm256_set1_ps( ( GLfloat )OCCLUSION_TILE_WIDTH );
+            __m256i begin = _mm256_cvttps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_sub_ps( first, offset ), zero ), width ) );
+            __m256i end = _mm256_cvttps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_sub_ps( last, offset ), zero ), width ) );
+            __m256i ones = _mm256_set1_epi32( -1 );
+            __m256i coverage = _mm256_andnot_si256( _mm256_sllv_epi32( ones, end ), _mm256_sllv_epi32( ones, begin ) );
+            if ( _mm256_testz_si256( coverage, coverage ) )
+            {
+                continue;
+            }
+#else
+            GLuint coverage[8];
+            GLuint any = 0;
+            for ( int r = 0; r < OCCLUSION_TILE_HEIGHT; r++ )
+            {
+                GLint begin = ( GLint )std::min( std::max( first[r] - x, 0.0f ), ( GLfloat )OCCLUSION_TILE_WIDTH );
+                GLint end = ( GLint )std::min( std::max( last[r] - x, 0.0f ), ( GLfloat )OCCLUSION_TILE_WIDTH );
+                coverage[r] = begin >= end ? 0u : ( 0xFFFFFFFFu << begin ) & ( 32 == end ? 0xFFFFFFFFu : ( 1u << end ) - 1u );
+                any |= coverage[r];
+            }
+            if ( !any )
+            {
+                continue;
+            }
+#endif
+
+            // The triangle's depth over the tile: its plane at the tile's deepest corner, no deeper than its deepest vertex
+            GLfloat cornerX = triangle.depthX > 0.0f ? x + OCCLUSION_TILE_WIDTH : x;
+            GLfloat cornerY = triangle.depthY > 0.0f ? ( GLfloat )( y + OCCLUSION_TILE_HEIGHT ) : ( GLfloat )y;
+            GLfloat depth = std::min( triangle.depth + triangle.depthX * cornerX + triangle.depthY * cornerY, triangle.farthest );
+
+            GLint tile = tileY * this->tilesX + tileX;
+            if ( depth >= this->farDepth[tile] )
+            {
+                continue;
+            }
+
+            // A triangle much nearer than the near layer starts it over, the pixels that were in it fall back to the
+            // far depth. Otherwise it joins the layer, which is then as deep as the deeper of the two
+            GLuint *mask = &this->masks[tile * OCCLUSION_TILE_HEIGHT];
+            GLfloat &farLayer = this->farDepth[tile], &nearLayer = this->nearDepth[tile];
+            bool restart = nearLayer - depth > farLayer - nearLayer;
+            nearLayer = restart ? depth : std::max( nearLayer, depth );
+#ifdef OCCLUSION_AVX2
+            __m256i covered = restart ? coverage : _mm256_or_si256( _mm256_loadu_si256( ( const __m256i * )mask ), coverage );
+            if ( _mm256_testc_si256( covered, ones ) )
+            {
+                farLayer = nearLayer;
+                nearLayer = 0.0f;
+                covered = _mm256_setzero_si256( );
+            }
+            _mm256_storeu_si256( ( __m256i * )mask, covered );
+#else
+            GLuint full = 0xFFFFFFFFu;
+            for ( int r = 0; r < OCCLUSION_TILE_HEIGHT; r++ )
+            {
+                mask[r] = restart ? coverage[r] : mask[r] | coverage[r];
+                full &= mask[r];
+            }
+            if ( 0xFFFFFFFFu == full )
+            {
+                farLayer = nearLayer;
+                nearLayer = 0.0f;
+                std::fill( mask, mask + OCCLUSION_TILE_HEIGHT, 0u );
+            }
+#endif
+        }
+    }
+
+    // The pixels [left, right) x [bottom, top) a box may cover and its nearest depth. Out of view the rectangle is
+    // empty, reaching behind the near plane it is the whole buffer from depth 0
+    struct Footprint
+    {
+        GLint left, right, bottom, top;
+        GLfloat nearest;
+    };
+
+    void project( const OcclusionBox &box, Footprint &footprint ) const
+    {
+        const glm::mat4 &m = this->viewProjection;
+        glm::vec4 center = m * glm::vec4( box.center, 1.0f );
+        glm::vec4 axes[3] = { m[0] * box.extent.x, m[1] * box.extent.y, m[2] * box.extent.z };
+
+        // How far the corners get from the center in x + w, y + w and z + w (across), and in x - w, y - w and z - w (along)
+        glm::vec4 across( std::abs( axes[0].x + axes[0].w ) + std::abs( axes[1].x + axes[1].w ) + std::abs( axes[2].x + axes[2].w ),
+                          std::abs( axes[0].y + axes[0].w ) + std::abs( axes[1].y + axes[1].w ) + std::abs( axes[2].y + axes[2].w ),
+                          std::abs( axes[0].z + axes[0].w ) + std::abs( axes[1].z + axes[1].w ) + std::abs( axes[2].z + axes[2].w ), 0.0f );
+        glm::vec4 along( std::abs( axes[0].x - axes[0].w ) + std::abs( axes[1].x - axes[1].w ) + std::abs( axes[2].x - axes[2].w ),
+                         std::abs( axes[0].y - axes[0].w ) + std::abs( axes[1].y - axes[1].w ) + std::abs( axes[2].y - axes[2].w ),
+                         std::abs( axes[0].z - axes[0].w ) + std::abs( axes[1].z - axes[1].w ) + std::abs( axes[2].z - axes[2].w ), 0.0f );
+
+        // Out of view when every corner is past the same plane: x + w < 0 for the left one, x - w > 0 for the right
+        if ( center.x + center.w + across.x < 0.0f || center.x - center.w - along.x > 0.0f ||
+             center.y + center.w + across.y < 0.0f || center.y - center.w - along.y > 0.0f ||
+             center.z + center.w + across.z < 0.0f || center.z - center.w - along.z > 0.0f )
+        {
+            footprint.left = footprint.right = footprint.bottom = footprint.top = 0;
+            footprint.nearest = 1.0f;
+            return;
+        }
+        if ( center.z + center.w - across.z < 0.0f || center.w - std::abs( axes[0].w ) - std::abs( axes[1].w ) - std::abs( axes[2].w ) <= 0.0f )
+        {
+            footprint.left = footprint.bottom = 0;
+            footprint.right = OCCLUSION_WIDTH;
+            footprint.top = OCCLUSION_HEIGHT;
+            footprint.nearest = 0.0f;
+            return;
+        }
+
+        GLfloat minX = 1.0e30f, maxX = -1.0e30f, minY = 1.0e30f, maxY = -1.0e30f, nearest = 1.0e30f;
+        for ( int i = 0; i < 8; i++ )
+        {
+            glm::vec4 corner = center + axes[0] * ( i & 1 ? 1.0f : -1.0f ) + axes[1] * ( i & 2 ? 1.0f : -1.0f ) + axes[2] * ( i & 4 ? 1.0f : -1.0f );
+            GLfloat inverse = 1.0f / corner.w;
+            minX = std::min( minX, corner.x * inverse );
+            maxX = std::max( maxX, corner.x * inverse );
+            minY = std::min( minY, corner.y * inverse );
+            maxY = std::max( maxY, corner.y * inverse );
+            nearest = std::min( nearest, corner.z * inverse );
+        }
+        this->bound( minX, maxX, minY, maxY, nearest, footprint );
+    }
+
+    // The buffer pixels under a rectangle in normalized device coordinates, rounded outwards
+    static void bound( GLfloat minX, GLfloat maxX, GLfloat minY, GLfloat maxY, GLfloat nearest, Footprint &footprint )
+    {
+        footprint.left = ( GLint )std::floor( std::max( minX * 0.5f + 0.5f, 0.0f ) * OCCLUSION_WIDTH );
+        footprint.right = std::min( ( GLint )std::floor( std::min( maxX * 0.5f + 0.5f, 1.0f ) * OCCLUSION_WIDTH ) + 1, OCCLUSION_WIDTH );
+        footprint.bottom = ( GLint )std::floor( std::max( minY * 0.5f + 0.5f, 0.0f ) * OCCLUSION_HEIGHT );
+        footprint.top = std::min( ( GLint )std::floor( std::min( maxY * 0.5f + 0.5f, 1.0f ) * OCCLUSION_HEIGHT ) + 1, OCCLUSION_HEIGHT );
+        footprint.nearest = nearest * 0.5f + 0.5f;
+    }
+
+#ifdef OCCLUSION_AVX2
+    // project( ) for 8 boxes at once, a box per lane
+    void projectBoxes( const OcclusionBox *boxes, Footprint *footprints ) const
+    {
+        const GLint stride = sizeof( OcclusionBox ) / sizeof( GLfloat );
+        const __m256i index = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32( stride ) );
+        const GLfloat *base = &boxes[0].center.x;
+        __m256 position[3], extent[3];
+        for ( int a = 0; a < 3; a++ )
+        {
+            position[a] = _mm256_i32gather_ps( base + a, index, 4 );
+            extent[a] = _mm256_i32gather_ps( base + 3 + a, index, 4 );
+        }
+
+        // The center and the three half axes in clip space, a coordinate at a time
+        const glm::mat4 &m = this->viewProjection;
+        const __m256 sign = _mm256_set1_ps( -0.0f );
+        __m256 center[4], axes[3][4];
+        for ( int r = 0; r < 4; r++ )
+        {
+            center[r] = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( m[0][r] ), position[0] ), _mm256_mul_ps( _mm256_set1_ps( m[1][r] ), position[1] ) ),
+                                       _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( m[2][r] ), position[2] ), _mm256_set1_ps( m[3][r] ) ) );
+            for ( int a = 0; a < 3; a++ )
+            {
+                axes[a][r] = _mm256_mul_ps( _mm256_set1_ps( m[a][r] ), extent[a] );
+            }
+        }
+
+        // The same plane tests as project( )
+        __m256 outside = _mm256_setzero_ps( ), across[3], along[3];
+        for ( int r = 0; r < 3; r++ )
+        {
+            across[r] = _mm256_setzero_ps( );
+            along[r] = _mm256_setzero_ps( );
+            for ( int a = 0; a < 3; a++ )
+            {
+                across[r] = _mm256_add_ps( across[r], _mm256_andnot_ps( sign, _mm256_add_ps( axes[a][r], axes[a][3] ) ) );
+                along[r] = _mm256_add_ps( along[r], _mm256_andnot_ps( sign, _mm256_sub_ps( axes[a][r], axes[a][3] ) ) );
+            }
+            __m256 plus = _mm256_add_ps( center[r], center[3] ), minus = _mm256_sub_ps( center[r], center[3] );
+            outside = _mm256_or_ps( outside, _mm256_cmp_ps( _mm256_add_ps( plus, across[r] ), _mm256_setzero_ps( ), _CMP_LT_OQ ) );
+            outside = _mm256_or_ps( outside, _mm256_cmp_ps( _mm256_sub_ps( minus, along[r] ), _mm256_setzero_ps( ), _CMP_GT_OQ ) );
+        }
+        __m256 reach = _mm256_add_ps( _mm256_add_ps( _mm256_andnot_ps( sign, axes[0][3] ), _mm256_andnot_ps( sign, axes[1][3] ) ),
+                                      _mm256_andnot_ps( sign, axes[2][3] ) );
+        __m256 behind = _mm256_or_ps( _mm256_cmp_ps( _mm256_sub_ps( _mm256_add_ps( center[2], center[3] ), across[2] ), _mm256_setzero_ps( ), _CMP_LT_OQ ),
+                                      _mm256_cmp_ps( _mm256_sub_ps( center[3], reach ), _mm256_setzero_ps( ), _CMP_LE_OQ ) );
+
+        // The corners, the far and near side along the third axis shared by four of them each
+        __m256 minX = _mm256_set1_ps( 1.0e30f ), maxX = _mm256_set1_ps( -1.0e30f ), minY = minX, maxY = maxX, nearest = minX;
+        for ( int side = 0; side < 2; side++ )
+        {
+            __m256 face[4];
+            for ( int r = 0; r < 4; r++ )
+            {
+                face[r] = side ? _mm256_add_ps( center[r], axes[2][r] ) : _mm256_sub_ps( center[r], axes[2][r] );
+            }
+            for ( int i = 0; i < 4; i++ )
+            {
+                __m256 corner[4];
+                for ( int r = 0; r < 4; r++ )
+                {
+                    corner[r] = i & 2 ? _mm256_add_ps( face[r], axes[1][r] ) : _mm256_sub_ps( face[r], axes[1][r] );
+                    corner[r] = i & 1 ? _mm256_add_ps( corner[r], axes[0][r] ) : _mm256_sub_ps( corner[r], axes[0][r] );
+                }
+
+                // A reciprocal estimate and a Newton step, good to a few parts in 10^7
+                __m256 estimate = _mm256_rcp_ps( corner[3] );
+                __m256 inverse = _mm256_mul_ps( estimate, _mm256_sub_ps( _mm256_set1_ps( 2.0f ), _mm256_mul_ps( corner[3], estimate ) ) );
+                __m256 x = _mm256_mul_ps( corner[0], inverse ), y = _mm256_mul_ps( corner[1], inverse );
+                minX = _mm256_min_ps( minX, x );
+                maxX = _mm256_max_ps( maxX, x );
+                minY = _mm256_min_ps( minY, y );
+                maxY = _mm256_max_ps( maxY, y );
+                nearest = _mm256_min_ps( nearest, _mm256_mul_ps( corner[2], inverse ) );
+            }
+        }
+
+        // bound( ) per lane, then the boxes out of view get an empty rectangle and the ones behind the near plane all of it
+        const __m256 half = _mm256_set1_ps( 0.5f ), zero = _mm256_setzero_ps( ), one = _mm256_set1_ps( 1.0f );
+        const __m256 width = _mm256_set1_ps( ( GLfloat )OCCLUSION_WIDTH ), height = _mm256_set1_ps( ( GLfloat )OCCLUSION_HEIGHT );
+        const __m256i step = _mm256_set1_epi32( 1 );
+        __m256i left = _mm256_cvttps_epi32( _mm256_floor_ps( _mm256_mul_ps( _mm256_max_ps( _mm256_add_ps( _mm256_mul_ps( minX, half ), half ), zero ), width ) ) );
+        __m256i right = _mm256_cvttps_epi32( _mm256_floor_ps( _mm256_mul_ps( _mm256_min_ps( _mm256_add_ps( _mm256_mul_ps( maxX, half ), half ), one ), width ) ) );
+        __m256i bottom = _mm256_cvttps_epi32( _mm256_floor_ps( _mm256_mul_ps( _mm256_max_ps( _mm256_add_ps( _mm256_mul_ps( minY, half ), half ), zero ), height ) ) );
+        __m256i top = _mm256_cvttps_epi32( _mm256_floor_ps( _mm256_mul_ps( _mm256_min_ps( _mm256_add_ps( _mm256_mul_ps( maxY, half ), half ), one ), height ) ) );
+        right = _mm256_min_epi32( _mm256_add_epi32( right, step ), _mm256_set1_epi32( OCCLUSION_WIDTH ) );
+        top = _mm256_min_epi32( _mm256_add_epi32( top, step ), _mm256_set1_epi32( OCCLUSION_HEIGHT ) );
+        nearest = _mm256_add_ps( _mm256_mul_ps( nearest, half ), half );
+
+        __m256i back = _mm256_castps_si256( _mm256_andnot_ps( outside, behind ) ), out = _mm256_castps_si256( outside );
+        left = _mm256_andnot_si256( _mm256_or_si256( out, back ), left );
+        bottom = _mm256_andnot_si256( _mm256_or_si256( out, back ), bottom );
+        right = _mm256_andnot_si256( out, _mm256_blendv_epi8( right, _mm256_set1_epi32( OCCLUSION_WIDTH ), back ) );
+        top = _mm256_andnot_si256( out, _mm256_blendv_epi8( top, _mm256_set1_epi32( OCCLUSION_HEIGHT ), back ) );
+        nearest = _mm256_blendv_ps( _mm256_andnot_ps( behind, nearest ), one, outside );
+
+        GLint bounds[4][8];
+        GLfloat depths[8];
+        _mm256_storeu_si256( ( __m256i * )bounds[0], left );
+        _mm256_storeu_si256( ( __m256i * )bounds[1], right );
+        _mm256_storeu_si256( ( __m256i * )bounds[2], bottom );
+        _mm256_storeu_si256( ( __m256i * )bounds[3], top );
+        _mm256_storeu_ps( depths, nearest );
+        for ( int l = 0; l < 8; l++ )
+        {
+            footprints[l].left = bounds[0][l];
+            footprints[l].right = bounds[1][l];
+            footprints[l].bottom = bounds[2][l];
+            footprints[l].top = bounds[3][l];
+            footprints[l].nearest = depths[l];
+        }
+    }
+#endif
+
+    // Whether a pixel of the footprint could be farther than the box
+    bool uncovered( const Footprint &footprint ) const
+    {
+        const GLfloat nearest = footprint.nearest;
+        for ( GLint tileY = footprint.bottom / OCCLUSION_TILE_HEIGHT; tileY * OCCLUSION_TILE_HEIGHT < footprint.top; tileY++ )
+        {
+            GLint rowBegin = std::max( footprint.bottom - tileY * OCCLUSION_TILE_HEIGHT, 0 );
+            GLint rowEnd = std::min( footprint.top - tileY * OCCLUSION_TILE_HEIGHT, OCCLUSION_TILE_HEIGHT );
+            for ( GLint tileX = footprint.left / OCCLUSION_TILE_WIDTH; tileX * OCCLUSION_TILE_WIDTH < footprint.right; tileX++ )
+            {
+                GLint tile = tileY * this->tilesX + tileX;
+                if ( nearest >= this->farDepth[tile] )
+                {
+                    continue;
+                }
+
+                GLint columnBegin = std::max( footprint.left - tileX * OCCLUSION_TILE_WIDTH, 0 );
+                GLint columnEnd = std::min( footprint.right - tileX * OCCLUSION_TILE_WIDTH, OCCLUSION_TILE_WIDTH );
+                GLuint columns = ( 0xFFFFFFFFu << columnBegin ) & ( 32 == columnEnd ? 0xFFFFFFFFu : ( 1u << columnEnd ) - 1u );
+                const GLuint *mask = &this->masks[tile * OCCLUSION_TILE_HEIGHT];
+
+                // Visible past a pixel outside the mask, or one inside it if the near layer is farther still
+                bool nearer = nearest < this->nearDepth[tile];
+#ifdef OCCLUSION_AVX2
+                __m256i row = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+                __m256i rows = _mm256_and_si256( _mm256_cmpgt_epi32( row, _mm256_set1_epi32( rowBegin - 1 ) ),
+                                                 _mm256_cmpgt_epi32( _mm256_set1_epi32( rowEnd ), row ) );
+                __m256i rectangle = _mm256_and_si256( rows, _mm256_set1_epi32( ( int )columns ) );
+                __m256i covered = _mm256_loadu_si256( ( const __m256i * )mask );
+                if ( !_mm256_testc_si256( covered, rectangle ) || ( nearer && !_mm256_testz_si256( covered, rectangle ) ) )
+                {
+                    return true;
+                }
+#else
+                for ( GLint r = rowBegin; r < rowEnd; r++ )
+                {
+                    if ( ( columns & ~mask[r] ) || ( nearer && ( columns & mask[r] ) ) )
+                    {
+                        return true;
+                    }
+                }
+#endif
+            }
+        }
+        return false;
+    }
+
+    // Eight boxes at a time where AVX2 allows, the rest one by one
+    static void cullBoxes( void *context, int begin, int end )
+    {
+        MaskedOcclusion *occlusion = ( MaskedOcclusion * )context;
+        int i = begin;
+#ifdef OCCLUSION_AVX2
+        Footprint footprints[8];
+        for ( ; i + 8 <= end; i += 8 )
+        {
+            occlusion->projectBoxes( occlusion->boxes + i, footprints );
+            for ( int l = 0; l < 8; l++ )
+            {
+                occlusion->flags[i + l] = occlusion->uncovered( footprints[l] ) ? 1 : 0;
+            }
+        }
+#endif
+        for ( ; i < end; i++ )
+        {
+            occlusion->flags[i] = occlusion->IsVisible( occlusion->boxes[i] ) ? 1 : 0;
+        }
+    }
+};
+
+#endif /* MaskedOcclusion_h */
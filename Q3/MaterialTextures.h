@@ -0,0 +1,313 @@
+#ifndef MaterialTextures_h
+#define MaterialTextures_h
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/image_helper.h"
+#include "Shader.h"
+#include "TextureManager.h"
+
+// Binding point of the MaterialHandles uniform block on the bindless path
+const GLuint MATERIAL_HANDLES_BINDING = 0;
+
+// Texture units taken by the material arrays; everything else can start at MATERIAL_TEXTURE_UNITS
+const GLint MATERIAL_TEXTURE_UNITS = 3;
+
+// Attribute location carrying the material index, set as a constant attribute per draw
+const GLuint MATERIAL_INDEX_ATTRIBUTE = 5;
+
+// Holds the diffuse/specular/normal maps of every material so that draws select a material by index
+// instead of binding textures. Same-sized maps are packed into the layers of three GL_TEXTURE_2D_ARRAYs
+// which stay bound to units 0-2; when ARB_bindless_texture is available every map keeps its own
+// texture and the resident handles are stored in a uniform block.
+class MaterialTextures
+{
+public:
+    MaterialTextures( GLsizei width, GLsizei height, GLint maxMaterials = 64 )
+    {
+        this->width = width;
+        this->height = height;
+        this->maxMaterials = maxMaterials;
+        this->bindless = GLEW_ARB_bindless_texture ? true : false;
+        this->handleBuffer = 0;
+
+        for ( int i = 0; i < MAPS; i++ )
+        {
+            this->arrays[i] = 0;
+        }
+    }
+
+    ~MaterialTextures( )
+    {
+        this->Clear( );
+    }
+
+    // Registers a material and returns its index, textures are uploaded by Build( ). An empty path leaves
+    // the map out, for one sampled from elsewhere (a virtual texture): it reads as the neutral texel, and
+    // a map no material has is kept at 1x1 rather than a layer of full size per material
+    GLint Add( const std::string &diffusePath, const std::string &specularPath, const std::string &normalPath )
+    {
+        if ( ( GLint )this->paths.size( ) / MAPS >= this->maxMaterials )
+        {
+            std::cout << "ERROR::MATERIAL::TOO_MANY_MATERIALS " << diffusePath << std::endl;
+            return 0;
+        }
+
+        this->paths.push_back( diffusePath );
+        this->paths.push_back( specularPath );
+        this->paths.push_back( normalPath );
+
+        return ( GLint )this->paths.size( ) / MAPS - 1;
+    }
+
+    void Build( )
+    {
+        if ( this->bindless )
+        {
+            this->buildBindless( );
+        }
+        else
+        {
+            this->buildArrays( );
+        }
+    }
+
+    // Hooks the shader up to the materials; only needs to run once per program
+    void Attach( const Shader &shader ) const
+    {
+        if ( this->bindless )
+        {
+            GLuint block = glGetUniformBlockIndex( shader.Program, "MaterialHandles" );
+
+            if ( GL_INVALID_INDEX != block )
+            {
+                glUniformBlockBinding( shader.Program, block, MATERIAL_HANDLES_BINDING );
+            }
+            glBindBufferBase( GL_UNIFORM_BUFFER, MATERIAL_HANDLES_BINDING, this->handleBuffer );
+        }
+        else
+        {
+            const char *names[MAPS] = { "diffuseMaps", "specularMaps", "normalMaps" };
+
+            glUseProgram( shader.Program );
+            for ( int i = 0; i < MAPS; i++ )
+            {
+                glActiveTexture( GL_TEXTURE0 + i );
+                glBindTexture( GL_TEXTURE_2D_ARRAY, this->arrays[i] );
+                glUniform1i( glGetUniformLocation( shader.Program, names[i] ), i );
+            }
+            glActiveTexture( GL_TEXTURE0 );
+        }
+    }
+
+    // Selects the material of the following draws, a vertex attribute write instead of texture binds
+    static void Select( GLint material )
+    {
+        glVertexAttribI1i( MATERIAL_INDEX_ATTRIBUTE, material );
+    }
+
+    // Lines to pass to the Shader constructor so the shader matches the path picked at runtime
+    std::string ShaderDefines( ) const
+    {
+        std::stringstream defines;
+
+        defines << "#define MAX_MATERIALS " << this->maxMaterials << "\n";
+        if ( this->bindless )
+        {
+            defines << "#define BINDLESS_TEXTURES\n";
+        }
+
+        return defines.str( );
+    }
+
+    bool IsBindless( ) const
+    {
+        return this->bindless;
+    }
+
+    // Releases every map, safe to call again and from the destructor; has to run while the context is alive
+    void Clear( )
+    {
+        // Materials sharing a map share its handle, which is only made non-resident once
+        for ( GLuint64 handle : this->handles )
+        {
+            if ( 0 != handle && glIsTextureHandleResidentARB( handle ) )
+            {
+                glMakeTextureHandleNonResidentARB( handle );
+            }
+        }
+        this->handles.clear( );
+
+        if ( !this->textures.empty( ) )
+        {
+            glDeleteTextures( ( GLsizei )this->textures.size( ), &this->textures[0] );
+            this->textures.clear( );
+        }
+        this->maps.Clear( );
+
+        if ( 0 != this->arrays[0] )
+        {
+            glDeleteTextures( MAPS, this->arrays );
+            for ( int i = 0; i < MAPS; i++ )
+            {
+                this->arrays[i] = 0;
+            }
+        }
+        if ( 0 != this->handleBuffer )
+        {
+            glDeleteBuffers( 1, &this->handleBuffer );
+            this->handleBuffer = 0;
+        }
+    }
+
+private:
+    static const int MAPS = 3;
+
+    GLsizei width, height;
+    GLint maxMaterials;
+    bool bindless;
+
+    // diffuse, specular, normal path of each material
+    std::vector<std::string> paths;
+
+    GLuint arrays[MAPS];
+
+    // Bindless maps, pinned as a resident handle has to keep its texture; fallbacks for maps that failed to load are in textures
+    TextureManager maps;
+    std::vector<GLuint> textures;
+    std::vector<GLuint64> handles;
+    GLuint handleBuffer;
+
+    // What a map that failed to load turns into: mid gray diffuse, no specular, flat normal
+    static void neutralTexel( int map, unsigned char *texel )
+    {
+        static const unsigned char neutral[MAPS][3] = { { 128, 128, 128 }, { 0, 0, 0 }, { 128, 128, 255 } };
+
+        texel[0] = neutral[map][0];
+        texel[1] = neutral[map][1];
+        texel[2] = neutral[map][2];
+    }
+
+    void buildArrays( )
+    {
+        GLsizei layers = ( GLsizei )this->paths.size( ) / MAPS;
+        std::vector<unsigned char> scaled( this->width * this->height * 3 );
+
+        if ( 0 == layers )
+        {
+            return;
+        }
+
+        glGenTextures( MAPS, this->arrays );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+        for ( int map = 0; map < MAPS; map++ )
+        {
+            // A map left out of every material is a 1x1 neutral texel per layer
+            GLsizei width = 1, height = 1;
+            for ( GLsizei layer = 0; layer < layers; layer++ )
+            {
+                if ( !this->paths[layer * MAPS + map].empty( ) )
+                {
+                    width = this->width;
+                    height = this->height;
+                }
+            }
+
+            glBindTexture( GL_TEXTURE_2D_ARRAY, this->arrays[map] );
+            glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, layers, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+
+            for ( GLsizei layer = 0; layer < layers; layer++ )
+            {
+                const std::string &path = this->paths[layer * MAPS + map];
+                int imageWidth = 0, imageHeight = 0, channels;
+                unsigned char *image = path.empty( ) ? NULL : SOIL_load_image( path.c_str( ), &imageWidth, &imageHeight, &channels, SOIL_LOAD_RGB );
+
+                if ( NULL == image )
+                {
+                    if ( !path.empty( ) )
+                    {
+                        std::cout << "ERROR::MATERIAL::LOAD_FAILED " << path << std::endl;
+                    }
+                    for ( GLsizei i = 0; i < width * height; i++ )
+                    {
+                        neutralTexel( map, &scaled[i * 3] );
+                    }
+                }
+                else if ( imageWidth != width || imageHeight != height )
+                {
+                    // Layers share one size, resample the odd ones out
+                    up_scale_image( image, imageWidth, imageHeight, 3, &scaled[0], width, height );
+                }
+
+                glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, GL_RGB, GL_UNSIGNED_BYTE,
+                                ( NULL != image && imageWidth == width && imageHeight == height ) ? image : &scaled[0] );
+                SOIL_free_image_data( image );
+            }
+
+            glGenerateMipmap( GL_TEXTURE_2D_ARRAY );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT );
+        }
+
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+    }
+
+    void buildBindless( )
+    {
+        // Mirrors the std140 layout of MaterialMaps in frag.vs: three uvec2 handles padded to 32 bytes
+        std::vector<GLuint64> block( this->maxMaterials * 4, 0 );
+
+        for ( size_t i = 0; i < this->paths.size( ); i++ )
+        {
+            int map = ( int )( i % MAPS );
+            GLuint texture = this->paths[i].empty( ) ? 0 : this->maps.Texture( this->maps.Load( this->paths[i], TEXTURE_PINNED ) );
+
+            if ( 0 == texture )
+            {
+                unsigned char texel[3];
+
+                if ( !this->paths[i].empty( ) )
+                {
+                    std::cout << "ERROR::MATERIAL::LOAD_FAILED " << this->paths[i] << std::endl;
+                }
+                neutralTexel( map, texel );
+                glGenTextures( 1, &texture );
+                glBindTexture( GL_TEXTURE_2D, texture );
+                glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+                glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, texel );
+                glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+                this->textures.push_back( texture );
+            }
+
+            // The texture is immutable from here on, its handle stays valid until it is deleted
+            GLuint64 handle = glGetTextureHandleARB( texture );
+            if ( !glIsTextureHandleResidentARB( handle ) )
+            {
+                glMakeTextureHandleResidentARB( handle );
+            }
+
+            this->handles.push_back( handle );
+            block[( i / MAPS ) * 4 + map] = handle;
+        }
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        glGenBuffers( 1, &this->handleBuffer );
+        glBindBuffer( GL_UNIFORM_BUFFER, this->handleBuffer );
+        glBufferData( GL_UNIFORM_BUFFER, block.size( ) * sizeof( GLuint64 ), &block[0], GL_STATIC_DRAW );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    }
+};
+
+#endif
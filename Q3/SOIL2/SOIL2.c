@@ -109,6 +109,15 @@
 #endif
 
 #include "SOIL2.h"
+#include "image_arena.h"
+/*	stb_image's working buffers come from the per-load arena	*/
+#define STBI_MALLOC( sz )			SOIL_arena_malloc( sz )
+#define STBI_REALLOC( p, newsz )	SOIL_arena_realloc( p, newsz )
+#define STBI_FREE( p )				SOIL_arena_free( p )
+/*	faster inflate and SIMD unfiltering for PNGs, see stb_image.h	*/
+#ifndef SOIL_NO_FAST_PNG
+#define STBI_FAST_PNG
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -117,11 +126,21 @@
 #include "image_DXT.h"
 #include "pvr_helper.h"
 #include "pkm_helper.h"
+#include "wfETC.h"
 #include "jo_jpeg.h"
+#include "image_cache.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined( SOIL_PLATFORM_WIN32 ) && ( defined( __unix__ ) || defined( __APPLE__ ) || defined( SOIL_X11_PLATFORM ) || defined( SOIL_PLATFORM_ANDROID ) )
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#define SOIL_HAS_MMAP
+#endif
+
 /*	error reporting	*/
 const char *result_string_pointer = "SOIL initialized";
 
@@ -148,6 +167,8 @@ int query_cubemap_capability( void );
 #define SOIL_PROXY_TEXTURE_CUBE_MAP			0x851B
 #define SOIL_MAX_CUBE_MAP_TEXTURE_SIZE		0x851C
 /*	for non-power-of-two texture	*/
+#define SOIL_TEXTURE_MAX_LEVEL				0x813D
+
 #define SOIL_IS_POW2( v ) ( ( v & ( v - 1 ) ) == 0 )
 static int has_NPOT_capability = SOIL_CAPABILITY_UNKNOWN;
 int query_NPOT_capability( void );
@@ -184,6 +205,7 @@ static int has_BGRA8888_capability = SOIL_CAPABILITY_UNKNOWN;
 int query_BGRA8888_capability( void );
 static int has_ETC1_capability = SOIL_CAPABILITY_UNKNOWN;
 int query_ETC1_capability( void );
+void check_for_GL_errors( const char *calling_location );
 
 /* GL_IMG_texture_compression_pvrtc */
 #define SOIL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG                      0x8C00
@@ -471,6 +493,414 @@ unsigned int
 	return tex_id;
 }
 
+/*	load options that change what ends up in a texture cache entry	*/
+#define SOIL_CACHE_FLAG_MASK ( SOIL_FLAG_MIPMAPS | SOIL_FLAG_GL_MIPMAPS | SOIL_FLAG_MULTIPLY_ALPHA | \
+		SOIL_FLAG_INVERT_Y | SOIL_FLAG_COMPRESS_TO_DXT | SOIL_FLAG_NTSC_SAFE_RGB | \
+		SOIL_FLAG_CoCg_Y | SOIL_FLAG_SRGB_COLOR_SPACE )
+/*	bump when the entry layout or the way levels are built changes	*/
+#define SOIL_CACHE_VERSION 1
+
+/*	everything a cache key mixes into the file hash	*/
+static unsigned int
+	SOIL_internal_cache_options
+	(
+		unsigned int flags,
+		int force_channels,
+		int DXT_mode, int sRGB_texture
+	)
+{
+	return (flags & SOIL_CACHE_FLAG_MASK) |
+			( (unsigned int)force_channels << 16 ) |
+			( (DXT_mode == SOIL_CAPABILITY_PRESENT) << 20 ) |
+			( sRGB_texture << 21 ) |
+			( SOIL_CACHE_VERSION << 24 );
+}
+
+/*	applies the per-pixel flags to img (in place), builds the whole MIP
+	chain and packs it, DXT compressed if requested, as a cache entry	*/
+static unsigned char*
+	SOIL_internal_build_cache_entry
+	(
+		unsigned char *img,
+		int width, int height, int channels,
+		unsigned int flags,
+		int DXT_mode, int sRGB_texture,
+		SOIL_cache_key key,
+		int *entry_length
+	)
+{
+	SOIL_cache_header header;
+	SOIL_cache_level levels[SOIL_CACHE_MAX_LEVELS];
+	unsigned char *entry, *level_img, *next_img = NULL;
+	unsigned int num_levels = 1, i, table_size, total;
+	*entry_length = 0;
+	if( flags & SOIL_FLAG_INVERT_Y )
+	{
+		int row, j;
+		for( j = 0; j*2 < height; ++j )
+		{
+			unsigned char *row1 = img + j * width * channels;
+			unsigned char *row2 = img + (height - 1 - j) * width * channels;
+			for( row = 0; row < width * channels; ++row )
+			{
+				unsigned char temp = row1[row];
+				row1[row] = row2[row];
+				row2[row] = temp;
+			}
+		}
+	}
+	if( flags & SOIL_FLAG_NTSC_SAFE_RGB )
+	{
+		scale_image_RGB_to_NTSC_safe( img, width, height, channels );
+	}
+	if( (flags & SOIL_FLAG_MULTIPLY_ALPHA) && ((channels == 2) || (channels == 4)) )
+	{
+		int j;
+		for( j = 0; j < width*height*channels; j += channels )
+		{
+			int c;
+			for( c = 0; c < channels - 1; ++c )
+			{
+				img[j+c] = (img[j+c] * img[j+channels-1] + 128) >> 8;
+			}
+		}
+	}
+	if( flags & SOIL_FLAG_CoCg_Y )
+	{
+		convert_RGB_to_YCoCg( img, width, height, channels );
+	}
+	/*	the header: formats are picked exactly like SOIL_internal_create_OGL_texture does	*/
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, SOIL_CACHE_MAGIC, 8 );
+	header.key = key;
+	header.width = width;
+	header.height = height;
+	header.channels = channels;
+	switch( channels )
+	{
+	case 1: header.pixel_format = GL_LUMINANCE; break;
+	case 2: header.pixel_format = GL_LUMINANCE_ALPHA; break;
+	case 3: header.pixel_format = GL_RGB; break;
+	default: header.pixel_format = GL_RGBA; break;
+	}
+	header.internal_format = header.pixel_format;
+	if( DXT_mode == SOIL_CAPABILITY_PRESENT )
+	{
+		if( (channels & 1) == 1 )
+		{
+			header.internal_format = sRGB_texture ? SOIL_GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : SOIL_RGB_S3TC_DXT1;
+		} else
+		{
+			header.internal_format = sRGB_texture ? SOIL_GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : SOIL_RGBA_S3TC_DXT5;
+		}
+		header.pixel_format = 0;
+	} else if( sRGB_texture && (channels == 3) )
+	{
+		header.internal_format = SOIL_GL_SRGB;
+	} else if( sRGB_texture && (channels == 4) )
+	{
+		header.internal_format = SOIL_GL_SRGB_ALPHA;
+	}
+	if( flags & (SOIL_FLAG_MIPMAPS | SOIL_FLAG_GL_MIPMAPS) )
+	{
+		while( (num_levels < SOIL_CACHE_MAX_LEVELS) &&
+			( ((width >> num_levels) > 0) || ((height >> num_levels) > 0) ) )
+		{
+			++num_levels;
+		}
+	}
+	header.num_levels = num_levels;
+	/*	worst case size: every level the larger of raw and DXT, a 4x4 block
+		costing 8 or 16 bytes however few of its pixels the level has	*/
+	table_size = sizeof( SOIL_cache_header ) + num_levels * sizeof( SOIL_cache_level );
+	total = table_size;
+	for( i = 0; i < num_levels; ++i )
+	{
+		unsigned int w = width >> i, h = height >> i;
+		unsigned int raw_size, DXT_size;
+		w = w ? w : 1;
+		h = h ? h : 1;
+		raw_size = w * h * channels;
+		DXT_size = ((w + 3) / 4) * ((h + 3) / 4) * (((channels & 1) == 1) ? 8 : 16);
+		total += (raw_size > DXT_size) ? raw_size : DXT_size;
+	}
+	entry = (unsigned char*)malloc( total );
+	if( NULL == entry )
+	{
+		return NULL;
+	}
+	total = table_size;
+	level_img = img;
+	for( i = 0; i < num_levels; ++i )
+	{
+		int w = width >> i, h = height >> i;
+		w = w ? w : 1;
+		h = h ? h : 1;
+		levels[i].width = w;
+		levels[i].height = h;
+		levels[i].offset = total;
+		levels[i].size = 0;
+		if( DXT_mode == SOIL_CAPABILITY_PRESENT )
+		{
+			int DDS_size;
+			unsigned char *DDS_data = ((channels & 1) == 1) ?
+					convert_image_to_DXT1( level_img, w, h, channels, &DDS_size ) :
+					convert_image_to_DXT5( level_img, w, h, channels, &DDS_size );
+			if( NULL == DDS_data )
+			{
+				break;
+			}
+			memcpy( entry + total, DDS_data, DDS_size );
+			levels[i].size = DDS_size;
+			SOIL_free_image_data( DDS_data );
+		} else
+		{
+			levels[i].size = w * h * channels;
+			memcpy( entry + total, level_img, levels[i].size );
+		}
+		total += levels[i].size;
+		/*	each level is a box filtered copy of the previous one	*/
+		if( i + 1 < num_levels )
+		{
+			int nw = (w >> 1) ? (w >> 1) : 1, nh = (h >> 1) ? (h >> 1) : 1;
+			unsigned char *resampled = (unsigned char*)SOIL_arena_malloc( nw * nh * channels );
+			if( NULL == resampled )
+			{
+				break;
+			}
+			mipmap_image( level_img, w, h, channels, resampled,
+					(w > 1) ? 2 : 1, (h > 1) ? 2 : 1 );
+			SOIL_free_image_data( next_img );
+			next_img = resampled;
+			level_img = resampled;
+		}
+	}
+	SOIL_free_image_data( next_img );
+	if( i < num_levels )
+	{
+		/*	ran out of memory or the compressor failed	*/
+		free( entry );
+		return NULL;
+	}
+	memcpy( entry, &header, sizeof( header ) );
+	memcpy( entry + sizeof( header ), levels, num_levels * sizeof( SOIL_cache_level ) );
+	*entry_length = (int)total;
+	return entry;
+}
+
+static unsigned int
+	SOIL_internal_upload_cache_entry
+	(
+		const unsigned char *const entry,
+		unsigned int reuse_texture_ID,
+		unsigned int flags
+	)
+{
+	const SOIL_cache_header *header = (const SOIL_cache_header*)entry;
+	const SOIL_cache_level *levels = (const SOIL_cache_level*)(entry + sizeof( SOIL_cache_header ));
+	unsigned int tex_id = reuse_texture_ID, i;
+	GLint unpack_aligment;
+	if( tex_id == 0 )
+	{
+		glGenTextures( 1, &tex_id );
+	}
+	check_for_GL_errors( "glGenTextures" );
+	if( tex_id == 0 )
+	{
+		result_string_pointer = "Failed to generate an OpenGL texture name; missing OpenGL context?";
+		return 0;
+	}
+	glBindTexture( GL_TEXTURE_2D, tex_id );
+	glGetIntegerv( GL_UNPACK_ALIGNMENT, &unpack_aligment );
+	if ( 1 != unpack_aligment )
+	{
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	}
+	for( i = 0; i < header->num_levels; ++i )
+	{
+		if( 0 == header->pixel_format )
+		{
+			soilGlCompressedTexImage2D(
+				GL_TEXTURE_2D, i,
+				header->internal_format, levels[i].width, levels[i].height, 0,
+				levels[i].size, entry + levels[i].offset );
+			check_for_GL_errors( "glCompressedTexImage2D" );
+		} else
+		{
+			glTexImage2D(
+				GL_TEXTURE_2D, i,
+				header->internal_format, levels[i].width, levels[i].height, 0,
+				header->pixel_format, GL_UNSIGNED_BYTE, entry + levels[i].offset );
+			check_for_GL_errors( "glTexImage2D" );
+		}
+	}
+	if ( 1 != unpack_aligment )
+	{
+		glPixelStorei( GL_UNPACK_ALIGNMENT, unpack_aligment );
+	}
+	glTexParameteri( GL_TEXTURE_2D, SOIL_TEXTURE_MAX_LEVEL, header->num_levels - 1 );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			(header->num_levels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+	if( flags & SOIL_FLAG_TEXTURE_REPEATS )
+	{
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+	} else
+	{
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, SOIL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, SOIL_CLAMP_TO_EDGE );
+	}
+	check_for_GL_errors( "GL_TEXTURE_WRAP_*" );
+	result_string_pointer = "Image loaded as an OpenGL texture";
+	return tex_id;
+}
+
+unsigned int
+	SOIL_load_OGL_texture_cached
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags
+	)
+{
+	const unsigned char *buffer, *entry;
+	unsigned char *img, *built;
+	int buffer_length, entry_length, width, height, channels;
+	int DXT_mode = SOIL_CAPABILITY_NONE, sRGB_texture;
+	unsigned int options, tex_id;
+	SOIL_cache_key key;
+	/*	pre-compressed files are already GPU ready, and resampled or
+		rectangle textures depend on the driver's limits: no caching	*/
+	if( flags & (SOIL_FLAG_DDS_LOAD_DIRECT | SOIL_FLAG_PVR_LOAD_DIRECT | SOIL_FLAG_ETC1_LOAD_DIRECT |
+				 SOIL_FLAG_POWER_OF_TWO | SOIL_FLAG_TEXTURE_RECTANGLE) )
+	{
+		return SOIL_load_OGL_texture( filename, force_channels, reuse_texture_ID, flags );
+	}
+	if( (force_channels < 0) || (force_channels > 4) )
+	{
+		force_channels = SOIL_LOAD_AUTO;
+	}
+	if( flags & SOIL_FLAG_COMPRESS_TO_DXT )
+	{
+		DXT_mode = query_DXT_capability();
+	}
+	sRGB_texture = query_sRGB_capability() == SOIL_CAPABILITY_PRESENT && ( flags & SOIL_FLAG_SRGB_COLOR_SPACE );
+	buffer = SOIL_map_file( filename, &buffer_length );
+	if( NULL == buffer )
+	{
+		return 0;
+	}
+	options = SOIL_internal_cache_options( flags, force_channels, DXT_mode, sRGB_texture );
+	key = SOIL_cache_make_key( buffer, buffer_length, options );
+	entry = SOIL_cache_lookup( key, &entry_length );
+	if( NULL != entry )
+	{
+		/*	warm start: straight from the cache mapping to the driver	*/
+		SOIL_unmap_file( buffer, buffer_length );
+		tex_id = SOIL_internal_upload_cache_entry( entry, reuse_texture_ID, flags );
+		if( tex_id )
+		{
+			SOIL_cache_count_hit( (unsigned int)entry_length );
+		}
+		SOIL_cache_release( entry, entry_length );
+		return tex_id;
+	}
+	SOIL_cache_count_miss();
+	img = SOIL_load_image_from_memory( buffer, buffer_length, &width, &height, &channels, force_channels );
+	SOIL_unmap_file( buffer, buffer_length );
+	if( NULL == img )
+	{
+		return 0;
+	}
+	if( (force_channels >= 1) && (force_channels <= 4) )
+	{
+		channels = force_channels;
+	}
+	SOIL_arena_begin( (size_t)width * height * channels, 0 );
+	built = SOIL_internal_build_cache_entry( img, width, height, channels,
+			flags, DXT_mode, sRGB_texture, key, &entry_length );
+	SOIL_arena_end();
+	SOIL_free_image_data( img );
+	if( NULL == built )
+	{
+		/*	couldn't build the chain, take the regular path	*/
+		return SOIL_load_OGL_texture( filename, force_channels, reuse_texture_ID, flags );
+	}
+	SOIL_cache_store( key, built, entry_length );
+	tex_id = SOIL_internal_upload_cache_entry( built, reuse_texture_ID, flags );
+	free( built );
+	return tex_id;
+}
+
+const unsigned char*
+	SOIL_load_cache_entry
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int flags,
+		int *entry_length
+	)
+{
+	const unsigned char *buffer, *entry;
+	unsigned char *img, *built;
+	int buffer_length, built_length, width, height, channels, stored;
+	int DXT_mode = (flags & SOIL_FLAG_COMPRESS_TO_DXT) ? SOIL_CAPABILITY_PRESENT : SOIL_CAPABILITY_NONE;
+	int sRGB_texture = (flags & SOIL_FLAG_SRGB_COLOR_SPACE) ? 1 : 0;
+	SOIL_cache_key key;
+	*entry_length = 0;
+	if( (force_channels < 0) || (force_channels > 4) )
+	{
+		force_channels = SOIL_LOAD_AUTO;
+	}
+	buffer = SOIL_map_file( filename, &buffer_length );
+	if( NULL == buffer )
+	{
+		result_string_pointer = "Unable to open file";
+		return NULL;
+	}
+	key = SOIL_cache_make_key( buffer, buffer_length,
+			SOIL_internal_cache_options( flags, force_channels, DXT_mode, sRGB_texture ) );
+	entry = SOIL_cache_lookup( key, entry_length );
+	if( NULL != entry )
+	{
+		SOIL_unmap_file( buffer, buffer_length );
+		SOIL_cache_count_hit( (unsigned int)*entry_length );
+		return entry;
+	}
+	SOIL_cache_count_miss();
+	img = SOIL_load_image_from_memory( buffer, buffer_length, &width, &height, &channels, force_channels );
+	SOIL_unmap_file( buffer, buffer_length );
+	if( NULL == img )
+	{
+		return NULL;
+	}
+	if( (force_channels >= 1) && (force_channels <= 4) )
+	{
+		channels = force_channels;
+	}
+	SOIL_arena_begin( (size_t)width * height * channels, 0 );
+	built = SOIL_internal_build_cache_entry( img, width, height, channels,
+			flags, DXT_mode, sRGB_texture, key, &built_length );
+	SOIL_arena_end();
+	SOIL_free_image_data( img );
+	if( NULL == built )
+	{
+		result_string_pointer = "Failed to build the MIP chain";
+		return NULL;
+	}
+	/*	handing out the stored file keeps a single way to release entries	*/
+	stored = SOIL_cache_store( key, built, built_length );
+	free( built );
+	if( !stored )
+	{
+		result_string_pointer = "Unable to write the texture cache entry";
+		return NULL;
+	}
+	return SOIL_cache_lookup( key, entry_length );
+}
+
 unsigned int
 	SOIL_load_OGL_HDR_texture
 	(
@@ -483,6 +913,8 @@ unsigned int
 {
 	/*	variables	*/
 	unsigned char* img = NULL;
+	const unsigned char *buffer;
+	int buffer_length;
 	int width, height, channels;
 	unsigned int tex_id;
 	/*	no direct uploading of the image as a DDS file	*/
@@ -496,11 +928,17 @@ unsigned int
 	}
 
 	/* check if the image is HDR */
-	if ( stbi_is_hdr( filename ) )
+	buffer = SOIL_map_file( filename, &buffer_length );
+	if( NULL == buffer )
+	{
+		return 0;
+	}
+	if ( stbi_is_hdr_from_memory( buffer, buffer_length ) )
 	{
 		/*	try to load the image (only the HDR type) */
-		img = stbi_load( filename, &width, &height, &channels, 4 );
+		img = stbi_load_from_memory( buffer, buffer_length, &width, &height, &channels, 4 );
 	}
+	SOIL_unmap_file( buffer, buffer_length );
 
 	/*	channels holds the original number of channels, which may have been forced	*/
 	if( NULL == img )
@@ -1373,7 +1811,7 @@ static void createMipmaps(const unsigned char *const img,
 		int MIPlevel = 1;
 		int MIPwidth = (width+1) / 2;
 		int MIPheight = (height+1) / 2;
-		unsigned char *resampled = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
+		unsigned char *resampled = (unsigned char*)SOIL_arena_malloc( channels*MIPwidth*MIPheight );
 
 		while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
 		{
@@ -1509,9 +1947,12 @@ unsigned int
 				 ( flags & SOIL_FLAG_CoCg_Y )
 				);
 
+	/*	temporaries live in the arena, room for a copy plus the MIP chain	*/
+	SOIL_arena_begin( (size_t)iwidth * iheight * channels * 2, 0 );
+
 	/*	create a copy the image data only if needed */
 	if ( needCopy ) {
-		img = (unsigned char*)malloc( iwidth*iheight*channels );
+		img = (unsigned char*)SOIL_arena_malloc( iwidth*iheight*channels );
 		memcpy( img, data, iwidth*iheight*channels );
 	}
 
@@ -1589,7 +2030,7 @@ unsigned int
 		if( (new_width != iwidth) || (new_height != iheight) )
 		{
 			/*	yep, resize	*/
-			unsigned char *resampled = (unsigned char*)malloc( channels*new_width*new_height );
+			unsigned char *resampled = (unsigned char*)SOIL_arena_malloc( channels*new_width*new_height );
 			up_scale_image(
 					NULL != img ? img : data, iwidth, iheight, channels,
 					resampled, new_width, new_height );
@@ -1621,7 +2062,7 @@ unsigned int
 		}
 		new_width = iwidth / reduce_block_x;
 		new_height = iheight / reduce_block_y;
-		resampled = (unsigned char*)malloc( channels*new_width*new_height );
+		resampled = (unsigned char*)SOIL_arena_malloc( channels*new_width*new_height );
 		/*	perform the actual reduction	*/
 		mipmap_image( NULL != img ? img : data, iwidth, iheight, channels,
 						resampled, reduce_block_x, reduce_block_y );
@@ -1811,6 +2252,7 @@ unsigned int
 	}
 
 	SOIL_free_image_data( img );
+	SOIL_arena_end();
 
 	return tex_id;
 }
@@ -1884,6 +2326,180 @@ int
 	return save_result;
 }
 
+const unsigned char*
+	SOIL_map_file
+	(
+		const char *filename,
+		int *length
+	)
+{
+	const unsigned char *data = NULL;
+	*length = 0;
+	if( NULL == filename )
+	{
+		result_string_pointer = "NULL filename";
+		return NULL;
+	}
+#if defined( SOIL_HAS_MMAP )
+	{
+		struct stat st;
+		void *mapping;
+		int fd = open( filename, O_RDONLY );
+		if( fd < 0 )
+		{
+			result_string_pointer = "Can not open file";
+			return NULL;
+		}
+		/*	only regular files of a size stb_image can address	*/
+		if( ( fstat( fd, &st ) != 0 ) || !S_ISREG( st.st_mode ) ||
+			( st.st_size <= 0 ) || ( st.st_size > 0x7fffffff ) )
+		{
+			close( fd );
+			result_string_pointer = "Can not map file";
+			return NULL;
+		}
+		mapping = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		/*	the mapping keeps its own reference to the file	*/
+		close( fd );
+		if( MAP_FAILED == mapping )
+		{
+			result_string_pointer = "Can not map file";
+			return NULL;
+		}
+		/*	decoders walk the file front to back exactly once	*/
+		madvise( mapping, (size_t)st.st_size, MADV_SEQUENTIAL );
+		madvise( mapping, (size_t)st.st_size, MADV_WILLNEED );
+		data = (const unsigned char*)mapping;
+		*length = (int)st.st_size;
+	}
+#elif defined( SOIL_PLATFORM_WIN32 )
+	{
+		HANDLE file, file_mapping;
+		LARGE_INTEGER size;
+		file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+				OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+		if( INVALID_HANDLE_VALUE == file )
+		{
+			result_string_pointer = "Can not open file";
+			return NULL;
+		}
+		if( !GetFileSizeEx( file, &size ) ||
+			( size.QuadPart <= 0 ) || ( size.QuadPart > 0x7fffffff ) )
+		{
+			CloseHandle( file );
+			result_string_pointer = "Can not map file";
+			return NULL;
+		}
+		file_mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+		CloseHandle( file );
+		if( NULL == file_mapping )
+		{
+			result_string_pointer = "Can not map file";
+			return NULL;
+		}
+		/*	the view keeps the mapping object alive	*/
+		data = (const unsigned char*)MapViewOfFile( file_mapping, FILE_MAP_READ, 0, 0, 0 );
+		CloseHandle( file_mapping );
+		if( NULL == data )
+		{
+			result_string_pointer = "Can not map file";
+			return NULL;
+		}
+		*length = (int)size.QuadPart;
+	}
+#else
+	{
+		/*	no mapping support, read the whole file in one go	*/
+		FILE *f;
+		long file_length;
+		unsigned char *buffer;
+		f = fopen( filename, "rb" );
+		if( NULL == f )
+		{
+			result_string_pointer = "Can not open file";
+			return NULL;
+		}
+		fseek( f, 0, SEEK_END );
+		file_length = ftell( f );
+		fseek( f, 0, SEEK_SET );
+		if( ( file_length <= 0 ) || ( file_length > 0x7fffffff ) )
+		{
+			fclose( f );
+			result_string_pointer = "Can not map file";
+			return NULL;
+		}
+		buffer = (unsigned char*)malloc( file_length );
+		if( NULL == buffer )
+		{
+			fclose( f );
+			result_string_pointer = "malloc failed";
+			return NULL;
+		}
+		*length = (int)fread( (void*)buffer, 1, file_length, f );
+		fclose( f );
+		data = buffer;
+	}
+#endif
+	result_string_pointer = "File mapped";
+	return data;
+}
+
+void
+	SOIL_unmap_file
+	(
+		const unsigned char *data,
+		int length
+	)
+{
+	if( NULL == data )
+	{
+		return;
+	}
+#if defined( SOIL_HAS_MMAP )
+	munmap( (void*)data, (size_t)length );
+#elif defined( SOIL_PLATFORM_WIN32 )
+	UnmapViewOfFile( (LPCVOID)data );
+#else
+	free( (void*)data );
+#endif
+}
+
+/*	decodes inside an arena scope sized from the image header; the
+	result is always handed back as a heap block	*/
+static unsigned char*
+	SOIL_internal_load_image_from_memory
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	unsigned char *result;
+	int info_width, info_height, info_channels;
+	size_t expected_size = 0, image_size = 0;
+	if( stbi_info_from_memory( buffer, buffer_length, &info_width, &info_height, &info_channels ) )
+	{
+		/*	anything as large as the final image goes to the heap, it
+			outlives the scope; the rest (zlib output of paletted or grey
+			images, JPEG component planes, tables) fits in twice the
+			decoded size	*/
+		image_size = (size_t)info_width * info_height *
+				( ((force_channels >= 1) && (force_channels <= 4)) ? force_channels : info_channels );
+		expected_size = (size_t)info_width * info_height * info_channels * 2;
+	}
+	SOIL_arena_begin( expected_size, image_size );
+	result = stbi_load_from_memory( buffer, buffer_length,
+			width, height, channels, force_channels );
+	if( NULL != result )
+	{
+		result = (unsigned char*)SOIL_arena_detach( result, (size_t)*width * *height *
+				( ((force_channels >= 1) && (force_channels <= 4)) ? force_channels : *channels ) );
+	}
+	SOIL_arena_end();
+	return result;
+}
+
 unsigned char*
 	SOIL_load_image
 	(
@@ -1892,8 +2508,21 @@ unsigned char*
 		int force_channels
 	)
 {
-	unsigned char *result = stbi_load( filename,
-			width, height, channels, force_channels );
+	unsigned char *result;
+	int length;
+	/*	decode straight out of the page cache, no stdio staging buffer	*/
+	const unsigned char *mapping = SOIL_map_file( filename, &length );
+	if( NULL != mapping )
+	{
+		result = SOIL_internal_load_image_from_memory( mapping, length,
+				width, height, channels, force_channels );
+		SOIL_unmap_file( mapping, length );
+	} else
+	{
+		/*	not a regular file (pipe, device...), let stdio deal with it	*/
+		result = stbi_load( filename,
+				width, height, channels, force_channels );
+	}
 	if( result == NULL )
 	{
 		result_string_pointer = stbi_failure_reason();
@@ -1913,7 +2542,7 @@ unsigned char*
 		int force_channels
 	)
 {
-	unsigned char *result = stbi_load_from_memory(
+	unsigned char *result = SOIL_internal_load_image_from_memory(
 				buffer, buffer_length,
 				width, height, channels,
 				force_channels );
@@ -1983,6 +2612,17 @@ int
 	if ( image_type == SOIL_SAVE_TYPE_JPG )
 	{
 		save_result = jo_write_jpg( filename, (const void*)data, width, height, channels, quality );
+	} else
+	if ( image_type == SOIL_SAVE_TYPE_PKM )
+	{
+		/*	ETC1 is the most widely supported, it just has no alpha	*/
+		save_result = save_image_as_PKM( filename, width, height, channels, data,
+				(channels & 1) == 0, quality < 50 ? ETC_QUALITY_FAST : ETC_QUALITY_HIGH );
+	} else
+	if ( image_type == SOIL_SAVE_TYPE_KTX )
+	{
+		save_result = save_image_as_KTX( filename, width, height, channels, data,
+				1, quality < 50 ? ETC_QUALITY_FAST : ETC_QUALITY_HIGH, 1 );
 	}
 	else
 	{
@@ -2005,8 +2645,9 @@ void
 		unsigned char *img_data
 	)
 {
+	/*	arena aware: heap blocks are simply free()'d	*/
 	if ( img_data )
-		free( (void*)img_data );
+		SOIL_arena_free( (void*)img_data );
 }
 
 const char*
@@ -2241,8 +2882,23 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		mipmaps = 0;
 		DDS_full_size = DDS_main_size;
 	}
-	DDS_data = (unsigned char*)malloc( DDS_full_size );
-	/*	got the image data RAM, create or use an existing OpenGL texture handle	*/
+	/*	only the uncompressed layouts that need their channels shuffled get a
+		scratch copy, everything else is uploaded straight out of the buffer	*/
+	if( uncompressed &&
+		( ( (header.sPixelFormat.dwRBitMask == 0xff0000) && ( ( block_size == 3 && S3TC_type == GL_RGB ) || ( block_size == 4 && S3TC_type == GL_RGBA ) ) ) ||
+		  ( block_size == 2 && (header.sPixelFormat.dwRBitMask == 0xf800 || header.sPixelFormat.dwRBitMask == 0x7c00) ) ||
+		  ( block_size == 2 &&
+			(header.sPixelFormat.dwRBitMask == 0xf00) &&
+			(header.sPixelFormat.dwGBitMask == 0xf0) &&
+			(header.sPixelFormat.dwBBitMask == 0xf) &&
+			(header.sPixelFormat.dwAlphaBitMask == 0xf000) ) ) )
+	{
+		DDS_data = (unsigned char*)malloc( DDS_full_size );
+	} else
+	{
+		DDS_data = NULL;
+	}
+	/*	create or use an existing OpenGL texture handle	*/
 	tex_ID = reuse_texture_ID;
 	if( tex_ID == 0 )
 	{
@@ -2256,10 +2912,15 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		if( buffer_index + DDS_full_size <= (unsigned int)buffer_length )
 		{
 			unsigned int byte_offset = DDS_main_size;
-			memcpy( (void*)DDS_data, (const void*)(&buffer[buffer_index]), DDS_full_size );
+			const unsigned char *face_data = &buffer[buffer_index];
+			if( NULL != DDS_data )
+			{
+				memcpy( (void*)DDS_data, (const void*)face_data, DDS_full_size );
+				face_data = DDS_data;
+			}
 			buffer_index += DDS_full_size;
 			/*	upload the main chunk	*/
-			if( uncompressed )
+			if( NULL != DDS_data )
 			{
 				if ( (header.sPixelFormat.dwRBitMask == 0xff0000) && ( ( block_size == 3 && S3TC_type == GL_RGB ) || ( block_size == 4 && S3TC_type == GL_RGBA ) ) )
 				{
@@ -2305,16 +2966,19 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 						DDS_data[i+1] = (pixel_new >> 8) & 0xff;
 					}
 				}
+			}
+			if( uncompressed )
+			{
 				glTexImage2D(
 					cf_target, 0,
 					S3TC_type, width, height, 0,
-					S3TC_type, format_type, DDS_data );
+					S3TC_type, format_type, face_data );
 			} else
 			{
 				soilGlCompressedTexImage2D(
 					cf_target, 0,
 					S3TC_type, width, height, 0,
-					DDS_main_size, DDS_data );
+					DDS_main_size, face_data );
 			}
 			/*	upload the mipmaps, if we have them	*/
 			for( i = 1; i <= mipmaps; ++i )
@@ -2337,14 +3001,14 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 					glTexImage2D(
 						cf_target, i,
 						S3TC_type, w, h, 0,
-						S3TC_type, format_type, &DDS_data[byte_offset] );
+						S3TC_type, format_type, &face_data[byte_offset] );
 				} else
 				{
 					mip_size = ((w+3)/4)*((h+3)/4)*block_size;
 					soilGlCompressedTexImage2D(
 						cf_target, i,
 						S3TC_type, w, h, 0,
-						mip_size, &DDS_data[byte_offset] );
+						mip_size, &face_data[byte_offset] );
 				}
 				/*	and move to the next mipmap	*/
 				byte_offset += mip_size;
@@ -2401,9 +3065,8 @@ unsigned int SOIL_direct_load_DDS(
 		int flags,
 		int loading_as_cubemap )
 {
-	FILE *f;
-	unsigned char *buffer;
-	size_t buffer_length, bytes_read;
+	const unsigned char *buffer;
+	int buffer_length;
 	unsigned int tex_ID = 0;
 	/*	error checks	*/
 	if( NULL == filename )
@@ -2411,35 +3074,19 @@ unsigned int SOIL_direct_load_DDS(
 		result_string_pointer = "NULL filename";
 		return 0;
 	}
-	f = fopen( filename, "rb" );
-	if( NULL == f )
+	/*	the compressed payload is handed to the driver straight from the mapping	*/
+	buffer = SOIL_map_file( filename, &buffer_length );
+	if( NULL == buffer )
 	{
 		/*	the file doesn't seem to exist (or be open-able)	*/
 		result_string_pointer = "Can not find DDS file";
 		return 0;
 	}
-	fseek( f, 0, SEEK_END );
-	buffer_length = ftell( f );
-	fseek( f, 0, SEEK_SET );
-	buffer = (unsigned char *) malloc( buffer_length );
-	if( NULL == buffer )
-	{
-		result_string_pointer = "malloc failed";
-		fclose( f );
-		return 0;
-	}
-	bytes_read = fread( (void*)buffer, 1, buffer_length, f );
-	fclose( f );
-	if( bytes_read < buffer_length )
-	{
-		/*	huh?	*/
-		buffer_length = bytes_read;
-	}
 	/*	now try to do the loading	*/
 	tex_ID = SOIL_direct_load_DDS_from_memory(
-		(const unsigned char *const)buffer, (int)buffer_length,
+		buffer, buffer_length,
 		reuse_texture_ID, flags, loading_as_cubemap );
-	SOIL_free_image_data( buffer );
+	SOIL_unmap_file( buffer, buffer_length );
 	return tex_ID;
 }
 
@@ -2718,9 +3365,8 @@ unsigned int SOIL_direct_load_PVR(
 		int flags,
 		int loading_as_cubemap )
 {
-	FILE *f;
-	unsigned char *buffer;
-	size_t buffer_length, bytes_read;
+	const unsigned char *buffer;
+	int buffer_length;
 	unsigned int tex_ID = 0;
 	/*	error checks	*/
 	if( NULL == filename )
@@ -2728,35 +3374,19 @@ unsigned int SOIL_direct_load_PVR(
 		result_string_pointer = "NULL filename";
 		return 0;
 	}
-	f = fopen( filename, "rb" );
-	if( NULL == f )
+	/*	the compressed payload is handed to the driver straight from the mapping	*/
+	buffer = SOIL_map_file( filename, &buffer_length );
+	if( NULL == buffer )
 	{
 		/*	the file doesn't seem to exist (or be open-able)	*/
 		result_string_pointer = "Can not find PVR file";
 		return 0;
 	}
-	fseek( f, 0, SEEK_END );
-	buffer_length = ftell( f );
-	fseek( f, 0, SEEK_SET );
-	buffer = (unsigned char *) malloc( buffer_length );
-	if( NULL == buffer )
-	{
-		result_string_pointer = "malloc failed";
-		fclose( f );
-		return 0;
-	}
-	bytes_read = fread( (void*)buffer, 1, buffer_length, f );
-	fclose( f );
-	if( bytes_read < buffer_length )
-	{
-		/*	huh?	*/
-		buffer_length = bytes_read;
-	}
 	/*	now try to do the loading	*/
 	tex_ID = SOIL_direct_load_PVR_from_memory(
-		(const unsigned char *const)buffer, (int)buffer_length,
+		buffer, buffer_length,
 		reuse_texture_ID, flags, loading_as_cubemap );
-	SOIL_free_image_data( buffer );
+	SOIL_unmap_file( buffer, buffer_length );
 	return tex_ID;
 }
 
@@ -2775,19 +3405,26 @@ unsigned int SOIL_direct_load_ETC1_from_memory(
 	char *texture_ptr = (char*)buffer + PKM_HEADER_SIZE;
 	GLint unpack_aligment;
 
+	/*	the callers decode on the CPU when this fails	*/
 	if ( query_ETC1_capability() != SOIL_CAPABILITY_PRESENT ) {
-		result_string_pointer = "error: ETC1 not supported. Decompress the texture first.";
+		result_string_pointer = "error: ETC1 not supported, decoding it instead.";
 		return 0;
 	}
 
-	if ( 0 != strcmp( header->aName, "PKM 10" ) ) {
-		result_string_pointer = "error: PKM 10 header not found.";
+	if ( buffer_length < PKM_HEADER_SIZE ||
+		( 0 != memcmp( header->aName, "PKM 10", 6 ) &&
+		  ( 0 != memcmp( header->aName, "PKM 20", 6 ) || PKM_FORMAT_ETC1_RGB != ((header->iFormatMSB << 8) | header->iFormatLSB) ) ) ) {
+		result_string_pointer = "error: ETC1 PKM header not found.";
 		return 0;
 	}
 
 	width = (header->iWidthMSB << 8) | header->iWidthLSB;
 	height = (header->iHeightMSB << 8) | header->iHeightLSB;
-	compressed_image_size = (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
+	if ( compressed_image_size < wfETC_ImageSize( width, height, WF_ETC1_RGB8 ) ) {
+		result_string_pointer = "error: PKM data truncated.";
+		return 0;
+	}
+	compressed_image_size = wfETC_ImageSize( width, height, WF_ETC1_RGB8 );
 
 	// load the texture up
 	tex_ID = reuse_texture_ID;
@@ -2855,9 +3492,8 @@ unsigned int SOIL_direct_load_ETC1(const char *filename,
 		unsigned int reuse_texture_ID,
 		int flags )
 {
-	FILE *f;
-	unsigned char *buffer;
-	size_t buffer_length, bytes_read;
+	const unsigned char *buffer;
+	int buffer_length;
 	unsigned int tex_ID = 0;
 	/*	error checks	*/
 	if( NULL == filename )
@@ -2865,35 +3501,19 @@ unsigned int SOIL_direct_load_ETC1(const char *filename,
 		result_string_pointer = "NULL filename";
 		return 0;
 	}
-	f = fopen( filename, "rb" );
-	if( NULL == f )
-	{
-		/*	the file doesn't seem to exist (or be open-able)	*/
-		result_string_pointer = "Can not find PVR file";
-		return 0;
-	}
-	fseek( f, 0, SEEK_END );
-	buffer_length = ftell( f );
-	fseek( f, 0, SEEK_SET );
-	buffer = (unsigned char *) malloc( buffer_length );
+	/*	the compressed payload is handed to the driver straight from the mapping	*/
+	buffer = SOIL_map_file( filename, &buffer_length );
 	if( NULL == buffer )
 	{
-		result_string_pointer = "malloc failed";
-		fclose( f );
+		/*	the file doesn't seem to exist (or be open-able)	*/
+		result_string_pointer = "Can not find PKM file";
 		return 0;
 	}
-	bytes_read = fread( (void*)buffer, 1, buffer_length, f );
-	fclose( f );
-	if( bytes_read < buffer_length )
-	{
-		/*	huh?	*/
-		buffer_length = bytes_read;
-	}
 	/*	now try to do the loading	*/
 	tex_ID = SOIL_direct_load_ETC1_from_memory(
-		(const unsigned char *const)buffer, (int)buffer_length,
+		buffer, buffer_length,
 		reuse_texture_ID, flags );
-	SOIL_free_image_data( buffer );
+	SOIL_unmap_file( buffer, buffer_length );
 	return tex_ID;
 }
 
@@ -0,0 +1,320 @@
+/*
+	Per-thread arena allocator for image decoding
+
+	public domain
+*/
+
+#include "image_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( _MSC_VER )
+	#define SOIL_THREAD_LOCAL __declspec( thread )
+#elif defined( __GNUC__ ) || defined( __clang__ )
+	#define SOIL_THREAD_LOCAL __thread
+#else
+	#define SOIL_THREAD_LOCAL _Thread_local
+#endif
+
+/*	every block is preceded by its size, which keeps blocks 16 byte aligned	*/
+#define SOIL_ARENA_ALIGN		16
+#define SOIL_ARENA_PREFIX		SOIL_ARENA_ALIGN
+#define SOIL_ARENA_MIN_CHUNK	(64 * 1024)
+/*	don't keep more than this around per thread between loads	*/
+#define SOIL_ARENA_RETAIN		(64 * 1024 * 1024)
+
+typedef struct SOIL_arena_chunk
+{
+	struct SOIL_arena_chunk *next;
+	size_t size;
+	size_t used;
+	size_t pad;
+} SOIL_arena_chunk;
+
+typedef struct
+{
+	SOIL_arena_chunk *head;		/*	the chunk being bumped, older ones follow	*/
+	unsigned char *last;		/*	most recent block, may be resized in place	*/
+	size_t heap_threshold;
+	int depth;
+} SOIL_arena;
+
+static SOIL_THREAD_LOCAL SOIL_arena arena;
+
+static size_t
+	align_size
+	(
+		size_t size
+	)
+{
+	return (size + SOIL_ARENA_ALIGN - 1) & ~(size_t)(SOIL_ARENA_ALIGN - 1);
+}
+
+static unsigned char*
+	chunk_data
+	(
+		SOIL_arena_chunk *chunk
+	)
+{
+	return (unsigned char*)(chunk + 1);
+}
+
+static void
+	free_chunks
+	(
+		void
+	)
+{
+	while( NULL != arena.head )
+	{
+		SOIL_arena_chunk *next = arena.head->next;
+		free( arena.head );
+		arena.head = next;
+	}
+	arena.last = NULL;
+}
+
+static int
+	add_chunk
+	(
+		size_t min_size
+	)
+{
+	size_t size = SOIL_ARENA_MIN_CHUNK;
+	SOIL_arena_chunk *chunk;
+	if( (NULL != arena.head) && (arena.head->size * 2 > size) )
+	{
+		size = arena.head->size * 2;
+	}
+	if( size < min_size )
+	{
+		size = min_size;
+	}
+	chunk = (SOIL_arena_chunk*)malloc( sizeof( SOIL_arena_chunk ) + size );
+	if( NULL == chunk )
+	{
+		return 0;
+	}
+	chunk->next = arena.head;
+	chunk->size = size;
+	chunk->used = 0;
+	arena.head = chunk;
+	return 1;
+}
+
+static int
+	owns
+	(
+		const void *ptr
+	)
+{
+	const SOIL_arena_chunk *chunk;
+	for( chunk = arena.head; NULL != chunk; chunk = chunk->next )
+	{
+		const unsigned char *data = (const unsigned char*)(chunk + 1);
+		if( ((const unsigned char*)ptr >= data) && ((const unsigned char*)ptr < data + chunk->used) )
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static size_t
+	block_size
+	(
+		const void *ptr
+	)
+{
+	size_t size;
+	memcpy( &size, (const unsigned char*)ptr - SOIL_ARENA_PREFIX, sizeof( size ) );
+	return size;
+}
+
+void
+	SOIL_arena_begin
+	(
+		size_t expected_size,
+		size_t heap_threshold
+	)
+{
+	if( arena.depth++ > 0 )
+	{
+		return;
+	}
+	arena.heap_threshold = heap_threshold;
+	arena.last = NULL;
+	expected_size = align_size( expected_size ) + SOIL_ARENA_MIN_CHUNK;
+	/*	a fragmented arena or one that is too small gets replaced by a
+		single chunk big enough for the whole load	*/
+	if( (NULL != arena.head) &&
+		((NULL != arena.head->next) || (arena.head->size < expected_size)) )
+	{
+		size_t total = 0;
+		SOIL_arena_chunk *chunk;
+		for( chunk = arena.head; NULL != chunk; chunk = chunk->next )
+		{
+			total += chunk->size;
+		}
+		if( total > expected_size )
+		{
+			expected_size = total;
+		}
+		free_chunks();
+	}
+	if( NULL == arena.head )
+	{
+		add_chunk( expected_size );
+	} else
+	{
+		arena.head->used = 0;
+	}
+}
+
+void
+	SOIL_arena_end
+	(
+		void
+	)
+{
+	if( arena.depth <= 0 )
+	{
+		return;
+	}
+	if( --arena.depth > 0 )
+	{
+		return;
+	}
+	arena.last = NULL;
+	if( (NULL != arena.head) &&
+		((NULL != arena.head->next) || (arena.head->size > SOIL_ARENA_RETAIN)) )
+	{
+		free_chunks();
+	} else if( NULL != arena.head )
+	{
+		arena.head->used = 0;
+	}
+}
+
+void*
+	SOIL_arena_malloc
+	(
+		size_t size
+	)
+{
+	size_t needed;
+	unsigned char *block;
+	if( (arena.depth <= 0) ||
+		((arena.heap_threshold > 0) && (size >= arena.heap_threshold)) )
+	{
+		return malloc( size );
+	}
+	needed = SOIL_ARENA_PREFIX + align_size( size );
+	if( (NULL == arena.head) || (arena.head->size - arena.head->used < needed) )
+	{
+		if( !add_chunk( needed ) )
+		{
+			return malloc( size );
+		}
+	}
+	block = chunk_data( arena.head ) + arena.head->used + SOIL_ARENA_PREFIX;
+	memcpy( block - SOIL_ARENA_PREFIX, &size, sizeof( size ) );
+	arena.head->used += needed;
+	arena.last = block;
+	return block;
+}
+
+void*
+	SOIL_arena_realloc
+	(
+		void *ptr,
+		size_t new_size
+	)
+{
+	size_t old_size;
+	void *moved;
+	if( NULL == ptr )
+	{
+		return SOIL_arena_malloc( new_size );
+	}
+	if( !owns( ptr ) )
+	{
+		return realloc( ptr, new_size );
+	}
+	old_size = block_size( ptr );
+	/*	resize the newest block in place when it still fits its chunk	*/
+	if( (ptr == arena.last) &&
+		((arena.heap_threshold == 0) || (new_size < arena.heap_threshold)) )
+	{
+		size_t start = (unsigned char*)ptr - chunk_data( arena.head );
+		if( start + align_size( new_size ) <= arena.head->size )
+		{
+			memcpy( (unsigned char*)ptr - SOIL_ARENA_PREFIX, &new_size, sizeof( new_size ) );
+			arena.head->used = start + align_size( new_size );
+			return ptr;
+		}
+	}
+	moved = SOIL_arena_malloc( new_size );
+	if( NULL != moved )
+	{
+		memcpy( moved, ptr, old_size < new_size ? old_size : new_size );
+		SOIL_arena_free( ptr );
+	}
+	return moved;
+}
+
+void
+	SOIL_arena_free
+	(
+		void *ptr
+	)
+{
+	if( NULL == ptr )
+	{
+		return;
+	}
+	if( !owns( ptr ) )
+	{
+		free( ptr );
+		return;
+	}
+	if( ptr == arena.last )
+	{
+		/*	pop it, stack style	*/
+		arena.head->used = (unsigned char*)ptr - SOIL_ARENA_PREFIX - chunk_data( arena.head );
+		arena.last = NULL;
+	}
+}
+
+void*
+	SOIL_arena_detach
+	(
+		void *ptr,
+		size_t size
+	)
+{
+	void *copy;
+	if( (NULL == ptr) || !owns( ptr ) )
+	{
+		return ptr;
+	}
+	copy = malloc( size );
+	if( NULL != copy )
+	{
+		memcpy( copy, ptr, size );
+	}
+	SOIL_arena_free( ptr );
+	return copy;
+}
+
+void
+	SOIL_arena_release
+	(
+		void
+	)
+{
+	if( arena.depth <= 0 )
+	{
+		free_chunks();
+	}
+}
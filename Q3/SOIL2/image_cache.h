@@ -0,0 +1,115 @@
+/*
+	Persistent cache of decoded, GPU-ready texture data
+
+	Entries are content addressed: the key is a hash of the source file
+	bytes mixed with every load option that changes the decoded result.
+	Each entry is a single file holding a SOIL_cache_header, a table of
+	mip levels and the level data, laid out exactly as it is handed to
+	glTexImage2D / glCompressedTexImage2D.
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_CACHE
+#define HEADER_IMAGE_CACHE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SOIL_CACHE_MAGIC		"SOILTC1"
+#define SOIL_CACHE_MAX_LEVELS	32
+
+typedef unsigned long long SOIL_cache_key;
+
+/**	Header of a cache entry, followed by num_levels SOIL_cache_level records **/
+typedef struct
+{
+	char			magic[8];
+	SOIL_cache_key	key;
+	unsigned int	width;
+	unsigned int	height;
+	unsigned int	channels;
+	unsigned int	internal_format;	/*	GL internal format	*/
+	unsigned int	pixel_format;		/*	GL_RGB etc., 0 for compressed data	*/
+	unsigned int	num_levels;
+} SOIL_cache_header;
+
+typedef struct
+{
+	unsigned int	width;
+	unsigned int	height;
+	unsigned int	offset;		/*	from the start of the entry	*/
+	unsigned int	size;
+} SOIL_cache_level;
+
+/**
+	Hashes a source file and the options it is decoded with into a cache key.
+**/
+SOIL_cache_key
+	SOIL_cache_make_key
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned int options
+	);
+
+/**
+	Maps the entry for key if it exists and is well formed, and marks it
+	as the most recently used entry.
+	\return NULL on a miss, otherwise the entry (release with SOIL_cache_release)
+**/
+const unsigned char*
+	SOIL_cache_lookup
+	(
+		SOIL_cache_key key,
+		int *entry_length
+	);
+
+void
+	SOIL_cache_release
+	(
+		const unsigned char *entry,
+		int entry_length
+	);
+
+/**
+	Writes an entry to the cache directory, then evicts the least recently
+	used entries until the cache fits its size limit.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_cache_store
+	(
+		SOIL_cache_key key,
+		const unsigned char *const entry,
+		int entry_length
+	);
+
+/**	Validates the header and level table of an entry **/
+int
+	SOIL_cache_validate
+	(
+		const unsigned char *const entry,
+		int entry_length,
+		SOIL_cache_key key
+	);
+
+/**	Counters, printed at exit **/
+void
+	SOIL_cache_count_hit
+	(
+		unsigned int bytes_saved
+	);
+
+void
+	SOIL_cache_count_miss
+	(
+		void
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_CACHE	*/
@@ -0,0 +1,153 @@
+/*
+	Parallel-for for the block decoders
+
+	public domain
+*/
+
+#include "image_parallel.h"
+
+#if defined( __WIN32__ ) || defined( _WIN32 ) || defined( WIN32 )
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#define SOIL_PARALLEL_WIN32
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#define SOIL_PARALLEL_MAX_THREADS 32
+
+typedef struct
+{
+	SOIL_parallel_task task;
+	void *context;
+	int begin;
+	int end;
+} SOIL_parallel_chunk;
+
+static int parallel_threads = 0;
+
+void
+	SOIL_parallel_set_threads
+	(
+		int threads
+	)
+{
+	parallel_threads = threads < 0 ? 0 : threads;
+}
+
+static int
+	core_count
+	(
+		void
+	)
+{
+#if defined( SOIL_PARALLEL_WIN32 )
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	return (int)info.dwNumberOfProcessors;
+#elif defined( _SC_NPROCESSORS_ONLN )
+	long cores = sysconf( _SC_NPROCESSORS_ONLN );
+	return cores > 0 ? (int)cores : 1;
+#else
+	return 1;
+#endif
+}
+
+#if defined( SOIL_PARALLEL_WIN32 )
+static DWORD WINAPI
+	run_chunk
+	(
+		LPVOID param
+	)
+{
+	SOIL_parallel_chunk *chunk = (SOIL_parallel_chunk*)param;
+	chunk->task( chunk->context, chunk->begin, chunk->end );
+	return 0;
+}
+#else
+static void*
+	run_chunk
+	(
+		void *param
+	)
+{
+	SOIL_parallel_chunk *chunk = (SOIL_parallel_chunk*)param;
+	chunk->task( chunk->context, chunk->begin, chunk->end );
+	return NULL;
+}
+#endif
+
+void
+	SOIL_parallel_for
+	(
+		int count,
+		int min_per_thread,
+		SOIL_parallel_task task,
+		void *context
+	)
+{
+	SOIL_parallel_chunk chunks[SOIL_PARALLEL_MAX_THREADS];
+#if defined( SOIL_PARALLEL_WIN32 )
+	HANDLE threads[SOIL_PARALLEL_MAX_THREADS];
+#else
+	pthread_t threads[SOIL_PARALLEL_MAX_THREADS];
+#endif
+	int started[SOIL_PARALLEL_MAX_THREADS];
+	int num_threads = parallel_threads > 0 ? parallel_threads : core_count();
+	int i;
+	if( count <= 0 )
+	{
+		return;
+	}
+	if( min_per_thread < 1 )
+	{
+		min_per_thread = 1;
+	}
+	if( num_threads > count / min_per_thread )
+	{
+		num_threads = count / min_per_thread;
+	}
+	if( num_threads > SOIL_PARALLEL_MAX_THREADS )
+	{
+		num_threads = SOIL_PARALLEL_MAX_THREADS;
+	}
+	if( num_threads <= 1 )
+	{
+		task( context, 0, count );
+		return;
+	}
+	for( i = 0; i < num_threads; ++i )
+	{
+		chunks[i].task = task;
+		chunks[i].context = context;
+		chunks[i].begin = (int)((long long)count * i / num_threads);
+		chunks[i].end = (int)((long long)count * (i + 1) / num_threads);
+		started[i] = 0;
+	}
+	/*	chunk 0 runs here, a chunk whose thread can't be started runs here too	*/
+	for( i = 1; i < num_threads; ++i )
+	{
+#if defined( SOIL_PARALLEL_WIN32 )
+		threads[i] = CreateThread( NULL, 0, run_chunk, &chunks[i], 0, NULL );
+		started[i] = (NULL != threads[i]);
+#else
+		started[i] = (0 == pthread_create( &threads[i], NULL, run_chunk, &chunks[i] ));
+#endif
+	}
+	run_chunk( &chunks[0] );
+	for( i = 1; i < num_threads; ++i )
+	{
+		if( !started[i] )
+		{
+			run_chunk( &chunks[i] );
+			continue;
+		}
+#if defined( SOIL_PARALLEL_WIN32 )
+		WaitForSingleObject( threads[i], INFINITE );
+		CloseHandle( threads[i] );
+#else
+		pthread_join( threads[i], NULL );
+#endif
+	}
+}
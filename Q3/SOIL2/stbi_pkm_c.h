@@ -1,6 +1,28 @@
 #include "pkm_helper.h"
 #include "wfETC.h"
 
+/*	maps the header to the decoder format, 0 for versions and formats we can't decode	*/
+static int stbi__pkm_format(const PKMHeader *header, wfETC_Format *format)
+{
+	if ( 0 == memcmp( header->aName, "PKM 10", 6 ) ) {
+		*format = WF_ETC1_RGB8;
+		return 1;
+	}
+
+	if ( 0 != memcmp( header->aName, "PKM 20", 6 ) ) {
+		return 0;
+	}
+
+	switch ( (header->iFormatMSB << 8) | header->iFormatLSB ) {
+		case PKM_FORMAT_ETC1_RGB:		*format = WF_ETC1_RGB8; return 1;
+		case PKM_FORMAT_ETC2_RGB:		*format = WF_ETC2_RGB8; return 1;
+		case PKM_FORMAT_ETC2_RGBA_OLD:
+		case PKM_FORMAT_ETC2_RGBA:		*format = WF_ETC2_RGBA8; return 1;
+		case PKM_FORMAT_ETC2_RGBA1:		*format = WF_ETC2_RGB8A1; return 1;
+		default: return 0;
+	}
+}
+
 static int stbi__pkm_test(stbi__context *s)
 {
 	//	check the magic number
@@ -24,9 +46,11 @@ static int stbi__pkm_test(stbi__context *s)
 		return 0;
 	}
 
-	if (stbi__get8(s) != '1') {
-		stbi__rewind(s);
-		return 0;
+	switch (stbi__get8(s)) {
+		case '1': case '2': break;
+		default:
+			stbi__rewind(s);
+			return 0;
 	}
 
 	if (stbi__get8(s) != '0') {
@@ -78,11 +102,10 @@ int      stbi__pkm_test_callbacks      (stbi_io_callbacks const *clbk, void *use
 static int stbi__pkm_info(stbi__context *s, int *x, int *y, int *comp )
 {
 	PKMHeader header;
+	wfETC_Format format;
 	unsigned int width, height;
 
-	stbi__getn( s, (stbi_uc*)(&header), sizeof(PKMHeader) );
-
-	if ( 0 != strcmp( header.aName, "PKM 10" ) ) {
+	if ( !stbi__getn( s, (stbi_uc*)(&header), sizeof(PKMHeader) ) || !stbi__pkm_format( &header, &format ) ) {
 		stbi__rewind(s);
 		return 0;
 	}
@@ -92,7 +115,7 @@ static int stbi__pkm_info(stbi__context *s, int *x, int *y, int *comp )
 
 	*x = s->img_x = width;
 	*y = s->img_y = height;
-	*comp = s->img_n = 3;
+	*comp = s->img_n = (format == WF_ETC2_RGB8 || format == WF_ETC1_RGB8) ? 3 : 4;
 
 	stbi__rewind(s);
 
@@ -141,14 +164,17 @@ static void * stbi__pkm_load(stbi__context *s, int *x, int *y, int *comp, int re
 	stbi_uc *pkm_data = NULL;
 	stbi_uc *pkm_res_data = NULL;
 	PKMHeader header;
+	wfETC_Format format;
 	unsigned int width;
 	unsigned int height;
 	unsigned int compressed_size;
 
-	stbi__getn( s, (stbi_uc*)(&header), sizeof(PKMHeader) );
+	if ( !stbi__getn( s, (stbi_uc*)(&header), sizeof(PKMHeader) ) ) {
+		return stbi__errpuc("bad file","PKM header truncated");
+	}
 
-	if ( 0 != strcmp( header.aName, "PKM 10" ) ) {
-		return NULL;
+	if ( !stbi__pkm_format( &header, &format ) ) {
+		return stbi__errpuc("bad format","unsupported PKM version or format");
 	}
 
 	width = (header.iWidthMSB << 8) | header.iWidthLSB;
@@ -158,16 +184,25 @@ static void * stbi__pkm_load(stbi__context *s, int *x, int *y, int *comp, int re
 	*y = s->img_y = height;
 	*comp = s->img_n = 4;
 
-	compressed_size = (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
+	compressed_size = wfETC_ImageSize( width, height, format );
 
-	pkm_data = (stbi_uc *)malloc(compressed_size);
-	stbi__getn( s, pkm_data, compressed_size );
+	pkm_data = (stbi_uc *)STBI_MALLOC(compressed_size);
+	if ( NULL == pkm_data ) {
+		return stbi__errpuc("outofmem", "Out of memory");
+	}
 
-	pkm_res_data = (stbi_uc *)malloc(width * height * s->img_n);
+	if ( !stbi__getn( s, pkm_data, compressed_size ) ) {
+		STBI_FREE( pkm_data );
+		return stbi__errpuc("bad file","PKM data truncated");
+	}
+
+	pkm_res_data = (stbi_uc *)STBI_MALLOC(width * height * s->img_n);
 
-	wfETC1_DecodeImage(pkm_data, pkm_res_data, width, height);
+	if ( NULL != pkm_res_data ) {
+		wfETC_DecodeImage(pkm_data, pkm_res_data, width, height, format);
+	}
 
-	free( pkm_data );
+	STBI_FREE( pkm_data );
 
 	if ( NULL != pkm_res_data ) {
 		if( (req_comp < 4) && (req_comp >= 1) ) {
@@ -179,8 +214,6 @@ static void * stbi__pkm_load(stbi__context *s, int *x, int *y, int *comp, int re
 		}
 
 		return (stbi_uc *)pkm_res_data;
-	} else {
-		free( pkm_res_data );
 	}
 
 	return NULL;
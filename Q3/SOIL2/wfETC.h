@@ -1,11 +1,6 @@
 #ifndef WF_ETC_H
 #define WF_ETC_H
 
-#define WF_LITTLE_ENDIAN
-
-// Qt ordering
-#define WF_ETC_RGBA( r, g, b, a ) ( ((a)<<24) | ((r)<<16) | ((g)<<8) | (b) ) // colors have been clamped by the time we hit here, so there should be no need to mask
-
 #ifdef _MSC_VER
 	#if _MSC_VER < 1300
 	   typedef signed   char  int8_t;
@@ -42,9 +37,26 @@
 extern "C" {
 #endif
 
+// Decoded pixels are 4 bytes each, in R, G, B, A order.
+// Define WF_ETC_NO_SIMD to build without the SSSE3 block writer.
+
+typedef enum
+{
+	WF_ETC1_RGB8,		//!< 8 byte blocks
+	WF_ETC2_RGB8,		//!< 8 byte blocks, ETC1 plus the T, H and planar modes
+	WF_ETC2_RGB8A1,		//!< 8 byte blocks, punch-through alpha
+	WF_ETC2_RGBA8		//!< 16 byte blocks, EAC alpha followed by an ETC2 color block
+} wfETC_Format;
+
 extern void wfETC1_DecodeBlock( const void* WF_RESTRICT src, void* WF_RESTRICT dst, const uint32_t dstStride /*=4*/ ); //!< stride in pixels; must be a multiple of four
 
-extern void wfETC1_DecodeImage( const void* WF_RESTRICT src, void* WF_RESTRICT dst, const uint32_t width, const uint32_t height ); //!< width/height in pixels; must be multiples of four
+extern void wfETC2_DecodeBlock( const void* WF_RESTRICT src, void* WF_RESTRICT dst, const uint32_t dstStride, const wfETC_Format format ); //!< stride in pixels
+
+extern void wfETC1_DecodeImage( const void* WF_RESTRICT src, void* WF_RESTRICT dst, const uint32_t width, const uint32_t height ); //!< width/height in pixels, the source is padded to whole blocks
+
+extern void wfETC_DecodeImage( const void* WF_RESTRICT src, void* WF_RESTRICT dst, const uint32_t width, const uint32_t height, const wfETC_Format format ); //!< decodes block rows in parallel
+
+extern uint32_t wfETC_ImageSize( const uint32_t width, const uint32_t height, const wfETC_Format format ); //!< compressed size in bytes
 
 #ifdef __cplusplus
 }
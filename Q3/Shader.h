@@ -14,15 +14,73 @@ public:
     GLuint Program;
     // Constructor generates the shader on the fly
     Shader( const GLchar *vertexPath, const GLchar *fragmentPath )
+    {
+        this->build( vertexPath, fragmentPath, "" );
+    }
+    
+    // Same, with extra preprocessor lines (e.g. "#define BINDLESS_TEXTURES\n") inserted after #version
+    Shader( const GLchar *vertexPath, const GLchar *fragmentPath, const std::string &defines )
+    {
+        this->build( vertexPath, fragmentPath, defines );
+    }
+    
+    // With a geometry shader between the two, the defines go into all three
+    Shader( const GLchar *vertexPath, const GLchar *fragmentPath, const GLchar *geometryPath, const std::string &defines )
+    {
+        this->build( vertexPath, fragmentPath, defines, geometryPath );
+    }
+    
+    // A compute program, used where the driver has ARB_compute_shader; check Valid( ) before dispatching
+    explicit Shader( const GLchar *computePath )
+    {
+        this->buildCompute( computePath );
+    }
+    
+    bool Valid( ) const
+    {
+        return 0 != this->Program;
+    }
+    
+    // Uses the current shader
+    void Use( )
+    {
+        glUseProgram( this->Program );
+    }
+    
+private:
+    // #version has to stay the first line, so defines go right after it
+    static std::string injectDefines( const std::string &code, const std::string &defines )
+    {
+        if ( defines.empty( ) )
+        {
+            return code;
+        }
+        std::string::size_type version = code.find( "#version" );
+        if ( std::string::npos == version )
+        {
+            return defines + code;
+        }
+        std::string::size_type lineEnd = code.find( '\n', version );
+        if ( std::string::npos == lineEnd )
+        {
+            return code + "\n" + defines;
+        }
+        return code.substr( 0, lineEnd + 1 ) + defines + code.substr( lineEnd + 1 );
+    }
+    
+    void build( const GLchar *vertexPath, const GLchar *fragmentPath, const std::string &defines, const GLchar *geometryPath = NULL )
     {
         // 1. Retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
+        std::string geometryCode;
         std::ifstream vShaderFile;
         std::ifstream fShaderFile;
+        std::ifstream gShaderFile;
         // ensures ifstream objects can throw exceptions:
         vShaderFile.exceptions ( std::ifstream::badbit );
         fShaderFile.exceptions ( std::ifstream::badbit );
+        gShaderFile.exceptions ( std::ifstream::badbit );
         try
         {
             // Open files
@@ -36,8 +94,17 @@ public:
             vShaderFile.close( );
             fShaderFile.close( );
             // Convert stream into string
-            vertexCode = vShaderStream.str( );
-            fragmentCode = fShaderStream.str( );
+            vertexCode = injectDefines( vShaderStream.str( ), defines );
+            fragmentCode = injectDefines( fShaderStream.str( ), defines );
+            
+            if ( NULL != geometryPath )
+            {
+                gShaderFile.open( geometryPath );
+                std::stringstream gShaderStream;
+                gShaderStream << gShaderFile.rdbuf( );
+                gShaderFile.close( );
+                geometryCode = injectDefines( gShaderStream.str( ), defines );
+            }
         }
         catch ( std::ifstream::failure e )
         {
@@ -71,10 +138,29 @@ public:
             glGetShaderInfoLog( fragment, 512, NULL, infoLog );
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
         }
+        // Geometry Shader
+        GLuint geometry = 0;
+        if ( NULL != geometryPath )
+        {
+            const GLchar *gShaderCode = geometryCode.c_str( );
+            geometry = glCreateShader( GL_GEOMETRY_SHADER );
+            glShaderSource( geometry, 1, &gShaderCode, NULL );
+            glCompileShader( geometry );
+            glGetShaderiv( geometry, GL_COMPILE_STATUS, &success );
+            if ( !success )
+            {
+                glGetShaderInfoLog( geometry, 512, NULL, infoLog );
+                std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n" << infoLog << std::endl;
+            }
+        }
         // Shader Program
         this->Program = glCreateProgram( );
         glAttachShader( this->Program, vertex );
         glAttachShader( this->Program, fragment );
+        if ( 0 != geometry )
+        {
+            glAttachShader( this->Program, geometry );
+        }
         glLinkProgram( this->Program );
         // Print linking errors if any
         glGetProgramiv( this->Program, GL_LINK_STATUS, &success );
@@ -86,12 +172,52 @@ public:
         // Delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader( vertex );
         glDeleteShader( fragment );
+        if ( 0 != geometry )
+        {
+            glDeleteShader( geometry );
+        }
         
     }
-    // Uses the current shader
-    void Use( )
+    
+    void buildCompute( const GLchar *computePath )
     {
-        glUseProgram( this->Program );
+        this->Program = 0;
+        std::ifstream cShaderFile( computePath );
+        if ( !cShaderFile )
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            return;
+        }
+        std::stringstream cShaderStream;
+        cShaderStream << cShaderFile.rdbuf( );
+        std::string computeCode = cShaderStream.str( );
+        const GLchar *cShaderCode = computeCode.c_str( );
+        GLint success;
+        GLchar infoLog[512];
+        // Compute Shader
+        GLuint compute = glCreateShader( GL_COMPUTE_SHADER );
+        glShaderSource( compute, 1, &cShaderCode, NULL );
+        glCompileShader( compute );
+        glGetShaderiv( compute, GL_COMPILE_STATUS, &success );
+        if ( !success )
+        {
+            glGetShaderInfoLog( compute, 512, NULL, infoLog );
+            std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+            glDeleteShader( compute );
+            return;
+        }
+        this->Program = glCreateProgram( );
+        glAttachShader( this->Program, compute );
+        glLinkProgram( this->Program );
+        glDeleteShader( compute );
+        glGetProgramiv( this->Program, GL_LINK_STATUS, &success );
+        if ( !success )
+        {
+            glGetProgramInfoLog( this->Program, 512, NULL, infoLog );
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+            glDeleteProgram( this->Program );
+            this->Program = 0;
+        }
     }
 };
 
@@ -0,0 +1,294 @@
+#ifndef ShadowCubes_h
+#define ShadowCubes_h
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "ClusteredLights.h"
+#include "SphericalHarmonics.h"
+
+// The first SHADOW_MAX_LIGHTS point lights cast shadows
+const GLint SHADOW_MAX_LIGHTS = 4;
+const GLint SHADOW_SIZE = 512;
+
+// Shadows start this far from the light
+const GLfloat SHADOW_NEAR = 0.01f;
+
+// Something drawn into the shadow maps: positions at location 0 of vao, and a bounding sphere in world space
+struct ShadowCaster
+{
+    GLuint vao;
+    GLsizei vertices;
+    glm::mat4 model;
+    glm::vec3 center;
+    GLfloat radius;
+};
+
+// Omnidirectional shadow maps for the first point lights, all of them in one pass. The six faces of
+// every light are layers of one depth texture array, light * 6 + face, in the face order and axes of
+// SH_FACE_AXES. Each caster is drawn once, instanced per light that needs new maps, and shadow.gs
+// sends every triangle to the faces it reaches through gl_Layer, skipping the faces the caster's
+// bounding sphere can't touch and the ones the triangle falls outside of. Maps are kept from frame to
+// frame and only a light that moved, or every light when a caster moved, is drawn again.
+// frag.vs and deferredfrag.vs pick the face and compare with hardware PCF (sampler2DArrayShadow).
+class ShadowCubes
+{
+public:
+    ShadowCubes( )
+        : shader( "resources/shaders/shadowcore.vs", "resources/shaders/shadowfrag.vs", "resources/shaders/shadow.gs", ShaderDefines( ) )
+    {
+        this->rendered = 0;
+        for ( int i = 0; i < SHADOW_MAX_LIGHTS; i++ )
+        {
+            this->lights[i] = glm::vec4( 0.0f );
+            this->valid[i] = false;
+        }
+
+        glGenTextures( 1, &this->texture );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, this->texture );
+        glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_SIZE, SHADOW_SIZE, SHADOW_MAX_LIGHTS * 6, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+
+        glGenFramebuffers( 1, &this->framebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, this->framebuffer );
+        glFramebufferTexture( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->texture, 0 );
+        glDrawBuffer( GL_NONE );
+        glReadBuffer( GL_NONE );
+        if ( GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus( GL_FRAMEBUFFER ) )
+        {
+            std::cout << "ERROR::SHADOW::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+        this->shader.Use( );
+        glUniform1f( glGetUniformLocation( this->shader.Program, "shadowNear" ), SHADOW_NEAR );
+    }
+
+    ~ShadowCubes( )
+    {
+        this->Clear( );
+    }
+
+    // Lines for the lighting shaders' Shader constructors, so their uniform arrays match
+    static std::string ShaderDefines( )
+    {
+        std::stringstream defines;
+
+        defines << "#define SHADOW_MAX_LIGHTS " << SHADOW_MAX_LIGHTS << "\n";
+
+        return defines.str( );
+    }
+
+    // Binds the maps to unit for a lighting shader; Update( ) keeps its shadow uniforms current
+    void Attach( const Shader &shader, GLint unit )
+    {
+        this->programs.push_back( shader.Program );
+        glUseProgram( shader.Program );
+        glUniform1i( glGetUniformLocation( shader.Program, "shadowMaps" ), unit );
+        glUniform1f( glGetUniformLocation( shader.Program, "shadowNear" ), SHADOW_NEAR );
+        glUniform1f( glGetUniformLocation( shader.Program, "shadowTexel" ), 2.0f / SHADOW_SIZE );
+        glActiveTexture( GL_TEXTURE0 + unit );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, this->texture );
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    // Redraws the maps of the lights that moved, all of them if a caster moved. Leaves the default
+    // framebuffer bound with a screenWidth x screenHeight viewport
+    void Update( const std::vector<ClusterLight> &lights, const std::vector<ShadowCaster> &casters, GLint screenWidth, GLint screenHeight )
+    {
+        GLint count = ( GLint )std::min( lights.size( ), ( size_t )SHADOW_MAX_LIGHTS );
+        bool castersMoved = !sameCasters( casters, this->casters );
+        GLint dirty[SHADOW_MAX_LIGHTS];
+        GLint dirtyCount = 0;
+
+        for ( GLint i = 0; i < count; i++ )
+        {
+            glm::vec4 light( lights[i].position, std::max( ClusteredLights::Range( lights[i] ), 2.0f * SHADOW_NEAR ) );
+
+            if ( castersMoved || !this->valid[i] || light != this->lights[i] )
+            {
+                this->lights[i] = light;
+                this->valid[i] = true;
+                dirty[dirtyCount++] = i;
+            }
+        }
+        this->casters = casters;
+        this->rendered = dirtyCount;
+
+        for ( size_t p = 0; p < this->programs.size( ); p++ )
+        {
+            glUseProgram( this->programs[p] );
+            glUniform1i( glGetUniformLocation( this->programs[p], "shadowCount" ), count );
+            glUniform4fv( glGetUniformLocation( this->programs[p], "shadowLights" ), SHADOW_MAX_LIGHTS, glm::value_ptr( this->lights[0] ) );
+        }
+
+        if ( 0 == dirtyCount )
+        {
+            return;
+        }
+
+        glBindFramebuffer( GL_FRAMEBUFFER, this->framebuffer );
+        glViewport( 0, 0, SHADOW_SIZE, SHADOW_SIZE );
+        this->clearLayers( dirty, dirtyCount, count );
+
+        this->shader.Use( );
+        glUniform4fv( glGetUniformLocation( this->shader.Program, "shadowLights" ), SHADOW_MAX_LIGHTS, glm::value_ptr( this->lights[0] ) );
+        glUniform1iv( glGetUniformLocation( this->shader.Program, "shadowSlots" ), dirtyCount, dirty );
+
+        // Slope scaled offset against acne, the shaders add a normal offset on top
+        glEnable( GL_POLYGON_OFFSET_FILL );
+        glPolygonOffset( 1.5f, 4.0f );
+
+        GLint modelLoc = glGetUniformLocation( this->shader.Program, "model" );
+        GLint masksLoc = glGetUniformLocation( this->shader.Program, "faceMasks" );
+        for ( size_t c = 0; c < casters.size( ); c++ )
+        {
+            const ShadowCaster &caster = casters[c];
+            GLint masks[SHADOW_MAX_LIGHTS];
+            GLint any = 0;
+
+            for ( GLint d = 0; d < dirtyCount; d++ )
+            {
+                masks[d] = faceMask( this->lights[dirty[d]], caster.center, caster.radius );
+                any |= masks[d];
+            }
+            if ( 0 == any )
+            {
+                continue;
+            }
+
+            glUniformMatrix4fv( modelLoc, 1, GL_FALSE, glm::value_ptr( caster.model ) );
+            glUniform1iv( masksLoc, dirtyCount, masks );
+            glBindVertexArray( caster.vao );
+            glDrawArraysInstanced( GL_TRIANGLES, 0, caster.vertices, dirtyCount );
+        }
+        glBindVertexArray( 0 );
+
+        glDisable( GL_POLYGON_OFFSET_FILL );
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+        glViewport( 0, 0, screenWidth, screenHeight );
+    }
+
+    // Lights whose maps were drawn by the last Update( )
+    GLint GetRendered( ) const
+    {
+        return this->rendered;
+    }
+
+    void Clear( )
+    {
+        if ( 0 != this->texture )
+        {
+            glDeleteFramebuffers( 1, &this->framebuffer );
+            glDeleteTextures( 1, &this->texture );
+            this->texture = 0;
+        }
+    }
+
+private:
+    Shader shader;
+    GLuint texture;
+    GLuint framebuffer;
+    glm::vec4 lights[SHADOW_MAX_LIGHTS];    // position and far plane the maps were drawn with
+    bool valid[SHADOW_MAX_LIGHTS];
+    std::vector<ShadowCaster> casters;
+    std::vector<GLuint> programs;
+    GLint rendered;
+
+    static bool sameCasters( const std::vector<ShadowCaster> &a, const std::vector<ShadowCaster> &b )
+    {
+        if ( a.size( ) != b.size( ) )
+        {
+            return false;
+        }
+        for ( size_t i = 0; i < a.size( ); i++ )
+        {
+            if ( a[i].vao != b[i].vao || a[i].vertices != b[i].vertices || a[i].model != b[i].model ||
+                 a[i].center != b[i].center || a[i].radius != b[i].radius )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // The faces whose 90 degree frustum a sphere overlaps. Face f holds the directions d with
+    // dot( d, axis ) >= | dot( d, s ) | and | dot( d, t ) |, four planes through the light
+    static GLint faceMask( const glm::vec4 &light, const glm::vec3 &center, GLfloat radius )
+    {
+        glm::vec3 d = center - glm::vec3( light );
+        GLfloat distance = std::sqrt( d.x * d.x + d.y * d.y + d.z * d.z );
+
+        if ( distance - radius > light.w )
+        {
+            return 0;
+        }
+        if ( distance <= radius )
+        {
+            return 63;
+        }
+
+        // Plane normals are ( axis +- s ) / sqrt( 2 ), so the sphere reaches in if dot( d, axis +- s ) >= -radius * sqrt( 2 )
+        GLfloat reach = -radius * 1.41421356f;
+        GLint mask = 0;
+        for ( int face = 0; face < 6; face++ )
+        {
+            const GLfloat *s = SH_FACE_AXES[face][0];
+            const GLfloat *t = SH_FACE_AXES[face][1];
+            const GLfloat *axis = SH_FACE_AXES[face][2];
+            GLfloat along = d.x * axis[0] + d.y * axis[1] + d.z * axis[2];
+            GLfloat across = d.x * s[0] + d.y * s[1] + d.z * s[2];
+            GLfloat up = d.x * t[0] + d.y * t[1] + d.z * t[2];
+
+            if ( along - across >= reach && along + across >= reach && along - up >= reach && along + up >= reach )
+            {
+                mask |= 1 << face;
+            }
+        }
+
+        return mask;
+    }
+
+    // A layered attachment clears all its layers, so if only some lights are redrawn theirs are cleared one by one
+    void clearLayers( const GLint *dirty, GLint dirtyCount, GLint count )
+    {
+        if ( dirtyCount == count )
+        {
+            glClear( GL_DEPTH_BUFFER_BIT );
+            for ( GLint i = count; i < SHADOW_MAX_LIGHTS; i++ )
+            {
+                this->valid[i] = false;
+            }
+            return;
+        }
+
+        for ( GLint d = 0; d < dirtyCount; d++ )
+        {
+            for ( GLint face = 0; face < 6; face++ )
+            {
+                glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->texture, 0, dirty[d] * 6 + face );
+                glClear( GL_DEPTH_BUFFER_BIT );
+            }
+        }
+        glFramebufferTexture( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->texture, 0 );
+    }
+};
+
+#endif
@@ -0,0 +1,1861 @@
+#ifndef SoftwareRenderer_h
+#define SoftwareRenderer_h
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define SOFTWARE_AVX2
+#endif
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/image_DXT.h"
+#include "SOIL2/image_parallel.h"
+
+// Screen tiles are rasterized in parallel, each by one thread, in the order the triangles were drawn
+const GLint SOFTWARE_TILE_SIZE = 64;
+
+// Inside a tile triangles are walked in square blocks of this many pixels a side, a row of a block
+// is a span of fragments shaded together
+const GLint SOFTWARE_BLOCK_SIZE = 8;
+const GLint SOFTWARE_LANES = 8;
+
+// Floats a program may pass from its vertex to its fragment stage
+const GLint SOFTWARE_MAX_VARYINGS = 16;
+
+// Vertices are snapped to 1/16 of a pixel, so the edge functions are exact in 64-bit integers and
+// a pixel on the edge two triangles share is drawn by exactly one of them
+const GLint SOFTWARE_SUBPIXELS = 16;
+
+// Triangles reaching further from the viewport than this, in 1/16 pixels, are dropped
+const GLdouble SOFTWARE_GUARD_BAND = 268435456.0;
+
+// Vertices transformed by a thread of their own once a draw has this many
+const GLint SOFTWARE_VERTICES_PER_THREAD = 4096;
+
+// An RGBA8 image with its mip chain, sampled like a GL_REPEAT texture with GL_LINEAR_MIPMAP_LINEAR.
+// Rows are in the order SOIL_load_image returns them, so t = 0 is the first row, as after glTexImage2D.
+// Levels are stored in tiles of 4x4 texels, 64 bytes, a cache line each, so a bilinear footprint
+// touches the same few lines whichever way texture space is crossed, and a minified level's samples
+// don't stride through whole rows. A BC1, BC2 or BC3 DDS keeps its blocks, which are the same 4x4
+// tiles, and decodes each block the first time a sample reaches it. The 8 lane Sample( ) picks each
+// fragment's level from its derivatives and filters with AVX2 gathers.
+// A texture that failed to load samples as white
+class SoftwareTexture
+{
+public:
+    SoftwareTexture( )
+    {
+        this->blockFormat = BLOCKS_NONE;
+    }
+
+    ~SoftwareTexture( )
+    {
+        this->Clear( );
+    }
+
+    // A BC1, BC2 or BC3 DDS stays compressed, anything else is decoded by SOIL_load_image up front
+    bool Load( const std::string &path )
+    {
+        std::string extension = path.substr( std::min( path.size( ), path.rfind( '.' ) ) );
+        std::transform( extension.begin( ), extension.end( ), extension.begin( ), ::tolower );
+        if ( ".dds" == extension && this->loadBlocks( path ) )
+        {
+            return true;
+        }
+
+        int width = 0, height = 0, channels = 0;
+        unsigned char *data = SOIL_load_image( path.c_str( ), &width, &height, &channels, SOIL_LOAD_RGBA );
+
+        if ( NULL == data )
+        {
+            std::cout << "ERROR::SOFTWARE::TEXTURE_LOAD_FAILED " << path << std::endl;
+            this->Clear( );
+            return false;
+        }
+
+        this->Set( width, height, data );
+        SOIL_free_image_data( data );
+
+        return true;
+    }
+
+    // Takes a copy of width x height RGBA8 texels and box filters the smaller levels from them
+    void Set( GLint width, GLint height, const unsigned char *rgba )
+    {
+        this->Clear( );
+        this->layout( width, height, 0 );
+        this->texels.assign( this->levels.back( ).offset + this->levels.back( ).tilesX * this->levels.back( ).tilesY * 16, 0 );
+
+        std::vector<unsigned char> source( rgba, rgba + ( size_t )width * height * 4 ), level;
+        this->store( this->levels[0], &source[0] );
+
+        for ( size_t l = 1; l < this->levels.size( ); l++ )
+        {
+            const Level &below = this->levels[l];
+            level.resize( ( size_t )below.width * below.height * 4 );
+
+            for ( GLint y = 0; y < below.height; y++ )
+            {
+                GLint y0 = std::min( y * 2, height - 1 ), y1 = std::min( y * 2 + 1, height - 1 );
+                for ( GLint x = 0; x < below.width; x++ )
+                {
+                    GLint x0 = std::min( x * 2, width - 1 ), x1 = std::min( x * 2 + 1, width - 1 );
+                    for ( int c = 0; c < 4; c++ )
+                    {
+                        GLint sum = source[( ( size_t )y0 * width + x0 ) * 4 + c] + source[( ( size_t )y0 * width + x1 ) * 4 + c] +
+                                    source[( ( size_t )y1 * width + x0 ) * 4 + c] + source[( ( size_t )y1 * width + x1 ) * 4 + c];
+                        level[( ( size_t )y * below.width + x ) * 4 + c] = ( unsigned char )( ( sum + 2 ) / 4 );
+                    }
+                }
+            }
+
+            this->store( below, &level[0] );
+            source.swap( level );
+            width = below.width;
+            height = below.height;
+        }
+    }
+
+    bool IsValid( ) const
+    {
+        return !this->levels.empty( );
+    }
+
+    GLint GetWidth( ) const
+    {
+        return this->IsValid( ) ? this->levels[0].width : 0;
+    }
+
+    GLint GetHeight( ) const
+    {
+        return this->IsValid( ) ? this->levels[0].height : 0;
+    }
+
+    // The top level as RGBA8 rows, decoding whatever blocks haven't been yet
+    void ReadTexels( std::vector<unsigned char> &rgba ) const
+    {
+        rgba.clear( );
+        if ( !this->IsValid( ) )
+        {
+            return;
+        }
+
+        const Level &level = this->levels[0];
+        rgba.resize( ( size_t )level.width * level.height * 4 );
+        for ( GLint y = 0; y < level.height; y++ )
+        {
+            for ( GLint x = 0; x < level.width; x++ )
+            {
+                memcpy( &rgba[( ( size_t )y * level.width + x ) * 4], this->fetch( level, x, y ), 4 );
+            }
+        }
+    }
+
+    // Trilinear sample, the level from the texture coordinates' screen-space derivatives
+    glm::vec4 Sample( const glm::vec2 &uv, const glm::vec2 &dUVdx, const glm::vec2 &dUVdy ) const
+    {
+        if ( !this->IsValid( ) )
+        {
+            return glm::vec4( 1.0f );
+        }
+
+        GLfloat w = ( GLfloat )this->levels[0].width, h = ( GLfloat )this->levels[0].height;
+        GLfloat dx = ( dUVdx.x * w ) * ( dUVdx.x * w ) + ( dUVdx.y * h ) * ( dUVdx.y * h );
+        GLfloat dy = ( dUVdy.x * w ) * ( dUVdy.x * w ) + ( dUVdy.y * h ) * ( dUVdy.y * h );
+        GLfloat lod = 0.5f * std::log2( std::max( std::max( dx, dy ), 1e-20f ) );
+
+        return this->SampleLevel( uv, lod );
+    }
+
+    // Sample( ) of a span's fragments, coordinates and derivatives by lane, lanes outside mask come back 0
+    void Sample( const GLfloat *s, const GLfloat *t, const GLfloat *dsdx, const GLfloat *dtdx, const GLfloat *dsdy, const GLfloat *dtdy,
+                 GLint mask, GLfloat texel[4][SOFTWARE_LANES] ) const
+    {
+#ifdef SOFTWARE_AVX2
+        __m256i active = laneMask( mask );
+        if ( !this->IsValid( ) )
+        {
+            for ( int c = 0; c < 4; c++ )
+            {
+                _mm256_storeu_ps( texel[c], _mm256_and_ps( _mm256_castsi256_ps( active ), _mm256_set1_ps( 1.0f ) ) );
+            }
+            return;
+        }
+
+        // The larger footprint axis in texels picks the level, as in Sample( )
+        __m256 w = _mm256_set1_ps( ( GLfloat )this->levels[0].width ), h = _mm256_set1_ps( ( GLfloat )this->levels[0].height );
+        __m256 ax = _mm256_mul_ps( _mm256_loadu_ps( dsdx ), w ), ay = _mm256_mul_ps( _mm256_loadu_ps( dtdx ), h );
+        __m256 bx = _mm256_mul_ps( _mm256_loadu_ps( dsdy ), w ), by = _mm256_mul_ps( _mm256_loadu_ps( dtdy ), h );
+        __m256 footprint = _mm256_max_ps( _mm256_add_ps( _mm256_mul_ps( ax, ax ), _mm256_mul_ps( ay, ay ) ),
+                                          _mm256_add_ps( _mm256_mul_ps( bx, bx ), _mm256_mul_ps( by, by ) ) );
+        __m256 lod = _mm256_mul_ps( _mm256_set1_ps( 0.5f ), log2Lanes( _mm256_max_ps( footprint, _mm256_set1_ps( 1e-20f ) ) ) );
+        lod = _mm256_min_ps( _mm256_max_ps( lod, _mm256_setzero_ps( ) ), _mm256_set1_ps( ( GLfloat )( this->levels.size( ) - 1 ) ) );
+
+        __m256 whole = _mm256_floor_ps( lod );
+        __m256 blend = _mm256_sub_ps( lod, whole );
+        __m256i level = _mm256_cvttps_epi32( whole );
+        __m256 u = _mm256_loadu_ps( s ), v = _mm256_loadu_ps( t );
+        __m256 color[4];
+        this->bilinearLanes( level, u, v, true, active, color );
+
+        // Lanes between two levels blend in the next one
+        __m256i between = _mm256_and_si256( active, _mm256_castps_si256( _mm256_cmp_ps( blend, _mm256_setzero_ps( ), _CMP_GT_OQ ) ) );
+        if ( !_mm256_testz_si256( between, between ) )
+        {
+            __m256 next[4];
+            __m256i last = _mm256_set1_epi32( ( GLint )this->levels.size( ) - 1 );
+            this->bilinearLanes( _mm256_min_epi32( _mm256_add_epi32( level, _mm256_set1_epi32( 1 ) ), last ), u, v, true, between, next );
+            for ( int c = 0; c < 4; c++ )
+            {
+                color[c] = _mm256_blendv_ps( color[c], _mm256_add_ps( color[c], _mm256_mul_ps( _mm256_sub_ps( next[c], color[c] ), blend ) ),
+                                             _mm256_castsi256_ps( between ) );
+            }
+        }
+
+        for ( int c = 0; c < 4; c++ )
+        {
+            _mm256_storeu_ps( texel[c], _mm256_and_ps( color[c], _mm256_castsi256_ps( active ) ) );
+        }
+#else
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            glm::vec4 sample( 0.0f );
+            if ( mask & ( 1 << l ) )
+            {
+                sample = this->Sample( glm::vec2( s[l], t[l] ), glm::vec2( dsdx[l], dtdx[l] ), glm::vec2( dsdy[l], dtdy[l] ) );
+            }
+            for ( int c = 0; c < 4; c++ )
+            {
+                texel[c][l] = sample[c];
+            }
+        }
+#endif
+    }
+
+    glm::vec4 SampleLevel( const glm::vec2 &uv, GLfloat lod ) const
+    {
+        if ( !this->IsValid( ) )
+        {
+            return glm::vec4( 1.0f );
+        }
+
+        lod = std::min( std::max( lod, 0.0f ), ( GLfloat )( this->levels.size( ) - 1 ) );
+        GLint level = ( GLint )lod;
+        GLfloat blend = lod - level;
+        glm::vec4 texel = this->bilinear( this->levels[level], uv.x, uv.y, true );
+
+        if ( blend > 0.0f && level + 1 < ( GLint )this->levels.size( ) )
+        {
+            texel = texel + ( this->bilinear( this->levels[level + 1], uv.x, uv.y, true ) - texel ) * blend;
+        }
+
+        return texel;
+    }
+
+    // Bilinear sample of the top level with GL_CLAMP_TO_EDGE, for cubemap faces
+    glm::vec4 SampleClamped( GLfloat s, GLfloat t ) const
+    {
+        if ( !this->IsValid( ) )
+        {
+            return glm::vec4( 1.0f );
+        }
+
+        return this->bilinear( this->levels[0], s, t, false );
+    }
+
+    // SampleClamped( ) by lane, writing only the lanes in mask
+    void SampleClamped( const GLfloat *s, const GLfloat *t, GLint mask, GLfloat texel[4][SOFTWARE_LANES] ) const
+    {
+#ifdef SOFTWARE_AVX2
+        __m256i active = laneMask( mask );
+        __m256 color[4];
+        if ( this->IsValid( ) )
+        {
+            this->bilinearLanes( _mm256_setzero_si256( ), _mm256_loadu_ps( s ), _mm256_loadu_ps( t ), false, active, color );
+        }
+        else
+        {
+            color[0] = color[1] = color[2] = color[3] = _mm256_set1_ps( 1.0f );
+        }
+
+        for ( int c = 0; c < 4; c++ )
+        {
+            _mm256_maskstore_ps( texel[c], active, color[c] );
+        }
+#else
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            if ( mask & ( 1 << l ) )
+            {
+                glm::vec4 sample = this->SampleClamped( s[l], t[l] );
+                for ( int c = 0; c < 4; c++ )
+                {
+                    texel[c][l] = sample[c];
+                }
+            }
+        }
+#endif
+    }
+
+    void Clear( )
+    {
+        this->levels.clear( );
+        std::vector<GLuint>( ).swap( this->texels );
+        std::vector<unsigned char>( ).swap( this->blocks );
+        std::vector< std::atomic<unsigned char> >( ).swap( this->decoded );
+        this->blockFormat = BLOCKS_NONE;
+    }
+
+private:
+    enum BlockFormat
+    {
+        BLOCKS_NONE,
+        BLOCKS_BC1,
+        BLOCKS_BC2,
+        BLOCKS_BC3
+    };
+
+    struct Level
+    {
+        GLint width;
+        GLint height;
+        GLint tilesX, tilesY;
+        GLint offset;           // first texel in texels, tiles follow row by row
+        size_t blockOffset;     // first byte in blocks
+    };
+
+    std::vector<Level> levels;
+    std::vector<GLint> levelTable;      // width, height, tilesX and offset of each level, for gathers
+
+    // RGBA8 texels, R in the low byte. For a DDS only the tiles decoded is set: they are the cache of its blocks
+    mutable std::vector<GLuint> texels;
+    std::vector<unsigned char> blocks;
+    mutable std::vector< std::atomic<unsigned char> > decoded;     // per tile, while there are blocks
+    mutable std::mutex decoding;
+    BlockFormat blockFormat;
+
+    // Sizes and offsets of count levels, the whole chain down to 1x1 for 0
+    void layout( GLint width, GLint height, GLint count )
+    {
+        GLint offset = 0;
+        size_t blockOffset = 0;
+        GLint blockBytes = BLOCKS_BC1 == this->blockFormat ? 8 : 16;
+
+        this->levels.clear( );
+        this->levelTable.clear( );
+        for ( ;; )
+        {
+            Level level;
+            level.width = width;
+            level.height = height;
+            level.tilesX = ( width + 3 ) / 4;
+            level.tilesY = ( height + 3 ) / 4;
+            level.offset = offset;
+            level.blockOffset = blockOffset;
+            this->levels.push_back( level );
+
+            GLint table[4] = { level.width, level.height, level.tilesX, level.offset };
+            this->levelTable.insert( this->levelTable.end( ), table, table + 4 );
+
+            offset += level.tilesX * level.tilesY * 16;
+            blockOffset += ( size_t )level.tilesX * level.tilesY * blockBytes;
+            if ( ( width <= 1 && height <= 1 ) || ( GLint )this->levels.size( ) == count )
+            {
+                break;
+            }
+
+            width = std::max( width / 2, 1 );
+            height = std::max( height / 2, 1 );
+        }
+    }
+
+    static size_t texelIndex( const Level &level, GLint x, GLint y )
+    {
+        return level.offset + ( ( size_t )( y >> 2 ) * level.tilesX + ( x >> 2 ) ) * 16 + ( y & 3 ) * 4 + ( x & 3 );
+    }
+
+    // Tiles a level given as RGBA8 rows
+    void store( const Level &level, const unsigned char *rgba )
+    {
+        for ( GLint y = 0; y < level.height; y++ )
+        {
+            for ( GLint x = 0; x < level.width; x++ )
+            {
+                memcpy( &this->texels[texelIndex( level, x, y )], &rgba[( ( size_t )y * level.width + x ) * 4], 4 );
+            }
+        }
+    }
+
+    const unsigned char *fetch( const Level &level, GLint x, GLint y ) const
+    {
+        size_t index = texelIndex( level, x, y );
+        if ( BLOCKS_NONE != this->blockFormat )
+        {
+            this->decodeTile( index / 16 );
+        }
+
+        return ( const unsigned char * )&this->texels[index];
+    }
+
+    glm::vec4 bilinear( const Level &level, GLfloat s, GLfloat t, bool repeat ) const
+    {
+        GLfloat x = s * level.width - 0.5f, y = t * level.height - 0.5f;
+        GLfloat fx = std::floor( x ), fy = std::floor( y );
+        GLint x0 = ( GLint )fx, y0 = ( GLint )fy;
+        GLfloat ax = x - fx, ay = y - fy;
+        GLint x1 = x0 + 1, y1 = y0 + 1;
+
+        if ( repeat )
+        {
+            x0 = ( ( x0 % level.width ) + level.width ) % level.width;
+            x1 = ( ( x1 % level.width ) + level.width ) % level.width;
+            y0 = ( ( y0 % level.height ) + level.height ) % level.height;
+            y1 = ( ( y1 % level.height ) + level.height ) % level.height;
+        }
+        else
+        {
+            x0 = std::min( std::max( x0, 0 ), level.width - 1 );
+            x1 = std::min( std::max( x1, 0 ), level.width - 1 );
+            y0 = std::min( std::max( y0, 0 ), level.height - 1 );
+            y1 = std::min( std::max( y1, 0 ), level.height - 1 );
+        }
+
+        const unsigned char *t00 = this->fetch( level, x0, y0 );
+        const unsigned char *t10 = this->fetch( level, x1, y0 );
+        const unsigned char *t01 = this->fetch( level, x0, y1 );
+        const unsigned char *t11 = this->fetch( level, x1, y1 );
+
+        glm::vec4 texel;
+        for ( int c = 0; c < 4; c++ )
+        {
+            GLfloat top = t00[c] + ( t10[c] - t00[c] ) * ax;
+            GLfloat bottom = t01[c] + ( t11[c] - t01[c] ) * ax;
+            texel[c] = ( top + ( bottom - top ) * ay ) * ( 1.0f / 255.0f );
+        }
+
+        return texel;
+    }
+
+#ifdef SOFTWARE_AVX2
+    static __m256i laneMask( GLint mask )
+    {
+        const __m256i bits = _mm256_setr_epi32( 1, 2, 4, 8, 16, 32, 64, 128 );
+        return _mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( mask ), bits ), bits );
+    }
+
+    // log2 of positive normal floats: the exponent plus a polynomial in the mantissa, within 3e-5
+    static __m256 log2Lanes( __m256 x )
+    {
+        __m256i bits = _mm256_castps_si256( x );
+        __m256 exponent = _mm256_cvtepi32_ps( _mm256_sub_epi32( _mm256_srli_epi32( bits, 23 ), _mm256_set1_epi32( 127 ) ) );
+        __m256 m = _mm256_sub_ps( _mm256_castsi256_ps( _mm256_or_si256( _mm256_and_si256( bits, _mm256_set1_epi32( 0x007FFFFF ) ),
+                                                                         _mm256_set1_epi32( 0x3F800000 ) ) ), _mm256_set1_ps( 1.0f ) );
+        __m256 p = _mm256_set1_ps( 0.04587895f );
+        p = _mm256_add_ps( _mm256_mul_ps( p, m ), _mm256_set1_ps( -0.19440832f ) );
+        p = _mm256_add_ps( _mm256_mul_ps( p, m ), _mm256_set1_ps( 0.41541119f ) );
+        p = _mm256_add_ps( _mm256_mul_ps( p, m ), _mm256_set1_ps( -0.70867891f ) );
+        p = _mm256_add_ps( _mm256_mul_ps( p, m ), _mm256_set1_ps( 1.44182550f ) );
+
+        return _mm256_add_ps( exponent, _mm256_mul_ps( p, m ) );
+    }
+
+    // Bilinear samples of each lane's level, the four texels gathered by lane; lanes outside active
+    // read nothing and come back 0
+    void bilinearLanes( __m256i level, __m256 s, __m256 t, bool repeat, __m256i active, __m256 *color ) const
+    {
+        const GLint *table = &this->levelTable[0];
+        __m256i entry = _mm256_slli_epi32( level, 2 );
+        __m256i width = _mm256_i32gather_epi32( table, entry, 4 );
+        __m256i height = _mm256_i32gather_epi32( table + 1, entry, 4 );
+        __m256i tilesX = _mm256_i32gather_epi32( table + 2, entry, 4 );
+        __m256i offset = _mm256_i32gather_epi32( table + 3, entry, 4 );
+        __m256 w = _mm256_cvtepi32_ps( width ), h = _mm256_cvtepi32_ps( height );
+        __m256 one = _mm256_set1_ps( 1.0f ), zero = _mm256_setzero_ps( );
+
+        __m256 x = _mm256_sub_ps( _mm256_mul_ps( s, w ), _mm256_set1_ps( 0.5f ) );
+        __m256 y = _mm256_sub_ps( _mm256_mul_ps( t, h ), _mm256_set1_ps( 0.5f ) );
+        __m256 fx = _mm256_floor_ps( x ), fy = _mm256_floor_ps( y );
+        __m256 ax = _mm256_sub_ps( x, fx ), ay = _mm256_sub_ps( y, fy );
+        __m256 x0, x1, y0, y1;
+
+        if ( repeat )
+        {
+            // Wrapped in floats, exact while the coordinates are within 2^24 texels
+            x0 = _mm256_sub_ps( fx, _mm256_mul_ps( w, _mm256_floor_ps( _mm256_div_ps( fx, w ) ) ) );
+            y0 = _mm256_sub_ps( fy, _mm256_mul_ps( h, _mm256_floor_ps( _mm256_div_ps( fy, h ) ) ) );
+            x0 = _mm256_min_ps( _mm256_max_ps( x0, zero ), _mm256_sub_ps( w, one ) );
+            y0 = _mm256_min_ps( _mm256_max_ps( y0, zero ), _mm256_sub_ps( h, one ) );
+            x1 = _mm256_add_ps( x0, one );
+            y1 = _mm256_add_ps( y0, one );
+            x1 = _mm256_andnot_ps( _mm256_cmp_ps( x1, w, _CMP_GE_OQ ), x1 );
+            y1 = _mm256_andnot_ps( _mm256_cmp_ps( y1, h, _CMP_GE_OQ ), y1 );
+        }
+        else
+        {
+            __m256 lastX = _mm256_sub_ps( w, one ), lastY = _mm256_sub_ps( h, one );
+            x0 = _mm256_min_ps( _mm256_max_ps( fx, zero ), lastX );
+            y0 = _mm256_min_ps( _mm256_max_ps( fy, zero ), lastY );
+            x1 = _mm256_min_ps( _mm256_max_ps( _mm256_add_ps( fx, one ), zero ), lastX );
+            y1 = _mm256_min_ps( _mm256_max_ps( _mm256_add_ps( fy, one ), zero ), lastY );
+        }
+
+        // Tile of 16 texels, then row and column in it
+        __m256i three = _mm256_set1_epi32( 3 );
+        __m256i column[2], row[2];
+        __m256 xs[2] = { x0, x1 }, ys[2] = { y0, y1 };
+        for ( int i = 0; i < 2; i++ )
+        {
+            __m256i cx = _mm256_cvttps_epi32( xs[i] ), cy = _mm256_cvttps_epi32( ys[i] );
+            column[i] = _mm256_add_epi32( _mm256_slli_epi32( _mm256_srli_epi32( cx, 2 ), 4 ), _mm256_and_si256( cx, three ) );
+            row[i] = _mm256_add_epi32( offset, _mm256_add_epi32( _mm256_slli_epi32( _mm256_mullo_epi32( _mm256_srli_epi32( cy, 2 ), tilesX ), 4 ),
+                                                                 _mm256_slli_epi32( _mm256_and_si256( cy, three ), 2 ) ) );
+        }
+        __m256i index[4] =
+        {
+            _mm256_add_epi32( row[0], column[0] ), _mm256_add_epi32( row[0], column[1] ),
+            _mm256_add_epi32( row[1], column[0] ), _mm256_add_epi32( row[1], column[1] )
+        };
+
+        if ( BLOCKS_NONE != this->blockFormat )
+        {
+            this->decodeLanes( index, active );
+        }
+
+        __m256 texel[4][4];
+        const int *base = ( const int * )&this->texels[0];
+        __m256i bytes = _mm256_set1_epi32( 0xFF );
+        for ( int i = 0; i < 4; i++ )
+        {
+            __m256i gathered = _mm256_mask_i32gather_epi32( _mm256_setzero_si256( ), base, index[i], active, 4 );
+            for ( int c = 0; c < 4; c++ )
+            {
+                texel[i][c] = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( gathered, 8 * c ), bytes ) );
+            }
+        }
+
+        for ( int c = 0; c < 4; c++ )
+        {
+            __m256 top = _mm256_add_ps( texel[0][c], _mm256_mul_ps( _mm256_sub_ps( texel[1][c], texel[0][c] ), ax ) );
+            __m256 bottom = _mm256_add_ps( texel[2][c], _mm256_mul_ps( _mm256_sub_ps( texel[3][c], texel[2][c] ), ax ) );
+            color[c] = _mm256_mul_ps( _mm256_add_ps( top, _mm256_mul_ps( _mm256_sub_ps( bottom, top ), ay ) ), _mm256_set1_ps( 1.0f / 255.0f ) );
+        }
+    }
+
+    // Makes sure the tiles the active lanes are about to gather from are decoded
+    void decodeLanes( const __m256i *index, __m256i active ) const
+    {
+        GLint mask = _mm256_movemask_ps( _mm256_castsi256_ps( active ) );
+        GLint lanes[SOFTWARE_LANES];
+
+        for ( int i = 0; i < 4; i++ )
+        {
+            _mm256_storeu_si256( ( __m256i * )lanes, _mm256_srli_epi32( index[i], 4 ) );
+            for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+            {
+                if ( mask & ( 1 << l ) )
+                {
+                    this->decodeTile( lanes[l] );
+                }
+            }
+        }
+    }
+#endif
+
+    // Reads a DDS of BC1 (DXT1), BC2 (DXT3) or BC3 (DXT5) blocks and the levels it has. False, and
+    // nothing printed, for anything else, which goes to SOIL_load_image instead
+    bool loadBlocks( const std::string &path )
+    {
+        int length = 0;
+        const unsigned char *file = SOIL_map_file( path.c_str( ), &length );
+        if ( NULL == file )
+        {
+            return false;
+        }
+
+        DDS_header header;
+        BlockFormat format = BLOCKS_NONE;
+        if ( length >= ( int )sizeof( DDS_header ) )
+        {
+            memcpy( &header, file, sizeof( DDS_header ) );
+            if ( 0x20534444 == header.dwMagic && ( header.sPixelFormat.dwFlags & DDPF_FOURCC ) && 0 == ( header.sCaps.dwCaps2 & DDSCAPS2_CUBEMAP ) &&
+                 header.dwWidth > 0 && header.dwHeight > 0 )
+            {
+                switch ( header.sPixelFormat.dwFourCC )
+                {
+                    case 0x31545844:    // "DXT1"
+                        format = BLOCKS_BC1;
+                        break;
+                    case 0x33545844:    // "DXT3"
+                        format = BLOCKS_BC2;
+                        break;
+                    case 0x35545844:    // "DXT5"
+                        format = BLOCKS_BC3;
+                        break;
+                }
+            }
+        }
+
+        bool loaded = false;
+        if ( BLOCKS_NONE != format )
+        {
+            this->Clear( );
+            this->blockFormat = format;
+            GLint count = ( header.dwFlags & DDSD_MIPMAPCOUNT ) && header.dwMipMapCount > 1 ? ( GLint )header.dwMipMapCount : 1;
+            this->layout( ( GLint )header.dwWidth, ( GLint )header.dwHeight, count );
+
+            const Level &last = this->levels.back( );
+            size_t size = last.blockOffset + ( size_t )last.tilesX * last.tilesY * ( BLOCKS_BC1 == format ? 8 : 16 );
+            if ( sizeof( DDS_header ) + size <= ( size_t )length )
+            {
+                this->blocks.assign( file + sizeof( DDS_header ), file + sizeof( DDS_header ) + size );
+                this->texels.assign( last.offset + last.tilesX * last.tilesY * 16, 0 );
+                std::vector< std::atomic<unsigned char> >( this->texels.size( ) / 16 ).swap( this->decoded );
+                loaded = true;
+            }
+            else
+            {
+                std::cout << "ERROR::SOFTWARE::TEXTURE_TRUNCATED " << path << std::endl;
+                this->Clear( );
+            }
+        }
+
+        SOIL_unmap_file( file, length );
+        return loaded;
+    }
+
+    // Decodes the block of a tile, numbered across all levels, into texels unless done already
+    void decodeTile( size_t tile ) const
+    {
+        if ( this->decoded[tile].load( std::memory_order_acquire ) )
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock( this->decoding );
+        if ( this->decoded[tile].load( std::memory_order_relaxed ) )
+        {
+            return;
+        }
+
+        size_t level = 0;
+        while ( level + 1 < this->levels.size( ) && ( size_t )this->levels[level + 1].offset <= tile * 16 )
+        {
+            level++;
+        }
+
+        GLint blockBytes = BLOCKS_BC1 == this->blockFormat ? 8 : 16;
+        const unsigned char *block = &this->blocks[this->levels[level].blockOffset + ( tile - this->levels[level].offset / 16 ) * blockBytes];
+        unsigned char rgba[16][4];
+
+        decodeColors( block + blockBytes - 8, BLOCKS_BC1 != this->blockFormat, rgba );
+        if ( BLOCKS_BC2 == this->blockFormat )
+        {
+            for ( int i = 0; i < 16; i++ )
+            {
+                rgba[i][3] = ( unsigned char )( ( ( block[i / 2] >> ( 4 * ( i & 1 ) ) ) & 0xF ) * 17 );
+            }
+        }
+        else if ( BLOCKS_BC3 == this->blockFormat )
+        {
+            decodeAlpha( block, rgba );
+        }
+
+        memcpy( &this->texels[tile * 16], rgba, sizeof( rgba ) );
+        this->decoded[tile].store( 1, std::memory_order_release );
+    }
+
+    // The colour half of a block: two RGB565 endpoints and 2 bits a texel. BC1 turns to three colours
+    // and transparent black when the first endpoint isn't the larger, BC2 and BC3 always have four
+    static void decodeColors( const unsigned char *block, bool fourColors, unsigned char rgba[16][4] )
+    {
+        GLuint endpoints[2] = { ( GLuint )( block[0] | block[1] << 8 ), ( GLuint )( block[2] | block[3] << 8 ) };
+        GLint palette[4][4];
+
+        for ( int e = 0; e < 2; e++ )
+        {
+            GLuint r = endpoints[e] >> 11, g = ( endpoints[e] >> 5 ) & 0x3F, b = endpoints[e] & 0x1F;
+            palette[e][0] = ( r << 3 ) | ( r >> 2 );
+            palette[e][1] = ( g << 2 ) | ( g >> 4 );
+            palette[e][2] = ( b << 3 ) | ( b >> 2 );
+            palette[e][3] = 255;
+        }
+        for ( int c = 0; c < 3; c++ )
+        {
+            if ( fourColors || endpoints[0] > endpoints[1] )
+            {
+                palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+                palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+            }
+            else
+            {
+                palette[2][c] = ( palette[0][c] + palette[1][c] ) / 2;
+                palette[3][c] = 0;
+            }
+        }
+        palette[2][3] = 255;
+        palette[3][3] = fourColors || endpoints[0] > endpoints[1] ? 255 : 0;
+
+        GLuint indices = block[4] | block[5] << 8 | block[6] << 16 | ( GLuint )block[7] << 24;
+        for ( int i = 0; i < 16; i++ )
+        {
+            const GLint *color = palette[( indices >> ( 2 * i ) ) & 3];
+            for ( int c = 0; c < 4; c++ )
+            {
+                rgba[i][c] = ( unsigned char )color[c];
+            }
+        }
+    }
+
+    // The alpha half of a BC3 block: two endpoints and 3 bits a texel, eight levels between them, or
+    // six plus 0 and 255 when the first endpoint isn't the larger
+    static void decodeAlpha( const unsigned char *block, unsigned char rgba[16][4] )
+    {
+        GLint alpha[8] = { block[0], block[1] };
+        for ( int i = 2; i < 8; i++ )
+        {
+            alpha[i] = block[0] > block[1] ? ( ( 8 - i ) * block[0] + ( i - 1 ) * block[1] ) / 7 :
+                       i < 6 ? ( ( 6 - i ) * block[0] + ( i - 1 ) * block[1] ) / 5 : 6 == i ? 0 : 255;
+        }
+
+        unsigned long long indices = 0;
+        for ( int b = 7; b >= 2; b-- )
+        {
+            indices = indices << 8 | block[b];
+        }
+        for ( int i = 0; i < 16; i++ )
+        {
+            rgba[i][3] = ( unsigned char )alpha[( indices >> ( 3 * i ) ) & 7];
+        }
+    }
+};
+
+// Six faces in +X, -X, +Y, -Y, +Z, -Z order, sampled by direction like a samplerCube (level 0 only)
+class SoftwareCubeMap
+{
+public:
+    bool Load( const std::vector<std::string> &faces )
+    {
+        bool loaded = true;
+
+        for ( size_t i = 0; i < 6 && i < faces.size( ); i++ )
+        {
+            loaded = this->faces[i].Load( faces[i] ) && loaded;
+        }
+
+        return loaded;
+    }
+
+    SoftwareTexture &Face( int face )
+    {
+        return this->faces[face];
+    }
+
+    // Face and coordinates from the major axis, as in table 8.18 of the GL 3.3 specification
+    glm::vec4 Sample( const glm::vec3 &direction ) const
+    {
+        glm::vec3 a( std::fabs( direction.x ), std::fabs( direction.y ), std::fabs( direction.z ) );
+        int face;
+        GLfloat sc, tc, ma;
+
+        if ( a.x >= a.y && a.x >= a.z )
+        {
+            face = direction.x >= 0.0f ? 0 : 1;
+            sc = direction.x >= 0.0f ? -direction.z : direction.z;
+            tc = -direction.y;
+            ma = a.x;
+        }
+        else if ( a.y >= a.z )
+        {
+            face = direction.y >= 0.0f ? 2 : 3;
+            sc = direction.x;
+            tc = direction.y >= 0.0f ? direction.z : -direction.z;
+            ma = a.y;
+        }
+        else
+        {
+            face = direction.z >= 0.0f ? 4 : 5;
+            sc = direction.z >= 0.0f ? direction.x : -direction.x;
+            tc = -direction.y;
+            ma = a.z;
+        }
+
+        // A face that didn't load leaves the cubemap incomplete, which samples as black
+        if ( 0.0f == ma || !this->faces[face].IsValid( ) )
+        {
+            return glm::vec4( 0.0f, 0.0f, 0.0f, 1.0f );
+        }
+
+        return this->faces[face].SampleClamped( 0.5f * ( sc / ma + 1.0f ), 0.5f * ( tc / ma + 1.0f ) );
+    }
+
+    // Sample( ) of a span's directions by lane, each face gathered for the lanes that land on it.
+    // Lanes outside mask come back 0
+    void Sample( const GLfloat *x, const GLfloat *y, const GLfloat *z, GLint mask, GLfloat texel[4][SOFTWARE_LANES] ) const
+    {
+        GLfloat s[SOFTWARE_LANES], t[SOFTWARE_LANES];
+        GLint face[SOFTWARE_LANES];
+
+#ifdef SOFTWARE_AVX2
+        __m256 dx = _mm256_loadu_ps( x ), dy = _mm256_loadu_ps( y ), dz = _mm256_loadu_ps( z ), zero = _mm256_setzero_ps( );
+        __m256 sign = _mm256_set1_ps( -0.0f );
+        __m256 ax = _mm256_andnot_ps( sign, dx ), ay = _mm256_andnot_ps( sign, dy ), az = _mm256_andnot_ps( sign, dz );
+        __m256 xMajor = _mm256_and_ps( _mm256_cmp_ps( ax, ay, _CMP_GE_OQ ), _mm256_cmp_ps( ax, az, _CMP_GE_OQ ) );
+        __m256 yMajor = _mm256_andnot_ps( xMajor, _mm256_cmp_ps( ay, az, _CMP_GE_OQ ) );
+        __m256 xPositive = _mm256_cmp_ps( dx, zero, _CMP_GE_OQ );
+        __m256 yPositive = _mm256_cmp_ps( dy, zero, _CMP_GE_OQ );
+        __m256 zPositive = _mm256_cmp_ps( dz, zero, _CMP_GE_OQ );
+        __m256 minusX = _mm256_xor_ps( dx, sign ), minusY = _mm256_xor_ps( dy, sign ), minusZ = _mm256_xor_ps( dz, sign );
+
+        // The z major case first, the x and y ones blended over it
+        __m256 sc = _mm256_blendv_ps( minusX, dx, zPositive ), tc = minusY, ma = az;
+        __m256 faces = _mm256_blendv_ps( _mm256_set1_ps( 5.0f ), _mm256_set1_ps( 4.0f ), zPositive );
+        sc = _mm256_blendv_ps( sc, dx, yMajor );
+        tc = _mm256_blendv_ps( tc, _mm256_blendv_ps( minusZ, dz, yPositive ), yMajor );
+        ma = _mm256_blendv_ps( ma, ay, yMajor );
+        faces = _mm256_blendv_ps( faces, _mm256_blendv_ps( _mm256_set1_ps( 3.0f ), _mm256_set1_ps( 2.0f ), yPositive ), yMajor );
+        sc = _mm256_blendv_ps( sc, _mm256_blendv_ps( dz, minusZ, xPositive ), xMajor );
+        tc = _mm256_blendv_ps( tc, minusY, xMajor );
+        ma = _mm256_blendv_ps( ma, ax, xMajor );
+        faces = _mm256_blendv_ps( faces, _mm256_blendv_ps( _mm256_set1_ps( 1.0f ), _mm256_set1_ps( 0.0f ), xPositive ), xMajor );
+
+        __m256 half = _mm256_set1_ps( 0.5f ), one = _mm256_set1_ps( 1.0f );
+        _mm256_storeu_ps( s, _mm256_mul_ps( half, _mm256_add_ps( _mm256_div_ps( sc, ma ), one ) ) );
+        _mm256_storeu_ps( t, _mm256_mul_ps( half, _mm256_add_ps( _mm256_div_ps( tc, ma ), one ) ) );
+
+        // Lanes without a major axis get face 6, which doesn't exist and samples black
+        faces = _mm256_blendv_ps( faces, _mm256_set1_ps( 6.0f ), _mm256_cmp_ps( ma, zero, _CMP_EQ_OQ ) );
+        _mm256_storeu_si256( ( __m256i * )face, _mm256_cvttps_epi32( faces ) );
+#else
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            GLfloat ax = std::fabs( x[l] ), ay = std::fabs( y[l] ), az = std::fabs( z[l] ), sc, tc, ma;
+            if ( ax >= ay && ax >= az )
+            {
+                face[l] = x[l] >= 0.0f ? 0 : 1;
+                sc = x[l] >= 0.0f ? -z[l] : z[l];
+                tc = -y[l];
+                ma = ax;
+            }
+            else if ( ay >= az )
+            {
+                face[l] = y[l] >= 0.0f ? 2 : 3;
+                sc = x[l];
+                tc = y[l] >= 0.0f ? z[l] : -z[l];
+                ma = ay;
+            }
+            else
+            {
+                face[l] = z[l] >= 0.0f ? 4 : 5;
+                sc = z[l] >= 0.0f ? x[l] : -x[l];
+                tc = -y[l];
+                ma = az;
+            }
+            face[l] = 0.0f == ma ? 6 : face[l];
+            s[l] = 0.5f * ( sc / ma + 1.0f );
+            t[l] = 0.5f * ( tc / ma + 1.0f );
+        }
+#endif
+
+        // Black for missing faces, as Sample( ), and 0 outside mask
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            texel[0][l] = texel[1][l] = texel[2][l] = 0.0f;
+            texel[3][l] = ( mask & ( 1 << l ) ) ? 1.0f : 0.0f;
+        }
+
+        for ( int f = 0; f < 6; f++ )
+        {
+            GLint lanes = 0;
+            for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+            {
+                lanes |= ( f == face[l] ) << l;
+            }
+            lanes &= mask;
+            if ( 0 != lanes && this->faces[f].IsValid( ) )
+            {
+                this->faces[f].SampleClamped( s, t, lanes, texel );
+            }
+        }
+    }
+
+private:
+    SoftwareTexture faces[6];
+};
+
+// A triangle after clipping and viewport transform. Edge i is edgeA * X + edgeB * Y + edgeC at a pixel
+// centre (X, Y) in 1/16 pixels, exact in 64 bits and biased so a pixel is covered when all three are
+// >= 0. Whatever is interpolated is a plane anchored at the first vertex
+struct SoftwarePlane
+{
+    GLfloat origin;     // value at the first vertex
+    GLfloat dx, dy;     // change per pixel
+};
+
+struct SoftwareTriangle
+{
+    long long edgeA[3], edgeB[3], edgeC[3];
+    bool wide;                              // edges change too much across a block to step them in 32 bits
+    GLdouble x0, y0;                        // first vertex in pixels
+    SoftwarePlane depth;                    // window depth
+    SoftwarePlane q;                        // 1 / w
+    SoftwarePlane varyings[SOFTWARE_MAX_VARYINGS];  // divided by w
+    GLint minX, minY, maxX, maxY;           // pixel bounds, inclusive
+};
+
+// A span of SOFTWARE_LANES fragments of one row, shaded together in structure of arrays layout:
+// the perspective-correct varyings at the pixel centres, and their exact screen-space derivatives on
+// request, as dFdx / dFdy. Lanes outside mask are off the triangle or failed the depth test, their
+// values needn't be finite and nothing they shade is written
+class SoftwareFragments
+{
+public:
+    GLfloat varyings[SOFTWARE_MAX_VARYINGS][SOFTWARE_LANES];
+    GLfloat x[SOFTWARE_LANES];      // window coordinates of the pixel centres
+    GLfloat y[SOFTWARE_LANES];
+    GLfloat depth[SOFTWARE_LANES];
+    GLint mask;                     // bit per lane that gets written
+
+    bool IsActive( GLint lane ) const
+    {
+        return 0 != ( this->mask & ( 1 << lane ) );
+    }
+
+    void Derivatives( GLint varying, GLfloat *dx, GLfloat *dy ) const
+    {
+        // d( A / Q ) = ( dA - A / Q dQ ) / Q, A and Q planes
+        const SoftwarePlane &a = this->triangle->varyings[varying];
+        const SoftwarePlane &q = this->triangle->q;
+
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            dx[l] = ( a.dx - this->varyings[varying][l] * q.dx ) * this->w[l];
+            dy[l] = ( a.dy - this->varyings[varying][l] * q.dy ) * this->w[l];
+        }
+    }
+
+private:
+    friend class SoftwareRenderer;
+
+    const SoftwareTriangle *triangle;
+    GLfloat w[SOFTWARE_LANES];
+};
+
+// A GPU-free implementation of the part of the GL pipeline the scenes use, for servers without a
+// GPU and for reference images. Draw( ) runs a program's vertex stage, clips against the near and
+// far planes, snaps to the viewport and sorts the triangles into SOFTWARE_TILE_SIZE tiles, then the
+// tiles are rasterized on SOIL_parallel_for's threads. In a tile each triangle is walked in 8x8 blocks:
+// a block that one edge misses is skipped, edges that hold the whole block aren't tested in it, and
+// the rest are evaluated over the block's rows of 8 pixels with AVX2, as are the early depth test
+// (GL_LESS), the perspective-correct varyings and the optional SRC_ALPHA, ONE_MINUS_SRC_ALPHA blend.
+// The program shades each row's 8 fragments in one call. Every tile takes the triangles in draw order,
+// so the image is the same whatever the thread count.
+// The colour buffer is RGBA8 and the depth buffer float, bottom row first as in GL.
+// A program is a class with
+//     static const GLint VARYINGS;
+//     void Vertex( const GLfloat *attributes, glm::vec4 &position, GLfloat *varyings ) const;
+//     void Fragments( const SoftwareFragments &fragments, GLfloat color[4][SOFTWARE_LANES] ) const;
+class SoftwareRenderer
+{
+public:
+    SoftwareRenderer( GLint width, GLint height )
+    {
+        this->width = width;
+        this->height = height;
+        this->tilesX = ( width + SOFTWARE_TILE_SIZE - 1 ) / SOFTWARE_TILE_SIZE;
+        this->tilesY = ( height + SOFTWARE_TILE_SIZE - 1 ) / SOFTWARE_TILE_SIZE;
+        this->color.assign( ( size_t )width * height * 4, 0 );
+        this->depth.assign( ( size_t )width * height, 1.0f );
+        this->bins.resize( this->tilesX * this->tilesY );
+        this->depthTest = true;
+        this->depthMask = true;
+        this->blend = false;
+    }
+
+    ~SoftwareRenderer( )
+    {
+        this->Clear( );
+    }
+
+    // glClear of the colour and depth buffers
+    void ClearBuffers( const glm::vec4 &clearColor )
+    {
+        unsigned char rgba[4];
+        for ( int c = 0; c < 4; c++ )
+        {
+            rgba[c] = toByte( clearColor[c] );
+        }
+        for ( size_t p = 0; p < this->depth.size( ); p++ )
+        {
+            memcpy( &this->color[p * 4], rgba, 4 );
+        }
+        std::fill( this->depth.begin( ), this->depth.end( ), 1.0f );
+    }
+
+    void SetDepthTest( bool enabled )
+    {
+        this->depthTest = enabled;
+    }
+
+    void SetDepthMask( bool enabled )
+    {
+        this->depthMask = enabled;
+    }
+
+    void SetBlend( bool enabled )
+    {
+        this->blend = enabled;
+    }
+
+    // glDrawArrays( GL_TRIANGLES ) of count vertices, stride floats apart
+    template <class Program>
+    void Draw( const Program &program, const GLfloat *vertices, GLint stride, GLsizei count )
+    {
+        count -= count % 3;
+        if ( count <= 0 )
+        {
+            return;
+        }
+
+        // Vertex stage
+        this->transformed.resize( count );
+        VertexJob<Program> vertexJob = { &program, vertices, stride, &this->transformed[0] };
+        SOIL_parallel_for( count, SOFTWARE_VERTICES_PER_THREAD, runVertices<Program>, &vertexJob );
+
+        // Clipping, setup and binning
+        this->triangles.clear( );
+        for ( size_t t = 0; t < this->bins.size( ); t++ )
+        {
+            this->bins[t].clear( );
+        }
+        for ( GLsizei v = 0; v < count; v += 3 )
+        {
+            this->clipTriangle( &this->transformed[v], Program::VARYINGS );
+        }
+        if ( this->triangles.empty( ) )
+        {
+            return;
+        }
+        for ( size_t t = 0; t < this->triangles.size( ); t++ )
+        {
+            const SoftwareTriangle &triangle = this->triangles[t];
+            for ( GLint ty = triangle.minY / SOFTWARE_TILE_SIZE; ty <= triangle.maxY / SOFTWARE_TILE_SIZE; ty++ )
+            {
+                for ( GLint tx = triangle.minX / SOFTWARE_TILE_SIZE; tx <= triangle.maxX / SOFTWARE_TILE_SIZE; tx++ )
+                {
+                    this->bins[ty * this->tilesX + tx].push_back( ( GLint )t );
+                }
+            }
+        }
+
+        // Rasterization, a tile per task
+        TileJob<Program> tileJob = { this, &program };
+        SOIL_parallel_for( this->tilesX * this->tilesY, 1, runTiles<Program>, &tileJob );
+    }
+
+    GLint GetWidth( ) const
+    {
+        return this->width;
+    }
+
+    GLint GetHeight( ) const
+    {
+        return this->height;
+    }
+
+    // RGBA8, bottom row first
+    const unsigned char *GetPixels( ) const
+    {
+        return &this->color[0];
+    }
+
+    // Writes the colour buffer top row first with SOIL_save_image, the type from the extension
+    // (.bmp, .tga or .dds, anything else is PNG)
+    bool Save( const std::string &path ) const
+    {
+        std::vector<unsigned char> flipped( this->color.size( ) );
+        size_t row = ( size_t )this->width * 4;
+        for ( GLint y = 0; y < this->height; y++ )
+        {
+            memcpy( &flipped[( this->height - 1 - y ) * row], &this->color[y * row], row );
+        }
+
+        std::string extension = path.substr( std::min( path.size( ), path.rfind( '.' ) ) );
+        std::transform( extension.begin( ), extension.end( ), extension.begin( ), ::tolower );
+        int type = ".bmp" == extension ? SOIL_SAVE_TYPE_BMP : ".tga" == extension ? SOIL_SAVE_TYPE_TGA :
+                   ".dds" == extension ? SOIL_SAVE_TYPE_DDS : SOIL_SAVE_TYPE_PNG;
+
+        if ( !SOIL_save_image( path.c_str( ), type, this->width, this->height, 4, &flipped[0] ) )
+        {
+            std::cout << "ERROR::SOFTWARE::SAVE_FAILED " << path << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void Clear( )
+    {
+        std::vector<unsigned char>( ).swap( this->color );
+        std::vector<GLfloat>( ).swap( this->depth );
+        std::vector<SoftwareTriangle>( ).swap( this->triangles );
+        std::vector<ClipVertex>( ).swap( this->transformed );
+        std::vector< std::vector<GLint> >( ).swap( this->bins );
+    }
+
+private:
+    struct ClipVertex
+    {
+        glm::vec4 position;
+        GLfloat varyings[SOFTWARE_MAX_VARYINGS];
+    };
+
+    template <class Program>
+    struct VertexJob
+    {
+        const Program *program;
+        const GLfloat *vertices;
+        GLint stride;
+        ClipVertex *out;
+    };
+
+    template <class Program>
+    struct TileJob
+    {
+        SoftwareRenderer *renderer;
+        const Program *program;
+    };
+
+    GLint width, height;
+    GLint tilesX, tilesY;
+    std::vector<unsigned char> color;
+    std::vector<GLfloat> depth;
+    bool depthTest;
+    bool depthMask;
+    bool blend;
+
+    // Per draw, kept so their memory is reused
+    std::vector<ClipVertex> transformed;
+    std::vector<SoftwareTriangle> triangles;
+    std::vector< std::vector<GLint> > bins;     // triangle indices per tile, in draw order
+
+    static unsigned char toByte( GLfloat value )
+    {
+        return ( unsigned char )( std::min( std::max( value, 0.0f ), 1.0f ) * 255.0f + 0.5f );
+    }
+
+    template <class Program>
+    static void runVertices( void *context, int begin, int end )
+    {
+        VertexJob<Program> *job = ( VertexJob<Program> * )context;
+
+        for ( int v = begin; v < end; v++ )
+        {
+            job->program->Vertex( job->vertices + ( size_t )v * job->stride, job->out[v].position, job->out[v].varyings );
+        }
+    }
+
+    template <class Program>
+    static void runTiles( void *context, int begin, int end )
+    {
+        TileJob<Program> *job = ( TileJob<Program> * )context;
+
+        for ( int tile = begin; tile < end; tile++ )
+        {
+            job->renderer->rasterizeTile( *job->program, tile );
+        }
+    }
+
+    // Sutherland-Hodgman against z >= -w and z <= w, the polygon left is cut into a fan. x and y
+    // aren't clipped, the pixel bounds keep the rasterizer on screen
+    void clipTriangle( const ClipVertex *corners, GLint varyings )
+    {
+        ClipVertex buffers[2][5];
+        GLint count = 3;
+        for ( int i = 0; i < 3; i++ )
+        {
+            buffers[0][i] = corners[i];
+        }
+
+        int current = 0;
+        for ( int plane = 0; plane < 2; plane++ )
+        {
+            const ClipVertex *in = buffers[current];
+            ClipVertex *out = buffers[1 - current];
+            GLint outCount = 0;
+
+            for ( GLint i = 0; i < count; i++ )
+            {
+                const ClipVertex &a = in[i];
+                const ClipVertex &b = in[( i + 1 ) % count];
+                GLfloat da = 0 == plane ? a.position.z + a.position.w : a.position.w - a.position.z;
+                GLfloat db = 0 == plane ? b.position.z + b.position.w : b.position.w - b.position.z;
+
+                if ( da >= 0.0f )
+                {
+                    out[outCount++] = a;
+                }
+                if ( ( da >= 0.0f ) != ( db >= 0.0f ) )
+                {
+                    GLfloat t = da / ( da - db );
+                    ClipVertex &v = out[outCount++];
+                    v.position = a.position + ( b.position - a.position ) * t;
+                    for ( GLint k = 0; k < varyings; k++ )
+                    {
+                        v.varyings[k] = a.varyings[k] + ( b.varyings[k] - a.varyings[k] ) * t;
+                    }
+                }
+            }
+
+            count = outCount;
+            current = 1 - current;
+            if ( count < 3 )
+            {
+                return;
+            }
+        }
+
+        for ( GLint i = 1; i + 1 < count; i++ )
+        {
+            this->setupTriangle( buffers[current][0], buffers[current][i], buffers[current][i + 1], varyings );
+        }
+    }
+
+    void setupTriangle( const ClipVertex &v0, const ClipVertex &v1, const ClipVertex &v2, GLint varyings )
+    {
+        const ClipVertex *v[3] = { &v0, &v1, &v2 };
+        SoftwareTriangle t;
+        long long x[3], y[3];
+        GLdouble depth[3], q[3];
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            // A vertex on the eye plane was cut away by the near plane, unless near is 0
+            GLfloat w = v[i]->position.w;
+            if ( w <= 0.0f )
+            {
+                return;
+            }
+
+            q[i] = 1.0 / w;
+            GLdouble fx = std::floor( ( v[i]->position.x * q[i] * 0.5 + 0.5 ) * this->width * SOFTWARE_SUBPIXELS + 0.5 );
+            GLdouble fy = std::floor( ( v[i]->position.y * q[i] * 0.5 + 0.5 ) * this->height * SOFTWARE_SUBPIXELS + 0.5 );
+
+            // Beyond the guard band the edge functions could overflow, only a vertex a hair's breadth
+            // past the near plane gets so far
+            if ( !( std::fabs( fx ) < SOFTWARE_GUARD_BAND && std::fabs( fy ) < SOFTWARE_GUARD_BAND ) )
+            {
+                return;
+            }
+
+            x[i] = ( long long )fx;
+            y[i] = ( long long )fy;
+            depth[i] = v[i]->position.z * q[i] * 0.5 + 0.5;
+        }
+
+        long long area = ( x[1] - x[0] ) * ( y[2] - y[0] ) - ( x[2] - x[0] ) * ( y[1] - y[0] );
+        if ( 0 == area )
+        {
+            return;
+        }
+
+        long long sign = area > 0 ? 1 : -1;
+        GLdouble a[3], b[3];
+        t.wide = false;
+        for ( int i = 0; i < 3; i++ )
+        {
+            int j = ( i + 1 ) % 3, k = ( i + 2 ) % 3;
+
+            // Edge j -> k, equal to area at corner i whichever way the triangle winds
+            t.edgeA[i] = -( y[k] - y[j] ) * sign;
+            t.edgeB[i] = ( x[k] - x[j] ) * sign;
+            t.edgeC[i] = ( ( y[k] - y[j] ) * x[j] - ( x[k] - x[j] ) * y[j] ) * sign;
+
+            // Of two triangles sharing an edge, only the one on its left or lower side covers centres on it
+            bool inclusive = t.edgeA[i] > 0 || ( 0 == t.edgeA[i] && t.edgeB[i] > 0 );
+            if ( !inclusive )
+            {
+                t.edgeC[i] -= 1;
+            }
+
+            // Barycentric gradients per pixel
+            a[i] = ( GLdouble )t.edgeA[i] * SOFTWARE_SUBPIXELS / ( GLdouble )( area * sign );
+            b[i] = ( GLdouble )t.edgeB[i] * SOFTWARE_SUBPIXELS / ( GLdouble )( area * sign );
+
+            long long span = ( std::llabs( t.edgeA[i] ) + std::llabs( t.edgeB[i] ) ) * ( SOFTWARE_BLOCK_SIZE - 1 ) * SOFTWARE_SUBPIXELS;
+            t.wide = t.wide || span >= 0x7FFFFFFF;
+        }
+
+        t.x0 = ( GLdouble )x[0] / SOFTWARE_SUBPIXELS;
+        t.y0 = ( GLdouble )y[0] / SOFTWARE_SUBPIXELS;
+        setPlane( t.depth, depth[0], depth[1], depth[2], a, b );
+        setPlane( t.q, q[0], q[1], q[2], a, b );
+        for ( GLint k = 0; k < varyings; k++ )
+        {
+            setPlane( t.varyings[k], v0.varyings[k] * q[0], v1.varyings[k] * q[1], v2.varyings[k] * q[2], a, b );
+        }
+
+        // Pixel centres at + 0.5 inside the bounds
+        GLdouble half = SOFTWARE_SUBPIXELS / 2;
+        t.minX = ( GLint )std::max( std::ceil( ( std::min( x[0], std::min( x[1], x[2] ) ) - half ) / SOFTWARE_SUBPIXELS ), 0.0 );
+        t.minY = ( GLint )std::max( std::ceil( ( std::min( y[0], std::min( y[1], y[2] ) ) - half ) / SOFTWARE_SUBPIXELS ), 0.0 );
+        t.maxX = ( GLint )std::min( std::floor( ( std::max( x[0], std::max( x[1], x[2] ) ) - half ) / SOFTWARE_SUBPIXELS ), this->width - 1.0 );
+        t.maxY = ( GLint )std::min( std::floor( ( std::max( y[0], std::max( y[1], y[2] ) ) - half ) / SOFTWARE_SUBPIXELS ), this->height - 1.0 );
+        if ( t.minX > t.maxX || t.minY > t.maxY )
+        {
+            return;
+        }
+
+        this->triangles.push_back( t );
+    }
+
+    static void setPlane( SoftwarePlane &plane, GLdouble f0, GLdouble f1, GLdouble f2, const GLdouble *a, const GLdouble *b )
+    {
+        plane.origin = ( GLfloat )f0;
+        plane.dx = ( GLfloat )( ( f1 - f0 ) * a[1] + ( f2 - f0 ) * a[2] );
+        plane.dy = ( GLfloat )( ( f1 - f0 ) * b[1] + ( f2 - f0 ) * b[2] );
+    }
+
+    template <class Program>
+    void rasterizeTile( const Program &program, GLint tile )
+    {
+        const std::vector<GLint> &bin = this->bins[tile];
+        GLint tileX = ( tile % this->tilesX ) * SOFTWARE_TILE_SIZE;
+        GLint tileY = ( tile / this->tilesX ) * SOFTWARE_TILE_SIZE;
+        const long long blockStep = ( SOFTWARE_BLOCK_SIZE - 1 ) * SOFTWARE_SUBPIXELS;
+        SoftwareFragments fragments;
+
+        for ( size_t n = 0; n < bin.size( ); n++ )
+        {
+            const SoftwareTriangle &t = this->triangles[bin[n]];
+            GLint minX = std::max( t.minX, tileX ), maxX = std::min( t.maxX, tileX + SOFTWARE_TILE_SIZE - 1 );
+            GLint minY = std::max( t.minY, tileY ), maxY = std::min( t.maxY, tileY + SOFTWARE_TILE_SIZE - 1 );
+            fragments.triangle = &t;
+
+            for ( GLint blockY = tileY + ( ( minY - tileY ) & ~( SOFTWARE_BLOCK_SIZE - 1 ) ); blockY <= maxY; blockY += SOFTWARE_BLOCK_SIZE )
+            {
+                for ( GLint blockX = tileX + ( ( minX - tileX ) & ~( SOFTWARE_BLOCK_SIZE - 1 ) ); blockX <= maxX; blockX += SOFTWARE_BLOCK_SIZE )
+                {
+                    // Each edge at the block's corner pixels: one that is negative at all four rejects the
+                    // block, one that is positive at all four needs no testing inside it
+                    long long start[3];
+                    GLint partial = 0;
+                    bool rejected = false;
+                    for ( int i = 0; i < 3 && !rejected; i++ )
+                    {
+                        start[i] = t.edgeA[i] * ( blockX * SOFTWARE_SUBPIXELS + SOFTWARE_SUBPIXELS / 2 ) +
+                                   t.edgeB[i] * ( blockY * SOFTWARE_SUBPIXELS + SOFTWARE_SUBPIXELS / 2 ) + t.edgeC[i];
+                        long long stepX = t.edgeA[i] * blockStep, stepY = t.edgeB[i] * blockStep;
+                        long long lowest = start[i] + std::min( stepX, 0LL ) + std::min( stepY, 0LL );
+                        long long highest = start[i] + std::max( stepX, 0LL ) + std::max( stepY, 0LL );
+
+                        rejected = highest < 0;
+                        if ( lowest < 0 )
+                        {
+                            partial |= 1 << i;
+                        }
+                    }
+                    if ( rejected )
+                    {
+                        continue;
+                    }
+
+                    // Lanes inside the bounds, which also keeps them on screen
+                    GLint lanes = 0;
+                    for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+                    {
+                        lanes |= ( blockX + l >= minX && blockX + l <= maxX ) << l;
+                    }
+
+                    GLint firstRow = std::max( blockY, minY ), lastRow = std::min( blockY + SOFTWARE_BLOCK_SIZE - 1, maxY );
+                    for ( GLint row = firstRow; row <= lastRow; row++ )
+                    {
+                        GLint mask = lanes;
+                        if ( 0 != partial )
+                        {
+                            mask &= cover( t, partial, start, row - blockY );
+                        }
+                        if ( 0 != mask )
+                        {
+                            this->shadeSpan( program, fragments, blockX, row, mask );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Lanes of a block's row that the partial edges cover, start holds the edges at the block's first pixel
+    static GLint cover( const SoftwareTriangle &t, GLint partial, const long long *start, GLint row )
+    {
+        GLint mask = ( 1 << SOFTWARE_LANES ) - 1;
+
+#ifdef SOFTWARE_AVX2
+        if ( !t.wide )
+        {
+            // Inside a block that an edge crosses it stays within 32 bits
+            const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+            for ( int i = 0; i < 3; i++ )
+            {
+                if ( partial & ( 1 << i ) )
+                {
+                    GLint first = ( GLint )( start[i] + t.edgeB[i] * row * SOFTWARE_SUBPIXELS );
+                    __m256i step = _mm256_set1_epi32( ( GLint )( t.edgeA[i] * SOFTWARE_SUBPIXELS ) );
+                    __m256i edge = _mm256_add_epi32( _mm256_set1_epi32( first ), _mm256_mullo_epi32( step, lane ) );
+                    mask &= ~_mm256_movemask_ps( _mm256_castsi256_ps( edge ) );
+                }
+            }
+
+            return mask;
+        }
+#endif
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            if ( partial & ( 1 << i ) )
+            {
+                long long edge = start[i] + t.edgeB[i] * row * SOFTWARE_SUBPIXELS;
+                for ( GLint l = 0; l < SOFTWARE_LANES; l++, edge += t.edgeA[i] * SOFTWARE_SUBPIXELS )
+                {
+                    if ( edge < 0 )
+                    {
+                        mask &= ~( 1 << l );
+                    }
+                }
+            }
+        }
+
+        return mask;
+    }
+
+    // Depth test, interpolation, shading and output of up to 8 pixels of a row from x on
+    template <class Program>
+    void shadeSpan( const Program &program, SoftwareFragments &fragments, GLint x, GLint y, GLint mask )
+    {
+        const SoftwareTriangle &t = *fragments.triangle;
+        size_t pixel = ( size_t )y * this->width + x;
+        GLdouble cx = x + 0.5 - t.x0, cy = y + 0.5 - t.y0;
+        GLfloat color[4][SOFTWARE_LANES];
+
+#ifdef SOFTWARE_AVX2
+        const __m256 lane = _mm256_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f );
+        const __m256i laneBits = _mm256_setr_epi32( 1, 2, 4, 8, 16, 32, 64, 128 );
+
+        // Early depth test
+        __m256 z = planeLanes( t.depth, cx, cy, lane );
+        __m256i write = _mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( mask ), laneBits ), laneBits );
+        if ( this->depthTest )
+        {
+            __m256 stored = _mm256_maskload_ps( &this->depth[pixel], write );
+            write = _mm256_and_si256( write, _mm256_castps_si256( _mm256_cmp_ps( z, stored, _CMP_LT_OQ ) ) );
+            mask = _mm256_movemask_ps( _mm256_castsi256_ps( write ) );
+            if ( 0 == mask )
+            {
+                return;
+            }
+        }
+
+        // Perspective-correct varyings
+        __m256 w = _mm256_div_ps( _mm256_set1_ps( 1.0f ), planeLanes( t.q, cx, cy, lane ) );
+        _mm256_storeu_ps( fragments.w, w );
+        _mm256_storeu_ps( fragments.depth, z );
+        _mm256_storeu_ps( fragments.x, _mm256_add_ps( _mm256_set1_ps( x + 0.5f ), lane ) );
+        _mm256_storeu_ps( fragments.y, _mm256_set1_ps( y + 0.5f ) );
+        for ( GLint k = 0; k < Program::VARYINGS; k++ )
+        {
+            _mm256_storeu_ps( fragments.varyings[k], _mm256_mul_ps( planeLanes( t.varyings[k], cx, cy, lane ), w ) );
+        }
+        fragments.mask = mask;
+
+        program.Fragments( fragments, color );
+
+        // Pack to RGBA8, blended over what is there
+        __m256 zero = _mm256_setzero_ps( ), one = _mm256_set1_ps( 1.0f );
+        __m256i *target = ( __m256i * )&this->color[pixel * 4];
+        __m256i packed = _mm256_setzero_si256( );
+        __m256i destination = _mm256_setzero_si256( );
+        __m256 alpha = _mm256_min_ps( _mm256_max_ps( _mm256_loadu_ps( color[3] ), zero ), one );
+        if ( this->blend )
+        {
+            destination = _mm256_maskload_epi32( ( const int * )target, write );
+        }
+        for ( int c = 0; c < 4; c++ )
+        {
+            __m256 value = _mm256_loadu_ps( color[c] );
+            if ( this->blend )
+            {
+                __m256i channel = _mm256_and_si256( _mm256_srli_epi32( destination, 8 * c ), _mm256_set1_epi32( 0xFF ) );
+                __m256 existing = _mm256_mul_ps( _mm256_cvtepi32_ps( channel ), _mm256_set1_ps( 1.0f / 255.0f ) );
+                value = _mm256_add_ps( _mm256_mul_ps( value, alpha ), _mm256_mul_ps( existing, _mm256_sub_ps( one, alpha ) ) );
+            }
+            value = _mm256_min_ps( _mm256_max_ps( value, zero ), one );
+            __m256i bytes = _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( value, _mm256_set1_ps( 255.0f ) ), _mm256_set1_ps( 0.5f ) ) );
+            packed = _mm256_or_si256( packed, _mm256_slli_epi32( bytes, 8 * c ) );
+        }
+        _mm256_maskstore_epi32( ( int * )target, write, packed );
+
+        if ( this->depthTest && this->depthMask )
+        {
+            _mm256_maskstore_ps( &this->depth[pixel], write, z );
+        }
+#else
+        GLfloat z[SOFTWARE_LANES];
+        planeLanes( t.depth, cx, cy, z );
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            if ( this->depthTest && ( mask & ( 1 << l ) ) && !( z[l] < this->depth[pixel + l] ) )
+            {
+                mask &= ~( 1 << l );
+            }
+        }
+        if ( 0 == mask )
+        {
+            return;
+        }
+
+        planeLanes( t.q, cx, cy, fragments.w );
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            fragments.w[l] = 1.0f / fragments.w[l];
+            fragments.depth[l] = z[l];
+            fragments.x[l] = x + l + 0.5f;
+            fragments.y[l] = y + 0.5f;
+        }
+        for ( GLint k = 0; k < Program::VARYINGS; k++ )
+        {
+            planeLanes( t.varyings[k], cx, cy, fragments.varyings[k] );
+            for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+            {
+                fragments.varyings[k][l] *= fragments.w[l];
+            }
+        }
+        fragments.mask = mask;
+
+        program.Fragments( fragments, color );
+
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            if ( 0 == ( mask & ( 1 << l ) ) )
+            {
+                continue;
+            }
+
+            unsigned char *target = &this->color[( pixel + l ) * 4];
+            GLfloat alpha = std::min( std::max( color[3][l], 0.0f ), 1.0f );
+            for ( int c = 0; c < 4; c++ )
+            {
+                target[c] = toByte( this->blend ? color[c][l] * alpha + target[c] * ( 1.0f / 255.0f ) * ( 1.0f - alpha ) : color[c][l] );
+            }
+
+            if ( this->depthTest && this->depthMask )
+            {
+                this->depth[pixel + l] = z[l];
+            }
+        }
+#endif
+    }
+
+    // A plane at the centres of a row's 8 pixels, the first of them cx, cy from the plane's origin
+#ifdef SOFTWARE_AVX2
+    static __m256 planeLanes( const SoftwarePlane &plane, GLdouble cx, GLdouble cy, __m256 lane )
+    {
+        GLfloat first = ( GLfloat )( plane.origin + plane.dx * cx + plane.dy * cy );
+        return _mm256_add_ps( _mm256_set1_ps( first ), _mm256_mul_ps( _mm256_set1_ps( plane.dx ), lane ) );
+    }
+#else
+    static void planeLanes( const SoftwarePlane &plane, GLdouble cx, GLdouble cy, GLfloat *out )
+    {
+        GLfloat first = ( GLfloat )( plane.origin + plane.dx * cx + plane.dy * cy );
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            out[l] = first + plane.dx * l;
+        }
+    }
+#endif
+};
+
+// core.vs and frag.vs of Q1 and Q2: a textured object, attributes position and texture coords (5 floats)
+struct SoftwareTexturedProgram
+{
+    static const GLint VARYINGS = 2;
+
+    glm::mat4 model, view, projection;
+    const SoftwareTexture *texture;
+
+    void Vertex( const GLfloat *attributes, glm::vec4 &position, GLfloat *varyings ) const
+    {
+        position = this->projection * this->view * this->model * glm::vec4( attributes[0], attributes[1], attributes[2], 1.0f );
+        varyings[0] = attributes[3];
+        varyings[1] = 1.0f - attributes[4];
+    }
+
+    void Fragments( const SoftwareFragments &fragments, GLfloat color[4][SOFTWARE_LANES] ) const
+    {
+        GLfloat dsdx[SOFTWARE_LANES], dsdy[SOFTWARE_LANES], dtdx[SOFTWARE_LANES], dtdy[SOFTWARE_LANES];
+        fragments.Derivatives( 0, dsdx, dsdy );
+        fragments.Derivatives( 1, dtdx, dtdy );
+        this->texture->Sample( fragments.varyings[0], fragments.varyings[1], dsdx, dtdx, dsdy, dtdy, fragments.mask, color );
+    }
+};
+
+// skycore.vs and skyfrag.vs: the skybox cube, positions only, view without its translation
+struct SoftwareSkyboxProgram
+{
+    static const GLint VARYINGS = 3;
+
+    glm::mat4 view, projection;
+    const SoftwareCubeMap *skybox;
+
+    void Vertex( const GLfloat *attributes, glm::vec4 &position, GLfloat *varyings ) const
+    {
+        position = this->projection * this->view * glm::vec4( attributes[0], attributes[1], attributes[2], 1.0f );
+        varyings[0] = attributes[0];
+        varyings[1] = attributes[1];
+        varyings[2] = attributes[2];
+    }
+
+    void Fragments( const SoftwareFragments &fragments, GLfloat color[4][SOFTWARE_LANES] ) const
+    {
+        this->skybox->Sample( fragments.varyings[0], fragments.varyings[1], fragments.varyings[2], fragments.mask, color );
+    }
+};
+
+// lightcore.vs and lightfrag.vs: flat coloured lamps, attributes world position and colour (6 floats)
+struct SoftwareColorProgram
+{
+    static const GLint VARYINGS = 3;
+
+    glm::mat4 view, projection;
+
+    void Vertex( const GLfloat *attributes, glm::vec4 &position, GLfloat *varyings ) const
+    {
+        position = this->projection * this->view * glm::vec4( attributes[0], attributes[1], attributes[2], 1.0f );
+        varyings[0] = attributes[3];
+        varyings[1] = attributes[4];
+        varyings[2] = attributes[5];
+    }
+
+    void Fragments( const SoftwareFragments &fragments, GLfloat color[4][SOFTWARE_LANES] ) const
+    {
+        for ( GLint l = 0; l < SOFTWARE_LANES; l++ )
+        {
+            color[0][l] = fragments.varyings[0][l];
+            color[1][l] = fragments.varyings[1][l];
+            color[2][l] = fragments.varyings[2][l];
+            color[3][l] = 1.0f;
+        }
+    }
+};
+
+// A point light as frag.vs reads it, faded out to nothing at radius
+struct SoftwarePointLight
+{
+    glm::vec3 position;
+    GLfloat radius;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    GLfloat linear;
+    GLfloat quadratic;
+};
+
+// Q3's core.vs and frag.vs without the clusters, shadows and sky reflection: normal mapped Phong or
+// Blinn-Phong from point lights, or from the directional light alone while db is set, plus the
+// irradiance ambient. Attributes are position, normal, texture coords, tangent and bitangent (14 floats).
+// Each step runs over the 8 lanes before the next, plain loops over arrays the compiler can vectorize
+struct SoftwarePhongProgram
+{
+    static const GLint VARYINGS = 14;
+
+    glm::mat4 model, view, projection;
+    glm::vec3 viewPos;
+    glm::vec3 directionDir, directionDiffuse, directionSpecular;
+    GLfloat shininess;
+    bool blinn;
+    bool db;
+    const SoftwareTexture *diffuseMap;
+    const SoftwareTexture *specularMap;
+    const SoftwareTexture *normalMap;      // flat when not valid
+    const std::vector<SoftwarePointLight> *lights;
+    const GLfloat *irradianceSH;            // 9 RGB coefficients, as SphericalHarmonics::GetCoefficients( )
+
+    void Vertex( const GLfloat *attributes, glm::vec4 &position, GLfloat *varyings ) const
+    {
+        glm::vec4 world = this->model * glm::vec4( attributes[0], attributes[1], attributes[2], 1.0f );
+        position = this->projection * this->view * world;
+
+        glm::vec3 T = glm::normalize( glm::vec3( this->model * glm::vec4( attributes[8], attributes[9], attributes[10], 0.0f ) ) );
+        glm::vec3 B = glm::normalize( glm::vec3( this->model * glm::vec4( attributes[11], attributes[12], attributes[13], 0.0f ) ) );
+        glm::vec3 N = glm::normalize( glm::vec3( this->model * glm::vec4( attributes[3], attributes[4], attributes[5], 0.0f ) ) );
+        GLfloat out[VARYINGS] = { world.x, world.y, world.z, attributes[6], attributes[7], T.x, T.y, T.z, B.x, B.y, B.z, N.x, N.y, N.z };
+        std::copy( out, out + VARYINGS, varyings );
+    }
+
+    void Fragments( const SoftwareFragments &fragments, GLfloat color[4][SOFTWARE_LANES] ) const
+    {
+        const GLint L = SOFTWARE_LANES;
+        const GLfloat ( *v )[L] = fragments.varyings;
+        GLfloat dsdx[L], dsdy[L], dtdx[L], dtdy[L];
+        fragments.Derivatives( 3, dsdx, dsdy );
+        fragments.Derivatives( 4, dtdx, dtdy );
+
+        // Material maps
+        GLfloat diffuse[4][L], specular[4][L], bump[4][L];
+        this->diffuseMap->Sample( v[3], v[4], dsdx, dtdx, dsdy, dtdy, fragments.mask, diffuse );
+        this->specularMap->Sample( v[3], v[4], dsdx, dtdx, dsdy, dtdy, fragments.mask, specular );
+        if ( this->normalMap->IsValid( ) )
+        {
+            this->normalMap->Sample( v[3], v[4], dsdx, dtdx, dsdy, dtdy, fragments.mask, bump );
+        }
+        else
+        {
+            std::fill( bump[0], bump[0] + L, 0.5f );
+            std::fill( bump[1], bump[1] + L, 0.5f );
+            std::fill( bump[2], bump[2] + L, 1.0f );
+        }
+        for ( int c = 0; c < 3; c++ )
+        {
+            for ( GLint l = 0; l < L; l++ )
+            {
+                bump[c][l] = bump[c][l] * 2.0f - 1.0f;
+            }
+        }
+
+        // Normal in world space and direction to the eye
+        GLfloat nx[L], ny[L], nz[L], ex[L], ey[L], ez[L];
+        for ( GLint l = 0; l < L; l++ )
+        {
+            GLfloat scale = 1.0f / std::sqrt( bump[0][l] * bump[0][l] + bump[1][l] * bump[1][l] + bump[2][l] * bump[2][l] );
+            GLfloat tx = bump[0][l] * scale, ty = bump[1][l] * scale, tz = bump[2][l] * scale;
+            nx[l] = v[5][l] * tx + v[8][l] * ty + v[11][l] * tz;
+            ny[l] = v[6][l] * tx + v[9][l] * ty + v[12][l] * tz;
+            nz[l] = v[7][l] * tx + v[10][l] * ty + v[13][l] * tz;
+            scale = 1.0f / std::sqrt( nx[l] * nx[l] + ny[l] * ny[l] + nz[l] * nz[l] );
+            nx[l] *= scale;
+            ny[l] *= scale;
+            nz[l] *= scale;
+
+            ex[l] = this->viewPos.x - v[0][l];
+            ey[l] = this->viewPos.y - v[1][l];
+            ez[l] = this->viewPos.z - v[2][l];
+            scale = 1.0f / std::sqrt( ex[l] * ex[l] + ey[l] * ey[l] + ez[l] * ez[l] );
+            ex[l] *= scale;
+            ey[l] *= scale;
+            ez[l] *= scale;
+        }
+
+        GLfloat result[3][L];
+        for ( GLint l = 0; l < L; l++ )
+        {
+            result[0][l] = result[1][l] = result[2][l] = 0.0f;
+        }
+
+        if ( this->db )
+        {
+            glm::vec3 toLight = glm::normalize( -this->directionDir );
+            for ( GLint l = 0; l < L; l++ )
+            {
+                GLfloat diff = std::max( nx[l] * toLight.x + ny[l] * toLight.y + nz[l] * toLight.z, 0.0f );
+                GLfloat spec = std::pow( std::max( this->specularTerm( toLight.x, toLight.y, toLight.z, nx[l], ny[l], nz[l], ex[l], ey[l], ez[l], true ), 0.0f ), this->shininess );
+                for ( int c = 0; c < 3; c++ )
+                {
+                    result[c][l] = this->directionDiffuse[c] * diff * diffuse[c][l] + this->directionSpecular[c] * spec * specular[c][l];
+                }
+            }
+        }
+        else
+        {
+            for ( size_t i = 0; i < this->lights->size( ); i++ )
+            {
+                const SoftwarePointLight &point = ( *this->lights )[i];
+
+                // Most lights reach none of the 8 fragments
+                GLfloat tx[L], ty[L], tz[L], distance2[L];
+                GLint reached = 0;
+                for ( GLint l = 0; l < L; l++ )
+                {
+                    tx[l] = point.position.x - v[0][l];
+                    ty[l] = point.position.y - v[1][l];
+                    tz[l] = point.position.z - v[2][l];
+                    distance2[l] = tx[l] * tx[l] + ty[l] * ty[l] + tz[l] * tz[l];
+                    reached |= distance2[l] < point.radius * point.radius;
+                }
+                if ( !reached )
+                {
+                    continue;
+                }
+
+                for ( GLint l = 0; l < L; l++ )
+                {
+                    GLfloat distance = std::sqrt( distance2[l] );
+                    GLfloat lx = tx[l] / distance, ly = ty[l] / distance, lz = tz[l] / distance;
+                    GLfloat diff = std::max( nx[l] * lx + ny[l] * ly + nz[l] * lz, 0.0f );
+
+                    // pow( x, 16 ) and pow( x, 8 ) of frag.vs by squaring
+                    GLfloat spec = std::max( this->specularTerm( lx, ly, lz, nx[l], ny[l], nz[l], ex[l], ey[l], ez[l], false ), 0.0f );
+                    spec *= spec;
+                    spec *= spec;
+                    spec *= spec;
+                    if ( this->blinn )
+                    {
+                        spec *= spec;
+                    }
+
+                    GLfloat attenuation = 1.0f / ( 1.0f + point.linear * distance + point.quadratic * distance2[l] );
+                    GLfloat ratio = distance2[l] / ( point.radius * point.radius );
+                    GLfloat fade = std::min( std::max( 1.0f - ratio * ratio, 0.0f ), 1.0f );
+                    attenuation *= fade * fade;
+
+                    for ( int c = 0; c < 3; c++ )
+                    {
+                        result[c][l] += ( point.diffuse[c] * diff * diffuse[c][l] + point.specular[c] * spec * specular[c][l] ) * attenuation;
+                    }
+                }
+            }
+        }
+
+        // Ambient from the sky's irradiance, the same polynomial as Irradiance( ) in frag.vs
+        const GLfloat *sh = this->irradianceSH;
+        for ( GLint l = 0; l < L; l++ )
+        {
+            for ( int c = 0; c < 3; c++ )
+            {
+                GLfloat irradiance = sh[c] + sh[3 + c] * ny[l] + sh[6 + c] * nz[l] + sh[9 + c] * nx[l] +
+                                     sh[12 + c] * ( nx[l] * ny[l] ) + sh[15 + c] * ( ny[l] * nz[l] ) + sh[18 + c] * ( 3.0f * nz[l] * nz[l] - 1.0f ) +
+                                     sh[21 + c] * ( nx[l] * nz[l] ) + sh[24 + c] * ( nx[l] * nx[l] - ny[l] * ny[l] );
+                color[c][l] = result[c][l] + std::max( irradiance, 0.0f ) * diffuse[c][l];
+            }
+            color[3][l] = 1.0f;
+        }
+    }
+
+    // Cosine the specular exponent is applied to: Blinn's half vector against the normal (the eye for
+    // the directional light, as frag.vs has it) or Phong's reflection against the eye
+    GLfloat specularTerm( GLfloat lx, GLfloat ly, GLfloat lz, GLfloat nx, GLfloat ny, GLfloat nz,
+                          GLfloat ex, GLfloat ey, GLfloat ez, bool directional ) const
+    {
+        if ( this->blinn )
+        {
+            GLfloat hx = lx + ex, hy = ly + ey, hz = lz + ez;
+            GLfloat scale = 1.0f / std::sqrt( hx * hx + hy * hy + hz * hz );
+            return directional ? ( ex * hx + ey * hy + ez * hz ) * scale : ( nx * hx + ny * hy + nz * hz ) * scale;
+        }
+
+        // reflect( -l, n ) = 2 dot( n, l ) n - l
+        GLfloat twice = 2.0f * ( nx * lx + ny * ly + nz * lz );
+        return ex * ( twice * nx - lx ) + ey * ( twice * ny - ly ) + ez * ( twice * nz - lz );
+    }
+};
+
+#endif
@@ -0,0 +1,662 @@
+#ifndef SpecularEnvironment_h
+#define SpecularEnvironment_h
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/image_cache.h"
+#include "SOIL2/image_helper.h"
+#include "SOIL2/image_parallel.h"
+#include "Shader.h"
+#include "SphericalHarmonics.h"
+
+// Level 0 holds mirror reflections, every level after it a rougher GGX lobe, up to roughness 1 at 8x8.
+// 6 faces of 5 levels fill 30 of the 32 levels a cache entry can hold
+const GLint ENV_SIZE = 128;
+const GLint ENV_LEVELS = 5;
+
+// Faces are box filtered down to this before the convolution; a larger sky adds cost, not detail
+const GLint ENV_SOURCE_SIZE = 256;
+
+const GLint ENV_SAMPLES = 64;
+
+// Part of the cache key, bump it whenever the filter changes so stale entries are never found
+const unsigned int ENV_CACHE_VERSION = 1;
+
+// The skybox prefiltered for glossy reflections (split-sum, Karis 2013): level l of the cubemap is
+// the sky convolved with a GGX lobe of roughness l / ( ENV_LEVELS - 1 ), so frag.vs needs a single
+// textureLod per fragment. Samples are importance sampled and read from the source mip whose texels
+// match the sample's solid angle (Colbert and Krivanek), which keeps 64 samples free of fireflies.
+// The convolution runs in a compute shader where the driver has one, otherwise on every core, and the
+// result is kept in the SOIL texture cache keyed by the face files, so it runs once per sky.
+class SpecularEnvironment
+{
+public:
+    SpecularEnvironment( bool useCompute = true )
+    {
+        this->texture = 0;
+        this->useCompute = useCompute;
+        this->sourceSize = 0;
+        for ( int i = 0; i < 6; i++ )
+        {
+            this->keys[i] = 0;
+            this->sizes[i] = 0;
+        }
+    }
+
+    ~SpecularEnvironment( )
+    {
+        this->Clear( );
+    }
+
+    // Hands over a decoded face, safe to call for different faces from different threads.
+    // key identifies the face's source file, it goes into the cache key
+    void SetFace( int face, const unsigned char *rgba, int size, SOIL_cache_key key )
+    {
+        if ( face < 0 || face >= 6 || NULL == rgba || size <= 0 )
+        {
+            return;
+        }
+
+        // Halve down to ENV_SOURCE_SIZE, then keep halving for the coarse samples
+        std::vector< std::vector<unsigned char> > &chain = this->sources[face];
+        std::vector<unsigned char> level, next;
+        const unsigned char *current = rgba;
+
+        chain.clear( );
+        this->sizes[face] = 0;
+        while ( size > ENV_SOURCE_SIZE )
+        {
+            next.resize( ( size_t )( size / 2 ) * ( size / 2 ) * 4 );
+            mipmap_image( current, size, size, 4, &next[0], 2, 2 );
+            level.swap( next );
+            current = &level[0];
+            size /= 2;
+        }
+
+        this->sizes[face] = size;
+        this->keys[face] = key;
+        chain.push_back( std::vector<unsigned char>( current, current + ( size_t )size * size * 4 ) );
+        while ( size > 1 )
+        {
+            std::vector<unsigned char> coarser( ( size_t )( size / 2 ) * ( size / 2 ) * 4 );
+            mipmap_image( &chain.back( )[0], size, size, 4, &coarser[0], 2, 2 );
+            chain.push_back( std::move( coarser ) );
+            size /= 2;
+        }
+    }
+
+    // Builds the prefiltered cubemap once every face is in, or loads it from the cache if this sky was seen
+    // before. Faces that failed to load are black, as they are in the skybox
+    void Finish( )
+    {
+        int size = 0;
+        for ( int i = 0; i < 6 && 0 == size; i++ )
+        {
+            size = this->sizes[i];
+        }
+        for ( int i = 0; i < 6; i++ )
+        {
+            if ( this->sizes[i] != size )
+            {
+                this->sources[i].clear( );
+                this->keys[i] = 0;
+            }
+        }
+        if ( 0 == size )
+        {
+            return;
+        }
+        this->sourceSize = size;
+
+        std::vector<unsigned char> levels[ENV_LEVELS][6];
+        SOIL_cache_key key = this->cacheKey( );
+        int entryLength = 0;
+        const unsigned char *entry = SOIL_cache_lookup( key, &entryLength );
+
+        if ( NULL != entry && readEntry( entry, levels ) )
+        {
+            SOIL_cache_count_hit( entryLength );
+        }
+        else
+        {
+            SOIL_cache_count_miss( );
+            if ( !this->useCompute || !this->prefilterOnGPU( levels ) )
+            {
+                this->prefilterOnCPU( levels );
+            }
+            storeEntry( key, levels );
+        }
+        if ( NULL != entry )
+        {
+            SOIL_cache_release( entry, entryLength );
+        }
+
+        if ( 0 == this->texture )
+        {
+            this->texture = allocate( );
+            glBindTexture( GL_TEXTURE_CUBE_MAP, this->texture );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+            for ( GLint level = 0; level < ENV_LEVELS; level++ )
+            {
+                for ( int i = 0; i < 6; i++ )
+                {
+                    glTexSubImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, ENV_SIZE >> level, ENV_SIZE >> level,
+                                     GL_RGBA, GL_UNSIGNED_BYTE, &levels[level][i][0] );
+                }
+            }
+        }
+
+        for ( int i = 0; i < 6; i++ )
+        {
+            std::vector< std::vector<unsigned char> >( ).swap( this->sources[i] );
+        }
+    }
+
+    // Binds the cubemap to unit and points the shader's environment sampler at it
+    void Attach( const Shader &shader, GLint unit ) const
+    {
+        glUseProgram( shader.Program );
+        glUniform1i( glGetUniformLocation( shader.Program, "environment" ), unit );
+        glUniform1f( glGetUniformLocation( shader.Program, "environmentLevels" ), ( GLfloat )( ENV_LEVELS - 1 ) );
+        glActiveTexture( GL_TEXTURE0 + unit );
+        glBindTexture( GL_TEXTURE_CUBE_MAP, this->texture );
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    GLuint Texture( ) const
+    {
+        return this->texture;
+    }
+
+    void Clear( )
+    {
+        if ( 0 != this->texture )
+        {
+            glDeleteTextures( 1, &this->texture );
+            this->texture = 0;
+        }
+        for ( int i = 0; i < 6; i++ )
+        {
+            this->sources[i].clear( );
+            this->sizes[i] = 0;
+        }
+    }
+
+private:
+    GLuint texture;
+    bool useCompute;
+    int sourceSize;
+    std::vector< std::vector<unsigned char> > sources[6];   // per face, ENV_SOURCE_SIZE or less down to 1x1
+    int sizes[6];
+    SOIL_cache_key keys[6];
+
+    // One GGX sample of a level, in the tangent space of the texel's direction
+    struct LobeSample
+    {
+        float direction[3];
+        float weight;
+        float lod;
+    };
+
+    struct PrefilterJob
+    {
+        const SpecularEnvironment *environment;
+        std::vector<unsigned char> ( *levels )[6];
+        std::vector<LobeSample> lobes[ENV_LEVELS];
+    };
+
+    SOIL_cache_key cacheKey( ) const
+    {
+        unsigned char buffer[sizeof( this->keys ) + 5 * sizeof( unsigned int )];
+        unsigned int parameters[5] = { ENV_CACHE_VERSION, ( unsigned int )ENV_SIZE, ( unsigned int )ENV_LEVELS,
+                                       ( unsigned int )ENV_SAMPLES, ( unsigned int )this->sourceSize };
+
+        memcpy( buffer, this->keys, sizeof( this->keys ) );
+        memcpy( buffer + sizeof( this->keys ), parameters, sizeof( parameters ) );
+
+        return SOIL_cache_make_key( buffer, ( int )sizeof( buffer ), ENV_CACHE_VERSION );
+    }
+
+    static size_t levelBytes( GLint level )
+    {
+        return ( size_t )( ENV_SIZE >> level ) * ( ENV_SIZE >> level ) * 4;
+    }
+
+    // Entries hold level-major face images: level 0 of +X .. -Z, then level 1, ...
+    static bool readEntry( const unsigned char *entry, std::vector<unsigned char> ( *levels )[6] )
+    {
+        const SOIL_cache_header *header = ( const SOIL_cache_header * )entry;
+        const SOIL_cache_level *table = ( const SOIL_cache_level * )( entry + sizeof( SOIL_cache_header ) );
+
+        if ( ( GLint )header->width != ENV_SIZE || header->num_levels != 6 * ENV_LEVELS )
+        {
+            return false;
+        }
+        for ( GLint level = 0; level < ENV_LEVELS; level++ )
+        {
+            for ( int i = 0; i < 6; i++ )
+            {
+                const SOIL_cache_level &stored = table[level * 6 + i];
+
+                if ( stored.size != levelBytes( level ) )
+                {
+                    return false;
+                }
+                levels[level][i].assign( entry + stored.offset, entry + stored.offset + stored.size );
+            }
+        }
+
+        return true;
+    }
+
+    static void storeEntry( SOIL_cache_key key, std::vector<unsigned char> ( *levels )[6] )
+    {
+        size_t tableSize = sizeof( SOIL_cache_header ) + 6 * ENV_LEVELS * sizeof( SOIL_cache_level );
+        size_t total = tableSize;
+        for ( GLint level = 0; level < ENV_LEVELS; level++ )
+        {
+            total += 6 * levelBytes( level );
+        }
+
+        std::vector<unsigned char> entry( total );
+        SOIL_cache_header header;
+        memset( &header, 0, sizeof( header ) );
+        memcpy( header.magic, SOIL_CACHE_MAGIC, 8 );
+        header.key = key;
+        header.width = ENV_SIZE;
+        header.height = ENV_SIZE;
+        header.channels = 4;
+        header.internal_format = GL_RGBA8;
+        header.pixel_format = GL_RGBA;
+        header.num_levels = 6 * ENV_LEVELS;
+        memcpy( &entry[0], &header, sizeof( header ) );
+
+        SOIL_cache_level *table = ( SOIL_cache_level * )&entry[sizeof( SOIL_cache_header )];
+        size_t offset = tableSize;
+        for ( GLint level = 0; level < ENV_LEVELS; level++ )
+        {
+            for ( int i = 0; i < 6; i++ )
+            {
+                SOIL_cache_level &stored = table[level * 6 + i];
+
+                stored.width = ENV_SIZE >> level;
+                stored.height = ENV_SIZE >> level;
+                stored.offset = ( unsigned int )offset;
+                stored.size = ( unsigned int )levelBytes( level );
+                memcpy( &entry[offset], &levels[level][i][0], stored.size );
+                offset += stored.size;
+            }
+        }
+
+        // Nothing is lost if the cache can't be written, the sky is just filtered again next run
+        SOIL_cache_store( key, &entry[0], ( int )entry.size( ) );
+    }
+
+    static GLuint allocate( )
+    {
+        GLuint id;
+        glGenTextures( 1, &id );
+        glBindTexture( GL_TEXTURE_CUBE_MAP, id );
+
+        if ( GLEW_ARB_texture_storage )
+        {
+            glTexStorage2D( GL_TEXTURE_CUBE_MAP, ENV_LEVELS, GL_RGBA8, ENV_SIZE, ENV_SIZE );
+        }
+        else
+        {
+            for ( int i = 0; i < 6; i++ )
+            {
+                for ( GLint level = 0; level < ENV_LEVELS; level++ )
+                {
+                    glTexImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA8, ENV_SIZE >> level, ENV_SIZE >> level, 0,
+                                  GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+                }
+            }
+            glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, ENV_LEVELS - 1 );
+        }
+
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+        glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS );
+
+        return id;
+    }
+
+    static float roughness( GLint level )
+    {
+        return ( float )level / ( ENV_LEVELS - 1 );
+    }
+
+    // GGX samples around +Z by a Hammersley sequence, with the source mip each one reads
+    std::vector<LobeSample> lobe( GLint level ) const
+    {
+        std::vector<LobeSample> samples;
+        float alpha = roughness( level ) * roughness( level );
+        float texelSolidAngle = 4.0f * 3.14159265f / ( 6.0f * this->sourceSize * this->sourceSize );
+        float lastLod = 0.0f;
+
+        for ( int i = 0; i < 6; i++ )
+        {
+            lastLod = std::max( lastLod, ( float )this->sources[i].size( ) - 1.0f );
+        }
+
+        if ( 0.0f == alpha )
+        {
+            LobeSample mirror = { { 0.0f, 0.0f, 1.0f }, 1.0f, std::log2( ( float )this->sourceSize / ( ENV_SIZE >> level ) ) };
+            mirror.lod = std::min( std::max( mirror.lod, 0.0f ), lastLod );
+            samples.push_back( mirror );
+            return samples;
+        }
+
+        for ( int i = 0; i < ENV_SAMPLES; i++ )
+        {
+            unsigned int bits = ( unsigned int )i;
+            bits = ( bits << 16u ) | ( bits >> 16u );
+            bits = ( ( bits & 0x55555555u ) << 1u ) | ( ( bits & 0xAAAAAAAAu ) >> 1u );
+            bits = ( ( bits & 0x33333333u ) << 2u ) | ( ( bits & 0xCCCCCCCCu ) >> 2u );
+            bits = ( ( bits & 0x0F0F0F0Fu ) << 4u ) | ( ( bits & 0xF0F0F0F0u ) >> 4u );
+            bits = ( ( bits & 0x00FF00FFu ) << 8u ) | ( ( bits & 0xFF00FF00u ) >> 8u );
+
+            float u = ( float )i / ENV_SAMPLES;
+            float v = bits * 2.3283064365386963e-10f;
+            float phi = 2.0f * 3.14159265f * u;
+            float cosTheta = std::sqrt( ( 1.0f - v ) / ( 1.0f + ( alpha * alpha - 1.0f ) * v ) );
+            float sinTheta = std::sqrt( 1.0f - cosTheta * cosTheta );
+            float half[3] = { sinTheta * std::cos( phi ), sinTheta * std::sin( phi ), cosTheta };
+
+            // Reflect the view, which is the normal, about the half vector
+            LobeSample sample;
+            for ( int c = 0; c < 3; c++ )
+            {
+                sample.direction[c] = 2.0f * cosTheta * half[c];
+            }
+            sample.direction[2] -= 1.0f;
+            sample.weight = sample.direction[2];
+            if ( sample.weight <= 0.0f )
+            {
+                continue;
+            }
+
+            // pdf of the reflected direction is D / 4 when view and normal agree
+            float denominator = ( alpha * alpha - 1.0f ) * cosTheta * cosTheta + 1.0f;
+            float distribution = alpha * alpha / ( 3.14159265f * denominator * denominator );
+            float sampleSolidAngle = 4.0f / ( ENV_SAMPLES * distribution );
+            sample.lod = std::min( std::max( 0.5f * std::log2( sampleSolidAngle / texelSolidAngle ) + 1.0f, 0.0f ), lastLod );
+            samples.push_back( sample );
+        }
+
+        return samples;
+    }
+
+    // Bilinear lookup in one level of one face, clamped at the face edges
+    void sampleFace( int face, int level, float s, float t, float *rgb ) const
+    {
+        const std::vector< std::vector<unsigned char> > &chain = this->sources[face];
+        if ( chain.empty( ) )
+        {
+            return;
+        }
+
+        level = std::min( level, ( int )chain.size( ) - 1 );
+        int size = std::max( 1, this->sourceSize >> level );
+        const unsigned char *texels = &chain[level][0];
+        float x = std::min( std::max( s * size - 0.5f, 0.0f ), size - 1.0f );
+        float y = std::min( std::max( t * size - 0.5f, 0.0f ), size - 1.0f );
+        int x0 = ( int )x, y0 = ( int )y;
+        int x1 = std::min( x0 + 1, size - 1 ), y1 = std::min( y0 + 1, size - 1 );
+        float fx = x - x0, fy = y - y0;
+
+        for ( int c = 0; c < 3; c++ )
+        {
+            float top = texels[( y0 * size + x0 ) * 4 + c] * ( 1.0f - fx ) + texels[( y0 * size + x1 ) * 4 + c] * fx;
+            float bottom = texels[( y1 * size + x0 ) * 4 + c] * ( 1.0f - fx ) + texels[( y1 * size + x1 ) * 4 + c] * fx;
+            rgb[c] = top * ( 1.0f - fy ) + bottom * fy;
+        }
+    }
+
+    // Trilinear cubemap lookup, faces picked by the major axis as GL does
+    void sampleCube( const float *d, float lod, float *rgb ) const
+    {
+        float ax = std::fabs( d[0] ), ay = std::fabs( d[1] ), az = std::fabs( d[2] );
+        int face;
+        float major, sc, tc;
+
+        if ( ax >= ay && ax >= az )
+        {
+            face = d[0] > 0.0f ? 0 : 1;
+            major = ax;
+            sc = d[0] > 0.0f ? -d[2] : d[2];
+            tc = -d[1];
+        }
+        else if ( ay >= az )
+        {
+            face = d[1] > 0.0f ? 2 : 3;
+            major = ay;
+            sc = d[0];
+            tc = d[1] > 0.0f ? d[2] : -d[2];
+        }
+        else
+        {
+            face = d[2] > 0.0f ? 4 : 5;
+            major = az;
+            sc = d[2] > 0.0f ? d[0] : -d[0];
+            tc = -d[1];
+        }
+
+        float s = 0.5f * ( sc / major + 1.0f ), t = 0.5f * ( tc / major + 1.0f );
+        int level = ( int )lod;
+        float blend = lod - level;
+        float fine[3] = { 0.0f, 0.0f, 0.0f }, coarse[3] = { 0.0f, 0.0f, 0.0f };
+
+        this->sampleFace( face, level, s, t, fine );
+        if ( blend > 0.0f )
+        {
+            this->sampleFace( face, level + 1, s, t, coarse );
+        }
+        for ( int c = 0; c < 3; c++ )
+        {
+            rgb[c] = fine[c] + ( coarse[c] - fine[c] ) * blend;
+        }
+    }
+
+    // Rows of every face and level, flattened so the threads share out all of them
+    static void prefilterRows( void *context, int begin, int end )
+    {
+        PrefilterJob *job = ( PrefilterJob * )context;
+
+        for ( int index = begin; index < end; index++ )
+        {
+            int row = index;
+            GLint level = 0;
+            while ( row >= 6 * ( ENV_SIZE >> level ) )
+            {
+                row -= 6 * ( ENV_SIZE >> level );
+                level++;
+            }
+
+            int size = ENV_SIZE >> level;
+            int face = row / size;
+            row %= size;
+
+            const float *axes = SH_FACE_AXES[face][0];
+            const std::vector<LobeSample> &samples = job->lobes[level];
+            unsigned char *out = &job->levels[level][face][( size_t )row * size * 4];
+            float t = ( row + 0.5f ) * 2.0f / size - 1.0f;
+
+            for ( int column = 0; column < size; column++ )
+            {
+                float s = ( column + 0.5f ) * 2.0f / size - 1.0f;
+                float normal[3], tangent[3], bitangent[3];
+                float length = std::sqrt( 1.0f + s * s + t * t );
+
+                for ( int c = 0; c < 3; c++ )
+                {
+                    normal[c] = ( axes[c] * s + axes[3 + c] * t + axes[6 + c] ) / length;
+                }
+
+                // Any frame around the normal will do, the lobe is symmetric
+                float up[3] = { 0.0f, 0.0f, 1.0f };
+                if ( std::fabs( normal[2] ) > 0.999f )
+                {
+                    up[0] = 1.0f;
+                    up[2] = 0.0f;
+                }
+                tangent[0] = up[1] * normal[2] - up[2] * normal[1];
+                tangent[1] = up[2] * normal[0] - up[0] * normal[2];
+                tangent[2] = up[0] * normal[1] - up[1] * normal[0];
+                float tangentLength = std::sqrt( tangent[0] * tangent[0] + tangent[1] * tangent[1] + tangent[2] * tangent[2] );
+                for ( int c = 0; c < 3; c++ )
+                {
+                    tangent[c] /= tangentLength;
+                }
+                bitangent[0] = normal[1] * tangent[2] - normal[2] * tangent[1];
+                bitangent[1] = normal[2] * tangent[0] - normal[0] * tangent[2];
+                bitangent[2] = normal[0] * tangent[1] - normal[1] * tangent[0];
+
+                float sum[3] = { 0.0f, 0.0f, 0.0f }, weight = 0.0f;
+                for ( size_t i = 0; i < samples.size( ); i++ )
+                {
+                    const LobeSample &sample = samples[i];
+                    float direction[3], rgb[3];
+
+                    for ( int c = 0; c < 3; c++ )
+                    {
+                        direction[c] = tangent[c] * sample.direction[0] + bitangent[c] * sample.direction[1] + normal[c] * sample.direction[2];
+                    }
+                    job->environment->sampleCube( direction, sample.lod, rgb );
+                    for ( int c = 0; c < 3; c++ )
+                    {
+                        sum[c] += rgb[c] * sample.weight;
+                    }
+                    weight += sample.weight;
+                }
+
+                for ( int c = 0; c < 3; c++ )
+                {
+                    out[column * 4 + c] = ( unsigned char )std::min( 255.0f, sum[c] / weight + 0.5f );
+                }
+                out[column * 4 + 3] = 255;
+            }
+        }
+    }
+
+    void prefilterOnCPU( std::vector<unsigned char> ( *levels )[6] ) const
+    {
+        PrefilterJob job;
+        int rows = 0;
+
+        job.environment = this;
+        job.levels = levels;
+        for ( GLint level = 0; level < ENV_LEVELS; level++ )
+        {
+            job.lobes[level] = this->lobe( level );
+            for ( int i = 0; i < 6; i++ )
+            {
+                levels[level][i].resize( levelBytes( level ) );
+            }
+            rows += 6 * ( ENV_SIZE >> level );
+        }
+
+        SOIL_parallel_for( rows, 16, prefilterRows, &job );
+    }
+
+    // Same filter in resources/shaders/prefilter.comp, writing straight into the texture;
+    // read back afterwards for the cache. false if the driver can't run it
+    bool prefilterOnGPU( std::vector<unsigned char> ( *levels )[6] )
+    {
+        if ( !GLEW_ARB_compute_shader || !GLEW_ARB_shader_image_load_store || !GLEW_ARB_texture_storage )
+        {
+            return false;
+        }
+
+        Shader prefilter( "resources/shaders/prefilter.comp" );
+        if ( !prefilter.Valid( ) )
+        {
+            return false;
+        }
+
+        // The source chain as a mipmapped cubemap, missing faces black
+        GLint sourceLevels = 0;
+        while ( ( this->sourceSize >> sourceLevels ) > 0 )
+        {
+            sourceLevels++;
+        }
+
+        GLuint source;
+        glGenTextures( 1, &source );
+        glActiveTexture( GL_TEXTURE0 );
+        glBindTexture( GL_TEXTURE_CUBE_MAP, source );
+        glTexStorage2D( GL_TEXTURE_CUBE_MAP, sourceLevels, GL_RGBA8, this->sourceSize, this->sourceSize );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        for ( int i = 0; i < 6; i++ )
+        {
+            for ( GLint level = 0; level < sourceLevels; level++ )
+            {
+                GLsizei size = this->sourceSize >> level;
+                std::vector<unsigned char> black;
+                const unsigned char *texels;
+
+                if ( level < ( GLint )this->sources[i].size( ) )
+                {
+                    texels = &this->sources[i][level][0];
+                }
+                else
+                {
+                    black.assign( ( size_t )size * size * 4, 0 );
+                    texels = &black[0];
+                }
+                glTexSubImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, texels );
+            }
+        }
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS );
+
+        this->texture = allocate( );
+        glBindTexture( GL_TEXTURE_CUBE_MAP, source );
+
+        prefilter.Use( );
+        glUniform1i( glGetUniformLocation( prefilter.Program, "source" ), 0 );
+        glUniform1i( glGetUniformLocation( prefilter.Program, "target" ), 0 );
+        glUniform1f( glGetUniformLocation( prefilter.Program, "sourceSize" ), ( GLfloat )this->sourceSize );
+        glUniform1i( glGetUniformLocation( prefilter.Program, "samples" ), ENV_SAMPLES );
+        for ( GLint level = 0; level < ENV_LEVELS; level++ )
+        {
+            GLint size = ENV_SIZE >> level;
+
+            glBindImageTexture( 0, this->texture, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8 );
+            glUniform1i( glGetUniformLocation( prefilter.Program, "levelSize" ), size );
+            glUniform1f( glGetUniformLocation( prefilter.Program, "roughness" ), roughness( level ) );
+            glDispatchCompute( ( size + 7 ) / 8, ( size + 7 ) / 8, 6 );
+        }
+        glMemoryBarrier( GL_TEXTURE_UPDATE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT );
+        glBindImageTexture( 0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8 );
+
+        glBindTexture( GL_TEXTURE_CUBE_MAP, this->texture );
+        glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+        for ( GLint level = 0; level < ENV_LEVELS; level++ )
+        {
+            for ( int i = 0; i < 6; i++ )
+            {
+                levels[level][i].resize( levelBytes( level ) );
+                glGetTexImage( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA, GL_UNSIGNED_BYTE, &levels[level][i][0] );
+            }
+        }
+
+        glDeleteTextures( 1, &source );
+        glDeleteProgram( prefilter.Program );
+
+        return true;
+    }
+};
+
+#endif
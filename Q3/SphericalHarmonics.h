@@ -0,0 +1,226 @@
+#ifndef SphericalHarmonics_h
+#define SphericalHarmonics_h
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define SH_SSE2
+#endif
+
+#include <GL/glew.h>
+
+// Terms of the L2 basis without their constants, in the order Irradiance( ) in frag.vs reads them:
+// 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2
+const int SH_COEFFICIENTS = 9;
+
+// s axis, t axis and centre of each face in GL's cubemap layout, +X, -X, +Y, -Y, +Z, -Z
+const float SH_FACE_AXES[6][3][3] =
+{
+    { {  0.0f,  0.0f, -1.0f }, { 0.0f, -1.0f,  0.0f }, {  1.0f,  0.0f,  0.0f } },
+    { {  0.0f,  0.0f,  1.0f }, { 0.0f, -1.0f,  0.0f }, { -1.0f,  0.0f,  0.0f } },
+    { {  1.0f,  0.0f,  0.0f }, { 0.0f,  0.0f,  1.0f }, {  0.0f,  1.0f,  0.0f } },
+    { {  1.0f,  0.0f,  0.0f }, { 0.0f,  0.0f, -1.0f }, {  0.0f, -1.0f,  0.0f } },
+    { {  1.0f,  0.0f,  0.0f }, { 0.0f, -1.0f,  0.0f }, {  0.0f,  0.0f,  1.0f } },
+    { { -1.0f,  0.0f,  0.0f }, { 0.0f, -1.0f,  0.0f }, {  0.0f,  0.0f, -1.0f } }
+};
+
+// Diffuse irradiance of a cubemap as 9 L2 spherical harmonic coefficients (Ramamoorthi and Hanrahan).
+// Every face is projected on its own (AddFace, safe to call for different faces from different
+// threads), each texel weighted by the solid angle it covers, then Finish( ) adds up the faces,
+// convolves with the clamped cosine lobe and folds in the basis constants and the 1 / pi of a
+// Lambertian surface. What is left is a polynomial in the normal that gives the ambient light
+// straight away. Until Finish( ) runs the irradiance is 1 everywhere, a flat ambient.
+class SphericalHarmonics
+{
+public:
+    SphericalHarmonics( )
+    {
+        memset( this->sums, 0, sizeof( this->sums ) );
+        memset( this->weights, 0, sizeof( this->weights ) );
+        memset( this->coefficients, 0, sizeof( this->coefficients ) );
+
+        for ( int c = 0; c < 3; c++ )
+        {
+            this->coefficients[0][c] = 1.0f;
+        }
+    }
+
+    // Projects one face of size x size RGBA8 texels, face in +X, -X, +Y, -Y, +Z, -Z order
+    void AddFace( int face, const unsigned char *rgba, int size )
+    {
+        if ( face < 0 || face >= 6 || NULL == rgba || size <= 0 )
+        {
+            return;
+        }
+
+        double *sums = this->sums[face][0];
+        memset( sums, 0, sizeof( this->sums[face] ) );
+        this->weights[face] = 0.0;
+
+        // Direction of a texel is axes[0] * s + axes[1] * t + axes[2], s and t in [-1, 1], rows top down
+        const float *axes = SH_FACE_AXES[face][0];
+        float step = 2.0f / size;
+
+        for ( int row = 0; row < size; row++ )
+        {
+            float t = ( row + 0.5f ) * step - 1.0f;
+            const unsigned char *texels = rgba + ( size_t )row * size * 4;
+            float rowSums[SH_COEFFICIENTS * 3];
+            float rowWeight = 0.0f;
+            int column = 0;
+
+            memset( rowSums, 0, sizeof( rowSums ) );
+
+#ifdef SH_SSE2
+            __m128 sumVectors[SH_COEFFICIENTS * 3];
+            __m128 weightVector = _mm_setzero_ps( );
+
+            for ( int k = 0; k < SH_COEFFICIENTS * 3; k++ )
+            {
+                sumVectors[k] = _mm_setzero_ps( );
+            }
+
+            __m128 tVector = _mm_set1_ps( t );
+            __m128 one = _mm_set1_ps( 1.0f );
+            __m128i byteMask = _mm_set1_epi32( 0xFF );
+
+            for ( ; column + 4 <= size; column += 4 )
+            {
+                __m128 s = _mm_add_ps( _mm_mul_ps( _mm_setr_ps( column + 0.5f, column + 1.5f, column + 2.5f, column + 3.5f ), _mm_set1_ps( step ) ), _mm_set1_ps( -1.0f ) );
+                __m128 lengthSquared = _mm_add_ps( one, _mm_add_ps( _mm_mul_ps( s, s ), _mm_mul_ps( tVector, tVector ) ) );
+                __m128 inverseLength = _mm_div_ps( one, _mm_sqrt_ps( lengthSquared ) );
+                __m128 weight = _mm_mul_ps( inverseLength, _mm_mul_ps( inverseLength, inverseLength ) );
+
+                __m128 x = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( s, _mm_set1_ps( axes[0] ) ), _mm_mul_ps( tVector, _mm_set1_ps( axes[3] ) ) ), _mm_set1_ps( axes[6] ) ), inverseLength );
+                __m128 y = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( s, _mm_set1_ps( axes[1] ) ), _mm_mul_ps( tVector, _mm_set1_ps( axes[4] ) ) ), _mm_set1_ps( axes[7] ) ), inverseLength );
+                __m128 z = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( s, _mm_set1_ps( axes[2] ) ), _mm_mul_ps( tVector, _mm_set1_ps( axes[5] ) ) ), _mm_set1_ps( axes[8] ) ), inverseLength );
+
+                __m128i pixels = _mm_loadu_si128( ( const __m128i * )( texels + column * 4 ) );
+                __m128 colors[3] =
+                {
+                    _mm_mul_ps( weight, _mm_cvtepi32_ps( _mm_and_si128( pixels, byteMask ) ) ),
+                    _mm_mul_ps( weight, _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( pixels, 8 ), byteMask ) ) ),
+                    _mm_mul_ps( weight, _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( pixels, 16 ), byteMask ) ) )
+                };
+
+                __m128 basis[SH_COEFFICIENTS] =
+                {
+                    one,
+                    y,
+                    z,
+                    x,
+                    _mm_mul_ps( x, y ),
+                    _mm_mul_ps( y, z ),
+                    _mm_sub_ps( _mm_mul_ps( _mm_set1_ps( 3.0f ), _mm_mul_ps( z, z ) ), one ),
+                    _mm_mul_ps( x, z ),
+                    _mm_sub_ps( _mm_mul_ps( x, x ), _mm_mul_ps( y, y ) )
+                };
+
+                for ( int k = 0; k < SH_COEFFICIENTS; k++ )
+                {
+                    for ( int c = 0; c < 3; c++ )
+                    {
+                        sumVectors[k * 3 + c] = _mm_add_ps( sumVectors[k * 3 + c], _mm_mul_ps( basis[k], colors[c] ) );
+                    }
+                }
+                weightVector = _mm_add_ps( weightVector, weight );
+            }
+
+            float lanes[4];
+            for ( int k = 0; k < SH_COEFFICIENTS * 3; k++ )
+            {
+                _mm_storeu_ps( lanes, sumVectors[k] );
+                rowSums[k] = ( lanes[0] + lanes[1] ) + ( lanes[2] + lanes[3] );
+            }
+            _mm_storeu_ps( lanes, weightVector );
+            rowWeight = ( lanes[0] + lanes[1] ) + ( lanes[2] + lanes[3] );
+#endif
+
+            for ( ; column < size; column++ )
+            {
+                float s = ( column + 0.5f ) * step - 1.0f;
+                float inverseLength = 1.0f / sqrtf( 1.0f + s * s + t * t );
+                float weight = inverseLength * inverseLength * inverseLength;
+                float x = ( axes[0] * s + axes[3] * t + axes[6] ) * inverseLength;
+                float y = ( axes[1] * s + axes[4] * t + axes[7] ) * inverseLength;
+                float z = ( axes[2] * s + axes[5] * t + axes[8] ) * inverseLength;
+                float basis[SH_COEFFICIENTS] = { 1.0f, y, z, x, x * y, y * z, 3.0f * z * z - 1.0f, x * z, x * x - y * y };
+
+                for ( int k = 0; k < SH_COEFFICIENTS; k++ )
+                {
+                    for ( int c = 0; c < 3; c++ )
+                    {
+                        rowSums[k * 3 + c] += basis[k] * weight * texels[column * 4 + c];
+                    }
+                }
+                rowWeight += weight;
+            }
+
+            // Rows go into doubles so a 2048^2 face does not lose the small terms
+            for ( int k = 0; k < SH_COEFFICIENTS * 3; k++ )
+            {
+                sums[k] += rowSums[k];
+            }
+            this->weights[face] += rowWeight;
+        }
+    }
+
+    // Adds up the faces and turns the projection into irradiance coefficients, colours in [0, 1]
+    void Finish( )
+    {
+        // Every face covers the same solid angle, so one face's weight scales the sum to the full 4 pi.
+        // A face that failed to load counts as black, as it is on screen
+        double faceWeight = 0.0;
+        for ( int face = 0; face < 6; face++ )
+        {
+            faceWeight = std::max( faceWeight, this->weights[face] );
+        }
+
+        if ( 0.0 == faceWeight )
+        {
+            return;
+        }
+
+        // Basis constants Y_lm, and A_l / pi, the cosine lobe in band l over the Lambertian pi
+        static const double basisConstants[SH_COEFFICIENTS] = { 0.282095, 0.488603, 0.488603, 0.488603, 1.092548, 1.092548, 0.315392, 1.092548, 0.546274 };
+        static const double bandWeights[SH_COEFFICIENTS] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+        const double scale = 4.0 * 3.14159265358979 / ( 6.0 * faceWeight ) / 255.0;
+
+        for ( int k = 0; k < SH_COEFFICIENTS; k++ )
+        {
+            for ( int c = 0; c < 3; c++ )
+            {
+                double sum = 0.0;
+                for ( int face = 0; face < 6; face++ )
+                {
+                    sum += this->sums[face][k][c];
+                }
+
+                // The constant appears twice: once projecting, once evaluating
+                this->coefficients[k][c] = ( GLfloat )( bandWeights[k] * basisConstants[k] * basisConstants[k] * scale * sum );
+            }
+        }
+    }
+
+    // Sets the irradianceSH[9] array of a program, uniforms stay with the program so once is enough
+    void Upload( GLuint program ) const
+    {
+        glUseProgram( program );
+        glUniform3fv( glGetUniformLocation( program, "irradianceSH" ), SH_COEFFICIENTS, this->coefficients[0] );
+    }
+
+    const GLfloat *GetCoefficients( ) const
+    {
+        return this->coefficients[0];
+    }
+
+private:
+    double sums[6][SH_COEFFICIENTS][3];
+    double weights[6];
+    GLfloat coefficients[SH_COEFFICIENTS][3];
+};
+
+#endif
@@ -0,0 +1,797 @@
+#ifndef VirtualTexture_h
+#define VirtualTexture_h
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/image_helper.h"
+#include "SOIL2/image_arena.h"
+#include "SOIL2/stb_image_write.h"
+#include "Shader.h"
+
+// Page layout, shared with VirtualSample( ) in frag.vs and with vtfeedback.vs
+const GLint VT_PAGE_SIZE = 128;
+const GLint VT_PAGE_BORDER = 4;
+const GLint VT_SLOT_SIZE = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+
+// Pages uploaded per Update( ), bounds the hitch when the camera jumps
+const GLint VT_MAX_UPLOADS_PER_FRAME = 8;
+
+// Pages handed to the streaming thread per Update( ), the rest is asked for again next frame
+const GLint VT_MAX_REQUESTS = 64;
+
+// Streams a texture of any size through a fixed pool of 128x128 pages.
+// The source is tiled once into a page file (BuildPageFile), one PNG per page and mip level,
+// each page carrying a border copied from its neighbours so bilinear filtering works across pages.
+// At runtime a small feedback pass records which pages are visible, a worker thread decodes the
+// missing ones and Update( ) uploads them into the physical page texture, evicting the least
+// recently used pages. The page table has one texel per page and mip level; a texel points at
+// the page's slot, or at the slot of the closest coarser page that is resident. The coarsest
+// level is a single page that never leaves the cache, so every lookup resolves to something.
+class VirtualTexture
+{
+public:
+    // cacheSlots pages per side in the physical texture, 16 gives 256 pages in about 14 MB of RGB8
+    VirtualTexture( const std::string &pageFile, GLint cacheSlots = 16, GLint feedbackScale = 8 )
+    {
+        this->valid = false;
+        this->cacheSlots = std::max( 2, std::min( cacheSlots, 256 ) );
+        this->feedbackScale = std::max( 1, feedbackScale );
+        this->frame = 1;
+        this->pageTable = 0;
+        this->physical = 0;
+        this->feedbackFBO = 0;
+        this->feedbackColor = 0;
+        this->feedbackDepth = 0;
+        this->feedbackWidth = 0;
+        this->feedbackHeight = 0;
+        this->feedbackIndex = 0;
+        this->feedbackPBO[0] = this->feedbackPBO[1] = 0;
+        this->feedbackFilled[0] = this->feedbackFilled[1] = false;
+        this->stopping = false;
+
+        if ( !this->open( pageFile ) )
+        {
+            return;
+        }
+
+        this->createTextures( );
+
+        // The root page is loaded up front and pinned to slot 0
+        std::vector<unsigned char> root;
+        GLint rootPage = this->pageIndex( this->levels - 1, 0, 0 );
+
+        if ( !this->decodePage( rootPage, root ) )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::ROOT_PAGE " << pageFile << std::endl;
+            return;
+        }
+        this->uploadPage( 0, root );
+        this->slots[0].page = rootPage;
+        this->pageSlot[rootPage] = 0;
+        this->updatePageTable( );
+
+        this->worker = std::thread( &VirtualTexture::streamPages, this );
+        this->valid = true;
+    }
+
+    ~VirtualTexture( )
+    {
+        this->Clear( );
+    }
+
+    // Tiles a power-of-two image into a page file, from full resolution down to a single page
+    static bool BuildPageFile( const std::string &sourcePath, const std::string &pageFile )
+    {
+        int width, height, channels;
+        unsigned char *source = SOIL_load_image( sourcePath.c_str( ), &width, &height, &channels, SOIL_LOAD_RGB );
+
+        if ( NULL == source )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::LOAD_FAILED " << sourcePath << std::endl;
+            return false;
+        }
+
+        if ( ( width & ( width - 1 ) ) || ( height & ( height - 1 ) ) || width < VT_PAGE_SIZE || height < VT_PAGE_SIZE )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::SIZE_NOT_POWER_OF_TWO " << sourcePath << std::endl;
+            SOIL_free_image_data( source );
+            return false;
+        }
+
+        FileHeader header;
+        memcpy( header.magic, magic( ), sizeof( header.magic ) );
+        header.width = width;
+        header.height = height;
+        header.pageSize = VT_PAGE_SIZE;
+        header.border = VT_PAGE_BORDER;
+        header.levels = levelCount( width, height );
+        header.pageCount = 0;
+        for ( GLuint m = 0; m < header.levels; m++ )
+        {
+            header.pageCount += pagesAt( width, m ) * pagesAt( height, m );
+        }
+
+        // Written under a temporary name and renamed, a crash never leaves a half written page file behind
+        std::string tempFile = pageFile + ".tmp";
+        std::ofstream out( tempFile.c_str( ), std::ios::binary );
+        std::vector<FileEntry> entries( header.pageCount );
+        std::vector<unsigned char> slot( VT_SLOT_SIZE * VT_SLOT_SIZE * 3 );
+        std::vector<unsigned char> encoded;
+        std::vector<unsigned char> mip;
+        const unsigned char *level = source;
+        unsigned long long offset = sizeof( header ) + entries.size( ) * sizeof( FileEntry );
+        GLuint page = 0;
+
+        out.write( ( const char * )&header, sizeof( header ) );
+        out.write( ( const char * )&entries[0], entries.size( ) * sizeof( FileEntry ) );
+
+        for ( GLuint m = 0; m < header.levels; m++ )
+        {
+            int levelWidth = std::max( 1, width >> m );
+            int levelHeight = std::max( 1, height >> m );
+
+            for ( GLuint py = 0; py < pagesAt( height, m ); py++ )
+            {
+                for ( GLuint px = 0; px < pagesAt( width, m ); px++ )
+                {
+                    // Texture repeats, so the border wraps around the level
+                    for ( int y = 0; y < VT_SLOT_SIZE; y++ )
+                    {
+                        int sy = wrap( ( int )py * VT_PAGE_SIZE + y - VT_PAGE_BORDER, levelHeight );
+
+                        for ( int x = 0; x < VT_SLOT_SIZE; x++ )
+                        {
+                            int sx = wrap( ( int )px * VT_PAGE_SIZE + x - VT_PAGE_BORDER, levelWidth );
+                            memcpy( &slot[( y * VT_SLOT_SIZE + x ) * 3], &level[( ( size_t )sy * levelWidth + sx ) * 3], 3 );
+                        }
+                    }
+
+                    encoded.clear( );
+                    stbi_write_png_to_func( appendBytes, &encoded, VT_SLOT_SIZE, VT_SLOT_SIZE, 3, &slot[0], VT_SLOT_SIZE * 3 );
+                    entries[page].offset = offset;
+                    entries[page].size = ( GLuint )encoded.size( );
+                    entries[page].pad = 0;
+                    out.write( ( const char * )&encoded[0], encoded.size( ) );
+                    offset += encoded.size( );
+                    page++;
+                }
+            }
+
+            if ( m + 1 < header.levels )
+            {
+                std::vector<unsigned char> next( std::max( 1, levelWidth / 2 ) * std::max( 1, levelHeight / 2 ) * 3 );
+                mipmap_image( level, levelWidth, levelHeight, 3, &next[0], 2, 2 );
+                mip.swap( next );
+                level = &mip[0];
+            }
+        }
+        SOIL_free_image_data( source );
+
+        out.seekp( sizeof( header ) );
+        out.write( ( const char * )&entries[0], entries.size( ) * sizeof( FileEntry ) );
+        out.close( );
+
+        if ( !out || 0 != std::rename( tempFile.c_str( ), pageFile.c_str( ) ) )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::WRITE_FAILED " << pageFile << std::endl;
+            std::remove( tempFile.c_str( ) );
+            return false;
+        }
+
+        return true;
+    }
+
+    bool IsValid( ) const
+    {
+        return this->valid;
+    }
+
+    // Lines to pass to the Shader constructor of the shaders sampling through the page table
+    std::string ShaderDefines( ) const
+    {
+        return this->valid ? "#define VIRTUAL_TEXTURE\n" : "";
+    }
+
+    // Binds the page table to firstUnit and the physical pages to firstUnit + 1
+    void Attach( const Shader &shader, GLint firstUnit ) const
+    {
+        this->attach( shader, firstUnit, 0.0f );
+    }
+
+    // Same for the feedback shader, whose mips are biased to make up for its lower resolution
+    void AttachFeedback( const Shader &shader, GLint firstUnit ) const
+    {
+        this->attach( shader, firstUnit, -std::log2( ( GLfloat )this->feedbackScale ) );
+    }
+
+    // Redirects rendering to the low resolution feedback target, draw with the feedback shader after this
+    void BeginFeedback( GLint screenWidth, GLint screenHeight )
+    {
+        GLint width = std::max( 1, screenWidth / this->feedbackScale );
+        GLint height = std::max( 1, screenHeight / this->feedbackScale );
+        const GLuint none[4] = { 0, 0, 0, 0 };
+
+        if ( width != this->feedbackWidth || height != this->feedbackHeight )
+        {
+            this->createFeedback( width, height );
+        }
+
+        glBindFramebuffer( GL_FRAMEBUFFER, this->feedbackFBO );
+        glViewport( 0, 0, width, height );
+        glClearBufferuiv( GL_COLOR, 0, none );
+        glClear( GL_DEPTH_BUFFER_BIT );
+    }
+
+    // Queues the read back of the feedback target; it is only looked at a frame later so nothing stalls
+    void EndFeedback( GLint screenWidth, GLint screenHeight )
+    {
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, this->feedbackPBO[this->feedbackIndex] );
+        glReadPixels( 0, 0, this->feedbackWidth, this->feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+        this->feedbackFilled[this->feedbackIndex] = true;
+        this->feedbackIndex ^= 1;
+
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+        glViewport( 0, 0, screenWidth, screenHeight );
+    }
+
+    // Once per frame: requests the pages the feedback asked for and uploads the ones that arrived
+    void Update( )
+    {
+        this->frame++;
+        this->processFeedback( );
+
+        std::vector<LoadedPage> arrived;
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+
+            while ( !this->completed.empty( ) && ( GLint )arrived.size( ) < VT_MAX_UPLOADS_PER_FRAME )
+            {
+                arrived.push_back( LoadedPage( ) );
+                arrived.back( ).page = this->completed.front( ).page;
+                arrived.back( ).texels.swap( this->completed.front( ).texels );
+                this->completed.pop_front( );
+            }
+        }
+
+        bool changed = false;
+
+        for ( size_t i = 0; i < arrived.size( ); i++ )
+        {
+            GLint page = arrived[i].page;
+
+            this->requested[page] = 0;
+            if ( arrived[i].texels.empty( ) || this->pageSlot[page] >= 0 )
+            {
+                continue;
+            }
+
+            GLint slot = this->evictSlot( );
+            if ( slot < 0 )
+            {
+                continue;
+            }
+
+            this->uploadPage( slot, arrived[i].texels );
+            this->slots[slot].page = page;
+            this->slots[slot].lastUsed = this->frame;
+            this->pageSlot[page] = slot;
+            changed = true;
+        }
+
+        if ( changed )
+        {
+            this->updatePageTable( );
+        }
+    }
+
+    // Stops the streaming thread and deletes the GL objects; call it while the GL context is still current
+    void Clear( )
+    {
+        this->stopStreaming( );
+        this->valid = false;
+
+        if ( 0 != this->pageTable )
+        {
+            glDeleteTextures( 1, &this->pageTable );
+            this->pageTable = 0;
+        }
+        if ( 0 != this->physical )
+        {
+            glDeleteTextures( 1, &this->physical );
+            this->physical = 0;
+        }
+        if ( 0 != this->feedbackFBO )
+        {
+            glDeleteFramebuffers( 1, &this->feedbackFBO );
+            glDeleteTextures( 1, &this->feedbackColor );
+            glDeleteRenderbuffers( 1, &this->feedbackDepth );
+            glDeleteBuffers( 2, this->feedbackPBO );
+            this->feedbackFBO = 0;
+            this->feedbackColor = 0;
+            this->feedbackDepth = 0;
+            this->feedbackPBO[0] = this->feedbackPBO[1] = 0;
+            this->feedbackWidth = this->feedbackHeight = 0;
+            this->feedbackFilled[0] = this->feedbackFilled[1] = false;
+        }
+    }
+
+private:
+    static const char *magic( )
+    {
+        return "SOILVT1";
+    }
+
+    struct FileHeader
+    {
+        char magic[8];
+        GLuint width;
+        GLuint height;
+        GLuint pageSize;
+        GLuint border;
+        GLuint levels;
+        GLuint pageCount;
+    };
+
+    struct FileEntry
+    {
+        unsigned long long offset;
+        GLuint size;
+        GLuint pad;
+    };
+
+    struct Slot
+    {
+        GLint page;
+        GLuint lastUsed;
+    };
+
+    struct LoadedPage
+    {
+        GLint page;
+        std::vector<unsigned char> texels;      // empty if decoding failed
+    };
+
+    bool valid;
+    GLint cacheSlots, feedbackScale;
+    GLuint frame;
+
+    // Page file
+    std::ifstream file;
+    FileHeader header;
+    std::vector<FileEntry> entries;
+    GLint levels;
+    std::vector<GLint> levelFirst, levelPagesX, levelPagesY;
+
+    // Residency, only touched by the render thread
+    std::vector<GLint> pageSlot;            // slot of each page, -1 when not resident
+    std::vector<GLuint> pageSeen;           // last frame the feedback asked for the page
+    std::vector<char> requested;            // queued, being decoded or waiting for upload
+    std::vector<Slot> slots;
+    std::vector< std::vector<GLubyte> > tableLevels;
+
+    GLuint pageTable, physical;
+    GLuint feedbackFBO, feedbackColor, feedbackDepth;
+    GLint feedbackWidth, feedbackHeight;
+    GLuint feedbackPBO[2];
+    bool feedbackFilled[2];
+    int feedbackIndex;
+
+    // Shared with the streaming thread
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<GLint> wanted;
+    std::deque<LoadedPage> completed;
+    bool stopping;
+
+    static GLuint levelCount( GLuint width, GLuint height )
+    {
+        GLuint levels = 1;
+
+        while ( ( width >> ( levels - 1 ) ) > ( GLuint )VT_PAGE_SIZE || ( height >> ( levels - 1 ) ) > ( GLuint )VT_PAGE_SIZE )
+        {
+            levels++;
+        }
+
+        return levels;
+    }
+
+    static GLuint pagesAt( GLuint size, GLuint level )
+    {
+        return std::max( 1u, ( size >> level ) / VT_PAGE_SIZE );
+    }
+
+    static int wrap( int value, int size )
+    {
+        return ( ( value % size ) + size ) % size;
+    }
+
+    static void appendBytes( void *context, void *data, int size )
+    {
+        std::vector<unsigned char> *bytes = ( std::vector<unsigned char> * )context;
+        bytes->insert( bytes->end( ), ( unsigned char * )data, ( unsigned char * )data + size );
+    }
+
+    GLint pageIndex( GLint level, GLint x, GLint y ) const
+    {
+        return this->levelFirst[level] + y * this->levelPagesX[level] + x;
+    }
+
+    bool open( const std::string &pageFile )
+    {
+        this->file.open( pageFile.c_str( ), std::ios::binary );
+        if ( !this->file.read( ( char * )&this->header, sizeof( this->header ) ) ||
+             0 != memcmp( this->header.magic, magic( ), sizeof( this->header.magic ) ) ||
+             ( GLint )this->header.pageSize != VT_PAGE_SIZE || ( GLint )this->header.border != VT_PAGE_BORDER ||
+             this->header.levels != levelCount( this->header.width, this->header.height ) )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_PAGE_FILE " << pageFile << std::endl;
+            return false;
+        }
+
+        this->levels = this->header.levels;
+        GLint pages = 0;
+
+        for ( GLint m = 0; m < this->levels; m++ )
+        {
+            this->levelFirst.push_back( pages );
+            this->levelPagesX.push_back( pagesAt( this->header.width, m ) );
+            this->levelPagesY.push_back( pagesAt( this->header.height, m ) );
+            this->tableLevels.push_back( std::vector<GLubyte>( this->levelPagesX[m] * this->levelPagesY[m] * 4 ) );
+            pages += this->levelPagesX[m] * this->levelPagesY[m];
+        }
+
+        if ( ( GLuint )pages != this->header.pageCount )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_PAGE_FILE " << pageFile << std::endl;
+            return false;
+        }
+
+        this->entries.resize( pages );
+        if ( !this->file.read( ( char * )&this->entries[0], pages * sizeof( FileEntry ) ) )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_PAGE_FILE " << pageFile << std::endl;
+            return false;
+        }
+
+        this->pageSlot.assign( pages, -1 );
+        this->pageSeen.assign( pages, 0 );
+        this->requested.assign( pages, 0 );
+
+        Slot empty = { -1, 0 };
+        this->slots.assign( this->cacheSlots * this->cacheSlots, empty );
+
+        return true;
+    }
+
+    // Only called by the streaming thread once it runs, so the file needs no lock
+    bool decodePage( GLint page, std::vector<unsigned char> &texels )
+    {
+        std::vector<unsigned char> encoded( this->entries[page].size );
+        int width, height, channels;
+
+        this->file.clear( );
+        this->file.seekg( this->entries[page].offset );
+        if ( encoded.empty( ) || !this->file.read( ( char * )&encoded[0], encoded.size( ) ) )
+        {
+            return false;
+        }
+
+        unsigned char *image = SOIL_load_image_from_memory( &encoded[0], ( int )encoded.size( ), &width, &height, &channels, SOIL_LOAD_RGB );
+        if ( NULL == image || VT_SLOT_SIZE != width || VT_SLOT_SIZE != height )
+        {
+            SOIL_free_image_data( image );
+            return false;
+        }
+
+        texels.assign( image, image + VT_SLOT_SIZE * VT_SLOT_SIZE * 3 );
+        SOIL_free_image_data( image );
+
+        return true;
+    }
+
+    void stopStreaming( )
+    {
+        if ( this->worker.joinable( ) )
+        {
+            {
+                std::lock_guard<std::mutex> lock( this->mutex );
+                this->stopping = true;
+            }
+            this->wakeup.notify_one( );
+            this->worker.join( );
+        }
+    }
+
+    void streamPages( )
+    {
+        std::unique_lock<std::mutex> lock( this->mutex );
+
+        while ( true )
+        {
+            while ( !this->stopping && this->wanted.empty( ) )
+            {
+                this->wakeup.wait( lock );
+            }
+
+            if ( this->stopping )
+            {
+                break;
+            }
+
+            LoadedPage loaded;
+            loaded.page = this->wanted.front( );
+            this->wanted.pop_front( );
+
+            lock.unlock( );
+            if ( !this->decodePage( loaded.page, loaded.texels ) )
+            {
+                loaded.texels.clear( );
+            }
+            lock.lock( );
+
+            this->completed.push_back( LoadedPage( ) );
+            this->completed.back( ).page = loaded.page;
+            this->completed.back( ).texels.swap( loaded.texels );
+        }
+
+        lock.unlock( );
+        SOIL_arena_release( );
+    }
+
+    void createTextures( )
+    {
+        GLint size = this->cacheSlots * VT_SLOT_SIZE;
+
+        // Fixed size whatever the source resolution
+        glGenTextures( 1, &this->physical );
+        glBindTexture( GL_TEXTURE_2D, this->physical );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+
+        // One RGBA8UI texel per page: slot x, slot y, mip level of the page in that slot
+        glGenTextures( 1, &this->pageTable );
+        glBindTexture( GL_TEXTURE_2D, this->pageTable );
+        for ( GLint m = 0; m < this->levels; m++ )
+        {
+            glTexImage2D( GL_TEXTURE_2D, m, GL_RGBA8UI, this->levelPagesX[m], this->levelPagesY[m], 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL );
+        }
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levels - 1 );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+
+    void createFeedback( GLint width, GLint height )
+    {
+        glDeleteTextures( 1, &this->feedbackColor );
+        glDeleteRenderbuffers( 1, &this->feedbackDepth );
+        glDeleteFramebuffers( 1, &this->feedbackFBO );
+        glDeleteBuffers( 2, this->feedbackPBO );
+
+        this->feedbackWidth = width;
+        this->feedbackHeight = height;
+        this->feedbackFilled[0] = this->feedbackFilled[1] = false;
+
+        // Each texel holds page x, page y, mip level and 1 where a virtual textured surface was drawn
+        glGenTextures( 1, &this->feedbackColor );
+        glBindTexture( GL_TEXTURE_2D, this->feedbackColor );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA16UI, width, height, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        glGenRenderbuffers( 1, &this->feedbackDepth );
+        glBindRenderbuffer( GL_RENDERBUFFER, this->feedbackDepth );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height );
+        glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+        glGenFramebuffers( 1, &this->feedbackFBO );
+        glBindFramebuffer( GL_FRAMEBUFFER, this->feedbackFBO );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->feedbackColor, 0 );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->feedbackDepth );
+        if ( GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus( GL_FRAMEBUFFER ) )
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER" << std::endl;
+        }
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+        glGenBuffers( 2, this->feedbackPBO );
+        for ( int i = 0; i < 2; i++ )
+        {
+            glBindBuffer( GL_PIXEL_PACK_BUFFER, this->feedbackPBO[i] );
+            glBufferData( GL_PIXEL_PACK_BUFFER, width * height * 4 * sizeof( GLushort ), NULL, GL_STREAM_READ );
+        }
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    }
+
+    void attach( const Shader &shader, GLint firstUnit, GLfloat mipBias ) const
+    {
+        glActiveTexture( GL_TEXTURE0 + firstUnit );
+        glBindTexture( GL_TEXTURE_2D, this->pageTable );
+        glActiveTexture( GL_TEXTURE0 + firstUnit + 1 );
+        glBindTexture( GL_TEXTURE_2D, this->physical );
+        glActiveTexture( GL_TEXTURE0 );
+
+        glUseProgram( shader.Program );
+        glUniform1i( glGetUniformLocation( shader.Program, "vtPageTable" ), firstUnit );
+        glUniform1i( glGetUniformLocation( shader.Program, "vtPhysical" ), firstUnit + 1 );
+        glUniform4f( glGetUniformLocation( shader.Program, "vtSize" ), ( GLfloat )this->header.width, ( GLfloat )this->header.height, ( GLfloat )( this->levels - 1 ), mipBias );
+        glUniform2f( glGetUniformLocation( shader.Program, "vtPhysicalSize" ), ( GLfloat )( this->cacheSlots * VT_SLOT_SIZE ), ( GLfloat )( this->cacheSlots * VT_SLOT_SIZE ) );
+    }
+
+    // Reads the feedback written a frame ago and hands the missing pages to the streaming thread
+    void processFeedback( )
+    {
+        int index = this->feedbackIndex;
+
+        if ( !this->feedbackFilled[index] )
+        {
+            return;
+        }
+        this->feedbackFilled[index] = false;
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, this->feedbackPBO[index] );
+        const GLushort *texels = ( const GLushort * )glMapBuffer( GL_PIXEL_PACK_BUFFER, GL_READ_ONLY );
+        std::vector< std::pair<GLint, GLint> > missing;        // level, page
+
+        if ( NULL != texels )
+        {
+            for ( GLint i = 0; i < this->feedbackWidth * this->feedbackHeight; i++ )
+            {
+                const GLushort *texel = &texels[i * 4];
+                GLint level = texel[2];
+
+                if ( 0 == texel[3] || level >= this->levels )
+                {
+                    continue;
+                }
+
+                GLint x = std::min( ( GLint )texel[0], this->levelPagesX[level] - 1 );
+                GLint y = std::min( ( GLint )texel[1], this->levelPagesY[level] - 1 );
+
+                // A page needs its parents too, coarser pages are what is shown until it arrives
+                for ( ; level < this->levels; level++, x /= 2, y /= 2 )
+                {
+                    GLint page = this->pageIndex( level, x, y );
+
+                    if ( this->pageSeen[page] == this->frame )
+                    {
+                        break;
+                    }
+                    this->pageSeen[page] = this->frame;
+
+                    if ( this->pageSlot[page] >= 0 )
+                    {
+                        this->slots[this->pageSlot[page]].lastUsed = this->frame;
+                    }
+                    else if ( !this->requested[page] )
+                    {
+                        missing.push_back( std::make_pair( level, page ) );
+                    }
+                }
+            }
+            glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+        }
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        // Coarse pages first, they cover the most screen
+        std::sort( missing.begin( ), missing.end( ), std::greater< std::pair<GLint, GLint> >( ) );
+        if ( ( GLint )missing.size( ) > VT_MAX_REQUESTS )
+        {
+            missing.resize( VT_MAX_REQUESTS );
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+
+            // Requests the thread hasn't started on are replaced by this frame's
+            for ( size_t i = 0; i < this->wanted.size( ); i++ )
+            {
+                this->requested[this->wanted[i]] = 0;
+            }
+            this->wanted.clear( );
+            for ( size_t i = 0; i < missing.size( ); i++ )
+            {
+                this->wanted.push_back( missing[i].second );
+                this->requested[missing[i].second] = 1;
+            }
+        }
+
+        if ( !missing.empty( ) )
+        {
+            this->wakeup.notify_one( );
+        }
+    }
+
+    // Least recently used slot that wasn't needed this frame, -1 if the whole cache is in view
+    GLint evictSlot( )
+    {
+        GLint best = -1;
+
+        // Slot 0 holds the root page for good
+        for ( GLint i = 1; i < ( GLint )this->slots.size( ); i++ )
+        {
+            if ( this->slots[i].lastUsed != this->frame && ( best < 0 || this->slots[i].lastUsed < this->slots[best].lastUsed ) )
+            {
+                best = i;
+            }
+        }
+
+        if ( best >= 0 && this->slots[best].page >= 0 )
+        {
+            this->pageSlot[this->slots[best].page] = -1;
+            this->slots[best].page = -1;
+        }
+
+        return best;
+    }
+
+    void uploadPage( GLint slot, const std::vector<unsigned char> &texels )
+    {
+        glBindTexture( GL_TEXTURE_2D, this->physical );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+        glTexSubImage2D( GL_TEXTURE_2D, 0, ( slot % this->cacheSlots ) * VT_SLOT_SIZE, ( slot / this->cacheSlots ) * VT_SLOT_SIZE,
+                        VT_SLOT_SIZE, VT_SLOT_SIZE, GL_RGB, GL_UNSIGNED_BYTE, &texels[0] );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+
+    // Every page points at itself when resident, otherwise at whatever its parent points at
+    void updatePageTable( )
+    {
+        glBindTexture( GL_TEXTURE_2D, this->pageTable );
+
+        for ( GLint m = this->levels - 1; m >= 0; m-- )
+        {
+            std::vector<GLubyte> &table = this->tableLevels[m];
+
+            for ( GLint y = 0; y < this->levelPagesY[m]; y++ )
+            {
+                for ( GLint x = 0; x < this->levelPagesX[m]; x++ )
+                {
+                    GLint slot = this->pageSlot[this->pageIndex( m, x, y )];
+                    GLubyte *entry = &table[( y * this->levelPagesX[m] + x ) * 4];
+
+                    if ( slot >= 0 )
+                    {
+                        entry[0] = ( GLubyte )( slot % this->cacheSlots );
+                        entry[1] = ( GLubyte )( slot / this->cacheSlots );
+                        entry[2] = ( GLubyte )m;
+                        entry[3] = 255;
+                    }
+                    else
+                    {
+                        memcpy( entry, &this->tableLevels[m + 1][( ( y / 2 ) * this->levelPagesX[m + 1] + x / 2 ) * 4], 4 );
+                    }
+                }
+            }
+
+            glTexSubImage2D( GL_TEXTURE_2D, m, 0, 0, this->levelPagesX[m], this->levelPagesY[m], GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &table[0] );
+        }
+
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+};
+
+#endif
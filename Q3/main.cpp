@@ -1,5 +1,9 @@
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
 
 // GLEW
 #define GLEW_STATIC
@@ -20,12 +24,26 @@
 #include "Shader.h"
 #include "Camera.h"
 #include "CubeMap.h"
+#include "MaterialTextures.h"
+#include "VirtualTexture.h"
+#include "ClusteredLights.h"
+#include "DeferredRenderer.h"
+#include "DepthPrepass.h"
+#include "ShadowCubes.h"
+#include "SoftwareRenderer.h"
+#include "MaskedOcclusion.h"
+#include "HiZCulling.h"
 
 
 // Function prototypes
 void KeyCallback( GLFWwindow *window, int key, int scancode, int action, int mode );
 void MouseCallback( GLFWwindow *window, double xPos, double yPos );
 void DoMovement( );
+void PlaceLights( std::vector<ClusterLight> &lights, GLuint count, GLfloat time );
+int RenderSoftware( const std::string &image, const GLfloat *vertices, GLsizei vertexCount, const GLfloat *skyboxVertices,
+                    const std::vector<std::string> &faces );
+int BenchmarkSoftware( );
+int BenchmarkOcclusion( const GLfloat *vertices, GLsizei vertexCount );
 
 // Window dimensions
 const GLuint WIDTH = 800, HEIGHT = 600;
@@ -41,6 +59,38 @@ bool firstMouse = true;
 // Light attributes
 glm::vec3 lightPos( 0.1f, 0.1f, 0.1f );
 
+// Press L to double the number of point lights, up to MAX_LIGHTS and back to 1
+const GLuint MAX_LIGHTS = 4096;
+GLuint lightCount = 1;
+
+// Frames averaged per light count and path by --light-benchmark
+const GLuint BENCHMARK_FRAMES = 60;
+
+// Pixels --software-benchmark draws per triangle size, spread over as many triangles as that takes
+const GLdouble SOFTWARE_BENCHMARK_PIXELS = 2.0e7;
+
+// Boxes --occlusion-benchmark culls behind a wall of occluders, and how many times it does
+const GLsizei OCCLUSION_BENCHMARK_BOXES = 100000;
+const GLuint OCCLUSION_BENCHMARK_RUNS = 50;
+
+// Press G to switch between forward (clustered) and deferred shading
+bool deferredShading = false;
+
+// Press P to cycle the depth pre-pass between auto (on while the overdraw makes it pay), on and off
+DepthPrepassMode prepassMode = PREPASS_AUTO;
+
+// Where the lamps hidden by the box are culled: nowhere, on the CPU ahead of the draw, or on the GPU
+// against the box's depth, which falls back to the CPU where the driver lacks compute shaders
+enum OcclusionMode
+{
+    OCCLUSION_OFF,
+    OCCLUSION_CPU,
+    OCCLUSION_GPU
+};
+
+// Press O to cycle the occlusion culling of the lamps behind the box between GPU, off and CPU
+OcclusionMode occlusionMode = OCCLUSION_GPU;
+
 //Keep B key pressed to display Bill-phong shading
 GLfloat blinn = 0.0;
 bool blinnkeypressed = false;
@@ -54,59 +104,32 @@ GLfloat deltaTime = 0.0f;    // Time between current frame and last frame
 GLfloat lastFrame = 0.0f;      // Time of last frame
 
 // The MAIN function, from here we start the application and run the game loop
-int main( )
+int main( int argc, char **argv )
 {
-    // Init GLFW
-    glfwInit( );
-    // Set all the required options for GLFW
-    glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
-    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 3 );
-    glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
-    glfwWindowHint( GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE );
-    glfwWindowHint( GLFW_RESIZABLE, GL_FALSE );
-    
-    // Create a GLFWwindow object that we can use for GLFW's functions
-    GLFWwindow* window = glfwCreateWindow( WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr );
-    
-    if ( nullptr == window )
-    {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate( );
-        
-        return EXIT_FAILURE;
-    }
-    
-    glfwMakeContextCurrent( window );
-    
-    glfwGetFramebufferSize( window, &SCREEN_WIDTH, &SCREEN_HEIGHT );
-    
-    // Set the required callback functions
-    glfwSetKeyCallback( window, KeyCallback );
-    glfwSetCursorPosCallback( window, MouseCallback );
-    
-    // GLFW Options
-    glfwSetInputMode( window, GLFW_CURSOR, GLFW_CURSOR_DISABLED );
-    
-    // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
-    glewExperimental = GL_TRUE;
-    // Initialize GLEW to setup the OpenGL Function pointers
-    if ( GLEW_OK != glewInit( ) )
+    // --light-benchmark renders each light count from 1 to MAX_LIGHTS forward, then deferred, and prints the frame times
+    // --derivative-tangents leaves the tangents out of the box's vertices, frag.vs derives them from screen-space derivatives
+    // --software <image> renders a frame on the CPU into the image, no window or GPU needed
+    // --software-benchmark prints the CPU rasterizer's triangles and pixels per second for triangles of several sizes
+    // --occlusion-benchmark prints how long the software occlusion culling takes for OCCLUSION_BENCHMARK_BOXES boxes
+    bool lightBenchmark = false;
+    bool derivativeTangents = false;
+    bool occlusionBenchmark = false;
+    std::string softwareImage;
+    for ( int i = 1; i < argc; i++ )
     {
-        std::cout << "Failed to initialize GLEW" << std::endl;
-        return EXIT_FAILURE;
+        lightBenchmark = lightBenchmark || 0 == strcmp( argv[i], "--light-benchmark" );
+        derivativeTangents = derivativeTangents || 0 == strcmp( argv[i], "--derivative-tangents" );
+        occlusionBenchmark = occlusionBenchmark || 0 == strcmp( argv[i], "--occlusion-benchmark" );
+        if ( 0 == strcmp( argv[i], "--software-benchmark" ) )
+        {
+            return BenchmarkSoftware( );
+        }
+        if ( 0 == strcmp( argv[i], "--software" ) && i + 1 < argc )
+        {
+            softwareImage = argv[++i];
+        }
     }
     
-    // Define the viewport dimensions
-    glViewport( 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT );
-    
-    // OpenGL options
-    glEnable( GL_DEPTH_TEST );
-    
-    
-    // Build and compile our shader program
-    Shader PointShader( "resources/shaders/core.vs", "resources/shaders/frag.vs" );
-    Shader lampShader( "resources/shaders/lightcore.vs", "resources/shaders/lightfrag.vs" );
-    
     // Set up vertex data (and buffer(s)) and attribute pointers
     GLfloat vertices[] =
     {
@@ -154,93 +177,6 @@ int main( )
         -0.2f,  0.2f, -0.2f,    0.0f,  1.0f,  0.0f,     0.0f,  1.0f,            0.0f, 0.0f, -1.0f,   -1.0f, 0.0f, 0.0f
     };
     
-    
-    
-    // First, set the container's VAO (and VBO)
-    GLuint VBO, boxVAO;
-    glGenVertexArrays( 1, &boxVAO );
-    glGenBuffers( 1, &VBO );
-    
-    glBindBuffer( GL_ARRAY_BUFFER, VBO );
-    glBufferData( GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW );
-    
-    glBindVertexArray( boxVAO );
-    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )0 );
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 3 * sizeof( GLfloat ) ) );
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 6 * sizeof( GLfloat ) ) );
-    glEnableVertexAttribArray( 2 );
-    glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 8 * sizeof( GLfloat ) ) );
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 11 * sizeof( GLfloat ) ) );
-    glEnableVertexAttribArray(4);
-    glBindVertexArray( 0 );
-    
-    // Then, we set the light's VAO (VBO stays the same. After all, the vertices are the same for the light object (also a 3D cube))
-    GLuint lightVAO;
-    glGenVertexArrays( 1, &lightVAO );
-    glBindVertexArray( lightVAO );
-    // We only need to bind to the VBO (to link it with glVertexAttribPointer), no need to fill it; the VBO's data already contains all we need.
-    glBindBuffer( GL_ARRAY_BUFFER, VBO );
-    // Set the vertex attributes (only position data for the lamp))
-    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )0 ); // Note that we skip over the other data in our buffer object (we don't need the normals/textures, only positions).
-    glEnableVertexAttribArray( 0 );
-    glBindVertexArray( 0 );
-    
-    
-    // Load textures
-    GLuint diffuseMap, specularMap, normalMap;
-    glGenTextures( 1, &diffuseMap );
-    glGenTextures( 1, &specularMap );
-    glGenTextures(1, &normalMap);
-    
-    int imageWidth, imageHeight;
-    unsigned char *image;
-    
-    // Diffuse map
-    image = SOIL_load_image( "resources/images/ROCK035_2K_Color.jpg", &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB );
-    glBindTexture( GL_TEXTURE_2D, diffuseMap );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
-    SOIL_free_image_data( image );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST );
-    
-    // Specular map
-    image = SOIL_load_image( "resources/images/ROCK035_2K_Displacement.jpg", &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB );
-    glBindTexture( GL_TEXTURE_2D, specularMap );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
-    SOIL_free_image_data( image );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST );
-    glBindTexture( GL_TEXTURE_2D, 0 );
-    
-    //Normal map
-    image = SOIL_load_image( "resources/images/ROCK035_2K_Normal.jpg", &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB );
-    glBindTexture( GL_TEXTURE_2D, normalMap );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
-    SOIL_free_image_data( image );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST );
-    glBindTexture( GL_TEXTURE_2D, 0 );
-    
-    
-    // Set texture units
-    PointShader.Use( );
-    glUniform1i( glGetUniformLocation( PointShader.Program, "material.diffuse" ), 0 );
-    glUniform1i( glGetUniformLocation( PointShader.Program, "material.specular" ), 1 );
-    glUniform1i( glGetUniformLocation( PointShader.Program, "material.normal" ), 2 );
-
-    
     //Skybox
     std::vector<std::string> faces =
     {
@@ -251,7 +187,6 @@ int main( )
         "resources/images/front.png",
         "resources/images/back.png"
     };
-    unsigned int cubemapTexture = loadCubemap(faces);
     
     float skyboxVertices[] = {
         // positions
@@ -298,7 +233,255 @@ int main( )
         1.0f, -1.0f,  1.0f
     };
     
+    // Without a GPU: one frame with the default camera, rendered on the CPU and saved
+    if ( !softwareImage.empty( ) )
+    {
+        return RenderSoftware( softwareImage, vertices, sizeof( vertices ) / sizeof( GLfloat ) / 14, skyboxVertices, faces );
+    }
+    if ( occlusionBenchmark )
+    {
+        return BenchmarkOcclusion( vertices, sizeof( vertices ) / sizeof( GLfloat ) / 14 );
+    }
+    
+    // Init GLFW
+    glfwInit( );
+    // Set all the required options for GLFW
+    glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
+    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 3 );
+    glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
+    glfwWindowHint( GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE );
+    glfwWindowHint( GLFW_RESIZABLE, GL_FALSE );
+    
+    // Create a GLFWwindow object that we can use for GLFW's functions
+    GLFWwindow* window = glfwCreateWindow( WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr );
+    
+    if ( nullptr == window )
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate( );
+        
+        return EXIT_FAILURE;
+    }
+    
+    glfwMakeContextCurrent( window );
+    
+    glfwGetFramebufferSize( window, &SCREEN_WIDTH, &SCREEN_HEIGHT );
+    
+    // Set the required callback functions
+    glfwSetKeyCallback( window, KeyCallback );
+    glfwSetCursorPosCallback( window, MouseCallback );
+    
+    // GLFW Options
+    glfwSetInputMode( window, GLFW_CURSOR, GLFW_CURSOR_DISABLED );
+    
+    // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
+    glewExperimental = GL_TRUE;
+    // Initialize GLEW to setup the OpenGL Function pointers
+    if ( GLEW_OK != glewInit( ) )
+    {
+        std::cout << "Failed to initialize GLEW" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    // Define the viewport dimensions
+    glViewport( 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT );
+    
+    // OpenGL options
+    glEnable( GL_DEPTH_TEST );
+    
+    if ( lightBenchmark )
+    {
+        glfwSwapInterval( 0 );
+    }
+    
+    
+    // Material maps live in texture arrays (or bindless handles), the shader is built for whichever is used
+    MaterialTextures materials( 2048, 2048 );
+    
+    // The rock's color map is streamed through a virtual texture, so its size isn't bound by VRAM.
+    // The page file is cut from the source image on the first run.
+    const std::string rockColorPages = "resources/images/ROCK035_2K_Color.jpg.vtpages";
+    if ( !std::ifstream( rockColorPages.c_str( ) ) )
+    {
+        VirtualTexture::BuildPageFile( "resources/images/ROCK035_2K_Color.jpg", rockColorPages );
+    }
+    VirtualTexture rockColor( rockColorPages );
+    
+    // Build and compile our shader program
+    const std::string TangentDefines = derivativeTangents ? "#define DERIVATIVE_TANGENTS\n" : "";
+    const std::string PointDefines = materials.ShaderDefines( ) + rockColor.ShaderDefines( ) + ShadowCubes::ShaderDefines( ) + TangentDefines;
+    Shader PointShader( "resources/shaders/core.vs", "resources/shaders/frag.vs", PointDefines );
+    Shader feedbackShader( "resources/shaders/core.vs", "resources/shaders/vtfeedback.vs", TangentDefines );
+    Shader lampShader( "resources/shaders/lightcore.vs", "resources/shaders/lightfrag.vs" );
+    
+    
+    
+    // First, set the container's VAO (and VBO)
+    GLuint VBO, boxVAO;
+    glGenVertexArrays( 1, &boxVAO );
+    glGenBuffers( 1, &VBO );
+    
+    glBindBuffer( GL_ARRAY_BUFFER, VBO );
+    glBufferData( GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW );
+    
+    glBindVertexArray( boxVAO );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )0 );
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 3 * sizeof( GLfloat ) ) );
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 6 * sizeof( GLfloat ) ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 8 * sizeof( GLfloat ) ) );
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )( 11 * sizeof( GLfloat ) ) );
+    glEnableVertexAttribArray(4);
+    glBindVertexArray( 0 );
+    
+    // Without tangents the box is drawn from its own 8 float vertices: position, normal and texture coords
+    GLuint compactVBO = 0;
+    if ( derivativeTangents )
+    {
+        std::vector<GLfloat> compact;
+        for ( size_t v = 0; v < sizeof( vertices ) / sizeof( GLfloat ); v += 14 )
+        {
+            compact.insert( compact.end( ), vertices + v, vertices + v + 8 );
+        }
+        
+        glGenBuffers( 1, &compactVBO );
+        glBindBuffer( GL_ARRAY_BUFFER, compactVBO );
+        glBufferData( GL_ARRAY_BUFFER, compact.size( ) * sizeof( GLfloat ), &compact[0], GL_STATIC_DRAW );
+        
+        glBindVertexArray( boxVAO );
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof( GLfloat ), ( GLvoid * )0 );
+        glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof( GLfloat ), ( GLvoid * )( 3 * sizeof( GLfloat ) ) );
+        glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof( GLfloat ), ( GLvoid * )( 6 * sizeof( GLfloat ) ) );
+        glDisableVertexAttribArray( 3 );
+        glDisableVertexAttribArray( 4 );
+        glBindVertexArray( 0 );
+    }
+    
+    // Then, we set the light's VAO (VBO stays the same. After all, the vertices are the same for the light object (also a 3D cube))
+    GLuint lightVAO;
+    glGenVertexArrays( 1, &lightVAO );
+    glBindVertexArray( lightVAO );
+    // We only need to bind to the VBO (to link it with glVertexAttribPointer), no need to fill it; the VBO's data already contains all we need.
+    glBindBuffer( GL_ARRAY_BUFFER, VBO );
+    // Set the vertex attributes (only position data for the lamp))
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )0 ); // Note that we skip over the other data in our buffer object (we don't need the normals/textures, only positions).
+    glEnableVertexAttribArray( 0 );
+    // One lamp per light, drawn instanced: position and size, then colour, per instance
+    GLuint lampVBO;
+    glGenBuffers( 1, &lampVBO );
+    glBindBuffer( GL_ARRAY_BUFFER, lampVBO );
+    glBufferData( GL_ARRAY_BUFFER, MAX_LIGHTS * 7 * sizeof( GLfloat ), NULL, GL_STREAM_DRAW );
+    glVertexAttribPointer( 1, 4, GL_FLOAT, GL_FALSE, 7 * sizeof( GLfloat ), ( GLvoid * )0 );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribDivisor( 1, 1 );
+    glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, 7 * sizeof( GLfloat ), ( GLvoid * )( 4 * sizeof( GLfloat ) ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribDivisor( 2, 1 );
+    glBindVertexArray( 0 );
+    
+    // The box hides the lamps behind it from the instanced draw, found on the CPU ahead of it or on the
+    // GPU by testing them against its depth, whose pyramid goes on the unit after the shadows
+    MaskedOcclusion occlusion;
+    std::vector<OcclusionBox> lampBoxes;
+    std::vector<GLuint> visibleLamps;
+    std::vector<GLfloat> visibleLampData;
+    GLsizei lampsDrawn = 0, lampsCulled = 0;
+    HiZCulling hiz( MATERIAL_TEXTURE_UNITS + 12 );
+    
+    // The GPU culled lamps come packed in a buffer of the culling's own, and their count with the draw
+    GLuint culledLightVAO;
+    glGenVertexArrays( 1, &culledLightVAO );
+    glBindVertexArray( culledLightVAO );
+    glBindBuffer( GL_ARRAY_BUFFER, VBO );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )0 );
+    glEnableVertexAttribArray( 0 );
+    if ( hiz.IsSupported( ) )
+    {
+        glBindBuffer( GL_ARRAY_BUFFER, hiz.GetInstances( ) );
+        glVertexAttribPointer( 1, 4, GL_FLOAT, GL_FALSE, 7 * sizeof( GLfloat ), ( GLvoid * )0 );
+        glEnableVertexAttribArray( 1 );
+        glVertexAttribDivisor( 1, 1 );
+        glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, 7 * sizeof( GLfloat ), ( GLvoid * )( 4 * sizeof( GLfloat ) ) );
+        glEnableVertexAttribArray( 2 );
+        glVertexAttribDivisor( 2, 1 );
+    }
+    glBindVertexArray( 0 );
+    
+    // And a VAO with the box's positions alone for the depth pre-pass
+    GLuint depthVAO;
+    glGenVertexArrays( 1, &depthVAO );
+    glBindVertexArray( depthVAO );
+    glBindBuffer( GL_ARRAY_BUFFER, VBO );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof( GLfloat ), ( GLvoid * )0 );
+    glEnableVertexAttribArray( 0 );
+    glBindVertexArray( 0 );
+    
+    
+    // Load textures: diffuse, specular and normal map of each material. The rock's color map stays out of
+    // the arrays while its virtual texture streams it, so only the resident pages take texture memory
+    GLint rock = materials.Add( rockColor.IsValid( ) ? "" : "resources/images/ROCK035_2K_Color.jpg",
+                                "resources/images/ROCK035_2K_Displacement.jpg",
+                                "resources/images/ROCK035_2K_Normal.jpg" );
+    materials.Build( );
+    
+    // Bind the material maps once, draws only select a material index from here on
+    materials.Attach( PointShader );
+    
+    // Page table and physical pages go after the skybox unit
+    if ( rockColor.IsValid( ) )
+    {
+        rockColor.Attach( PointShader, MATERIAL_TEXTURE_UNITS + 1 );
+        rockColor.AttachFeedback( feedbackShader, MATERIAL_TEXTURE_UNITS + 1 );
+    }
+
+    
+    // Faces decode in parallel and are stored as BC1, an eighth of the uncompressed size.
+    // The same pass projects them onto the harmonics that light the scene's ambient term,
+    // and prefilters them for reflections (cached, so only the first run pays for it)
+    SphericalHarmonics skyIrradiance;
+    SpecularEnvironment skyReflections;
+    unsigned int cubemapTexture = loadCubemap( faces, CUBEMAP_COMPRESS, &skyIrradiance, &skyReflections );
+    skyIrradiance.Upload( PointShader.Program );
+    
+    // Reflections go after the virtual texture's units, the light buffers after them
+    skyReflections.Attach( PointShader, MATERIAL_TEXTURE_UNITS + 3 );
+    
+    ClusteredLights clusters;
+    clusters.Attach( PointShader, MATERIAL_TEXTURE_UNITS + 4 );
+    std::vector<ClusterLight> lights;
+    std::vector<GLfloat> lamps;
+    
+    // The deferred path draws the box into a G-buffer with the same material maps and lights it with the
+    // same sky, its light buffer and G-buffer maps go after the clustered path's units
+    DeferredRenderer deferred( PointDefines, MATERIAL_TEXTURE_UNITS + 7 );
+    materials.Attach( deferred.GeometryShader( ) );
+    if ( rockColor.IsValid( ) )
+    {
+        rockColor.Attach( deferred.GeometryShader( ), MATERIAL_TEXTURE_UNITS + 1 );
+    }
+    skyIrradiance.Upload( deferred.LightingShader( ).Program );
+    skyReflections.Attach( deferred.LightingShader( ), MATERIAL_TEXTURE_UNITS + 3 );
+    
+    // Lays down the box's depth before it is shaded, so frag.vs runs once per pixel
+    DepthPrepass prepass;
+    
+    // The first point lights cast shadows of the box, their maps go on the last unit
+    ShadowCubes shadows;
+    shadows.Attach( PointShader, MATERIAL_TEXTURE_UNITS + 11 );
+    shadows.Attach( deferred.LightingShader( ), MATERIAL_TEXTURE_UNITS + 11 );
+    std::vector<ShadowCaster> casters( 1 );
+    
+    // The skybox gets the first unit after the material maps, bound once for the whole run
+    glActiveTexture( GL_TEXTURE0 + MATERIAL_TEXTURE_UNITS );
+    glBindTexture( GL_TEXTURE_CUBE_MAP, cubemapTexture );
+    glActiveTexture( GL_TEXTURE0 );
+    
     Shader skyboxShader( "resources/shaders/skycore.vs", "resources/shaders/skyfrag.vs" );
+    skyboxShader.Use( );
+    glUniform1i( glGetUniformLocation( skyboxShader.Program, "skybox" ), MATERIAL_TEXTURE_UNITS );
     
     GLuint VBOcm, VAOcm;
     glGenVertexArrays( 1, &VAOcm );
@@ -319,6 +502,8 @@ int main( )
     // Game loop
     //Moving light
     GLfloat theta = 45.0f;
+    GLuint benchmarkFrame = 0;
+    GLdouble benchmarkStart = glfwGetTime( );
     while ( !glfwWindowShouldClose( window ) )
     {
         // Calculate deltatime of current frame
@@ -334,11 +519,30 @@ int main( )
         lightPos.x = 0.2 * cos(glm::radians(theta));
         lightPos.z = 0.2 * sin(glm::radians(theta));
         theta-=0.7f;
+        PlaceLights( lights, lightCount, currentFrame );
+        
+        glm::mat4 model(1);
+        model = glm::translate( model, glm::vec3(-0.4f, 0.4f, -0.4f) );
         
+        // Shadow maps of the lights that moved, the box is the only caster (the lamps sit around their lights)
+        casters[0].vao = depthVAO;
+        casters[0].vertices = 36;
+        casters[0].model = model;
+        casters[0].center = glm::vec3( -0.4f, 0.4f, -0.4f );
+        casters[0].radius = 0.2f * 1.7320508f;
+        shadows.Update( lights, casters, SCREEN_WIDTH, SCREEN_HEIGHT );
         
-        // Clear the colorbuffer
-        glClearColor( 0.1f, 0.1f, 0.1f, 1.0f );
-        glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+        
+        // Clear the colorbuffer, the deferred path draws everything into its G-buffer and copies it over at the end
+        if ( deferredShading )
+        {
+            deferred.Begin( SCREEN_WIDTH, SCREEN_HEIGHT );
+        }
+        else
+        {
+            glClearColor( 0.1f, 0.1f, 0.1f, 1.0f );
+            glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+        }
         
         // Draw skybox as last
         glDepthMask( GL_FALSE );  // Change depth function so depth test passes when values are equal to depth buffer's content
@@ -354,7 +558,6 @@ int main( )
         
         // skybox cube
         glBindVertexArray( VAOcm );
-        glBindTexture( GL_TEXTURE_CUBE_MAP, cubemapTexture );
         glDrawArrays( GL_TRIANGLES, 0, 36 );
         glBindVertexArray( 0 );
         glDepthMask( GL_TRUE ); // Set depth function back to default
@@ -362,83 +565,210 @@ int main( )
         
         //Shader dependent
         
-        PointShader.Use();
+        // Depth of the opaque geometry first, if the pre-pass is on or due to measure the overdraw
+        if ( prepass.GetMode( ) != prepassMode )
+        {
+            prepass.SetMode( prepassMode );
+        }
+        if ( prepass.Begin( view, projection ) )
+        {
+            prepass.Draw( depthVAO, model, 36 );
+            prepass.End( );
+        }
+        
+        // Forward shading lights the box as it is drawn, deferred draws it into the G-buffer and lights it afterwards
+        Shader &lightingShader = deferredShading ? deferred.LightingShader( ) : PointShader;
+        Shader &boxShader = deferredShading ? deferred.GeometryShader( ) : PointShader;
+        
+        // Sort the point lights into the clusters of this view
+        if ( !deferredShading )
+        {
+            clusters.Update( lights, view, projection, SCREEN_WIDTH, SCREEN_HEIGHT );
+        }
+        
+        lightingShader.Use();
         // Use cooresponding shader when setting uniforms/drawing objects
-        GLint lightPosLoc = glGetUniformLocation( PointShader.Program, "point.position" );
-        GLint viewPosLoc = glGetUniformLocation( PointShader.Program, "viewPos" );
-        glUniform3f( lightPosLoc, lightPos.x, lightPos.y, lightPos.z );
+        GLint viewPosLoc = glGetUniformLocation( lightingShader.Program, "viewPos" );
         glUniform3f( viewPosLoc,  camera.GetPosition( ).x, camera.GetPosition( ).y, camera.GetPosition( ).z );
         // Set lights properties
-        glUniform3f( glGetUniformLocation( PointShader.Program, "point.ambient" ), 0.5f, 0.5f, 0.5f );
-        glUniform3f( glGetUniformLocation( PointShader.Program, "point.diffuse" ), 2.0f, 2.0f, 2.0f );
-        glUniform3f( glGetUniformLocation( PointShader.Program, "point.specular" ), 1.0f, 1.0f, 1.0f );
-        glUniform1f( glGetUniformLocation( PointShader.Program, "point.constant" ), 1.0f );
-        glUniform1f( glGetUniformLocation( PointShader.Program, "point.linear" ), 0.0 );
-        glUniform1f( glGetUniformLocation( PointShader.Program, "point.quadratic" ), 3.0f );
-        glUniform3f( glGetUniformLocation( PointShader.Program, "direction.dir" ), 0.5f, 0.5f, 0.5f );
-        glUniform3f( glGetUniformLocation( PointShader.Program, "direction.ambient" ), 0.3f, 0.3f, 0.3f );
-        glUniform3f( glGetUniformLocation( PointShader.Program, "direction.diffuse" ), 0.2f, 0.2f, 0.2f );
-        glUniform3f( glGetUniformLocation( PointShader.Program, "direction.specular" ), 0.0f, 0.0f, 0.0f );
-        glUniform1f( glGetUniformLocation( PointShader.Program, "blinn" ), blinn );
-        glUniform1f( glGetUniformLocation( PointShader.Program, "db" ), db );
+        glUniform3f( glGetUniformLocation( lightingShader.Program, "direction.dir" ), 0.5f, 0.5f, 0.5f );
+        glUniform3f( glGetUniformLocation( lightingShader.Program, "direction.diffuse" ), 0.2f, 0.2f, 0.2f );
+        glUniform3f( glGetUniformLocation( lightingShader.Program, "direction.specular" ), 0.0f, 0.0f, 0.0f );
+        glUniform1f( glGetUniformLocation( lightingShader.Program, "blinn" ), blinn );
+        glUniform1f( glGetUniformLocation( lightingShader.Program, "db" ), db );
         // Set material properties
-        glUniform1f( glGetUniformLocation( PointShader.Program, "material.shininess"), 5.0f );
+        glUniform1f( glGetUniformLocation( lightingShader.Program, "material.shininess"), 5.0f );
         
         
+        boxShader.Use( );
         // Get the uniform locations
-        GLint modelLoc = glGetUniformLocation( PointShader.Program, "model" );
-        GLint viewLoc  = glGetUniformLocation( PointShader.Program, "view" );
-        GLint projLoc  = glGetUniformLocation( PointShader.Program, "projection" );
+        GLint modelLoc = glGetUniformLocation( boxShader.Program, "model" );
+        GLint viewLoc  = glGetUniformLocation( boxShader.Program, "view" );
+        GLint projLoc  = glGetUniformLocation( boxShader.Program, "projection" );
         // Pass the matrices to the shader
         glUniformMatrix4fv( viewLoc, 1, GL_FALSE, glm::value_ptr( view ) );
         glUniformMatrix4fv( projLoc, 1, GL_FALSE, glm::value_ptr( projection ) );
         
-        // Bind diffuse map
-        glActiveTexture( GL_TEXTURE0 );
-        glBindTexture( GL_TEXTURE_2D, diffuseMap );
-        // Bind specular map
-        glActiveTexture( GL_TEXTURE1 );
-        glBindTexture( GL_TEXTURE_2D, specularMap );
-        //Bind normal map
-        glActiveTexture( GL_TEXTURE2 );
-        glBindTexture( GL_TEXTURE_2D, normalMap );
-        
-        
         //Draw the box
-        glm::mat4 model(1);
-        model = glm::translate( model, glm::vec3(-0.4f, 0.4f, -0.4f) );
+        if ( deferredShading )
+        {
+            deferred.BeginGeometry( );
+        }
+        prepass.BeginShading( );
+        MaterialTextures::Select( rock );
         glBindVertexArray( boxVAO );
         glUniformMatrix4fv( modelLoc, 1, GL_FALSE, glm::value_ptr( model ) );
         glDrawArrays( GL_TRIANGLES, 0, 36 );
         glBindVertexArray( 0 );
+        prepass.EndShading( );
+        if ( deferredShading )
+        {
+            deferred.EndGeometry( );
+        }
+        
+        // The box is the only occluder and is drawn first, so the pyramid the lamps are tested against is
+        // this frame's, not the usual previous one
+        OcclusionMode lampCulling = OCCLUSION_GPU == occlusionMode && !hiz.IsSupported( ) ? OCCLUSION_CPU : occlusionMode;
+        if ( OCCLUSION_GPU == lampCulling )
+        {
+            hiz.Build( SCREEN_WIDTH, SCREEN_HEIGHT, projection * view );
+        }
+        
+        // Record at low resolution which rock pages the box needs, Update( ) streams the missing ones in
+        if ( rockColor.IsValid( ) )
+        {
+            rockColor.BeginFeedback( SCREEN_WIDTH, SCREEN_HEIGHT );
+            feedbackShader.Use( );
+            glUniformMatrix4fv( glGetUniformLocation( feedbackShader.Program, "model" ), 1, GL_FALSE, glm::value_ptr( model ) );
+            glUniformMatrix4fv( glGetUniformLocation( feedbackShader.Program, "view" ), 1, GL_FALSE, glm::value_ptr( view ) );
+            glUniformMatrix4fv( glGetUniformLocation( feedbackShader.Program, "projection" ), 1, GL_FALSE, glm::value_ptr( projection ) );
+            glBindVertexArray( boxVAO );
+            glDrawArrays( GL_TRIANGLES, 0, 36 );
+            glBindVertexArray( 0 );
+            rockColor.EndFeedback( SCREEN_WIDTH, SCREEN_HEIGHT );
+            rockColor.Update( );
+        }
+        
+        // Ambient and directional light over the G-buffer, then a volume per point light
+        if ( deferredShading )
+        {
+            deferred.Light( lights, view, projection, db <= 0.0f );
+        }
         
         
-        // Also draw the lamp object, again binding the appropriate shader
+        // Also draw the lamp objects, again binding the appropriate shader
         lampShader.Use( );
         // Get location objects for the matrices on the lamp shader (these could be different on a different shader)
-        modelLoc = glGetUniformLocation( lampShader.Program, "model" );
         viewLoc = glGetUniformLocation( lampShader.Program, "view" );
         projLoc = glGetUniformLocation( lampShader.Program, "projection" );
         // Set matrices
         glUniformMatrix4fv( viewLoc, 1, GL_FALSE, glm::value_ptr( view ) );
         glUniformMatrix4fv( projLoc, 1, GL_FALSE, glm::value_ptr( projection ) );
-        model = glm::mat4(1);
-        model = glm::translate( model, lightPos );
-        model = glm::scale( model, glm::vec3( 0.05f ) ); // Make it a smaller cube
-        glUniformMatrix4fv( modelLoc, 1, GL_FALSE, glm::value_ptr( model ) );
-        // Draw the light object (using light's vertex attributes)
-        glBindVertexArray( lightVAO );
-        glDrawArrays( GL_TRIANGLES, 0, 36 );
-        glBindVertexArray( 0 );
+        // Small cubes, the first one the size the single lamp always had, tinted with their light's colour
+        lamps.resize( lights.size( ) * 7 );
+        for ( size_t i = 0; i < lights.size( ); i++ )
+        {
+            glm::vec3 tint = lights[i].diffuse / std::max( std::max( lights[i].diffuse.r, lights[i].diffuse.g ), lights[i].diffuse.b );
+            GLfloat lamp[7] = { lights[i].position.x, lights[i].position.y, lights[i].position.z, 0 == i ? 0.05f : 0.01f, tint.r, tint.g, tint.b };
+            std::copy( lamp, lamp + 7, &lamps[i * 7] );
+        }
+        // Only the lamps the box leaves in sight are drawn. The CPU packs them into the lamp buffer ahead of
+        // the draw, the GPU into a buffer of its own with their count going straight into an indirect draw,
+        // so the counts it reports are a few frames old
+        lampBoxes.resize( lights.size( ) );
+        for ( size_t i = 0; i < lights.size( ); i++ )
+        {
+            lampBoxes[i].center = lights[i].position;
+            lampBoxes[i].extent = glm::vec3( 0.2f * lamps[i * 7 + 3] );
+        }
+        if ( OCCLUSION_GPU == lampCulling )
+        {
+            hiz.Cull( &lampBoxes[0], &lamps[0], 7, ( GLsizei )lights.size( ), 36 );
+            lampShader.Use( );    // Cull( ) leaves its compute program in use
+            glBindBuffer( GL_DRAW_INDIRECT_BUFFER, hiz.GetCommand( ) );
+            glBindVertexArray( culledLightVAO );
+            glDrawArraysIndirect( GL_TRIANGLES, ( GLvoid * )0 );
+            glBindVertexArray( 0 );
+            glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+            lampsDrawn = hiz.GetVisible( );
+            lampsCulled = hiz.GetCulled( );
+        }
+        else
+        {
+            lampsDrawn = ( GLsizei )lights.size( );
+            const GLfloat *lampData = &lamps[0];
+            if ( OCCLUSION_CPU == lampCulling )
+            {
+                occlusion.Begin( projection * view );
+                occlusion.AddOccluder( vertices, 14, 36, model );
+                occlusion.Rasterize( );
+                lampsDrawn = occlusion.Cull( &lampBoxes[0], ( GLsizei )lampBoxes.size( ), visibleLamps );
+                MaskedOcclusion::Gather( &lamps[0], 7, visibleLamps, visibleLampData );
+                lampData = visibleLampData.empty( ) ? NULL : &visibleLampData[0];
+            }
+            lampsCulled = ( GLsizei )lights.size( ) - lampsDrawn;
+            if ( lampsDrawn > 0 )
+            {
+                glBindBuffer( GL_ARRAY_BUFFER, lampVBO );
+                glBufferSubData( GL_ARRAY_BUFFER, 0, lampsDrawn * 7 * sizeof( GLfloat ), lampData );
+                // Draw the light objects (using light's vertex attributes)
+                glBindVertexArray( lightVAO );
+                glDrawArraysInstanced( GL_TRIANGLES, 0, 36, lampsDrawn );
+                glBindVertexArray( 0 );
+            }
+        }
+        
+        if ( deferredShading )
+        {
+            deferred.Resolve( );
+        }
         
         
         // Swap the screen buffers
         glfwSwapBuffers(window);
+        
+        if ( lightBenchmark && ++benchmarkFrame == BENCHMARK_FRAMES )
+        {
+            glFinish( );
+            GLdouble now = glfwGetTime( );
+            if ( deferredShading )
+            {
+                std::cout << "lights " << lightCount << ": deferred " << ( now - benchmarkStart ) * 1000.0 / BENCHMARK_FRAMES << " ms/frame" << std::endl;
+                
+                if ( lightCount == MAX_LIGHTS )
+                {
+                    glfwSetWindowShouldClose( window, GL_TRUE );
+                }
+                lightCount = std::min( lightCount * 2, MAX_LIGHTS );
+            }
+            else
+            {
+                std::cout << "lights " << lightCount << ": forward " << ( now - benchmarkStart ) * 1000.0 / BENCHMARK_FRAMES << " ms/frame, "
+                          << clusters.GetAssignments( ) << " cluster assignments, overdraw " << prepass.GetOverdraw( ) << ", "
+                          << lampsDrawn << " lamps drawn, " << lampsCulled << " culled" << std::endl;
+            }
+            deferredShading = !deferredShading;
+            benchmarkFrame = 0;
+            benchmarkStart = glfwGetTime( );
+        }
     }
     
     glDeleteVertexArrays( 1, &boxVAO );
     glDeleteVertexArrays( 1, &lightVAO );
+    glDeleteVertexArrays( 1, &culledLightVAO );
+    glDeleteVertexArrays( 1, &depthVAO );
     glDeleteBuffers( 1, &VBO );
+    glDeleteBuffers( 1, &lampVBO );
+    glDeleteBuffers( 1, &compactVBO );
+    glDeleteTextures( 1, &cubemapTexture );
+    skyReflections.Clear( );
+    clusters.Clear( );
+    deferred.Clear( );
+    prepass.Clear( );
+    shadows.Clear( );
+    hiz.Clear( );
+    materials.Clear( );
+    rockColor.Clear( );
     
     // Terminate GLFW, clearing any resources allocated by GLFW.
     glfwTerminate( );
@@ -493,6 +823,41 @@ void DoMovement( )
     }
 }
 
+// The moving lamp, then lights circling the box on orbits of their own, the same ones every run
+void PlaceLights( std::vector<ClusterLight> &lights, GLuint count, GLfloat time )
+{
+    lights.resize( count );
+    
+    ClusterLight &lamp = lights[0];
+    lamp.position = lightPos;
+    lamp.diffuse = glm::vec3( 2.0f, 2.0f, 2.0f );
+    lamp.specular = glm::vec3( 1.0f, 1.0f, 1.0f );
+    lamp.constant = 1.0f;
+    lamp.linear = 0.0f;
+    lamp.quadratic = 3.0f;
+    
+    std::srand( 1 );
+    for ( GLuint i = 1; i < count; i++ )
+    {
+        GLfloat random[7];
+        for ( int j = 0; j < 7; j++ )
+        {
+            random[j] = ( GLfloat )std::rand( ) / RAND_MAX;
+        }
+        
+        GLfloat angle = random[0] * 6.2831853f + time * ( 0.2f + random[1] );
+        GLfloat radius = 0.35f + 0.5f * random[2];
+        
+        ClusterLight &light = lights[i];
+        light.position = glm::vec3( -0.4f, 0.4f, -0.4f ) + glm::vec3( radius * cos( angle ), 0.8f * random[3] - 0.4f, radius * sin( angle ) );
+        light.diffuse = glm::vec3( 0.2f + random[4], 0.2f + random[5], 0.2f + random[6] );
+        light.specular = light.diffuse * 0.5f;
+        light.constant = 1.0f;
+        light.linear = 0.0f;
+        light.quadratic = 1500.0f;
+    }
+}
+
 // Is called whenever a key is pressed/released via GLFW
 void KeyCallback( GLFWwindow *window, int key, int scancode, int action, int mode )
 {
@@ -501,6 +866,26 @@ void KeyCallback( GLFWwindow *window, int key, int scancode, int action, int mod
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
     
+    if ( GLFW_KEY_L == key && GLFW_PRESS == action )
+    {
+        lightCount = lightCount >= MAX_LIGHTS ? 1 : lightCount * 2;
+    }
+    
+    if ( GLFW_KEY_G == key && GLFW_PRESS == action )
+    {
+        deferredShading = !deferredShading;
+    }
+    
+    if ( GLFW_KEY_P == key && GLFW_PRESS == action )
+    {
+        prepassMode = PREPASS_AUTO == prepassMode ? PREPASS_ON : PREPASS_ON == prepassMode ? PREPASS_OFF : PREPASS_AUTO;
+    }
+    
+    if ( GLFW_KEY_O == key && GLFW_PRESS == action )
+    {
+        occlusionMode = OCCLUSION_GPU == occlusionMode ? OCCLUSION_OFF : OCCLUSION_OFF == occlusionMode ? OCCLUSION_CPU : OCCLUSION_GPU;
+    }
+    
     if ( key >= 0 && key < 1024 )
     {
         if ( action == GLFW_PRESS )
@@ -531,3 +916,211 @@ void MouseCallback( GLFWwindow *window, double xPos, double yPos )
     
     camera.ProcessMouseMovement( xOffset, yOffset );
 }
+
+// The scene of the first frame drawn on the CPU by SoftwareRenderer.h and written to image: sky, box and lamps
+// from the default camera, lit by the point lights as frag.vs lights them (no reflections or shadows)
+int RenderSoftware( const std::string &image, const GLfloat *vertices, GLsizei vertexCount, const GLfloat *skyboxVertices,
+                    const std::vector<std::string> &faces )
+{
+    SoftwareRenderer renderer( WIDTH, HEIGHT );
+    
+    // Maps that don't load turn into what MaterialTextures uses instead: mid gray diffuse, no specular, flat normal
+    const std::string maps[3] =
+    {
+        "resources/images/ROCK035_2K_Color.jpg",
+        "resources/images/ROCK035_2K_Displacement.jpg",
+        "resources/images/ROCK035_2K_Normal.jpg"
+    };
+    static const unsigned char neutral[3][4] = { { 128, 128, 128, 255 }, { 0, 0, 0, 255 }, { 128, 128, 255, 255 } };
+    SoftwareTexture rock[3];
+    for ( int i = 0; i < 3; i++ )
+    {
+        if ( !rock[i].Load( maps[i] ) )
+        {
+            rock[i].Set( 1, 1, neutral[i] );
+        }
+    }
+    
+    // The sky, and its irradiance from the faces the GPU path would accept (square ones)
+    SoftwareCubeMap sky;
+    sky.Load( faces );
+    SphericalHarmonics skyIrradiance;
+    std::vector<unsigned char> texels;
+    for ( int i = 0; i < 6; i++ )
+    {
+        if ( sky.Face( i ).IsValid( ) && sky.Face( i ).GetWidth( ) == sky.Face( i ).GetHeight( ) )
+        {
+            sky.Face( i ).ReadTexels( texels );
+            skyIrradiance.AddFace( i, &texels[0], sky.Face( i ).GetWidth( ) );
+        }
+    }
+    skyIrradiance.Finish( );
+    
+    // The lights where the first frame puts them
+    lightPos.x = 0.2 * cos( glm::radians( 45.0f ) );
+    lightPos.z = 0.2 * sin( glm::radians( 45.0f ) );
+    std::vector<ClusterLight> lights;
+    PlaceLights( lights, lightCount, 0.0f );
+    std::vector<SoftwarePointLight> points( lights.size( ) );
+    for ( size_t i = 0; i < lights.size( ); i++ )
+    {
+        points[i].position = lights[i].position;
+        points[i].radius = ClusteredLights::Range( lights[i] );
+        points[i].diffuse = lights[i].diffuse;
+        points[i].specular = lights[i].specular;
+        points[i].linear = lights[i].linear;
+        points[i].quadratic = lights[i].quadratic;
+    }
+    
+    glm::mat4 projection = glm::perspective( camera.GetZoom( ), ( GLfloat )WIDTH / ( GLfloat )HEIGHT, 0.1f, 100.0f );
+    glm::mat4 view = glm::mat4( glm::mat3( camera.GetViewMatrix( ) ) );
+    glm::mat4 model( 1 );
+    model = glm::translate( model, glm::vec3( -0.4f, 0.4f, -0.4f ) );
+    
+    renderer.ClearBuffers( glm::vec4( 0.1f, 0.1f, 0.1f, 1.0f ) );
+    
+    // Skybox without depth writes
+    SoftwareSkyboxProgram skybox;
+    skybox.view = view;
+    skybox.projection = projection;
+    skybox.skybox = &sky;
+    renderer.SetDepthMask( false );
+    renderer.Draw( skybox, skyboxVertices, 3, 36 );
+    renderer.SetDepthMask( true );
+    
+    // The box
+    SoftwarePhongProgram box;
+    box.model = model;
+    box.view = view;
+    box.projection = projection;
+    box.viewPos = camera.GetPosition( );
+    box.directionDir = glm::vec3( 0.5f, 0.5f, 0.5f );
+    box.directionDiffuse = glm::vec3( 0.2f, 0.2f, 0.2f );
+    box.directionSpecular = glm::vec3( 0.0f, 0.0f, 0.0f );
+    box.shininess = 5.0f;
+    box.blinn = blinn > 0.0f;
+    box.db = db > 0.0f;
+    box.diffuseMap = &rock[0];
+    box.specularMap = &rock[1];
+    box.normalMap = &rock[2];
+    box.lights = &points;
+    box.irradianceSH = skyIrradiance.GetCoefficients( );
+    renderer.Draw( box, vertices, 14, vertexCount );
+    
+    // Lamps, a cube per light the size and tint lightcore.vs gives it
+    std::vector<GLfloat> lamps;
+    for ( size_t i = 0; i < lights.size( ); i++ )
+    {
+        glm::vec3 tint = lights[i].diffuse / std::max( std::max( lights[i].diffuse.r, lights[i].diffuse.g ), lights[i].diffuse.b );
+        GLfloat size = 0 == i ? 0.05f : 0.01f;
+        for ( GLsizei v = 0; v < 36; v++ )
+        {
+            glm::vec3 position = glm::vec3( vertices[v * 14], vertices[v * 14 + 1], vertices[v * 14 + 2] ) * size + lights[i].position;
+            GLfloat lamp[6] = { position.x, position.y, position.z, tint.r, tint.g, tint.b };
+            lamps.insert( lamps.end( ), lamp, lamp + 6 );
+        }
+    }
+    SoftwareColorProgram lamp;
+    lamp.view = view;
+    lamp.projection = projection;
+    renderer.Draw( lamp, &lamps[0], 6, ( GLsizei )( lamps.size( ) / 6 ) );
+    
+    return renderer.Save( image ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Flat coloured right triangles scattered over the screen at random depths, legs from 1 to 256 pixels, each
+// size drawn in one call. Small triangles measure setup and binning, large ones the block and span loops
+int BenchmarkSoftware( )
+{
+    SoftwareRenderer renderer( WIDTH, HEIGHT );
+    SoftwareColorProgram program;
+    program.view = glm::mat4( 1.0f );
+    program.projection = glm::mat4( 1.0f );
+    
+    std::vector<GLfloat> vertices;
+    for ( GLint leg = 1; leg <= 256; leg *= 2 )
+    {
+        GLdouble area = leg * leg / 2.0;
+        GLint count = ( GLint )std::min( SOFTWARE_BENCHMARK_PIXELS / area, 500000.0 );
+        
+        srand( 1 );
+        vertices.clear( );
+        for ( GLint i = 0; i < count; i++ )
+        {
+            GLfloat x = ( GLfloat )( rand( ) % ( WIDTH - leg ) ) + 0.3f, y = ( GLfloat )( rand( ) % ( HEIGHT - leg ) ) + 0.3f;
+            GLfloat z = rand( ) / ( GLfloat )RAND_MAX * 2.0f - 1.0f;
+            GLfloat red = rand( ) / ( GLfloat )RAND_MAX;
+            GLfloat corners[3][2] = { { x, y }, { x + leg, y }, { x, y + leg } };
+            for ( int c = 0; c < 3; c++ )
+            {
+                GLfloat vertex[6] = { corners[c][0] / WIDTH * 2.0f - 1.0f, corners[c][1] / HEIGHT * 2.0f - 1.0f, z, red, 0.5f, 0.2f };
+                vertices.insert( vertices.end( ), vertex, vertex + 6 );
+            }
+        }
+        
+        renderer.ClearBuffers( glm::vec4( 0.0f ) );
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+        renderer.Draw( program, &vertices[0], 6, count * 3 );
+        GLdouble seconds = std::chrono::duration<GLdouble>( std::chrono::steady_clock::now( ) - start ).count( );
+        
+        std::cout << "legs " << leg << " px: " << count / seconds / 1.0e6 << " Mtriangles/s, "
+                  << count * area / seconds / 1.0e6 << " Mpixels/s" << std::endl;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+// A wall of scaled up boxes in front of the camera and OCCLUSION_BENCHMARK_BOXES small ones scattered around and behind
+// it, culled OCCLUSION_BENCHMARK_RUNS times: prints the time the occluders take to draw and the boxes to test
+int BenchmarkOcclusion( const GLfloat *vertices, GLsizei vertexCount )
+{
+    glm::mat4 projection = glm::perspective( camera.GetZoom( ), ( GLfloat )WIDTH / ( GLfloat )HEIGHT, 0.1f, 100.0f );
+    glm::mat4 view = camera.GetViewMatrix( );
+    
+    std::vector<glm::mat4> walls;
+    for ( GLint x = -4; x < 4; x++ )
+    {
+        for ( GLint y = -3; y < 3; y++ )
+        {
+            glm::mat4 model( 1 );
+            model = glm::translate( model, glm::vec3( x * 2.0f + 1.0f, y * 2.0f + 1.0f, -10.0f ) );
+            model = glm::scale( model, glm::vec3( 5.0f ) );
+            walls.push_back( model );
+        }
+    }
+    
+    srand( 1 );
+    std::vector<OcclusionBox> boxes( OCCLUSION_BENCHMARK_BOXES );
+    for ( GLsizei i = 0; i < OCCLUSION_BENCHMARK_BOXES; i++ )
+    {
+        boxes[i].center = glm::vec3( rand( ) / ( GLfloat )RAND_MAX * 60.0f - 30.0f, rand( ) / ( GLfloat )RAND_MAX * 40.0f - 20.0f,
+                                     rand( ) / ( GLfloat )RAND_MAX * -80.0f );
+        boxes[i].extent = glm::vec3( 0.05f + rand( ) / ( GLfloat )RAND_MAX * 0.2f );
+    }
+    
+    MaskedOcclusion occlusion;
+    std::vector<GLuint> visible;
+    GLdouble rasterize = 0.0, cull = 0.0;
+    for ( GLuint run = 0; run < OCCLUSION_BENCHMARK_RUNS; run++ )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+        occlusion.Begin( projection * view );
+        for ( size_t i = 0; i < walls.size( ); i++ )
+        {
+            occlusion.AddOccluder( vertices, 14, vertexCount, walls[i] );
+        }
+        occlusion.Rasterize( );
+        std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now( );
+        occlusion.Cull( &boxes[0], OCCLUSION_BENCHMARK_BOXES, visible );
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now( );
+        
+        rasterize += std::chrono::duration<GLdouble>( middle - start ).count( );
+        cull += std::chrono::duration<GLdouble>( end - middle ).count( );
+    }
+    
+    std::cout << "occluders " << occlusion.GetTriangles( ) << " triangles: " << rasterize * 1000.0 / OCCLUSION_BENCHMARK_RUNS << " ms, "
+              << OCCLUSION_BENCHMARK_BOXES << " boxes: " << cull * 1000.0 / OCCLUSION_BENCHMARK_RUNS << " ms, "
+              << visible.size( ) << " visible" << std::endl;
+    
+    return EXIT_SUCCESS;
+}
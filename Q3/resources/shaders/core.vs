@@ -2,26 +2,43 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 texCoords;
+#ifndef DERIVATIVE_TANGENTS
 layout (location = 3) in vec3 aTangent;
 layout (location = 4) in vec3 aBitangent;
+#endif
+layout (location = 5) in int aMaterial;
 
 
 out vec3 FragPos;
 out vec2 TexCoords;
+#ifdef DERIVATIVE_TANGENTS
+// frag.vs rebuilds the tangent and bitangent from screen-space derivatives, only the normal is passed on
+out vec3 Normal;
+#else
 out mat3 TBN;
+#endif
+flat out int MaterialIndex;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Same as depthcore.vs, so the depth pre-pass and this pass agree exactly
+invariant gl_Position;
+
 void main()
 {
     gl_Position = projection * view * model * vec4(position, 1.0f);
     FragPos = vec3(model*vec4(position, 1.0f));
     TexCoords = texCoords;
+    MaterialIndex = aMaterial;
     
+#ifdef DERIVATIVE_TANGENTS
+    Normal = vec3(model * vec4(aNormal, 0.0));
+#else
     vec3 T = normalize(vec3(model * vec4(aTangent,   0.0)));
     vec3 B = normalize(vec3(model * vec4(aBitangent, 0.0)));
     vec3 N = normalize(vec3(model * vec4(aNormal,    0.0)));
     TBN = mat3(T, B, N);
+#endif
 }
@@ -0,0 +1,34 @@
+#version 330 core
+layout (location = 0) in vec3 position;     // unit sphere around a point light
+
+// Lights in the layout of ClusteredLights.h, 3 texels each: position and radius, diffuse and linear, specular and quadratic
+uniform samplerBuffer lights;
+uniform int firstLight;
+uniform int fullscreen;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+flat out vec4 LightPositionRadius;
+flat out vec4 LightDiffuseLinear;
+flat out vec4 LightSpecularQuadratic;
+flat out int LightIndex;
+
+void main()
+{
+    // One triangle over the whole screen, corners made up from the vertex index
+    if (fullscreen != 0)
+    {
+        vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+        return;
+    }
+    
+    LightIndex = firstLight + gl_InstanceID;
+    int light = LightIndex * 3;
+    LightPositionRadius = texelFetch(lights, light);
+    LightDiffuseLinear = texelFetch(lights, light + 1);
+    LightSpecularQuadratic = texelFetch(lights, light + 2);
+    
+    gl_Position = projection * view * vec4(LightPositionRadius.xyz + position * LightPositionRadius.w, 1.0);
+}
@@ -0,0 +1,193 @@
+#version 330 core
+// Lighting pass of DeferredRenderer.h, the same lighting as frag.vs read back from the G-buffer
+
+#ifndef SHADOW_MAX_LIGHTS
+#define SHADOW_MAX_LIGHTS 4
+#endif
+
+struct Material
+{
+    float     shininess;
+};
+
+struct Direction
+{
+    vec3 dir;
+    
+    vec3 diffuse;
+    vec3 specular;
+    
+};
+
+flat in vec4 LightPositionRadius;
+flat in vec4 LightDiffuseLinear;
+flat in vec4 LightSpecularQuadratic;
+flat in int LightIndex;
+
+out vec4 color;
+
+uniform sampler2D gAlbedo;      // albedo, specular intensity in alpha
+uniform sampler2D gNormal;      // octahedral normal
+uniform sampler2D gDepth;       // view space depth
+
+uniform int fullscreen;         // 1: ambient and directional light, 0: a point light's volume
+uniform mat4 inverseView;
+uniform vec2 projectionScale;   // projection[0][0] and projection[1][1]
+
+uniform vec3 viewPos;
+uniform Material material;
+uniform Direction direction;
+uniform float blinn;
+uniform float db;
+
+// Diffuse light of the skybox as 9 L2 spherical harmonics, see SphericalHarmonics.h
+uniform vec3 irradianceSH[9];
+
+// The skybox prefiltered for GGX, one roughness per mip level, see SpecularEnvironment.h
+uniform samplerCube environment;
+uniform float environmentLevels;    // last mip level, roughness 1
+
+// Omnidirectional shadows of the first point lights, six layers per light, see ShadowCubes.h
+uniform sampler2DArrayShadow shadowMaps;
+uniform int shadowCount;
+uniform vec4 shadowLights[SHADOW_MAX_LIGHTS];   // position and far plane the maps were drawn with
+uniform float shadowNear;
+uniform float shadowTexel;                      // size of a map texel one unit from the light
+
+// s axis, t axis and centre of each face, +X, -X, +Y, -Y, +Z, -Z, as in shadow.gs
+const vec3 shadowFaceAxes[18] = vec3[18](
+    vec3( 0.0,  0.0, -1.0), vec3(0.0, -1.0,  0.0), vec3( 1.0,  0.0,  0.0),
+    vec3( 0.0,  0.0,  1.0), vec3(0.0, -1.0,  0.0), vec3(-1.0,  0.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0,  0.0,  1.0), vec3( 0.0,  1.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0,  0.0, -1.0), vec3( 0.0, -1.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0, -1.0,  0.0), vec3( 0.0,  0.0,  1.0),
+    vec3(-1.0,  0.0,  0.0), vec3(0.0, -1.0,  0.0), vec3( 0.0,  0.0, -1.0));
+
+vec3 DecodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// Ambient light arriving from the sky around a surface facing n
+vec3 Irradiance(vec3 n)
+{
+    return irradianceSH[0]
+         + irradianceSH[1] * n.y + irradianceSH[2] * n.z + irradianceSH[3] * n.x
+         + irradianceSH[4] * (n.x * n.y) + irradianceSH[5] * (n.y * n.z)
+         + irradianceSH[6] * (3.0 * n.z * n.z - 1.0)
+         + irradianceSH[7] * (n.x * n.z) + irradianceSH[8] * (n.x * n.x - n.y * n.y);
+}
+
+// 1 where light index reaches position, 0 in its shadow, filtered over 2x2 map texels
+float PointShadow(int index, vec3 position, vec3 norm)
+{
+    if (index >= shadowCount)
+    {
+        return 1.0;
+    }
+    
+    // Pushed out along the normal by a texel and a half at this distance, against acne
+    vec3 d = position - shadowLights[index].xyz;
+    vec3 a = abs(d);
+    d += norm * (max(a.x, max(a.y, a.z)) * shadowTexel * 1.5);
+    a = abs(d);
+    
+    int face = a.x >= a.y && a.x >= a.z ? (d.x >= 0.0 ? 0 : 1) : a.y >= a.z ? (d.y >= 0.0 ? 2 : 3) : (d.z >= 0.0 ? 4 : 5);
+    float forward = dot(d, shadowFaceAxes[face * 3 + 2]);
+    vec2 st = vec2(dot(d, shadowFaceAxes[face * 3]), dot(d, shadowFaceAxes[face * 3 + 1])) / forward;
+    
+    // Same depth as the projection in shadow.gs
+    float far = shadowLights[index].w;
+    float depth = ((far + shadowNear) - 2.0 * far * shadowNear / forward) / (far - shadowNear);
+    return texture(shadowMaps, vec4(st * 0.5 + 0.5, float(index * 6 + face), depth * 0.5 + 0.5));
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 albedoSpecular = texelFetch(gAlbedo, pixel, 0);
+    vec3 albedo = albedoSpecular.rgb;
+    vec3 specularMap = vec3(albedoSpecular.a);
+    vec3 norm = DecodeNormal(texelFetch(gNormal, pixel, 0).xy);
+    
+    // World position from the depth along the pixel's ray
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+    vec3 FragPos = vec3(inverseView * vec4(ndc * depth / projectionScale, -depth, 1.0));
+    
+    //ViewDir
+    vec3 viewDir = normalize(viewPos - FragPos);
+    
+    if (fullscreen != 0)
+    {
+        // Ambient comes from the sky, the same for either light
+        vec3 ambient = max(Irradiance(norm), 0.0) * albedo;
+        
+        // Glossy reflection of the sky, its roughness from the Blinn-Phong exponent, weighted by Schlick's Fresnel
+        float roughness = sqrt(sqrt(2.0 / (material.shininess + 2.0)));
+        vec3 reflection = textureLod(environment, reflect(-viewDir, norm), roughness * environmentLevels).rgb;
+        float fresnel = 0.04 + 0.96 * pow(1.0 - max(dot(norm, viewDir), 0.0), 5.0);
+        ambient += reflection * specularMap * fresnel;
+        
+        vec3 directionalresult = vec3(0.0);
+        if (db > 0)
+        {
+            vec3 lightDir = normalize(-direction.dir);
+            float diff = max(dot(norm, lightDir), 0.0);
+            float spec = 0.0f;
+            if (blinn > 0)
+            {
+                vec3 halfwayDir = normalize(lightDir + viewDir);
+                spec = pow(max(dot(viewDir, halfwayDir), 0.0), material.shininess);
+            }
+            else
+            {
+                vec3 reflectDir = reflect(-lightDir, norm);
+                spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+            }
+            directionalresult = direction.diffuse * diff * albedo + direction.specular * spec * specularMap;
+        }
+        
+        color = vec4(directionalresult + ambient, 0.0);
+        return;
+    }
+    
+    // The volume is a little larger than the light's range, the rest of it adds nothing
+    vec3 toLight = LightPositionRadius.xyz - FragPos;
+    float distance = length(toLight);
+    if (distance >= LightPositionRadius.w)
+    {
+        discard;
+    }
+    
+    //Diffuse
+    vec3 lightDir = toLight / distance;
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = LightDiffuseLinear.rgb * diff * albedo;
+    
+    // Specular
+    float spec = 0.0;
+    if (blinn > 0)
+    {
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        spec = pow(max(dot(norm, halfwayDir), 0.0), 16.0);
+    }
+    else
+    {
+        vec3 reflectDir = reflect(-lightDir, norm);
+        spec = pow(max(dot(viewDir, reflectDir), 0.0), 8.0);
+    }
+    vec3 specular = LightSpecularQuadratic.rgb * spec * specularMap;
+    
+    // Attenuation, faded out towards the radius so it ends without a seam
+    float attenuation = 1.0f / (1.0f + LightDiffuseLinear.w * distance + LightSpecularQuadratic.w * (distance * distance));
+    float fade        = clamp(1.0 - pow(distance / LightPositionRadius.w, 4.0), 0.0, 1.0);
+    attenuation      *= fade * fade;
+    
+    color = vec4((diffuse + specular) * attenuation * PointShadow(LightIndex, FragPos, norm), 0.0);
+}
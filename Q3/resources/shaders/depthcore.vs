@@ -0,0 +1,15 @@
+#version 330 core
+// Depth pre-pass, see DepthPrepass.h: the same transform as core.vs and nothing else
+layout (location = 0) in vec3 position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// Must match core.vs bit for bit, the shaded pass tests against this depth with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+}
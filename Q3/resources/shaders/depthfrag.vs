@@ -0,0 +1,6 @@
+#version 330 core
+// Depth pre-pass, see DepthPrepass.h: only depth is written, colour writes are masked off
+
+void main()
+{
+}
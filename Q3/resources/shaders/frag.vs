@@ -1,21 +1,29 @@
 #version 330 core
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
+
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 64
+#endif
+
+#ifndef SHADOW_MAX_LIGHTS
+#define SHADOW_MAX_LIGHTS 4
+#endif
+
 struct Material
 {
-    sampler2D diffuse;
-    sampler2D specular;
-    sampler2D normal;
     float     shininess;
 };
 
 struct PointLight
 {
     vec3 position;
+    float radius;
     
-    vec3 ambient;
     vec3 diffuse;
     vec3 specular;
     
-    float constant;
     float linear;
     float quadratic;
 };
@@ -24,7 +32,6 @@ struct Direction
 {
     vec3 dir;
     
-    vec3 ambient;
     vec3 diffuse;
     vec3 specular;
     
@@ -33,26 +40,217 @@ struct Direction
 
 in vec3 FragPos;
 in vec2 TexCoords;
+#ifdef DERIVATIVE_TANGENTS
+in vec3 Normal;
+#else
 in mat3 TBN;
+#endif
+flat in int MaterialIndex;
 
+#ifdef GBUFFER_PASS
+// Geometry pass of DeferredRenderer.h: the surface goes to the G-buffer and the lights come later
+layout (location = 0) out vec4 color;       // lit colour, black until the light volumes add to it
+layout (location = 1) out vec4 gAlbedo;     // albedo, specular intensity in alpha
+layout (location = 2) out vec2 gNormal;     // octahedral normal
+layout (location = 3) out float gDepth;     // view space depth
+#else
 out vec4 color;
+#endif
 
 uniform vec3 viewPos;
 uniform Material material;
-uniform PointLight point;
 uniform Direction direction;
 uniform float blinn;
 uniform float db;
+uniform mat4 view;
+
+// Point lights sorted into a froxel grid, see ClusteredLights.h
+uniform samplerBuffer lights;           // 3 texels per light: position and radius, diffuse and linear, specular and quadratic
+uniform usamplerBuffer lightClusters;   // offset and count in lightIndices, per cluster
+uniform usamplerBuffer lightIndices;
+uniform vec4 clusterTiles;              // tile width and height in pixels, tiles across and down
+uniform vec3 clusterSlices;             // slice = log(depth) * x + y, slice count
+
+// Diffuse light of the skybox as 9 L2 spherical harmonics, see SphericalHarmonics.h
+uniform vec3 irradianceSH[9];
+
+// The skybox prefiltered for GGX, one roughness per mip level, see SpecularEnvironment.h
+uniform samplerCube environment;
+uniform float environmentLevels;    // last mip level, roughness 1
+
+// Omnidirectional shadows of the first point lights, six layers per light, see ShadowCubes.h
+uniform sampler2DArrayShadow shadowMaps;
+uniform int shadowCount;
+uniform vec4 shadowLights[SHADOW_MAX_LIGHTS];   // position and far plane the maps were drawn with
+uniform float shadowNear;
+uniform float shadowTexel;                      // size of a map texel one unit from the light
+
+// s axis, t axis and centre of each face, +X, -X, +Y, -Y, +Z, -Z, as in shadow.gs
+const vec3 shadowFaceAxes[18] = vec3[18](
+    vec3( 0.0,  0.0, -1.0), vec3(0.0, -1.0,  0.0), vec3( 1.0,  0.0,  0.0),
+    vec3( 0.0,  0.0,  1.0), vec3(0.0, -1.0,  0.0), vec3(-1.0,  0.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0,  0.0,  1.0), vec3( 0.0,  1.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0,  0.0, -1.0), vec3( 0.0, -1.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0, -1.0,  0.0), vec3( 0.0,  0.0,  1.0),
+    vec3(-1.0,  0.0,  0.0), vec3(0.0, -1.0,  0.0), vec3( 0.0,  0.0, -1.0));
+
+#ifdef VIRTUAL_TEXTURE
+// Diffuse map streamed in 128x128 pages, see VirtualTexture.h
+uniform usampler2D vtPageTable;
+uniform sampler2D vtPhysical;
+uniform vec4 vtSize;            // virtual width, height, last mip level, mip bias
+uniform vec2 vtPhysicalSize;
+
+const float VT_PAGE_SIZE = 128.0;
+const float VT_PAGE_BORDER = 4.0;
+const float VT_SLOT_SIZE = VT_PAGE_SIZE + 2.0 * VT_PAGE_BORDER;
+
+vec3 VirtualSample(vec2 uv)
+{
+    vec2 texel = uv * vtSize.xy;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float mip = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vtSize.w, 0.0, vtSize.z);
+    int level = int(mip);
+    
+    // The entry is the page itself or its closest resident ancestor, b holds the level it came from
+    ivec2 pages = textureSize(vtPageTable, level);
+    vec2 wrapped = fract(uv);
+    uvec4 entry = texelFetch(vtPageTable, min(ivec2(wrapped * vec2(pages)), pages - 1), level);
+    
+    vec2 levelSize = max(floor(vtSize.xy / exp2(float(entry.b))), vec2(1.0));
+    vec2 inPage = mod(wrapped * levelSize, VT_PAGE_SIZE);
+    vec2 physical = (vec2(entry.rg) * VT_SLOT_SIZE + VT_PAGE_BORDER + inPage) / vtPhysicalSize;
+    return textureLod(vtPhysical, physical, 0.0).rgb;
+}
+#endif
+
+// Material maps are picked by MaterialIndex, nothing gets bound per draw
+#ifdef BINDLESS_TEXTURES
+struct MaterialMaps
+{
+    uvec2 diffuse;
+    uvec2 specular;
+    uvec2 normal;
+    uvec2 pad;
+};
+
+layout (std140) uniform MaterialHandles
+{
+    MaterialMaps materials[MAX_MATERIALS];
+};
+
+#ifndef VIRTUAL_TEXTURE
+vec3 DiffuseMap()  { return vec3(texture(sampler2D(materials[MaterialIndex].diffuse), TexCoords)); }
+#endif
+vec3 SpecularMap() { return vec3(texture(sampler2D(materials[MaterialIndex].specular), TexCoords)); }
+vec3 NormalMap()   { return vec3(texture(sampler2D(materials[MaterialIndex].normal), TexCoords)); }
+#else
+uniform sampler2DArray diffuseMaps;
+uniform sampler2DArray specularMaps;
+uniform sampler2DArray normalMaps;
+
+#ifndef VIRTUAL_TEXTURE
+vec3 DiffuseMap()  { return vec3(texture(diffuseMaps, vec3(TexCoords, MaterialIndex))); }
+#endif
+vec3 SpecularMap() { return vec3(texture(specularMaps, vec3(TexCoords, MaterialIndex))); }
+vec3 NormalMap()   { return vec3(texture(normalMaps, vec3(TexCoords, MaterialIndex))); }
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+vec3 DiffuseMap()  { return VirtualSample(TexCoords); }
+#endif
+
+// Ambient light arriving from the sky around a surface facing n
+vec3 Irradiance(vec3 n)
+{
+    return irradianceSH[0]
+         + irradianceSH[1] * n.y + irradianceSH[2] * n.z + irradianceSH[3] * n.x
+         + irradianceSH[4] * (n.x * n.y) + irradianceSH[5] * (n.y * n.z)
+         + irradianceSH[6] * (3.0 * n.z * n.z - 1.0)
+         + irradianceSH[7] * (n.x * n.z) + irradianceSH[8] * (n.x * n.x - n.y * n.y);
+}
 
-vec3 GetPointResult( PointLight point, vec3 norm, vec3 viewDir)
+#ifdef DERIVATIVE_TANGENTS
+// Tangent frame of the surface around this pixel, from how its position and texture coordinates change
+// across the screen (Schuler 2013), so the vertices don't have to carry tangents. Called before any
+// branching, derivatives are undefined in non-uniform control flow
+mat3 CotangentFrame(vec3 N, vec3 p, vec2 uv)
 {
-    // Ambient
-    vec3 ambient = point.ambient * vec3(texture(material.diffuse, TexCoords));
+    vec3 dp1 = dFdx(p);
+    vec3 dp2 = dFdy(p);
+    vec2 duv1 = dFdx(uv);
+    vec2 duv2 = dFdy(uv);
     
+    vec3 dp2perp = cross(dp2, N);
+    vec3 dp1perp = cross(N, dp1);
+    vec3 T = dp2perp * duv1.x + dp1perp * duv2.x;
+    vec3 B = dp2perp * duv1.y + dp1perp * duv2.y;
+    
+    // Unit length like the tangents core.vs normalizes, so a stretched texture doesn't flatten the bumps
+    return mat3(normalize(T), normalize(B), N);
+}
+#endif
+
+// Unit normal folded onto the octahedron |x| + |y| + |z| = 1, two channels instead of three
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return n.xy;
+}
+
+PointLight FetchPointLight(int index)
+{
+    vec4 positionRadius = texelFetch(lights, index * 3);
+    vec4 diffuseLinear = texelFetch(lights, index * 3 + 1);
+    vec4 specularQuadratic = texelFetch(lights, index * 3 + 2);
+    
+    PointLight point;
+    point.position = positionRadius.xyz;
+    point.radius = positionRadius.w;
+    point.diffuse = diffuseLinear.rgb;
+    point.linear = diffuseLinear.w;
+    point.specular = specularQuadratic.rgb;
+    point.quadratic = specularQuadratic.w;
+    return point;
+}
+
+// 1 where light index reaches position, 0 in its shadow, filtered over 2x2 map texels
+float PointShadow(int index, vec3 position, vec3 norm)
+{
+    if (index >= shadowCount)
+    {
+        return 1.0;
+    }
+    
+    // Pushed out along the normal by a texel and a half at this distance, against acne
+    vec3 d = position - shadowLights[index].xyz;
+    vec3 a = abs(d);
+    d += norm * (max(a.x, max(a.y, a.z)) * shadowTexel * 1.5);
+    a = abs(d);
+    
+    int face = a.x >= a.y && a.x >= a.z ? (d.x >= 0.0 ? 0 : 1) : a.y >= a.z ? (d.y >= 0.0 ? 2 : 3) : (d.z >= 0.0 ? 4 : 5);
+    float forward = dot(d, shadowFaceAxes[face * 3 + 2]);
+    vec2 st = vec2(dot(d, shadowFaceAxes[face * 3]), dot(d, shadowFaceAxes[face * 3 + 1])) / forward;
+    
+    // Same depth as the projection in shadow.gs
+    float far = shadowLights[index].w;
+    float depth = ((far + shadowNear) - 2.0 * far * shadowNear / forward) / (far - shadowNear);
+    return texture(shadowMaps, vec4(st * 0.5 + 0.5, float(index * 6 + face), depth * 0.5 + 0.5));
+}
+
+// The maps come in already sampled: this runs in the per-cluster loop, where neighbouring pixels go round
+// a different number of times and implicit-LOD lookups have no derivatives to go by
+vec3 GetPointResult( PointLight point, vec3 norm, vec3 viewDir, vec3 diffuseTexel, vec3 specularTexel)
+{
     //Diffuse
     vec3 lightDir = normalize(point.position - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = point.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse = point.diffuse * diff * diffuseTexel;
     
     // Specular
     float spec = 0.0;
@@ -66,22 +264,23 @@ vec3 GetPointResult( PointLight point, vec3 norm, vec3 viewDir)
         vec3 reflectDir = reflect(-lightDir, norm);
         spec = pow(max(dot(viewDir, reflectDir), 0.0), 8.0);
     }
-    vec3 specular = point.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 specular = point.specular * spec * specularTexel;
     
-    // Attenuation
+    // Attenuation, faded out towards the radius the light was clustered with so it ends without a seam
     float distance    = length(point.position - FragPos);
-    float attenuation = 1.0f / (point.constant + point.linear * distance + point.quadratic * (distance * distance));
+    float attenuation = 1.0f / (1.0f + point.linear * distance + point.quadratic * (distance * distance));
+    float fade        = clamp(1.0 - pow(distance / point.radius, 4.0), 0.0, 1.0);
+    attenuation      *= fade * fade;
     
-    ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
     
-    return ambient + diffuse + specular;
+    return diffuse + specular;
     
 }
 
 
-vec3 GetDirectionalResult( Direction direction, vec3 norm, vec3 viewDir)
+vec3 GetDirectionalResult( Direction direction, vec3 norm, vec3 viewDir, vec3 diffuseTexel, vec3 specularTexel)
 {
     vec3 lightDir = normalize(-direction.dir);
     // diffuse shading
@@ -99,10 +298,9 @@ vec3 GetDirectionalResult( Direction direction, vec3 norm, vec3 viewDir)
         spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     }
     // combine results
-    vec3 ambient  = direction.ambient  * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse  = direction.diffuse  * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = direction.specular * spec * vec3(texture(material.specular, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 diffuse  = direction.diffuse  * diff * diffuseTexel;
+    vec3 specular = direction.specular * spec * specularTexel;
+    return (diffuse + specular);
 }
 
 
@@ -112,16 +310,51 @@ void main()
     vec3 finalcolor = vec3(0.0f, 0.0f, 0.0f);
     
     
+    // Every map sampled once, up front, while all the pixels of a quad are still together
+    vec3 diffuseTexel = DiffuseMap();
+    vec3 specularTexel = SpecularMap();
+    
     //Normal
-    vec3 norm = vec3(texture(material.normal, TexCoords));
+    vec3 norm = NormalMap();
     norm = normalize(norm * 2.0 - 1.0);
+#ifdef DERIVATIVE_TANGENTS
+    norm = normalize(CotangentFrame(normalize(Normal), FragPos, TexCoords) * norm);
+#else
     norm = normalize(TBN * norm);
+#endif
+    
+#ifdef GBUFFER_PASS
+    color = vec4(0.0);
+    gAlbedo = vec4(diffuseTexel, specularTexel.r);
+    gNormal = EncodeNormal(norm);
+    gDepth = -(view * vec4(FragPos, 1.0)).z;
+    return;
+#endif
     
     //ViewDir
     vec3 viewDir = normalize(viewPos - FragPos);
     
-    vec3 pointresult = GetPointResult(point, norm, viewDir);
-    vec3 directionalresult = GetDirectionalResult(direction, norm, viewDir);
+    // Only the lights listed for this fragment's cluster
+    vec3 pointresult = vec3(0.0);
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    int slice = int(clamp(log(max(depth, 1e-4)) * clusterSlices.x + clusterSlices.y, 0.0, clusterSlices.z - 1.0));
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTiles.xy), ivec2(clusterTiles.zw) - 1);
+    uvec2 cluster = texelFetch(lightClusters, (slice * int(clusterTiles.w) + tile.y) * int(clusterTiles.z) + tile.x).xy;
+    for (uint i = 0u; i < cluster.y && db <= 0.0; i++)
+    {
+        int index = int(texelFetch(lightIndices, int(cluster.x + i)).x);
+        pointresult += GetPointResult(FetchPointLight(index), norm, viewDir, diffuseTexel, specularTexel) * PointShadow(index, FragPos, norm);
+    }
+    vec3 directionalresult = GetDirectionalResult(direction, norm, viewDir, diffuseTexel, specularTexel);
+    
+    // Ambient comes from the sky, the same for either light
+    vec3 ambient = max(Irradiance(norm), 0.0) * diffuseTexel;
+    
+    // Glossy reflection of the sky, its roughness from the Blinn-Phong exponent, weighted by Schlick's Fresnel
+    float roughness = sqrt(sqrt(2.0 / (material.shininess + 2.0)));
+    vec3 reflection = textureLod(environment, reflect(-viewDir, norm), roughness * environmentLevels).rgb;
+    float fresnel = 0.04 + 0.96 * pow(1.0 - max(dot(norm, viewDir), 0.0), 5.0);
+    ambient += reflection * specularTexel * fresnel;
     
     if(db>0)
     {
@@ -132,7 +365,7 @@ void main()
         finalcolor = pointresult;
     }
     
-    color = vec4(finalcolor, 1.0f);
+    color = vec4(finalcolor + ambient, 1.0f);
 }
 
 
@@ -1,12 +1,15 @@
-
 #version 330 core
 layout (location = 0) in vec3 position;
+layout (location = 1) in vec4 lamp;         // per instance: position and size
+layout (location = 2) in vec3 lampColor;    // per instance
+
+out vec3 LampColor;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f);
+    gl_Position = projection * view * vec4(position * lamp.w + lamp.xyz, 1.0f);
+    LampColor = lampColor;
 }
@@ -1,8 +1,9 @@
-
 #version 330 core
+in vec3 LampColor;
+
 out vec4 color;
 
 void main()
 {
-    color = vec4(1.0f, 1.0f, 1.0f, 1.0f); 
+    color = vec4(LampColor, 1.0f); 
 }
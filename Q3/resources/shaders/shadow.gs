@@ -0,0 +1,72 @@
+#version 330 core
+// Shadow maps, see ShadowCubes.h: every instance is one light, every triangle goes to the faces of
+// its cube that it reaches, layer light * 6 + face
+#ifndef SHADOW_MAX_LIGHTS
+#define SHADOW_MAX_LIGHTS 4
+#endif
+
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+in vec3 WorldPos[];
+flat in int Instance[];
+
+uniform vec4 shadowLights[SHADOW_MAX_LIGHTS];   // position and far plane
+uniform int shadowSlots[SHADOW_MAX_LIGHTS];     // light drawn by each instance
+uniform int faceMasks[SHADOW_MAX_LIGHTS];       // faces the caster's bounds reach, per instance
+uniform float shadowNear;
+
+// s axis, t axis and centre of each face, +X, -X, +Y, -Y, +Z, -Z, as SH_FACE_AXES in SphericalHarmonics.h
+const vec3 faceAxes[18] = vec3[18](
+    vec3( 0.0,  0.0, -1.0), vec3(0.0, -1.0,  0.0), vec3( 1.0,  0.0,  0.0),
+    vec3( 0.0,  0.0,  1.0), vec3(0.0, -1.0,  0.0), vec3(-1.0,  0.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0,  0.0,  1.0), vec3( 0.0,  1.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0,  0.0, -1.0), vec3( 0.0, -1.0,  0.0),
+    vec3( 1.0,  0.0,  0.0), vec3(0.0, -1.0,  0.0), vec3( 0.0,  0.0,  1.0),
+    vec3(-1.0,  0.0,  0.0), vec3(0.0, -1.0,  0.0), vec3( 0.0,  0.0, -1.0));
+
+void main()
+{
+    int slot = shadowSlots[Instance[0]];
+    int mask = faceMasks[Instance[0]];
+    vec3 light = shadowLights[slot].xyz;
+    float far = shadowLights[slot].w;
+    
+    // 90 degree perspective along the face's centre axis, depth as in a regular projection
+    float depthScale = (far + shadowNear) / (far - shadowNear);
+    float depthBias = -2.0 * far * shadowNear / (far - shadowNear);
+    
+    for (int face = 0; face < 6; face++)
+    {
+        if ((mask & (1 << face)) == 0)
+        {
+            continue;
+        }
+        
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++)
+        {
+            vec3 d = WorldPos[i] - light;
+            float forward = dot(d, faceAxes[face * 3 + 2]);
+            clip[i] = vec4(dot(d, faceAxes[face * 3]), dot(d, faceAxes[face * 3 + 1]), forward * depthScale + depthBias, forward);
+        }
+        
+        // Skip the face if all three corners are beyond the same side of its frustum
+        if ((clip[0].x >  clip[0].w && clip[1].x >  clip[1].w && clip[2].x >  clip[2].w) ||
+            (clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w) ||
+            (clip[0].y >  clip[0].w && clip[1].y >  clip[1].w && clip[2].y >  clip[2].w) ||
+            (clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w) ||
+            (clip[0].z < -clip[0].w && clip[1].z < -clip[1].w && clip[2].z < -clip[2].w))
+        {
+            continue;
+        }
+        
+        for (int i = 0; i < 3; i++)
+        {
+            gl_Layer = slot * 6 + face;
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
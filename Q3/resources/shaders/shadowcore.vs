@@ -0,0 +1,15 @@
+#version 330 core
+// Shadow maps, see ShadowCubes.h: world positions go on to shadow.gs, which projects them per face
+layout (location = 0) in vec3 position;
+
+uniform mat4 model;
+
+out vec3 WorldPos;
+flat out int Instance;
+
+void main()
+{
+    WorldPos = vec3(model * vec4(position, 1.0f));
+    Instance = gl_InstanceID;
+    gl_Position = vec4(WorldPos, 1.0);
+}
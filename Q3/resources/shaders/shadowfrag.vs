@@ -0,0 +1,6 @@
+#version 330 core
+// Shadow maps, see ShadowCubes.h: only depth is written
+
+void main()
+{
+}
@@ -0,0 +1,21 @@
+#version 330 core
+// Virtual texture feedback: every pixel writes the page and mip level it wants to sample
+in vec2 TexCoords;
+
+out uvec4 page;
+
+uniform usampler2D vtPageTable;
+uniform vec4 vtSize;    // virtual width, height, last mip level, mip bias
+
+void main()
+{
+    vec2 texel = TexCoords * vtSize.xy;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float mip = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vtSize.w, 0.0, vtSize.z);
+    int level = int(mip);
+    
+    ivec2 pages = textureSize(vtPageTable, level);
+    ivec2 p = min(ivec2(fract(TexCoords) * vec2(pages)), pages - 1);
+    page = uvec4(uvec2(p), uint(level), 1u);
+}